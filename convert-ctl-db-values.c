@@ -0,0 +1,246 @@
+/*
+ * convert-ctl-db-values.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Measure throughput of the evaluation of volume curve in ctl-tlv.h, from
+ * raw values to dB and back, for typical TLVs of drivers and for each
+ * implementation which this CPU can run. Results of vector implementations
+ * are checked against scalar implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sound/asound.h>
+#include <sound/tlv.h>
+
+#include "latency.h"
+#include "sample-conversion.h"
+#include "ctl-tlv.h"
+
+/* Nano seconds to repeat each operation. */
+#define MEASURE_DURATION    200000000ull
+/* The difference of single precision between implementations. */
+#define DB_TOLERANCE        0.001f
+
+struct curve {
+    const char *label;
+    const unsigned int *tlv;
+    int32_t min;
+    int32_t max;
+};
+
+/* -100.00 dB to 0 dB in 0.50 dB, with mute. */
+static const unsigned int db_scale[] = {
+    SNDRV_CTL_TLVT_DB_SCALE, 2 * sizeof(unsigned int),
+    (unsigned int)-10000, 50 | SNDRV_CTL_TLVD_DB_SCALE_MUTE,
+};
+
+static const unsigned int db_minmax_mute[] = {
+    SNDRV_CTL_TLVT_DB_MINMAX_MUTE, 2 * sizeof(unsigned int),
+    (unsigned int)-9600, 600,
+};
+
+/* Coarse steps in low level, as the codecs of HD Audio. */
+static const unsigned int db_range[] = {
+    SNDRV_CTL_TLVT_DB_RANGE, 3 * 6 * sizeof(unsigned int),
+    0, 15, SNDRV_CTL_TLVT_DB_SCALE, 2 * sizeof(unsigned int),
+        (unsigned int)-9000, 300 | SNDRV_CTL_TLVD_DB_SCALE_MUTE,
+    16, 63, SNDRV_CTL_TLVT_DB_SCALE, 2 * sizeof(unsigned int),
+        (unsigned int)-4500, 75,
+    64, 255, SNDRV_CTL_TLVT_DB_MINMAX, 2 * sizeof(unsigned int),
+        (unsigned int)-975, 1200,
+};
+
+static const unsigned int db_linear[] = {
+    SNDRV_CTL_TLVT_DB_LINEAR, 2 * sizeof(unsigned int),
+    SNDRV_CTL_TLVD_DB_GAIN_MUTE, 0,
+};
+
+static const struct curve curves[] = {
+    { "db-scale",       db_scale,       0,  200 },
+    { "db-minmax-mute", db_minmax_mute, 0,  65535 },
+    { "db-range",       db_range,       0,  255 },
+    { "db-linear",      db_linear,      0,  65535 },
+};
+
+struct payload {
+    size_t count;
+    int32_t *raw;
+    int32_t *raw_ref;
+    float *db;
+    float *db_ref;
+};
+
+/* Out of the range partially, to exercise NAN and clamp. */
+static void generate_raw(int32_t *raw, size_t count, int32_t min, int32_t max)
+{
+    uint32_t seed = 0x12345678;
+    uint64_t span = (uint64_t)max - min + 3;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        raw[i] = (int32_t)(min - 1 + (int64_t)(seed % span));
+    }
+}
+
+/* Beyond both ends of the curve partially, and mute. */
+static void generate_db(float *db, size_t count, const struct ctl_tlv *tlv)
+{
+    uint32_t seed = 0x87654321;
+    float low = tlv->min_db > -144.0f ? tlv->min_db : -144.0f;
+    float high = 24.0f;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        if (seed % 64 == 0)
+            db[i] = -INFINITY;
+        else
+            db[i] = low - 6.0f + (float)(seed >> 8) / (1 << 24) *
+                                 (high - low + 12.0f);
+    }
+}
+
+static bool match_db(const float *db, const float *ref, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (isnan(db[i]) || isnan(ref[i])) {
+            if (isnan(db[i]) != isnan(ref[i]))
+                return false;
+        } else if (isinf(db[i]) || isinf(ref[i])) {
+            if (db[i] != ref[i])
+                return false;
+        } else if (fabsf(db[i] - ref[i]) > DB_TOLERANCE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Returns throughput in million values per second. */
+static double measure_evaluation(enum sample_impl impl,
+                                 const struct ctl_tlv *tlv, bool to_db,
+                                 struct payload *payload)
+{
+    uint64_t begin, elapsed;
+    uint64_t rounds = 0;
+
+    begin = latency_now();
+    do {
+        if (to_db)
+            ctl_tlv_to_db_impl(impl, tlv, payload->raw_ref, payload->db,
+                               payload->count);
+        else
+            ctl_tlv_from_db_impl(impl, tlv, payload->db_ref, payload->raw,
+                                 payload->count);
+        ++rounds;
+        elapsed = latency_now() - begin;
+    } while (elapsed < MEASURE_DURATION);
+
+    return (double)rounds * payload->count * 1000 / elapsed;
+}
+
+static int measure_curve(const struct curve *curve, struct payload *payload)
+{
+    struct ctl_tlv tlv;
+    double to, from;
+    bool match;
+    int impl;
+    int err;
+
+    err = ctl_tlv_parse(&tlv, curve->tlv, 2 * sizeof(unsigned int) +
+                        curve->tlv[1], curve->min, curve->max);
+    if (err < 0) {
+        printf("    %-16s fail to parse: %s\n", curve->label,
+               strerror(-err));
+        return err;
+    }
+
+    /* References by scalar implementation. */
+    generate_raw(payload->raw_ref, payload->count, curve->min, curve->max);
+    generate_db(payload->db_ref, payload->count, &tlv);
+
+    for (impl = 0; impl < SAMPLE_IMPL_COUNT; ++impl) {
+        if (!sample_impl_available(impl))
+            continue;
+
+        to = measure_evaluation(impl, &tlv, true, payload);
+        from = measure_evaluation(impl, &tlv, false, payload);
+
+        /* The scalar results are kept in the second half of the buffers. */
+        ctl_tlv_to_db_impl(SAMPLE_IMPL_SCALAR, &tlv, payload->raw_ref,
+                           payload->db + payload->count, payload->count);
+        ctl_tlv_from_db_impl(SAMPLE_IMPL_SCALAR, &tlv, payload->db_ref,
+                             payload->raw + payload->count, payload->count);
+        match = match_db(payload->db, payload->db + payload->count,
+                         payload->count) &&
+                memcmp(payload->raw, payload->raw + payload->count,
+                       payload->count * sizeof(*payload->raw)) == 0;
+
+        printf("    %-16s %2u %-8s %12.1f %12.1f %s\n", curve->label,
+               tlv.range_count, sample_impl_labels[impl], to, from,
+               match ? "" : "MISMATCH");
+        if (!match)
+            err = -EIO;
+    }
+
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct payload payload = {0};
+    unsigned int i;
+    int err = 0;
+
+    if (argc > 1)
+        payload.count = strtoul(argv[1], NULL, 10);
+    else
+        payload.count = 4096;
+    if (payload.count == 0) {
+        printf("Usage: %s [VALUES]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* The second half holds the results of scalar implementation. */
+    payload.raw = calloc(payload.count * 2, sizeof(*payload.raw));
+    payload.raw_ref = calloc(payload.count, sizeof(*payload.raw_ref));
+    payload.db = calloc(payload.count * 2, sizeof(*payload.db));
+    payload.db_ref = calloc(payload.count, sizeof(*payload.db_ref));
+    if (payload.raw == NULL || payload.raw_ref == NULL ||
+        payload.db == NULL || payload.db_ref == NULL) {
+        err = -ENOMEM;
+        goto end;
+    }
+
+    printf("Evaluation of %zu values, best implementation: %s\n",
+           payload.count, sample_impl_labels[sample_best_impl()]);
+    printf("    %-16s %2s %-8s %12s %12s\n", "curve", "r", "impl",
+           "to dB Mv/s", "from dB Mv/s");
+
+    for (i = 0; i < sizeof(curves) / sizeof(curves[0]); ++i) {
+        if (measure_curve(&curves[i], &payload) < 0)
+            err = -EIO;
+    }
+end:
+    free(payload.raw);
+    free(payload.raw_ref);
+    free(payload.db);
+    free(payload.db_ref);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+/*
+ * convert-pcm-samples.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Measure throughput of the conversion between float and each linear PCM
+ * format, and of interleave/deinterleave, for each implementation which this
+ * CPU can run. Results of vector implementations are checked against scalar
+ * implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+#include "sample-conversion.h"
+
+/* Nano seconds to repeat each operation. */
+#define MEASURE_DURATION    200000000ull
+
+struct payload {
+    size_t samples;
+    float *floats;
+    float *floats_ref;
+    unsigned char *pcm;
+    unsigned char *pcm_ref;
+};
+
+/* Out of [-1.0, 1.0] partially, to exercise clamp. */
+static void generate_floats(float *floats, size_t samples)
+{
+    uint32_t seed = 0x12345678;
+    size_t i;
+
+    for (i = 0; i < samples; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        floats[i] = ((float)(seed >> 8) / (1 << 24)) * 2.2f - 1.1f;
+    }
+}
+
+/* Returns throughput in GB/s, counting bytes of both sides. */
+static double measure_conversion(enum sample_impl impl,
+                                 snd_pcm_format_t format, bool to_float,
+                                 struct payload *payload, size_t bytes)
+{
+    uint64_t begin, elapsed;
+    uint64_t rounds = 0;
+
+    begin = latency_now();
+    do {
+        if (to_float)
+            sample_to_float_impl(impl, format, payload->pcm_ref,
+                                 payload->floats, payload->samples);
+        else
+            sample_from_float_impl(impl, format, payload->floats_ref,
+                                   payload->pcm, payload->samples);
+        ++rounds;
+        elapsed = latency_now() - begin;
+    } while (elapsed < MEASURE_DURATION);
+
+    return (double)rounds * bytes / elapsed;
+}
+
+static int measure_format(snd_pcm_format_t format, struct payload *payload)
+{
+    struct sample_layout layout;
+    size_t pcm_bytes, bytes;
+    double from, to;
+    bool match;
+    int impl;
+    int err;
+
+    err = sample_get_layout(format, &layout);
+    if (err < 0)
+        return err;
+    pcm_bytes = payload->samples * layout.phys_bytes;
+    bytes = pcm_bytes + payload->samples * sizeof(float);
+
+    /* References by scalar implementation. */
+    generate_floats(payload->floats_ref, payload->samples);
+    sample_from_float_impl(SAMPLE_IMPL_SCALAR, format, payload->floats_ref,
+                           payload->pcm_ref, payload->samples);
+
+    for (impl = 0; impl < SAMPLE_IMPL_COUNT; ++impl) {
+        if (!sample_impl_available(impl))
+            continue;
+
+        from = measure_conversion(impl, format, false, payload, bytes);
+        match = memcmp(payload->pcm, payload->pcm_ref, pcm_bytes) == 0;
+
+        /* The floats converted back are compared with scalar ones. */
+        sample_to_float_impl(SAMPLE_IMPL_SCALAR, format, payload->pcm_ref,
+                             payload->floats_ref, payload->samples);
+        to = measure_conversion(impl, format, true, payload, bytes);
+        match &= memcmp(payload->floats, payload->floats_ref,
+                        payload->samples * sizeof(float)) == 0;
+        generate_floats(payload->floats_ref, payload->samples);
+
+        printf("    %-12s %-8s %10.3f %10.3f %s\n",
+               pcm_stream_format_labels[format], sample_impl_labels[impl],
+               from, to, match ? "" : "MISMATCH");
+        if (!match)
+            err = -EIO;
+    }
+
+    return err;
+}
+
+static double measure_interleave(enum sample_impl impl, bool deinterleave,
+                                 unsigned char *frames, unsigned char **bufs,
+                                 unsigned int channels, unsigned int bytes,
+                                 size_t count)
+{
+    uint64_t begin, elapsed;
+    uint64_t rounds = 0;
+
+    begin = latency_now();
+    do {
+        if (deinterleave)
+            sample_deinterleave_impl(impl, (void *const *)bufs, frames,
+                                     channels, bytes, count);
+        else
+            sample_interleave_impl(impl, frames, (const void *const *)bufs,
+                                   channels, bytes, count);
+        ++rounds;
+        elapsed = latency_now() - begin;
+    } while (elapsed < MEASURE_DURATION);
+
+    /* Both of read and write. */
+    return (double)rounds * count * channels * bytes * 2 / elapsed;
+}
+
+static int measure_channels(struct payload *payload, unsigned int channels,
+                            unsigned int bytes)
+{
+    size_t count = payload->samples / channels;
+    size_t size = count * bytes;
+    unsigned char *bufs[channels];
+    double inter, deinter;
+    unsigned int ch;
+    bool match;
+    int impl;
+    int err = 0;
+
+    /* The source of interleave is kept in the reference buffer. */
+    for (ch = 0; ch < channels; ++ch)
+        bufs[ch] = payload->pcm_ref + ch * size;
+    generate_floats(payload->floats_ref, payload->samples);
+    memcpy(payload->pcm_ref, payload->floats_ref, count * channels * bytes);
+
+    for (impl = 0; impl < SAMPLE_IMPL_COUNT; ++impl) {
+        if (!sample_impl_available(impl))
+            continue;
+
+        inter = measure_interleave(impl, false, payload->pcm, bufs, channels,
+                                   bytes, count);
+
+        /* Deinterleave into float buffer, then compare with the source. */
+        for (ch = 0; ch < channels; ++ch)
+            bufs[ch] = (unsigned char *)payload->floats + ch * size;
+        deinter = measure_interleave(impl, true, payload->pcm, bufs,
+                                     channels, bytes, count);
+        match = memcmp(payload->floats, payload->pcm_ref,
+                       count * channels * bytes) == 0;
+        for (ch = 0; ch < channels; ++ch)
+            bufs[ch] = payload->pcm_ref + ch * size;
+
+        printf("    %2u ch x %u bytes %-8s %10.3f %10.3f %s\n",
+               channels, bytes, sample_impl_labels[impl], inter, deinter,
+               match ? "" : "MISMATCH");
+        if (!match)
+            err = -EIO;
+    }
+
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    static const unsigned int channels[] = { 2, 8 };
+    static const unsigned int bytes[] = { 2, 4 };
+    struct payload payload = {0};
+    int format;
+    unsigned int i, j;
+    int err = 0;
+
+    if (argc > 1)
+        payload.samples = strtoul(argv[1], NULL, 10);
+    else
+        payload.samples = 1 << 16;
+    if (payload.samples == 0) {
+        printf("Usage: %s [SAMPLES [FORMAT ...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Enough for float64. */
+    payload.floats = calloc(payload.samples, sizeof(double));
+    payload.floats_ref = calloc(payload.samples, sizeof(double));
+    payload.pcm = calloc(payload.samples, sizeof(double));
+    payload.pcm_ref = calloc(payload.samples, sizeof(double));
+    if (payload.floats == NULL || payload.floats_ref == NULL ||
+        payload.pcm == NULL || payload.pcm_ref == NULL) {
+        err = -ENOMEM;
+        goto end;
+    }
+
+    printf("Conversion of %zu samples, best implementation: %s\n",
+           payload.samples, sample_impl_labels[sample_best_impl()]);
+    printf("    %-12s %-8s %10s %10s\n", "format", "impl", "from GB/s",
+           "to GB/s");
+
+    if (argc > 2) {
+        for (i = 2; i < argc; ++i) {
+            format = pcm_stream_parse_format(argv[i]);
+            if (format < 0) {
+                printf("Unsupported format: %s\n", argv[i]);
+                err = -EINVAL;
+                goto end;
+            }
+            if (measure_format(format, &payload) < 0)
+                err = -EIO;
+        }
+    } else {
+        for (i = 0; i < sizeof(pcm_stream_format_labels) /
+                        sizeof(pcm_stream_format_labels[0]); ++i) {
+            if (pcm_stream_format_labels[i] == NULL)
+                continue;
+            if (measure_format(i, &payload) < 0)
+                err = -EIO;
+        }
+    }
+
+    printf("Interleave of %zu samples:\n", payload.samples);
+    printf("    %-17s %-8s %10s %10s\n", "layout", "impl", "inter GB/s",
+           "deint GB/s");
+    for (i = 0; i < sizeof(channels) / sizeof(channels[0]); ++i) {
+        for (j = 0; j < sizeof(bytes) / sizeof(bytes[0]); ++j) {
+            if (measure_channels(&payload, channels[i], bytes[j]) < 0)
+                err = -EIO;
+        }
+    }
+end:
+    free(payload.floats);
+    free(payload.floats_ref);
+    free(payload.pcm);
+    free(payload.pcm_ref);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
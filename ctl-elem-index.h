@@ -0,0 +1,309 @@
+/*
+ * ctl-elem-index.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Index over the identifiers of control elements. Two open addressing hash
+ * tables resolve the tuple of iface, device, subdevice, name and index, and
+ * the numid, to the identifier in constant time. A secondary array sorted by
+ * name serves the query for a prefix of name by binary search. The index is
+ * a snapshot of SNDRV_CTL_IOCTL_ELEM_LIST; it should be built again when
+ * elements are added or removed.
+ */
+
+#ifndef CTL_ELEM_INDEX_H
+#define CTL_ELEM_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <sound/asound.h>
+
+/* The slot holds the position in the array of identifiers plus one. */
+#define CTL_ELEM_INDEX_EMPTY	0
+
+struct ctl_elem_index {
+	struct snd_ctl_elem_id *ids;
+	unsigned int count;
+
+	/* The number of slots is power of two, at least twice of count. */
+	uint32_t *id_slots;
+	uint32_t *numid_slots;
+	unsigned int mask;
+
+	/* The positions sorted by name, then by the rest of the tuple. */
+	uint32_t *sorted;
+};
+
+static inline uint32_t ctl_elem_index_hash_id(unsigned int iface,
+					      unsigned int device,
+					      unsigned int subdevice,
+					      const char *name,
+					      unsigned int index)
+{
+	const unsigned int fields[] = { iface, device, subdevice, index };
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	/* FNV-1a. */
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+		hash ^= fields[i];
+		hash *= 16777619u;
+	}
+	for (i = 0; i < SNDRV_CTL_ELEM_ID_NAME_MAXLEN && name[i] != '\0'; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static inline uint32_t ctl_elem_index_hash_numid(unsigned int numid)
+{
+	/* Fibonacci hashing; numids are mostly sequential. */
+	return numid * 2654435761u;
+}
+
+static inline int ctl_elem_index_compare_name(const struct snd_ctl_elem_id *l,
+					      const struct snd_ctl_elem_id *r)
+{
+	int result;
+
+	result = strncmp((const char *)l->name, (const char *)r->name,
+			 sizeof(l->name));
+	if (result != 0)
+		return result;
+	if (l->iface != r->iface)
+		return l->iface < r->iface ? -1 : 1;
+	if (l->device != r->device)
+		return l->device < r->device ? -1 : 1;
+	if (l->subdevice != r->subdevice)
+		return l->subdevice < r->subdevice ? -1 : 1;
+	if (l->index != r->index)
+		return l->index < r->index ? -1 : 1;
+	return 0;
+}
+
+/* qsort(3) has no argument for context. */
+static __thread const struct snd_ctl_elem_id *ctl_elem_index_sorting;
+
+static inline int ctl_elem_index_compare_positions(const void *a,
+						   const void *b)
+{
+	const uint32_t *l = a, *r = b;
+
+	return ctl_elem_index_compare_name(&ctl_elem_index_sorting[*l],
+					   &ctl_elem_index_sorting[*r]);
+}
+
+static inline void ctl_elem_index_free(struct ctl_elem_index *index)
+{
+	free(index->ids);
+	free(index->id_slots);
+	free(index->numid_slots);
+	free(index->sorted);
+	memset(index, 0, sizeof(*index));
+}
+
+/* The identifiers are copied. */
+static inline int ctl_elem_index_build(struct ctl_elem_index *index,
+				       const struct snd_ctl_elem_id *ids,
+				       unsigned int count)
+{
+	const struct snd_ctl_elem_id *id;
+	unsigned int slots = 16;
+	uint32_t slot;
+	unsigned int i;
+
+	memset(index, 0, sizeof(*index));
+
+	while (slots < count * 2) {
+		if (slots > UINT32_MAX / 2)
+			return -ENOMEM;
+		slots *= 2;
+	}
+
+	index->ids = malloc(sizeof(*ids) * (count > 0 ? count : 1));
+	index->id_slots = calloc(slots, sizeof(*index->id_slots));
+	index->numid_slots = calloc(slots, sizeof(*index->numid_slots));
+	index->sorted = malloc(sizeof(*index->sorted) *
+			       (count > 0 ? count : 1));
+	if (index->ids == NULL || index->id_slots == NULL ||
+	    index->numid_slots == NULL || index->sorted == NULL) {
+		ctl_elem_index_free(index);
+		return -ENOMEM;
+	}
+	memcpy(index->ids, ids, sizeof(*ids) * count);
+	index->count = count;
+	index->mask = slots - 1;
+
+	for (i = 0; i < count; ++i) {
+		id = &index->ids[i];
+
+		/* Linear probing. The duplicated tuple is ignored. */
+		slot = ctl_elem_index_hash_id(id->iface, id->device,
+					      id->subdevice,
+					      (const char *)id->name,
+					      id->index) & index->mask;
+		while (index->id_slots[slot] != CTL_ELEM_INDEX_EMPTY)
+			slot = (slot + 1) & index->mask;
+		index->id_slots[slot] = i + 1;
+
+		slot = ctl_elem_index_hash_numid(id->numid) & index->mask;
+		while (index->numid_slots[slot] != CTL_ELEM_INDEX_EMPTY)
+			slot = (slot + 1) & index->mask;
+		index->numid_slots[slot] = i + 1;
+
+		index->sorted[i] = i;
+	}
+
+	ctl_elem_index_sorting = index->ids;
+	qsort(index->sorted, count, sizeof(*index->sorted),
+	      ctl_elem_index_compare_positions);
+	ctl_elem_index_sorting = NULL;
+
+	return 0;
+}
+
+/* Build the index from the elements currently in the control device. */
+static inline int ctl_elem_index_load(struct ctl_elem_index *index, int fd)
+{
+	struct snd_ctl_elem_list list = {0};
+	struct snd_ctl_elem_id *ids;
+	int err;
+
+	if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0)
+		return -errno;
+
+	ids = calloc(list.count > 0 ? list.count : 1, sizeof(*ids));
+	if (ids == NULL)
+		return -ENOMEM;
+
+	while (list.offset < list.count) {
+		/* 1000 is enough less than the limitation of one operation. */
+		list.space = list.count - list.offset;
+		if (list.space > 1000)
+			list.space = 1000;
+		list.pids = ids + list.offset;
+		if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0) {
+			err = -errno;
+			free(ids);
+			return err;
+		}
+		/* Some elements may be removed in the middle. */
+		if (list.used == 0)
+			break;
+		list.offset += list.used;
+	}
+
+	err = ctl_elem_index_build(index, ids, list.offset);
+	free(ids);
+
+	return err;
+}
+
+static inline const struct snd_ctl_elem_id *ctl_elem_index_find(
+					const struct ctl_elem_index *index,
+					unsigned int iface, unsigned int device,
+					unsigned int subdevice,
+					const char *name,
+					unsigned int elem_index)
+{
+	const struct snd_ctl_elem_id *id;
+	uint32_t slot;
+
+	if (index->count == 0)
+		return NULL;
+
+	slot = ctl_elem_index_hash_id(iface, device, subdevice, name,
+				      elem_index) & index->mask;
+	while (index->id_slots[slot] != CTL_ELEM_INDEX_EMPTY) {
+		id = &index->ids[index->id_slots[slot] - 1];
+		if (id->iface == iface && id->device == device &&
+		    id->subdevice == subdevice && id->index == elem_index &&
+		    strncmp((const char *)id->name, name,
+			    sizeof(id->name)) == 0)
+			return id;
+		slot = (slot + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+static inline const struct snd_ctl_elem_id *ctl_elem_index_find_numid(
+					const struct ctl_elem_index *index,
+					unsigned int numid)
+{
+	const struct snd_ctl_elem_id *id;
+	uint32_t slot;
+
+	if (index->count == 0)
+		return NULL;
+
+	slot = ctl_elem_index_hash_numid(numid) & index->mask;
+	while (index->numid_slots[slot] != CTL_ELEM_INDEX_EMPTY) {
+		id = &index->ids[index->numid_slots[slot] - 1];
+		if (id->numid == numid)
+			return id;
+		slot = (slot + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the range of elements of which name starts with the prefix. Returns
+ * the number of them, and the first position for ctl_elem_index_sorted().
+ */
+static inline unsigned int ctl_elem_index_prefix(
+					const struct ctl_elem_index *index,
+					const char *prefix, unsigned int *first)
+{
+	size_t len = strnlen(prefix, SNDRV_CTL_ELEM_ID_NAME_MAXLEN);
+	unsigned int low, high, middle;
+	const char *name;
+
+	/* The lower bound of the prefix. */
+	low = 0;
+	high = index->count;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		name = (const char *)index->ids[index->sorted[middle]].name;
+		if (strncmp(name, prefix, len) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	*first = low;
+
+	/* The upper bound of the names which start with the prefix. */
+	high = index->count;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		name = (const char *)index->ids[index->sorted[middle]].name;
+		if (strncmp(name, prefix, len) <= 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low - *first;
+}
+
+static inline const struct snd_ctl_elem_id *ctl_elem_index_sorted(
+					const struct ctl_elem_index *index,
+					unsigned int position)
+{
+	if (position >= index->count)
+		return NULL;
+	return &index->ids[index->sorted[position]];
+}
+
+#endif
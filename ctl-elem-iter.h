@@ -0,0 +1,272 @@
+/*
+ * ctl-elem-iter.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Iterator over the identifiers of control elements, which lists them by
+ * SNDRV_CTL_IOCTL_ELEM_LIST in windows of fixed size instead of allocating
+ * the whole list. Two buffers of window are used in turn; with pipeline,
+ * a thread lists the next window while the caller processes the current
+ * one, e.g. by SNDRV_CTL_IOCTL_ELEM_INFO.
+ *
+ * The list in kernel is in the order of addition, thus in ascending order of
+ * numid. Each window overlaps the last identifier of the previous one; when
+ * it is not found at the position, some elements were removed during the
+ * walk, then the position is searched again backward and the identifiers
+ * already returned are skipped by numid. The elements added during the walk
+ * are returned at the end.
+ */
+
+#ifndef CTL_ELEM_ITER_H
+#define CTL_ELEM_ITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <sound/asound.h>
+
+/* ALSA middleware has limitation of one operation. */
+#define CTL_ELEM_ITER_MAX_WINDOW	1000
+
+struct ctl_elem_iter {
+	int fd;
+	unsigned int window;
+
+	/* The window one larger to hold the overlapped identifier. */
+	struct snd_ctl_elem_id *scratch;
+	struct snd_ctl_elem_id *bufs[2];
+	unsigned int counts[2];
+	bool filled[2];
+	unsigned int producer;
+	unsigned int consumer;
+	bool consuming;
+
+	/* The position in the list of kernel and the last numid listed. */
+	unsigned int offset;
+	unsigned int last_numid;
+	bool done;
+	int err;
+
+	bool pipeline;
+	bool quit;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	unsigned int listed;
+	unsigned int resyncs;
+};
+
+/*
+ * Search the position of the last identifier backward, then list the window
+ * after it. The numids already returned are skipped.
+ */
+static inline int ctl_elem_iter_list(struct ctl_elem_iter *iter,
+				     struct snd_ctl_elem_id *ids,
+				     unsigned int *count)
+{
+	struct snd_ctl_elem_list list = {0};
+	unsigned int start, back = 0;
+	unsigned int i;
+
+	*count = 0;
+
+	while (1) {
+		start = iter->offset > 0 ? iter->offset - 1 : 0;
+		start = start > back ? start - back : 0;
+
+		list.offset = start;
+		list.space = iter->window + 1;
+		list.pids = iter->scratch;
+		if (ioctl(iter->fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0)
+			return -errno;
+
+		/* The first window, or the overlapped one is still there. */
+		if (iter->offset == 0 || start == 0 ||
+		    (list.used > 0 &&
+		     iter->scratch[0].numid <= iter->last_numid))
+			break;
+
+		/* Some elements before the position were removed. */
+		back = back > 0 ? back * 2 : iter->window;
+		++iter->resyncs;
+	}
+
+	while (1) {
+		for (i = 0; i < list.used; ++i) {
+			if (iter->offset > 0 &&
+			    iter->scratch[i].numid <= iter->last_numid)
+				continue;
+			if (*count == iter->window)
+				break;
+			ids[(*count)++] = iter->scratch[i];
+		}
+		iter->offset = start + i;
+
+		/* All of them were returned already; go forward. */
+		if (*count > 0 || list.used < iter->window + 1)
+			break;
+		start = iter->offset;
+		list.offset = start;
+		if (ioctl(iter->fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0)
+			return -errno;
+	}
+
+	if (*count > 0)
+		iter->last_numid = ids[*count - 1].numid;
+	iter->listed += *count;
+
+	return 0;
+}
+
+static inline void *ctl_elem_iter_run(void *arg)
+{
+	struct ctl_elem_iter *iter = arg;
+	unsigned int slot;
+	unsigned int count;
+	int err;
+
+	pthread_mutex_lock(&iter->lock);
+	while (!iter->quit && !iter->done) {
+		slot = iter->producer;
+		while (iter->filled[slot] && !iter->quit)
+			pthread_cond_wait(&iter->cond, &iter->lock);
+		if (iter->quit)
+			break;
+		pthread_mutex_unlock(&iter->lock);
+
+		err = ctl_elem_iter_list(iter, iter->bufs[slot], &count);
+
+		pthread_mutex_lock(&iter->lock);
+		iter->counts[slot] = count;
+		iter->filled[slot] = true;
+		iter->producer = 1 - slot;
+		if (err < 0)
+			iter->err = err;
+		if (err < 0 || count == 0)
+			iter->done = true;
+		pthread_cond_broadcast(&iter->cond);
+	}
+	pthread_mutex_unlock(&iter->lock);
+
+	return NULL;
+}
+
+static inline void ctl_elem_iter_fini(struct ctl_elem_iter *iter)
+{
+	if (iter->pipeline) {
+		pthread_mutex_lock(&iter->lock);
+		iter->quit = true;
+		pthread_cond_broadcast(&iter->cond);
+		pthread_mutex_unlock(&iter->lock);
+		pthread_join(iter->thread, NULL);
+		pthread_cond_destroy(&iter->cond);
+		pthread_mutex_destroy(&iter->lock);
+		iter->pipeline = false;
+	}
+
+	free(iter->scratch);
+	free(iter->bufs[0]);
+	free(iter->bufs[1]);
+	iter->scratch = NULL;
+	iter->bufs[0] = NULL;
+	iter->bufs[1] = NULL;
+}
+
+static inline int ctl_elem_iter_init(struct ctl_elem_iter *iter, int fd,
+				     unsigned int window, bool pipeline)
+{
+	int err;
+
+	memset(iter, 0, sizeof(*iter));
+	if (window == 0 || window >= CTL_ELEM_ITER_MAX_WINDOW)
+		window = CTL_ELEM_ITER_MAX_WINDOW - 1;
+	iter->fd = fd;
+	iter->window = window;
+
+	iter->scratch = calloc(window + 1, sizeof(*iter->scratch));
+	iter->bufs[0] = calloc(window, sizeof(*iter->bufs[0]));
+	iter->bufs[1] = calloc(window, sizeof(*iter->bufs[1]));
+	if (iter->scratch == NULL || iter->bufs[0] == NULL ||
+	    iter->bufs[1] == NULL) {
+		ctl_elem_iter_fini(iter);
+		return -ENOMEM;
+	}
+
+	if (pipeline) {
+		pthread_mutex_init(&iter->lock, NULL);
+		pthread_cond_init(&iter->cond, NULL);
+		err = -pthread_create(&iter->thread, NULL, ctl_elem_iter_run,
+				      iter);
+		if (err < 0) {
+			/* List the windows in the caller instead. */
+			pthread_cond_destroy(&iter->cond);
+			pthread_mutex_destroy(&iter->lock);
+			return 0;
+		}
+		iter->pipeline = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the next window of identifiers, valid till the next call. The count
+ * is zero at the end of the list.
+ */
+static inline int ctl_elem_iter_next(struct ctl_elem_iter *iter,
+				     const struct snd_ctl_elem_id **ids,
+				     unsigned int *count)
+{
+	unsigned int slot;
+	int err;
+
+	*ids = NULL;
+	*count = 0;
+
+	if (!iter->pipeline) {
+		if (iter->done)
+			return iter->err;
+		err = ctl_elem_iter_list(iter, iter->bufs[0], count);
+		if (err < 0 || *count == 0) {
+			iter->err = err;
+			iter->done = true;
+			*count = 0;
+			return err;
+		}
+		*ids = iter->bufs[0];
+		return 0;
+	}
+
+	pthread_mutex_lock(&iter->lock);
+	/* The window returned last time is free for the thread. */
+	if (iter->consuming) {
+		iter->filled[iter->consumer] = false;
+		iter->consumer = 1 - iter->consumer;
+		iter->consuming = false;
+		pthread_cond_broadcast(&iter->cond);
+	}
+
+	slot = iter->consumer;
+	while (!iter->filled[slot])
+		pthread_cond_wait(&iter->cond, &iter->lock);
+	err = iter->err;
+	if (err == 0 && iter->counts[slot] > 0) {
+		*ids = iter->bufs[slot];
+		*count = iter->counts[slot];
+		iter->consuming = true;
+	}
+	pthread_mutex_unlock(&iter->lock);
+
+	return err;
+}
+
+#endif
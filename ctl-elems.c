@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include <string.h>
 #include <limits.h>
@@ -20,9 +21,35 @@
 #include <sys/ioctl.h>
 
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sound/asound.h>
 
+#include "latency.h"
+#include "dump-output.h"
+#include "ctl-label-cache.h"
+#include "ctl-elem-iter.h"
+#include "ctl-tlv.h"
+
+#define MAX_CARDS   32
+/* The identifiers listed at once, in each of two buffers. */
+#define ELEM_WINDOW 256
+
+struct inventory_entry {
+    char path[64];
+    struct dump_output out;
+    uint64_t elapsed;
+    int err;
+};
+
+struct inventory {
+    struct inventory_entry *entries;
+    unsigned int count;
+    unsigned int next;
+    pthread_mutex_t lock;
+    int format;
+};
+
 static const char *const type_labels[] = {
     [SNDRV_CTL_ELEM_TYPE_NONE]          = "none",
     [SNDRV_CTL_ELEM_TYPE_BOOLEAN]       = "boolean",
@@ -73,48 +100,137 @@ static const int access_flags[] = {
     [11]    = SNDRV_CTL_ELEM_ACCESS_USER,
 };
 
-static int dump_integer_elem(int fd, struct snd_ctl_elem_info *info)
+static int dump_integer_elem(int fd, struct snd_ctl_elem_info *info,
+                             struct ctl_label_cache *cache,
+                             struct dump_output *out)
 {
-    printf("      min:  %ld\n", info->value.integer.min);
-    printf("      max:  %ld\n", info->value.integer.max);
-    printf("      step: %ld\n", info->value.integer.step);
+    dump_output_int(out, "min", info->value.integer.min);
+    dump_output_int(out, "max", info->value.integer.max);
+    dump_output_int(out, "step", info->value.integer.step);
 
     return 0;
 }
 
-static int dump_enumerated_elem(int fd, struct snd_ctl_elem_info *info)
+static int dump_enumerated_elem(int fd, struct snd_ctl_elem_info *info,
+                                struct ctl_label_cache *cache,
+                                struct dump_output *out)
 {
+    const ctl_label_t *labels;
     int i;
+    int err;
 
-    printf("      items:  %d\n", info->value.enumerated.items);
+    dump_output_int(out, "items", info->value.enumerated.items);
 
-    printf("      labels:\n");
-    printf("        ");
-    for (i = 0; i < info->value.enumerated.items; ++i) {
-        info->value.enumerated.item = i;
-        /* Just querying, has no side effects. */
-        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_INFO, info) < 0)
-            return errno;
+    /* Identical lists of labels are shared by elements. */
+    err = ctl_label_cache_lookup(cache, fd, info, &labels);
+    if (err < 0)
+        return err;
 
-        printf("'%s', ", info->value.enumerated.name);
-    }
-    printf("\n");
+    dump_output_begin_list(out, "labels");
+    for (i = 0; i < info->value.enumerated.items; ++i)
+        dump_output_string(out, NULL, labels[i]);
+    dump_output_end(out);
 
     return 0;
 }
 
-static int dump_integer64_elem(int fd, struct snd_ctl_elem_info *info)
+static int dump_integer64_elem(int fd, struct snd_ctl_elem_info *info,
+                               struct ctl_label_cache *cache,
+                               struct dump_output *out)
 {
-    printf("      min:  %ld\n", info->value.integer.min);
-    printf("      max:  %ld\n", info->value.integer.max);
-    printf("      step: %ld\n", info->value.integer.step);
+    dump_output_int(out, "min", info->value.integer64.min);
+    dump_output_int(out, "max", info->value.integer64.max);
+    dump_output_int(out, "step", info->value.integer64.step);
 
     return 0;
 }
 
-static int dump_elem(int fd, struct snd_ctl_elem_id *id)
+static int32_t clamp_int32(long long val)
+{
+    if (val < INT32_MIN)
+        return INT32_MIN;
+    if (val > INT32_MAX)
+        return INT32_MAX;
+    return val;
+}
+
+/* The ranges of dB are in 0.01 dB, as the TLV has. */
+static void dump_tlv(int fd, const struct snd_ctl_elem_info *info,
+                     struct dump_output *out)
+{
+    unsigned int buf[CTL_TLV_MAX_BYTES / sizeof(unsigned int)];
+    const struct ctl_tlv_range *range;
+    const struct ctl_tlv_chmap *chmap;
+    struct ctl_tlv tlv;
+    char key[16];
+    int32_t min = 0, max = 0;
+    unsigned int bytes = 0, pos;
+    unsigned int i, j;
+    int err;
+
+    if (info->type == SNDRV_CTL_ELEM_TYPE_INTEGER) {
+        min = info->value.integer.min;
+        max = info->value.integer.max;
+    } else if (info->type == SNDRV_CTL_ELEM_TYPE_INTEGER64) {
+        /* The curves are evaluated in 32 bit; the rest are out of range. */
+        min = clamp_int32(info->value.integer64.min);
+        max = clamp_int32(info->value.integer64.max);
+    }
+
+    dump_output_begin(out, "tlv");
+
+    err = ctl_tlv_read(fd, info->id.numid, buf, sizeof(buf), &bytes);
+    if (err == 0)
+        err = ctl_tlv_parse(&tlv, ((struct snd_ctl_tlv *)buf)->tlv, bytes,
+                            min, max);
+    if (err < 0) {
+        /* Not fatal to the walk; some drivers have no data for the mode. */
+        dump_output_label(out, "error", strerror(-err));
+        dump_output_end(out);
+        return;
+    }
+
+    for (i = 0; i < tlv.range_count; ++i) {
+        range = &tlv.ranges[i];
+        snprintf(key, sizeof(key), "range-%u", i);
+        dump_output_begin(out, key);
+        dump_output_label(out, "type", ctl_tlv_type_labels[range->type]);
+        dump_output_int(out, "min", range->min);
+        dump_output_int(out, "max", range->max);
+        dump_output_int(out, "min-cdb", range->min_cdb);
+        dump_output_int(out, "max-cdb", range->max_cdb);
+        dump_output_bool(out, "mute", range->mute);
+        dump_output_end(out);
+    }
+
+    for (i = 0; i < tlv.chmap_count; ++i) {
+        chmap = &tlv.chmaps[i];
+        snprintf(key, sizeof(key), "chmap-%u", i);
+        dump_output_begin(out, key);
+        dump_output_label(out, "type", ctl_tlv_chmap_type_labels[
+                            chmap->type - SNDRV_CTL_TLVT_CHMAP_FIXED]);
+        dump_output_begin_list(out, "positions");
+        for (j = 0; j < chmap->channels; ++j) {
+            /* The phase inverse and driver-specific bits are ignored. */
+            pos = chmap->positions[j] & SNDRV_CHMAP_POSITION_MASK;
+            if (pos <= SNDRV_CHMAP_LAST)
+                dump_output_label(out, NULL, ctl_tlv_position_labels[pos]);
+            else
+                dump_output_int(out, NULL, chmap->positions[j]);
+        }
+        dump_output_end(out);
+        dump_output_end(out);
+    }
+
+    dump_output_end(out);
+}
+
+static int dump_elem(int fd, const struct snd_ctl_elem_id *id,
+                     struct ctl_label_cache *cache, struct dump_output *out)
 {
-    int (*const funcs[])(int fd, struct snd_ctl_elem_info *info) = {
+    int (*const funcs[])(int fd, struct snd_ctl_elem_info *info,
+                         struct ctl_label_cache *cache,
+                         struct dump_output *out) = {
         [SNDRV_CTL_ELEM_TYPE_NONE]          = NULL,
         [SNDRV_CTL_ELEM_TYPE_BOOLEAN]       = NULL,
         [SNDRV_CTL_ELEM_TYPE_INTEGER]       = dump_integer_elem,
@@ -129,136 +245,325 @@ static int dump_elem(int fd, struct snd_ctl_elem_id *id)
 
     info.id = *id;
     if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_INFO, &info) < 0) {
-        printf("ioctl(2) with SNDRV_CTL_IOCTL_ELEM_INFO\n");
-        return -errno;
+        err = -errno;
+        /* The element can be removed during the walk. */
+        if (err != -ENOENT)
+            fprintf(stderr, "ioctl(2) with SNDRV_CTL_IOCTL_ELEM_INFO\n");
+        return err;
     }
 
     if (info.type >= sizeof(funcs)/sizeof(funcs[0])) {
         return -EIO;
     }
 
-    printf("  Element %d:\n", info.id.numid);
-    printf("    iface:      %s\n", iface_labels[info.id.iface]);
-    printf("    device:     %d\n", info.id.device);
-    printf("    subdevice:  %d\n", info.id.subdevice);
-    printf("    name:       '%s'\n", info.id.name);
-    printf("    index:      %d\n", info.id.index);
+    dump_output_begin(out, "element");
+    dump_output_int(out, "numid", info.id.numid);
+    dump_output_label(out, "iface", iface_labels[info.id.iface]);
+    dump_output_int(out, "device", info.id.device);
+    dump_output_int(out, "subdevice", info.id.subdevice);
+    dump_output_string(out, "name", (const char *)info.id.name);
+    dump_output_int(out, "index", info.id.index);
 
-    printf("    type:       %s\n", type_labels[info.type]);
+    dump_output_label(out, "type", type_labels[info.type]);
 
-    printf("    access:     ");
+    dump_output_begin_list(out, "access");
     for (i = 0; i < sizeof(access_labels)/sizeof(access_labels[0]); ++i) {
         if (info.access & access_flags[i])
-            printf("%s, ", access_labels[i]);
+            dump_output_label(out, NULL, access_labels[i]);
     }
-    printf("\n");
-    printf("    members:    %d\n", info.count);
-    printf("    lock-owner: %d\n", info.owner);
+    dump_output_end(out);
+    dump_output_int(out, "members", info.count);
+    dump_output_int(out, "lock-owner", info.owner);
 
-    printf("    dimension:  ");
+    dump_output_begin_list(out, "dimension");
     for (i = 0; i < sizeof(info.dimen.d)/sizeof(info.dimen.d[0]); ++i)
-        printf("[%d] => %d, ", i, info.dimen.d[i]);
-    printf("\n");
+        dump_output_int(out, NULL, info.dimen.d[i]);
+    dump_output_end(out);
 
     if (funcs[info.type]) {
-        printf("    type dependent:\n");
-        err = funcs[info.type](fd, &info);
+        dump_output_begin(out, "type-dependent");
+        err = funcs[info.type](fd, &info, cache, out);
+        dump_output_end(out);
     }
 
+    if (info.access & SNDRV_CTL_ELEM_ACCESS_TLV_READ)
+        dump_tlv(fd, &info, out);
+
+    dump_output_end(out);
+
     return err;
 }
 
-static int dump_elems(int fd, struct snd_ctl_elem_list *list)
+/* The identifiers are listed in windows while the previous one is dumped. */
+static int dump_elems(int fd, struct ctl_label_cache *cache,
+                      struct dump_output *out)
 {
+    struct ctl_elem_iter iter;
+    const struct snd_ctl_elem_id *ids;
+    uint64_t begin, elapsed, first = 0;
+    unsigned int count;
     int i;
     int err;
 
-    for (i = 0; i < list->count; ++i) {
-        err = dump_elem(fd, &list->pids[i]);
+    begin = latency_now();
+    err = ctl_elem_iter_init(&iter, fd, ELEM_WINDOW, true);
+    if (err < 0)
+        return err;
+
+    while (1) {
+        err = ctl_elem_iter_next(&iter, &ids, &count);
+        if (err < 0 || count == 0)
+            break;
+        if (first == 0)
+            first = latency_now() - begin;
+
+        for (i = 0; i < count; ++i) {
+            /* Removed after listed. */
+            err = dump_elem(fd, &ids[i], cache, out);
+            if (err == -ENOENT)
+                err = 0;
+            if (err < 0)
+                break;
+        }
         if (err < 0)
             break;
     }
 
+    elapsed = latency_now() - begin;
+
+    /* The counters are updated by the thread till it is joined. */
+    ctl_elem_iter_fini(&iter);
+
+    dump_output_begin(out, "walk");
+    dump_output_int(out, "elements", iter.listed);
+    dump_output_int(out, "window", iter.window);
+    dump_output_int(out, "resyncs", iter.resyncs);
+    dump_output_int(out, "first-element-us", first / 1000);
+    dump_output_int(out, "elapsed-us", elapsed / 1000);
+    dump_output_end(out);
+
     return err;
 }
 
-static int allocate_elem_ids(int fd, struct snd_ctl_elem_list *list)
+static int dump_card_info(int fd, const char *path,
+                          struct snd_ctl_card_info *info,
+                          struct dump_output *out)
 {
-    struct snd_ctl_elem_id *ids;
-
-    /* Get the number of elements in this control device. */
-    if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, list) < 0)
+    memset(info, 0, sizeof(*info));
+    if (ioctl(fd, SNDRV_CTL_IOCTL_CARD_INFO, info) < 0) {
+        fprintf(stderr, "ioctl(2): %s\n", strerror(errno));
         return -errno;
+    }
 
-    /* No elements found. */
-    if (list->count == 0)
-        return 0;
+    dump_output_begin(out, "card");
+    dump_output_string(out, "path", path);
+    dump_output_int(out, "card", info->card);
+    dump_output_string(out, "id", (const char *)info->id);
+    dump_output_string(out, "driver", (const char *)info->driver);
+    dump_output_string(out, "name", (const char *)info->name);
+    dump_output_string(out, "long-name", (const char *)info->longname);
+    dump_output_string(out, "mixer-name", (const char *)info->mixername);
+    dump_output_string(out, "components", (const char *)info->components);
+    dump_output_end(out);
 
-    /* Allocate spaces for these elements. */
-    ids = calloc(list->count, sizeof(struct snd_ctl_elem_id));
-    if (ids == NULL)
-        return -ENOMEM;
+    return 0;
+}
+
+static void dump_label_cache(const struct ctl_label_cache *cache, bool loaded,
+                             struct dump_output *out)
+{
+    dump_output_begin(out, "label-cache");
+    dump_output_bool(out, "loaded", loaded);
+    dump_output_int(out, "lists", cache->set_count);
+    dump_output_int(out, "labels", cache->label_count);
+    dump_output_int(out, "elements", cache->entry_count);
+    dump_output_int(out, "cached-elements", cache->hits);
+    dump_output_int(out, "shared-elements", cache->shared);
+    dump_output_int(out, "ioctls", cache->ioctls);
+    dump_output_int(out, "avoided-ioctls", cache->avoided);
+    dump_output_end(out);
+}
+
+static int dump_card(const char *path, const char *cache_path,
+                     struct dump_output *out)
+{
+    struct snd_ctl_card_info info;
+    struct ctl_label_key key = {0};
+    struct ctl_label_cache cache;
+    bool loaded = false;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
 
-    list->offset = 0;
-    while (list->offset < list->count) {
-        /*
-         * ALSA middleware has limitation of one operation.
-         * 1000 is enought less than the limitation.
-         */
-        if (list->count - list->offset > 1000)
-            list->space = 1000;
-        else
-            list->space = list->count - list->offset;
-        list->pids = ids + list->offset;
-
-        /* Get the IDs of elements in this control device. */
-        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, list) < 0) {
-            free(ids);
-            list->pids = NULL;
-            return errno;
+    err = dump_card_info(fd, path, &info, out);
+    if (err >= 0) {
+        /* Without the key, the labels are still interned in this run. */
+        if (ctl_label_cache_make_key(&info, path, &key) < 0)
+            cache_path = NULL;
+        ctl_label_cache_init(&cache, &key);
+        if (cache_path != NULL) {
+            err = ctl_label_cache_load(&cache, cache_path);
+            if (err < 0 && err != -ENOENT && err != -ESTALE)
+                fprintf(stderr, "%s: %s\n", cache_path, strerror(-err));
+            loaded = err >= 0;
         }
 
-        list->offset += list->space;
+        err = dump_elems(fd, &cache, out);
+        dump_label_cache(&cache, loaded, out);
+
+        /* A partial list is not stored. */
+        if (err >= 0 && cache_path != NULL) {
+            err = ctl_label_cache_save(&cache, cache_path);
+            if (err < 0)
+                fprintf(stderr, "%s: %s\n", cache_path, strerror(-err));
+        }
+        ctl_label_cache_free(&cache);
     }
 
-    list->pids = ids;
-    list->space = list->count;
+    close(fd);
 
-    return 0;
+    return err;
 }
 
-static void deallocate_elem_ids(struct snd_ctl_elem_list *list)
+static void *run_worker(void *arg)
 {
-    if (list->pids != NULL)
-        free(list->pids);
-}
+    struct inventory *inventory = arg;
+    struct inventory_entry *entry;
+    unsigned int index;
+    uint64_t begin;
 
-static int dump_card_info(int fd)
-{
-    struct snd_ctl_card_info info = {0};
+    while (1) {
+        pthread_mutex_lock(&inventory->lock);
+        index = inventory->next++;
+        pthread_mutex_unlock(&inventory->lock);
 
-    if (ioctl(fd, SNDRV_CTL_IOCTL_CARD_INFO, &info) < 0) {
-        printf("ioctl(2): %s\n", strerror(errno));
-        return -errno;
+        if (index >= inventory->count)
+            break;
+        entry = &inventory->entries[index];
+
+        /* Kept in the buffer of each card till all of them are done. */
+        dump_output_init(&entry->out, inventory->format, -1);
+        begin = latency_now();
+        entry->err = dump_card(entry->path, NULL, &entry->out);
+        entry->elapsed = latency_now() - begin;
+
+        dump_output_begin(&entry->out, "scan");
+        dump_output_string(&entry->out, "path", entry->path);
+        dump_output_int(&entry->out, "elapsed-us", entry->elapsed / 1000);
+        if (entry->err < 0)
+            dump_output_string(&entry->out, "error", strerror(-entry->err));
+        dump_output_end(&entry->out);
     }
 
-    printf("  Card information:\n");
-    printf("    card:       %d\n", info.card);
-    printf("    id:         '%s'\n", info.id);
-    printf("    driver:     '%s'\n", info.driver);
-    printf("    name:       '%s'\n", info.name);
-    printf("    long-name:  '%s'\n", info.longname);
-    printf("    mixer-name: '%s'\n", info.mixername);
-    printf("    components: '%s'\n", info.components);
+    return NULL;
+}
+
+static int collect_cards(struct inventory *inventory)
+{
+    struct inventory_entry *entries;
+    struct inventory_entry *entry;
+    char path[64];
+    int card;
+
+    for (card = 0; card < MAX_CARDS; ++card) {
+        snprintf(path, sizeof(path), "/dev/snd/controlC%d", card);
+        if (access(path, F_OK) < 0)
+            continue;
+
+        entries = realloc(inventory->entries,
+                          sizeof(*entries) * (inventory->count + 1));
+        if (entries == NULL)
+            return -ENOMEM;
+        inventory->entries = entries;
+
+        entry = &entries[inventory->count++];
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->path, sizeof(entry->path), "%s", path);
+    }
 
     return 0;
 }
 
+/* Scan all of the cards by the bounded number of workers. */
+static int dump_all_cards(int format, unsigned long workers)
+{
+    struct inventory inventory = {0};
+    struct dump_output out;
+    pthread_t *threads;
+    unsigned int i, failed = 0;
+    uint64_t begin;
+    int err;
+
+    err = collect_cards(&inventory);
+    if (err < 0) {
+        free(inventory.entries);
+        return err;
+    }
+    if (inventory.count == 0) {
+        printf("No control character device found.\n");
+        return -ENODEV;
+    }
+
+    if (workers > inventory.count)
+        workers = inventory.count;
+    threads = calloc(workers, sizeof(*threads));
+    if (threads == NULL) {
+        free(inventory.entries);
+        return -ENOMEM;
+    }
+    inventory.format = format;
+    pthread_mutex_init(&inventory.lock, NULL);
+
+    begin = latency_now();
+    for (i = 0; i < workers; ++i) {
+        err = -pthread_create(&threads[i], NULL, run_worker, &inventory);
+        if (err < 0) {
+            workers = i;
+            break;
+        }
+    }
+    /* The workers which started take the rest of cards. */
+    if (workers == 0)
+        run_worker(&inventory);
+    for (i = 0; i < workers; ++i)
+        pthread_join(threads[i], NULL);
+
+    /* In the order of card number, regardless of the order of completion. */
+    dump_output_init(&out, format, STDOUT_FILENO);
+    for (i = 0; i < inventory.count; ++i) {
+        dump_output_merge(&out, &inventory.entries[i].out);
+        dump_output_fini(&inventory.entries[i].out);
+        if (inventory.entries[i].err < 0)
+            ++failed;
+    }
+    dump_output_begin(&out, "inventory");
+    dump_output_int(&out, "cards", inventory.count);
+    dump_output_int(&out, "workers", workers);
+    dump_output_int(&out, "failed", failed);
+    dump_output_int(&out, "elapsed-us", (latency_now() - begin) / 1000);
+    dump_output_end(&out);
+    err = dump_output_fini(&out);
+
+    pthread_mutex_destroy(&inventory.lock);
+    free(threads);
+    free(inventory.entries);
+
+    if (err == 0 && failed > 0)
+        err = -EIO;
+    return err;
+}
+
 int main(int argc, const char *const argv[])
 {
     const char *path;
-    int fd;
-    struct snd_ctl_elem_list list = {0};
+    const char *cache_path = NULL;
+    unsigned long workers;
+    struct dump_output out;
+    int format = DUMP_OUTPUT_HUMAN;
+    int arg = 2;
     int err;
 
     if (argc < 2) {
@@ -268,26 +573,45 @@ int main(int argc, const char *const argv[])
     }
     path = argv[1];
 
-    fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        printf("open(2): %s\n", strerror(errno));
+    if (strcmp(path, "all") == 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 2) {
+            format = dump_output_parse_format(argv[2]);
+            if (argc > 3)
+                workers = strtoul(argv[3], NULL, 10);
+        }
+        if (format < 0 || workers == 0) {
+            printf("Usage: %s all [human|json|binary [WORKERS]]\n",
+                   argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (dump_all_cards(format, workers) < 0)
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    /* Any unknown word is rejected, not taken as the path of cache. */
+    if (argc > arg && dump_output_parse_format(argv[arg]) >= 0)
+        format = dump_output_parse_format(argv[arg++]);
+    if (argc == arg + 2 && strcmp(argv[arg], "cache") == 0)
+        cache_path = argv[arg + 1];
+    else if (argc != arg)
+        format = -EINVAL;
+    if (format < 0) {
+        printf("Usage: %s CONTROL-DEVICE [human|json|binary] [cache FILE]\n",
+               argv[0]);
+        printf("       %s all [human|json|binary [WORKERS]]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    err = allocate_elem_ids(fd, &list);
+    dump_output_init(&out, format, STDOUT_FILENO);
+    err = dump_card(path, cache_path, &out);
+    dump_output_fini(&out);
     if (err < 0) {
-        close(fd);
+        fprintf(stderr, "%s: %s\n", path, strerror(-err));
         return EXIT_FAILURE;
     }
 
-    printf("%s\n", path);
-    err = dump_card_info(fd);
-    if (err >= 0)
-        err = dump_elems(fd, &list);
-
-    deallocate_elem_ids(&list);
-
-    close(fd);
-
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,424 @@
+/*
+ * ctl-label-cache.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Interning cache of the labels of enumerated control elements. Drivers tend
+ * to give the same list of items to many elements, e.g. routing selectors of
+ * USB audio interfaces, while SNDRV_CTL_IOCTL_ELEM_INFO returns one label per
+ * call. The identical lists are stored once and shared by elements; all of
+ * labels of an element which is not known yet are queried, since a part of
+ * them can not prove the rest. The mapping from element to list can be saved
+ * and loaded again, keyed by the card and the ctime of the control character
+ * device, then the labels of known elements are not queried.
+ */
+
+#ifndef CTL_LABEL_CACHE_H
+#define CTL_LABEL_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sound/asound.h>
+
+#define CTL_LABEL_CACHE_MAGIC	"CTLLABEL"
+#define CTL_LABEL_CACHE_VERSION	1
+
+#define CTL_LABEL_SIZE	\
+	sizeof(((struct snd_ctl_elem_info *)0)->value.enumerated.name)
+
+typedef char ctl_label_t[CTL_LABEL_SIZE];
+
+struct ctl_label_key {
+	char id[16];
+	char driver[16];
+	char components[128];
+	char mixername[80];
+	char release[65];
+	int64_t ctl_ctime;
+};
+
+struct ctl_label_set {
+	uint32_t first;
+	uint32_t items;
+};
+
+struct ctl_label_entry {
+	/* The numid is always zero, since it is not stable between runs. */
+	struct snd_ctl_elem_id id;
+	uint32_t items;
+	uint32_t set;
+};
+
+struct ctl_label_header {
+	char magic[8];
+	uint32_t version;
+	/* Detects change of layout of the structures in uAPI. */
+	uint32_t entry_size;
+	uint32_t label_size;
+	uint32_t label_count;
+	uint32_t set_count;
+	uint32_t entry_count;
+	struct ctl_label_key key;
+};
+
+struct ctl_label_cache {
+	struct ctl_label_key key;
+
+	ctl_label_t *labels;
+	unsigned int label_count;
+	unsigned int label_space;
+	struct ctl_label_set *sets;
+	unsigned int set_count;
+	unsigned int set_space;
+	struct ctl_label_entry *entries;
+	unsigned int entry_count;
+	unsigned int entry_space;
+	/* The loaded entries are sorted, the others are appended after them. */
+	unsigned int sorted;
+
+	/* SNDRV_CTL_IOCTL_ELEM_INFO for labels, issued and avoided. */
+	uint64_t ioctls;
+	uint64_t avoided;
+	unsigned int hits;
+	unsigned int shared;
+};
+
+static inline int ctl_label_cache_make_key(const struct snd_ctl_card_info *info,
+					   const char *path,
+					   struct ctl_label_key *key)
+{
+	struct utsname name;
+	struct stat st;
+
+	if (uname(&name) < 0 || stat(path, &st) < 0)
+		return -errno;
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key->id, info->id, sizeof(key->id));
+	memcpy(key->driver, info->driver, sizeof(key->driver));
+	memcpy(key->components, info->components, sizeof(key->components));
+	memcpy(key->mixername, info->mixername, sizeof(key->mixername));
+	snprintf(key->release, sizeof(key->release), "%s", name.release);
+	/* Changes when the card is registered again. */
+	key->ctl_ctime = (int64_t)st.st_ctim.tv_sec * 1000000000ll +
+			 st.st_ctim.tv_nsec;
+
+	return 0;
+}
+
+static inline void ctl_label_cache_init(struct ctl_label_cache *cache,
+					const struct ctl_label_key *key)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->key = *key;
+}
+
+static inline void ctl_label_cache_free(struct ctl_label_cache *cache)
+{
+	free(cache->labels);
+	free(cache->sets);
+	free(cache->entries);
+	cache->labels = NULL;
+	cache->sets = NULL;
+	cache->entries = NULL;
+}
+
+static inline int ctl_label_cache_reserve(void **array, unsigned int *space,
+					  unsigned int count,
+					  unsigned int extra, size_t size)
+{
+	unsigned int want = *space > 0 ? *space : 16;
+	void *ptr;
+
+	if (count + extra <= *space)
+		return 0;
+	if (extra > UINT_MAX - count)
+		return -ENOMEM;
+	while (want < count + extra)
+		want = want > UINT_MAX / 2 ? count + extra : want * 2;
+
+	ptr = realloc(*array, size * want);
+	if (ptr == NULL)
+		return -ENOMEM;
+	*array = ptr;
+	*space = want;
+
+	return 0;
+}
+
+static inline int ctl_label_cache_compare_id(const void *a, const void *b)
+{
+	const struct snd_ctl_elem_id *l = a, *r = b;
+
+	if (l->iface != r->iface)
+		return l->iface < r->iface ? -1 : 1;
+	if (l->device != r->device)
+		return l->device < r->device ? -1 : 1;
+	if (l->subdevice != r->subdevice)
+		return l->subdevice < r->subdevice ? -1 : 1;
+	if (l->index != r->index)
+		return l->index < r->index ? -1 : 1;
+	return strncmp((const char *)l->name, (const char *)r->name,
+		       sizeof(l->name));
+}
+
+static inline int ctl_label_cache_compare_entries(const void *a, const void *b)
+{
+	const struct ctl_label_entry *l = a, *r = b;
+
+	return ctl_label_cache_compare_id(&l->id, &r->id);
+}
+
+static inline struct ctl_label_entry *ctl_label_cache_find(
+					struct ctl_label_cache *cache,
+					const struct snd_ctl_elem_id *id)
+{
+	struct ctl_label_entry entry = {0};
+
+	entry.id = *id;
+	entry.id.numid = 0;
+	return bsearch(&entry, cache->entries, cache->sorted,
+		       sizeof(*cache->entries),
+		       ctl_label_cache_compare_entries);
+}
+
+static inline int ctl_label_cache_query(struct ctl_label_cache *cache, int fd,
+					struct snd_ctl_elem_info *info,
+					unsigned int item, ctl_label_t label)
+{
+	info->value.enumerated.item = item;
+	++cache->ioctls;
+	/* Just querying, has no side effects. */
+	if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_INFO, info) < 0)
+		return -errno;
+	memcpy(label, info->value.enumerated.name, CTL_LABEL_SIZE);
+	label[CTL_LABEL_SIZE - 1] = '\0';
+
+	return 0;
+}
+
+/*
+ * Get the interned labels of the enumerated element of which information is
+ * in info. The labels are valid till the next call.
+ */
+static inline int ctl_label_cache_lookup(struct ctl_label_cache *cache,
+					 int fd, struct snd_ctl_elem_info *info,
+					 const ctl_label_t **labels)
+{
+	unsigned int items = info->value.enumerated.items;
+	struct ctl_label_entry *entry;
+	struct ctl_label_set *set;
+	unsigned int i, index;
+	int err;
+
+	*labels = NULL;
+	if (items == 0)
+		return 0;
+
+	entry = ctl_label_cache_find(cache, &info->id);
+	if (entry != NULL && entry->items == items &&
+	    entry->set < cache->set_count) {
+		cache->avoided += items;
+		++cache->hits;
+		*labels = cache->labels + cache->sets[entry->set].first;
+		return 0;
+	}
+
+	err = ctl_label_cache_reserve((void **)&cache->labels,
+				      &cache->label_space, cache->label_count,
+				      items, sizeof(*cache->labels));
+	if (err < 0)
+		return err;
+	err = ctl_label_cache_reserve((void **)&cache->sets,
+				      &cache->set_space, cache->set_count, 1,
+				      sizeof(*cache->sets));
+	if (err < 0)
+		return err;
+
+	/* Queried into the space after the interned labels. */
+	for (i = 0; i < items; ++i) {
+		err = ctl_label_cache_query(cache, fd, info, i,
+				cache->labels[cache->label_count + i]);
+		if (err < 0)
+			return err;
+	}
+
+	/* The space is reused when the whole list is identical. */
+	for (index = 0; index < cache->set_count; ++index) {
+		set = &cache->sets[index];
+		if (set->items == items &&
+		    memcmp(cache->labels[set->first],
+			   cache->labels[cache->label_count],
+			   items * CTL_LABEL_SIZE) == 0)
+			break;
+	}
+	if (index < cache->set_count) {
+		++cache->shared;
+	} else {
+		set = &cache->sets[cache->set_count++];
+		set->first = cache->label_count;
+		set->items = items;
+		cache->label_count += items;
+	}
+
+	if (entry != NULL) {
+		/* The number of items was changed by the driver. */
+		entry->items = items;
+		entry->set = index;
+	} else {
+		err = ctl_label_cache_reserve((void **)&cache->entries,
+					      &cache->entry_space,
+					      cache->entry_count, 1,
+					      sizeof(*cache->entries));
+		if (err < 0)
+			return err;
+		entry = &cache->entries[cache->entry_count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->id = info->id;
+		entry->id.numid = 0;
+		entry->items = items;
+		entry->set = index;
+	}
+
+	*labels = cache->labels + cache->sets[index].first;
+	return 0;
+}
+
+/* The file for the other card or the other registration is not loaded. */
+static inline int ctl_label_cache_load(struct ctl_label_cache *cache,
+				       const char *path)
+{
+	struct ctl_label_header header;
+	struct ctl_label_set *set;
+	unsigned int i;
+	FILE *file;
+	int err = 0;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -errno;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header.magic, CTL_LABEL_CACHE_MAGIC,
+		   sizeof(header.magic)) ||
+	    header.version != CTL_LABEL_CACHE_VERSION ||
+	    header.entry_size != sizeof(struct ctl_label_entry) ||
+	    header.label_size != CTL_LABEL_SIZE) {
+		err = -EPROTO;
+		goto end;
+	}
+	if (memcmp(&header.key, &cache->key, sizeof(header.key)) != 0) {
+		err = -ESTALE;
+		goto end;
+	}
+
+	cache->labels = calloc(header.label_count > 0 ? header.label_count : 1,
+			       sizeof(*cache->labels));
+	cache->sets = calloc(header.set_count > 0 ? header.set_count : 1,
+			     sizeof(*cache->sets));
+	cache->entries = calloc(header.entry_count > 0 ? header.entry_count : 1,
+				sizeof(*cache->entries));
+	if (cache->labels == NULL || cache->sets == NULL ||
+	    cache->entries == NULL) {
+		err = -ENOMEM;
+		goto end;
+	}
+	if (fread(cache->labels, sizeof(*cache->labels), header.label_count,
+		  file) != header.label_count ||
+	    fread(cache->sets, sizeof(*cache->sets), header.set_count,
+		  file) != header.set_count ||
+	    fread(cache->entries, sizeof(*cache->entries), header.entry_count,
+		  file) != header.entry_count) {
+		err = -EPROTO;
+		goto end;
+	}
+
+	/* Each list should be in the array of labels. */
+	for (i = 0; i < header.set_count; ++i) {
+		set = &cache->sets[i];
+		if (set->first > header.label_count ||
+		    set->items > header.label_count - set->first) {
+			err = -EPROTO;
+			goto end;
+		}
+	}
+	for (i = 0; i < header.label_count; ++i)
+		cache->labels[i][CTL_LABEL_SIZE - 1] = '\0';
+
+	cache->label_count = cache->label_space = header.label_count;
+	cache->set_count = cache->set_space = header.set_count;
+	cache->entry_count = cache->entry_space = header.entry_count;
+	qsort(cache->entries, cache->entry_count, sizeof(*cache->entries),
+	      ctl_label_cache_compare_entries);
+	cache->sorted = cache->entry_count;
+end:
+	fclose(file);
+	if (err < 0) {
+		ctl_label_cache_free(cache);
+		cache->label_space = cache->set_space = cache->entry_space = 0;
+	}
+	return err;
+}
+
+static inline int ctl_label_cache_save(const struct ctl_label_cache *cache,
+				       const char *path)
+{
+	struct ctl_label_header header = {0};
+	char tmp[PATH_MAX];
+	FILE *file;
+	int fd;
+	int err = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	fchmod(fd, 0644);
+	file = fdopen(fd, "w");
+	if (file == NULL) {
+		err = -errno;
+		close(fd);
+		goto end;
+	}
+
+	memcpy(header.magic, CTL_LABEL_CACHE_MAGIC, sizeof(header.magic));
+	header.version = CTL_LABEL_CACHE_VERSION;
+	header.entry_size = sizeof(struct ctl_label_entry);
+	header.label_size = CTL_LABEL_SIZE;
+	header.label_count = cache->label_count;
+	header.set_count = cache->set_count;
+	header.entry_count = cache->entry_count;
+	header.key = cache->key;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(cache->labels, sizeof(*cache->labels), cache->label_count, file);
+	fwrite(cache->sets, sizeof(*cache->sets), cache->set_count, file);
+	fwrite(cache->entries, sizeof(*cache->entries), cache->entry_count,
+	       file);
+
+	if (ferror(file))
+		err = -EIO;
+	if (fclose(file) != 0 && err == 0)
+		err = -errno;
+	if (err == 0 && rename(tmp, path) < 0)
+		err = -errno;
+end:
+	if (err < 0)
+		unlink(tmp);
+	return err;
+}
+
+#endif
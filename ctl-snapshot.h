@@ -0,0 +1,535 @@
+/*
+ * ctl-snapshot.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Snapshot of the values of control elements. The values of all readable
+ * elements are packed into one array with the size of member for each type,
+ * and the elements are sorted by their identifiers so that two snapshots are
+ * compared by one merge. The file is in host byte order since it is restored
+ * on the same machine.
+ */
+
+#ifndef CTL_SNAPSHOT_H
+#define CTL_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sound/asound.h>
+
+#define CTL_SNAPSHOT_MAGIC	"CTLSNAP"
+#define CTL_SNAPSHOT_VERSION	1
+
+/* ALSA middleware has limitation of one operation. */
+#define CTL_SNAPSHOT_LIST_CHUNK	1000
+
+struct ctl_snapshot_elem {
+	struct snd_ctl_elem_id id;
+	uint32_t type;
+	uint32_t access;
+	/* The number of members. */
+	uint32_t count;
+	/* The offset of the first member in the array of values. */
+	uint32_t offset;
+};
+
+struct ctl_snapshot {
+	struct ctl_snapshot_elem *elems;
+	unsigned int count;
+	unsigned char *values;
+	size_t size;
+};
+
+struct ctl_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t elem_size;
+	uint32_t count;
+	uint32_t size;
+};
+
+/*
+ * The long is 32 bit in ILP32 ABI, thus any value of integer type fits in
+ * 32 bit. The whole IEC 60958 status is one member.
+ */
+static inline size_t ctl_snapshot_member_size(snd_ctl_elem_type_t type)
+{
+	switch (type) {
+	case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+	case SNDRV_CTL_ELEM_TYPE_BYTES:
+		return 1;
+	case SNDRV_CTL_ELEM_TYPE_INTEGER:
+		return sizeof(int32_t);
+	case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+		return sizeof(uint32_t);
+	case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+		return sizeof(int64_t);
+	case SNDRV_CTL_ELEM_TYPE_IEC958:
+		return sizeof(struct snd_aes_iec958);
+	default:
+		return 0;
+	}
+}
+
+/* The members which struct snd_ctl_elem_value can carry for the type. */
+static inline unsigned int ctl_snapshot_member_capacity(
+						snd_ctl_elem_type_t type)
+{
+	struct snd_ctl_elem_value value;
+
+	switch (type) {
+	case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+	case SNDRV_CTL_ELEM_TYPE_INTEGER:
+		return sizeof(value.value.integer.value) /
+		       sizeof(value.value.integer.value[0]);
+	case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+		return sizeof(value.value.enumerated.item) /
+		       sizeof(value.value.enumerated.item[0]);
+	case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+		return sizeof(value.value.integer64.value) /
+		       sizeof(value.value.integer64.value[0]);
+	case SNDRV_CTL_ELEM_TYPE_BYTES:
+		return sizeof(value.value.bytes.data);
+	case SNDRV_CTL_ELEM_TYPE_IEC958:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static inline const unsigned char *ctl_snapshot_member(
+					const struct ctl_snapshot *snap,
+					const struct ctl_snapshot_elem *elem,
+					unsigned int member)
+{
+	return snap->values + elem->offset +
+	       member * ctl_snapshot_member_size(elem->type);
+}
+
+static inline void ctl_snapshot_pack(const struct ctl_snapshot_elem *elem,
+				     const struct snd_ctl_elem_value *value,
+				     unsigned char *dst)
+{
+	int32_t integer;
+	uint32_t item;
+	unsigned int i;
+
+	for (i = 0; i < elem->count; ++i) {
+		switch (elem->type) {
+		case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+			dst[i] = !!value->value.integer.value[i];
+			break;
+		case SNDRV_CTL_ELEM_TYPE_INTEGER:
+			integer = value->value.integer.value[i];
+			memcpy(dst + i * sizeof(integer), &integer,
+			       sizeof(integer));
+			break;
+		case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+			item = value->value.enumerated.item[i];
+			memcpy(dst + i * sizeof(item), &item, sizeof(item));
+			break;
+		case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+			memcpy(dst + i * sizeof(int64_t),
+			       &value->value.integer64.value[i],
+			       sizeof(int64_t));
+			break;
+		case SNDRV_CTL_ELEM_TYPE_BYTES:
+			dst[i] = value->value.bytes.data[i];
+			break;
+		case SNDRV_CTL_ELEM_TYPE_IEC958:
+			memcpy(dst, &value->value.iec958,
+			       sizeof(value->value.iec958));
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static inline void ctl_snapshot_unpack(const struct ctl_snapshot_elem *elem,
+				       const unsigned char *src,
+				       struct snd_ctl_elem_value *value)
+{
+	int32_t integer;
+	uint32_t item;
+	unsigned int i;
+
+	memset(value, 0, sizeof(*value));
+	value->id = elem->id;
+
+	for (i = 0; i < elem->count; ++i) {
+		switch (elem->type) {
+		case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+			value->value.integer.value[i] = src[i];
+			break;
+		case SNDRV_CTL_ELEM_TYPE_INTEGER:
+			memcpy(&integer, src + i * sizeof(integer),
+			       sizeof(integer));
+			value->value.integer.value[i] = integer;
+			break;
+		case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+			memcpy(&item, src + i * sizeof(item), sizeof(item));
+			value->value.enumerated.item[i] = item;
+			break;
+		case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+			memcpy(&value->value.integer64.value[i],
+			       src + i * sizeof(int64_t), sizeof(int64_t));
+			break;
+		case SNDRV_CTL_ELEM_TYPE_BYTES:
+			value->value.bytes.data[i] = src[i];
+			break;
+		case SNDRV_CTL_ELEM_TYPE_IEC958:
+			memcpy(&value->value.iec958, src,
+			       sizeof(value->value.iec958));
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* The order of iface, device, subdevice, name and index. */
+static inline int ctl_snapshot_compare_id(const struct snd_ctl_elem_id *l,
+					  const struct snd_ctl_elem_id *r)
+{
+	int diff;
+
+	if (l->iface != r->iface)
+		return l->iface < r->iface ? -1 : 1;
+	if (l->device != r->device)
+		return l->device < r->device ? -1 : 1;
+	if (l->subdevice != r->subdevice)
+		return l->subdevice < r->subdevice ? -1 : 1;
+	diff = strncmp((const char *)l->name, (const char *)r->name,
+		       sizeof(l->name));
+	if (diff != 0)
+		return diff;
+	if (l->index != r->index)
+		return l->index < r->index ? -1 : 1;
+	return 0;
+}
+
+static inline int ctl_snapshot_compare_elems(const void *l, const void *r)
+{
+	const struct ctl_snapshot_elem *lhs = l;
+	const struct ctl_snapshot_elem *rhs = r;
+
+	return ctl_snapshot_compare_id(&lhs->id, &rhs->id);
+}
+
+static inline void ctl_snapshot_free(struct ctl_snapshot *snap)
+{
+	free(snap->elems);
+	free(snap->values);
+	memset(snap, 0, sizeof(*snap));
+}
+
+static inline int ctl_snapshot_list_ids(int fd, struct snd_ctl_elem_id **ids,
+					unsigned int *count)
+{
+	struct snd_ctl_elem_list list = {0};
+
+	*ids = NULL;
+	*count = 0;
+
+	if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0)
+		return -errno;
+	if (list.count == 0)
+		return 0;
+
+	*ids = calloc(list.count, sizeof(**ids));
+	if (*ids == NULL)
+		return -ENOMEM;
+	*count = list.count;
+
+	while (list.offset < *count) {
+		list.space = *count - list.offset;
+		if (list.space > CTL_SNAPSHOT_LIST_CHUNK)
+			list.space = CTL_SNAPSHOT_LIST_CHUNK;
+		list.pids = *ids + list.offset;
+		if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0) {
+			free(*ids);
+			*ids = NULL;
+			*count = 0;
+			return -errno;
+		}
+		/* Some elements are removed in the middle. */
+		if (list.used == 0)
+			break;
+		list.offset += list.used;
+	}
+	*count = list.offset;
+
+	return 0;
+}
+
+/*
+ * Read the values of all readable elements. The elements removed during the
+ * walk are just skipped.
+ */
+static inline int ctl_snapshot_take(int fd, struct ctl_snapshot *snap)
+{
+	struct snd_ctl_elem_info info;
+	struct snd_ctl_elem_value value;
+	struct ctl_snapshot_elem *elem;
+	struct snd_ctl_elem_id *ids;
+	unsigned int i, count;
+	size_t size, member;
+	void *buf;
+	int err;
+
+	memset(snap, 0, sizeof(*snap));
+
+	err = ctl_snapshot_list_ids(fd, &ids, &count);
+	if (err < 0)
+		return err;
+
+	snap->elems = calloc(count > 0 ? count : 1, sizeof(*snap->elems));
+	if (snap->elems == NULL) {
+		free(ids);
+		return -ENOMEM;
+	}
+
+	/* Enough for the most of elements. */
+	size = count * sizeof(int32_t) * 2;
+
+	for (i = 0; i < count; ++i) {
+		memset(&info, 0, sizeof(info));
+		info.id = ids[i];
+		if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_INFO, &info) < 0) {
+			if (errno == ENOENT)
+				continue;
+			err = -errno;
+			goto error;
+		}
+		member = ctl_snapshot_member_size(info.type);
+		if (!(info.access & SNDRV_CTL_ELEM_ACCESS_READ) || member == 0)
+			continue;
+
+		memset(&value, 0, sizeof(value));
+		value.id = info.id;
+		if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_READ, &value) < 0) {
+			if (errno == ENOENT || errno == EPERM)
+				continue;
+			err = -errno;
+			goto error;
+		}
+
+		elem = &snap->elems[snap->count];
+		elem->id = info.id;
+		elem->type = info.type;
+		elem->access = info.access;
+		elem->count = info.type == SNDRV_CTL_ELEM_TYPE_IEC958 ?
+			      1 : info.count;
+		elem->offset = snap->size;
+
+		if (snap->values == NULL ||
+		    snap->size + elem->count * member > size) {
+			while (snap->size + elem->count * member > size)
+				size = size > 0 ? size * 2 : 4096;
+			buf = realloc(snap->values, size);
+			if (buf == NULL) {
+				err = -ENOMEM;
+				goto error;
+			}
+			snap->values = buf;
+		}
+
+		ctl_snapshot_pack(elem, &value, snap->values + snap->size);
+		snap->size += elem->count * member;
+		++snap->count;
+	}
+
+	free(ids);
+	qsort(snap->elems, snap->count, sizeof(*snap->elems),
+	      ctl_snapshot_compare_elems);
+
+	return 0;
+error:
+	free(ids);
+	ctl_snapshot_free(snap);
+	return err;
+}
+
+static inline int ctl_snapshot_save(const struct ctl_snapshot *snap,
+				    const char *path)
+{
+	struct ctl_snapshot_header header = {0};
+	FILE *file;
+	int err = 0;
+
+	file = fopen(path, "w");
+	if (file == NULL)
+		return -errno;
+
+	memcpy(header.magic, CTL_SNAPSHOT_MAGIC, sizeof(CTL_SNAPSHOT_MAGIC));
+	header.version = CTL_SNAPSHOT_VERSION;
+	header.elem_size = sizeof(struct ctl_snapshot_elem);
+	header.count = snap->count;
+	header.size = snap->size;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(snap->elems, sizeof(*snap->elems), snap->count, file);
+	fwrite(snap->values, 1, snap->size, file);
+
+	if (ferror(file))
+		err = -EIO;
+	if (fclose(file) != 0 && err == 0)
+		err = -errno;
+
+	return err;
+}
+
+static inline int ctl_snapshot_load(struct ctl_snapshot *snap,
+				    const char *path)
+{
+	struct ctl_snapshot_header header;
+	struct ctl_snapshot_elem *elem;
+	size_t member;
+	unsigned int i;
+	FILE *file;
+	int err = 0;
+
+	memset(snap, 0, sizeof(*snap));
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -errno;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header.magic, CTL_SNAPSHOT_MAGIC,
+		   sizeof(CTL_SNAPSHOT_MAGIC)) ||
+	    header.version != CTL_SNAPSHOT_VERSION ||
+	    header.elem_size != sizeof(struct ctl_snapshot_elem)) {
+		err = -EPROTO;
+		goto end;
+	}
+
+	snap->elems = calloc(header.count > 0 ? header.count : 1,
+			     sizeof(*snap->elems));
+	snap->values = malloc(header.size > 0 ? header.size : 1);
+	if (snap->elems == NULL || snap->values == NULL) {
+		err = -ENOMEM;
+		goto end;
+	}
+	if (fread(snap->elems, sizeof(*snap->elems), header.count, file) !=
+							header.count ||
+	    fread(snap->values, 1, header.size, file) != header.size) {
+		err = -EPROTO;
+		goto end;
+	}
+	snap->count = header.count;
+	snap->size = header.size;
+
+	/*
+	 * Each element should fit in the array of values and in the structure
+	 * to restore, and be sorted by the identifier for bsearch(3).
+	 */
+	for (i = 0; i < snap->count; ++i) {
+		elem = &snap->elems[i];
+		member = ctl_snapshot_member_size(elem->type);
+		if (member == 0 ||
+		    elem->count > ctl_snapshot_member_capacity(elem->type) ||
+		    elem->offset > snap->size ||
+		    elem->count * member > snap->size - elem->offset ||
+		    (i > 0 && ctl_snapshot_compare_id(&snap->elems[i - 1].id,
+						      &elem->id) >= 0)) {
+			err = -EPROTO;
+			break;
+		}
+	}
+end:
+	fclose(file);
+	if (err < 0)
+		ctl_snapshot_free(snap);
+	return err;
+}
+
+static inline bool ctl_snapshot_member_differs(
+				const struct ctl_snapshot *old,
+				const struct ctl_snapshot_elem *old_elem,
+				const struct ctl_snapshot *new,
+				const struct ctl_snapshot_elem *new_elem,
+				unsigned int member)
+{
+	if (member >= old_elem->count || member >= new_elem->count)
+		return true;
+	return memcmp(ctl_snapshot_member(old, old_elem, member),
+		      ctl_snapshot_member(new, new_elem, member),
+		      ctl_snapshot_member_size(old_elem->type)) != 0;
+}
+
+/*
+ * Call the function for each changed member between two snapshots. For the
+ * element only in either snapshot, the other is NULL and the member is 0.
+ * Returns the number of calls.
+ */
+static inline unsigned int ctl_snapshot_diff(
+		const struct ctl_snapshot *old,
+		const struct ctl_snapshot *new,
+		void (*changed)(void *private,
+				const struct ctl_snapshot_elem *old_elem,
+				const struct ctl_snapshot_elem *new_elem,
+				unsigned int member),
+		void *private)
+{
+	const struct ctl_snapshot_elem *l, *r;
+	unsigned int i = 0, j = 0, member, members;
+	unsigned int calls = 0;
+	int order;
+
+	while (i < old->count || j < new->count) {
+		l = i < old->count ? &old->elems[i] : NULL;
+		r = j < new->count ? &new->elems[j] : NULL;
+		if (l == NULL)
+			order = 1;
+		else if (r == NULL)
+			order = -1;
+		else
+			order = ctl_snapshot_compare_id(&l->id, &r->id);
+
+		if (order < 0) {
+			changed(private, l, NULL, 0);
+			++calls;
+			++i;
+			continue;
+		}
+		if (order > 0) {
+			changed(private, NULL, r, 0);
+			++calls;
+			++j;
+			continue;
+		}
+
+		/* The element with the other type is the other one. */
+		if (l->type != r->type) {
+			changed(private, l, NULL, 0);
+			changed(private, NULL, r, 0);
+			calls += 2;
+		} else {
+			members = l->count > r->count ? l->count : r->count;
+			for (member = 0; member < members; ++member) {
+				if (!ctl_snapshot_member_differs(old, l, new, r,
+								 member))
+					continue;
+				changed(private, l, r, member);
+				++calls;
+			}
+		}
+		++i;
+		++j;
+	}
+
+	return calls;
+}
+
+#endif
@@ -0,0 +1,747 @@
+/*
+ * ctl-tlv.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Parser of the TLV data of control elements, for dB scale, linear volume,
+ * dB min/max with or without mute, dB range containers and channel maps,
+ * and evaluation of the volume curve between raw values and dB for whole
+ * arrays at once. The curve is split into ranges of raw values; ranges of
+ * dB scale and of dB min/max are affine in dB, thus evaluated by scalar,
+ * SSE2 and AVX2 implementations selected as in sample-conversion.h. The
+ * ranges of linear volume are evaluated by scalar code in every
+ * implementation, since they require logarithm.
+ */
+
+#ifndef CTL_TLV_H
+#define CTL_TLV_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include <sound/asound.h>
+#include <sound/tlv.h>
+
+#include "sample-conversion.h"
+
+/* Enough for the TLV of any element in drivers in tree. */
+#define CTL_TLV_MAX_BYTES	4096
+#define CTL_TLV_MAX_RANGES	16
+#define CTL_TLV_MAX_CHMAPS	16
+#define CTL_TLV_MAX_CHANNELS	32
+/* Containers in containers. */
+#define CTL_TLV_MAX_DEPTH	4
+
+struct ctl_tlv_range {
+	/* SNDRV_CTL_TLVT_DB_SCALE, _DB_LINEAR, _DB_MINMAX(_MUTE). */
+	unsigned int type;
+	int32_t min;
+	int32_t max;
+	/* In 0.01 dB at the minimum and the maximum raw value. */
+	int32_t min_cdb;
+	int32_t max_cdb;
+	/* The minimum raw value means mute. */
+	bool mute;
+
+	/* dB = offset + slope * raw, for the affine ranges. */
+	float offset;
+	float slope;
+	float inverse;
+};
+
+struct ctl_tlv_chmap {
+	/* SNDRV_CTL_TLVT_CHMAP_FIXED, _VAR or _PAIRED. */
+	unsigned int type;
+	unsigned int channels;
+	unsigned int positions[CTL_TLV_MAX_CHANNELS];
+};
+
+struct ctl_tlv {
+	struct ctl_tlv_range ranges[CTL_TLV_MAX_RANGES];
+	unsigned int range_count;
+	struct ctl_tlv_chmap chmaps[CTL_TLV_MAX_CHMAPS];
+	unsigned int chmap_count;
+
+	/* The whole curve. */
+	bool has_linear;
+	int32_t min;
+	int32_t max;
+	float min_db;
+};
+
+static const char *const ctl_tlv_type_labels[] = {
+	[SNDRV_CTL_TLVT_CONTAINER]	= "container",
+	[SNDRV_CTL_TLVT_DB_SCALE]	= "db-scale",
+	[SNDRV_CTL_TLVT_DB_LINEAR]	= "db-linear",
+	[SNDRV_CTL_TLVT_DB_RANGE]	= "db-range",
+	[SNDRV_CTL_TLVT_DB_MINMAX]	= "db-minmax",
+	[SNDRV_CTL_TLVT_DB_MINMAX_MUTE]	= "db-minmax-mute",
+};
+
+static const char *const ctl_tlv_chmap_type_labels[] = {
+	[SNDRV_CTL_TLVT_CHMAP_FIXED - SNDRV_CTL_TLVT_CHMAP_FIXED] = "fixed",
+	[SNDRV_CTL_TLVT_CHMAP_VAR - SNDRV_CTL_TLVT_CHMAP_FIXED] = "var",
+	[SNDRV_CTL_TLVT_CHMAP_PAIRED - SNDRV_CTL_TLVT_CHMAP_FIXED] = "paired",
+};
+
+static const char *const ctl_tlv_position_labels[] = {
+	[SNDRV_CHMAP_UNKNOWN]	= "UNKNOWN",
+	[SNDRV_CHMAP_NA]	= "NA",
+	[SNDRV_CHMAP_MONO]	= "MONO",
+	[SNDRV_CHMAP_FL]	= "FL",
+	[SNDRV_CHMAP_FR]	= "FR",
+	[SNDRV_CHMAP_RL]	= "RL",
+	[SNDRV_CHMAP_RR]	= "RR",
+	[SNDRV_CHMAP_FC]	= "FC",
+	[SNDRV_CHMAP_LFE]	= "LFE",
+	[SNDRV_CHMAP_SL]	= "SL",
+	[SNDRV_CHMAP_SR]	= "SR",
+	[SNDRV_CHMAP_RC]	= "RC",
+	[SNDRV_CHMAP_FLC]	= "FLC",
+	[SNDRV_CHMAP_FRC]	= "FRC",
+	[SNDRV_CHMAP_RLC]	= "RLC",
+	[SNDRV_CHMAP_RRC]	= "RRC",
+	[SNDRV_CHMAP_FLW]	= "FLW",
+	[SNDRV_CHMAP_FRW]	= "FRW",
+	[SNDRV_CHMAP_FLH]	= "FLH",
+	[SNDRV_CHMAP_FCH]	= "FCH",
+	[SNDRV_CHMAP_FRH]	= "FRH",
+	[SNDRV_CHMAP_TC]	= "TC",
+	[SNDRV_CHMAP_TFL]	= "TFL",
+	[SNDRV_CHMAP_TFR]	= "TFR",
+	[SNDRV_CHMAP_TFC]	= "TFC",
+	[SNDRV_CHMAP_TRL]	= "TRL",
+	[SNDRV_CHMAP_TRR]	= "TRR",
+	[SNDRV_CHMAP_TRC]	= "TRC",
+	[SNDRV_CHMAP_TFLC]	= "TFLC",
+	[SNDRV_CHMAP_TFRC]	= "TFRC",
+	[SNDRV_CHMAP_TSL]	= "TSL",
+	[SNDRV_CHMAP_TSR]	= "TSR",
+	[SNDRV_CHMAP_LLFE]	= "LLFE",
+	[SNDRV_CHMAP_RLFE]	= "RLFE",
+	[SNDRV_CHMAP_BC]	= "BC",
+	[SNDRV_CHMAP_BLC]	= "BLC",
+	[SNDRV_CHMAP_BRC]	= "BRC",
+};
+
+/* Read the TLV of the element into the buffer, including its header. */
+static inline int ctl_tlv_read(int fd, unsigned int numid, unsigned int *buf,
+			       size_t size, unsigned int *bytes)
+{
+	struct snd_ctl_tlv *tlv = (struct snd_ctl_tlv *)buf;
+
+	if (size < sizeof(*tlv) + 2 * sizeof(unsigned int))
+		return -EINVAL;
+
+	tlv->numid = numid;
+	tlv->length = size - sizeof(*tlv);
+	if (ioctl(fd, SNDRV_CTL_IOCTL_TLV_READ, tlv) < 0)
+		return -errno;
+
+	/* The length of the first item, in bytes aligned to 4. */
+	*bytes = 2 * sizeof(unsigned int) + ((tlv->tlv[1] + 3) & ~3u);
+	if (*bytes > tlv->length)
+		return -EPROTO;
+
+	return 0;
+}
+
+static inline void ctl_tlv_fix_range(struct ctl_tlv_range *range)
+{
+	int64_t span = (int64_t)range->max - range->min;
+
+	range->offset = 0.0f;
+	range->slope = 0.0f;
+	range->inverse = 0.0f;
+	if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+		return;
+
+	if (span > 0)
+		range->slope = (range->max_cdb - range->min_cdb) / 100.0f /
+			       (float)span;
+	range->offset = range->min_cdb / 100.0f - range->slope * range->min;
+	if (range->slope != 0.0f)
+		range->inverse = 1.0f / range->slope;
+}
+
+static inline int ctl_tlv_add_range(struct ctl_tlv *tlv, unsigned int type,
+				    const unsigned int *payload,
+				    unsigned int bytes, int32_t min,
+				    int32_t max)
+{
+	struct ctl_tlv_range *range;
+	unsigned int step;
+	int64_t cdb;
+
+	if (bytes < 2 * sizeof(unsigned int) || min > max)
+		return -EPROTO;
+	if (tlv->range_count >= CTL_TLV_MAX_RANGES)
+		return -ENOSPC;
+
+	range = &tlv->ranges[tlv->range_count++];
+	memset(range, 0, sizeof(*range));
+	range->type = type;
+	range->min = min;
+	range->max = max;
+	range->min_cdb = (int32_t)payload[0];
+
+	switch (type) {
+	case SNDRV_CTL_TLVT_DB_SCALE:
+		step = payload[1] & SNDRV_CTL_TLVD_DB_SCALE_MASK;
+		range->mute = payload[1] & SNDRV_CTL_TLVD_DB_SCALE_MUTE;
+		cdb = range->min_cdb + (int64_t)step * ((int64_t)max - min);
+		range->max_cdb = cdb > INT32_MAX ? INT32_MAX : cdb;
+		break;
+	case SNDRV_CTL_TLVT_DB_LINEAR:
+		range->max_cdb = (int32_t)payload[1];
+		range->mute = range->min_cdb <= SNDRV_CTL_TLVD_DB_GAIN_MUTE;
+		break;
+	case SNDRV_CTL_TLVT_DB_MINMAX:
+	case SNDRV_CTL_TLVT_DB_MINMAX_MUTE:
+		range->max_cdb = (int32_t)payload[1];
+		range->mute = type == SNDRV_CTL_TLVT_DB_MINMAX_MUTE;
+		break;
+	default:
+		break;
+	}
+
+	ctl_tlv_fix_range(range);
+	if (type == SNDRV_CTL_TLVT_DB_LINEAR)
+		tlv->has_linear = true;
+
+	return 0;
+}
+
+static inline int ctl_tlv_add_chmap(struct ctl_tlv *tlv, unsigned int type,
+				    const unsigned int *payload,
+				    unsigned int bytes)
+{
+	struct ctl_tlv_chmap *chmap;
+	unsigned int i;
+
+	if (tlv->chmap_count >= CTL_TLV_MAX_CHMAPS)
+		return -ENOSPC;
+
+	chmap = &tlv->chmaps[tlv->chmap_count++];
+	chmap->type = type;
+	chmap->channels = bytes / sizeof(unsigned int);
+	if (chmap->channels > CTL_TLV_MAX_CHANNELS)
+		chmap->channels = CTL_TLV_MAX_CHANNELS;
+	for (i = 0; i < chmap->channels; ++i)
+		chmap->positions[i] = payload[i];
+
+	return 0;
+}
+
+/* One item of which the raw values are between min and max. */
+static inline int ctl_tlv_parse_item(struct ctl_tlv *tlv,
+				     const unsigned int *item,
+				     unsigned int bytes, int32_t min,
+				     int32_t max, unsigned int depth)
+{
+	const unsigned int *payload = item + 2;
+	unsigned int type, length, words;
+	unsigned int pos, entry_bytes;
+	int err;
+
+	if (bytes < 2 * sizeof(unsigned int) || depth > CTL_TLV_MAX_DEPTH)
+		return -EPROTO;
+	type = item[0];
+	length = (item[1] + 3) & ~3u;
+	if (item[1] > bytes - 2 * sizeof(unsigned int) ||
+	    length > bytes - 2 * sizeof(unsigned int))
+		return -EPROTO;
+	words = length / sizeof(unsigned int);
+
+	switch (type) {
+	case SNDRV_CTL_TLVT_CONTAINER:
+		for (pos = 0; pos + 2 <= words; pos += 2 + entry_bytes / 4) {
+			entry_bytes = (payload[pos + 1] + 3) & ~3u;
+			if (entry_bytes > (words - pos - 2) * 4)
+				return -EPROTO;
+			err = ctl_tlv_parse_item(tlv, payload + pos,
+						 (words - pos) * 4, min, max,
+						 depth + 1);
+			if (err < 0)
+				return err;
+		}
+		return 0;
+	case SNDRV_CTL_TLVT_DB_RANGE:
+		/* The sequence of the range of raw values and the item. */
+		for (pos = 0; pos + 4 <= words; pos += 4 + entry_bytes / 4) {
+			entry_bytes = (payload[pos + 3] + 3) & ~3u;
+			if (entry_bytes > (words - pos - 4) * 4)
+				return -EPROTO;
+			err = ctl_tlv_parse_item(tlv, payload + pos + 2,
+						 (words - pos - 2) * 4,
+						 (int32_t)payload[pos],
+						 (int32_t)payload[pos + 1],
+						 depth + 1);
+			if (err < 0)
+				return err;
+		}
+		return 0;
+	case SNDRV_CTL_TLVT_DB_SCALE:
+	case SNDRV_CTL_TLVT_DB_LINEAR:
+	case SNDRV_CTL_TLVT_DB_MINMAX:
+	case SNDRV_CTL_TLVT_DB_MINMAX_MUTE:
+		return ctl_tlv_add_range(tlv, type, payload, item[1], min, max);
+	case SNDRV_CTL_TLVT_CHMAP_FIXED:
+	case SNDRV_CTL_TLVT_CHMAP_VAR:
+	case SNDRV_CTL_TLVT_CHMAP_PAIRED:
+		return ctl_tlv_add_chmap(tlv, type, payload, item[1]);
+	default:
+		/* Unknown to this program; skipped. */
+		return 0;
+	}
+}
+
+/* The raw values of the element are between min and max. */
+static inline int ctl_tlv_parse(struct ctl_tlv *tlv, const unsigned int *item,
+				unsigned int bytes, int32_t min, int32_t max)
+{
+	const struct ctl_tlv_range *range;
+	unsigned int i;
+	int err;
+
+	memset(tlv, 0, sizeof(*tlv));
+	err = ctl_tlv_parse_item(tlv, item, bytes, min, max, 0);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < tlv->range_count; ++i) {
+		range = &tlv->ranges[i];
+		if (i == 0 || range->min < tlv->min)
+			tlv->min = range->min;
+		if (i == 0 || range->max > tlv->max)
+			tlv->max = range->max;
+		if (i == 0 || range->min_cdb / 100.0f < tlv->min_db)
+			tlv->min_db = range->min_cdb / 100.0f;
+	}
+
+	return 0;
+}
+
+static inline float ctl_tlv_linear_to_db(const struct ctl_tlv_range *range,
+					 int32_t raw)
+{
+	double low, high, val;
+
+	if (raw <= range->min || range->max <= range->min) {
+		if (range->mute)
+			return -INFINITY;
+		return range->min_cdb / 100.0f;
+	}
+	if (raw >= range->max)
+		return range->max_cdb / 100.0f;
+
+	low = range->mute ? 0.0 : pow(10.0, range->min_cdb / 2000.0);
+	high = pow(10.0, range->max_cdb / 2000.0);
+	val = low + (high - low) * ((double)raw - range->min) /
+				   ((double)range->max - range->min);
+	return 20.0 * log10(val);
+}
+
+static inline int32_t ctl_tlv_linear_from_db(const struct ctl_tlv_range *range,
+					     float db)
+{
+	double low, high, val;
+
+	if (!(db > range->min_cdb / 100.0f) || range->max <= range->min)
+		return range->min;
+	if (db >= range->max_cdb / 100.0f)
+		return range->max;
+
+	low = range->mute ? 0.0 : pow(10.0, range->min_cdb / 2000.0);
+	high = pow(10.0, range->max_cdb / 2000.0);
+	val = (pow(10.0, db / 20.0) - low) / (high - low);
+	return range->min + (int32_t)lrint(val * ((double)range->max -
+						  range->min));
+}
+
+/* The first range which covers the raw value, or NULL. */
+static inline const struct ctl_tlv_range *ctl_tlv_find_raw(
+					const struct ctl_tlv *tlv, int32_t raw)
+{
+	unsigned int i;
+
+	for (i = 0; i < tlv->range_count; ++i) {
+		if (raw >= tlv->ranges[i].min && raw <= tlv->ranges[i].max)
+			return &tlv->ranges[i];
+	}
+
+	return NULL;
+}
+
+static inline bool ctl_tlv_range_covers_db(const struct ctl_tlv_range *range,
+					   float db)
+{
+	return (range->mute || db >= range->min_cdb / 100.0f) &&
+	       db <= range->max_cdb / 100.0f;
+}
+
+/* The first range which covers the dB value, or NULL. */
+static inline const struct ctl_tlv_range *ctl_tlv_find_db(
+					const struct ctl_tlv *tlv, float db)
+{
+	unsigned int i;
+
+	for (i = 0; i < tlv->range_count; ++i) {
+		if (ctl_tlv_range_covers_db(&tlv->ranges[i], db))
+			return &tlv->ranges[i];
+	}
+
+	return NULL;
+}
+
+/* NAN for the raw value out of all ranges, -INFINITY for mute. */
+static inline float ctl_tlv_to_db_value(const struct ctl_tlv *tlv,
+					int32_t raw)
+{
+	const struct ctl_tlv_range *range = ctl_tlv_find_raw(tlv, raw);
+
+	if (range == NULL)
+		return NAN;
+	if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+		return ctl_tlv_linear_to_db(range, raw);
+	if (range->mute && raw == range->min)
+		return -INFINITY;
+	return range->offset + range->slope * (float)raw;
+}
+
+/* The nearest raw value; out of all ranges, the minimum or the maximum. */
+static inline int32_t ctl_tlv_from_db_value(const struct ctl_tlv *tlv,
+					    float db)
+{
+	const struct ctl_tlv_range *range = ctl_tlv_find_db(tlv, db);
+	float x;
+
+	if (range == NULL)
+		return db < tlv->min_db ? tlv->min : tlv->max;
+	if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+		return ctl_tlv_linear_from_db(range, db);
+
+	/* In the same way as MAXPS and MINPS, which take the bound for NaN. */
+	x = (db - range->offset) * range->inverse;
+	x = x > (float)range->min ? x : (float)range->min;
+	x = x < (float)range->max ? x : (float)range->max;
+	return (int32_t)lrintf(x);
+}
+
+static inline void ctl_tlv_to_db_scalar(const struct ctl_tlv *tlv,
+					const int32_t *raw, float *db,
+					size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		db[i] = ctl_tlv_to_db_value(tlv, raw[i]);
+}
+
+static inline void ctl_tlv_from_db_scalar(const struct ctl_tlv *tlv,
+					  const float *db, int32_t *raw,
+					  size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		raw[i] = ctl_tlv_from_db_value(tlv, db[i]);
+}
+
+/* The values of which first range is linear volume, left by vector code. */
+static inline void ctl_tlv_fix_linear(const struct ctl_tlv *tlv,
+				      const int32_t *raw, float *db,
+				      size_t count)
+{
+	const struct ctl_tlv_range *range;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		range = ctl_tlv_find_raw(tlv, raw[i]);
+		if (range != NULL && range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+			db[i] = ctl_tlv_linear_to_db(range, raw[i]);
+	}
+}
+
+static inline void ctl_tlv_fix_linear_inverse(const struct ctl_tlv *tlv,
+					      const float *db, int32_t *raw,
+					      size_t count)
+{
+	const struct ctl_tlv_range *range;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		range = ctl_tlv_find_db(tlv, db[i]);
+		if (range != NULL && range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+			raw[i] = ctl_tlv_linear_from_db(range, db[i]);
+	}
+}
+
+#ifdef SAMPLE_CONVERSION_X86
+
+__attribute__((target("sse2")))
+static inline __m128 ctl_tlv_blend_sse2(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+__attribute__((target("sse2")))
+static inline size_t ctl_tlv_to_db_sse2(const struct ctl_tlv *tlv,
+					const int32_t *raw, float *db,
+					size_t count)
+{
+	const struct ctl_tlv_range *range;
+	__m128i v, low, high;
+	__m128 f, done, in, val, result;
+	unsigned int r;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(raw + i));
+		f = _mm_cvtepi32_ps(v);
+		result = _mm_set1_ps(NAN);
+		done = _mm_setzero_ps();
+
+		/* The first range which covers the value wins. */
+		for (r = 0; r < tlv->range_count; ++r) {
+			range = &tlv->ranges[r];
+			low = _mm_set1_epi32(range->min);
+			high = _mm_set1_epi32(range->max);
+			in = _mm_castsi128_ps(_mm_andnot_si128(
+					_mm_or_si128(_mm_cmplt_epi32(v, low),
+						     _mm_cmpgt_epi32(v, high)),
+					_mm_set1_epi32(-1)));
+			in = _mm_andnot_ps(done, in);
+			done = _mm_or_ps(done, in);
+			if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+				continue;
+
+			val = _mm_mul_ps(_mm_set1_ps(range->slope), f);
+			val = _mm_add_ps(_mm_set1_ps(range->offset), val);
+			if (range->mute)
+				val = ctl_tlv_blend_sse2(
+					_mm_castsi128_ps(
+						_mm_cmpeq_epi32(v, low)),
+					_mm_set1_ps(-INFINITY), val);
+			result = ctl_tlv_blend_sse2(in, val, result);
+		}
+
+		_mm_storeu_ps(db + i, result);
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static inline size_t ctl_tlv_from_db_sse2(const struct ctl_tlv *tlv,
+					  const float *db, int32_t *raw,
+					  size_t count)
+{
+	const struct ctl_tlv_range *range;
+	__m128 d, done, in, x, result;
+	unsigned int r;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = _mm_loadu_ps(db + i);
+		/* Out of all ranges. */
+		result = ctl_tlv_blend_sse2(
+				_mm_cmplt_ps(d, _mm_set1_ps(tlv->min_db)),
+				_mm_set1_ps((float)tlv->min),
+				_mm_set1_ps((float)tlv->max));
+		done = _mm_setzero_ps();
+
+		for (r = 0; r < tlv->range_count; ++r) {
+			range = &tlv->ranges[r];
+			in = _mm_cmple_ps(d,
+					  _mm_set1_ps(range->max_cdb / 100.0f));
+			if (!range->mute)
+				in = _mm_and_ps(in, _mm_cmpge_ps(d,
+					_mm_set1_ps(range->min_cdb / 100.0f)));
+			in = _mm_andnot_ps(done, in);
+			done = _mm_or_ps(done, in);
+			if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+				continue;
+
+			x = _mm_sub_ps(d, _mm_set1_ps(range->offset));
+			x = _mm_mul_ps(x, _mm_set1_ps(range->inverse));
+			x = _mm_max_ps(x, _mm_set1_ps((float)range->min));
+			x = _mm_min_ps(x, _mm_set1_ps((float)range->max));
+			result = ctl_tlv_blend_sse2(in, x, result);
+		}
+
+		_mm_storeu_si128((__m128i *)(raw + i), _mm_cvtps_epi32(result));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t ctl_tlv_to_db_avx2(const struct ctl_tlv *tlv,
+					const int32_t *raw, float *db,
+					size_t count)
+{
+	const struct ctl_tlv_range *range;
+	__m256i v, low, high, out;
+	__m256 f, done, in, val, result;
+	unsigned int r;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(raw + i));
+		f = _mm256_cvtepi32_ps(v);
+		result = _mm256_set1_ps(NAN);
+		done = _mm256_setzero_ps();
+
+		for (r = 0; r < tlv->range_count; ++r) {
+			range = &tlv->ranges[r];
+			low = _mm256_set1_epi32(range->min);
+			high = _mm256_set1_epi32(range->max);
+			out = _mm256_or_si256(_mm256_cmpgt_epi32(low, v),
+					      _mm256_cmpgt_epi32(v, high));
+			in = _mm256_andnot_ps(_mm256_castsi256_ps(out),
+					_mm256_castsi256_ps(
+						_mm256_set1_epi32(-1)));
+			in = _mm256_andnot_ps(done, in);
+			done = _mm256_or_ps(done, in);
+			if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+				continue;
+
+			val = _mm256_mul_ps(_mm256_set1_ps(range->slope), f);
+			val = _mm256_add_ps(_mm256_set1_ps(range->offset), val);
+			if (range->mute)
+				val = _mm256_blendv_ps(val,
+					_mm256_set1_ps(-INFINITY),
+					_mm256_castsi256_ps(
+						_mm256_cmpeq_epi32(v, low)));
+			result = _mm256_blendv_ps(result, val, in);
+		}
+
+		_mm256_storeu_ps(db + i, result);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t ctl_tlv_from_db_avx2(const struct ctl_tlv *tlv,
+					  const float *db, int32_t *raw,
+					  size_t count)
+{
+	const struct ctl_tlv_range *range;
+	__m256 d, done, in, x, result;
+	unsigned int r;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		d = _mm256_loadu_ps(db + i);
+		result = _mm256_blendv_ps(_mm256_set1_ps((float)tlv->max),
+				_mm256_set1_ps((float)tlv->min),
+				_mm256_cmp_ps(d, _mm256_set1_ps(tlv->min_db),
+					      _CMP_LT_OQ));
+		done = _mm256_setzero_ps();
+
+		for (r = 0; r < tlv->range_count; ++r) {
+			range = &tlv->ranges[r];
+			in = _mm256_cmp_ps(d,
+					_mm256_set1_ps(range->max_cdb / 100.0f),
+					_CMP_LE_OQ);
+			if (!range->mute)
+				in = _mm256_and_ps(in, _mm256_cmp_ps(d,
+					_mm256_set1_ps(range->min_cdb / 100.0f),
+					_CMP_GE_OQ));
+			in = _mm256_andnot_ps(done, in);
+			done = _mm256_or_ps(done, in);
+			if (range->type == SNDRV_CTL_TLVT_DB_LINEAR)
+				continue;
+
+			x = _mm256_mul_ps(_mm256_sub_ps(d,
+						_mm256_set1_ps(range->offset)),
+					  _mm256_set1_ps(range->inverse));
+			x = _mm256_max_ps(x, _mm256_set1_ps((float)range->min));
+			x = _mm256_min_ps(x, _mm256_set1_ps((float)range->max));
+			result = _mm256_blendv_ps(result, x, in);
+		}
+
+		_mm256_storeu_si256((__m256i *)(raw + i),
+				    _mm256_cvtps_epi32(result));
+	}
+
+	return i;
+}
+
+#endif
+
+/* dB for each raw value; NAN out of all ranges, -INFINITY for mute. */
+static inline int ctl_tlv_to_db_impl(enum sample_impl impl,
+				     const struct ctl_tlv *tlv,
+				     const int32_t *raw, float *db,
+				     size_t count)
+{
+	size_t done = 0;
+
+	if (!sample_impl_available(impl))
+		return -ENOTSUP;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (impl == SAMPLE_IMPL_AVX2)
+		done = ctl_tlv_to_db_avx2(tlv, raw, db, count);
+	else if (impl == SAMPLE_IMPL_SSE2)
+		done = ctl_tlv_to_db_sse2(tlv, raw, db, count);
+	if (done > 0 && tlv->has_linear)
+		ctl_tlv_fix_linear(tlv, raw, db, done);
+#endif
+
+	/* The rest. */
+	ctl_tlv_to_db_scalar(tlv, raw + done, db + done, count - done);
+
+	return 0;
+}
+
+/* The nearest raw value for each dB. */
+static inline int ctl_tlv_from_db_impl(enum sample_impl impl,
+				       const struct ctl_tlv *tlv,
+				       const float *db, int32_t *raw,
+				       size_t count)
+{
+	size_t done = 0;
+
+	if (!sample_impl_available(impl))
+		return -ENOTSUP;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (impl == SAMPLE_IMPL_AVX2)
+		done = ctl_tlv_from_db_avx2(tlv, db, raw, count);
+	else if (impl == SAMPLE_IMPL_SSE2)
+		done = ctl_tlv_from_db_sse2(tlv, db, raw, count);
+	if (done > 0 && tlv->has_linear)
+		ctl_tlv_fix_linear_inverse(tlv, db, raw, done);
+#endif
+
+	/* The rest. */
+	ctl_tlv_from_db_scalar(tlv, db + done, raw + done, count - done);
+
+	return 0;
+}
+
+static inline int ctl_tlv_to_db(const struct ctl_tlv *tlv, const int32_t *raw,
+				float *db, size_t count)
+{
+	return ctl_tlv_to_db_impl(sample_best_impl(), tlv, raw, db, count);
+}
+
+static inline int ctl_tlv_from_db(const struct ctl_tlv *tlv, const float *db,
+				  int32_t *raw, size_t count)
+{
+	return ctl_tlv_from_db_impl(sample_best_impl(), tlv, db, raw, count);
+}
+
+#endif
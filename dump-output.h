@@ -0,0 +1,486 @@
+/*
+ * dump-output.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * The output layer shared by the dump programs. The programs emit a sequence
+ * of records, each of which is an object with fields of string, integer,
+ * boolean, nested object and list of scalar values. The records are rendered
+ * into one of the backends below and written by write(2) in bulk.
+ *
+ * human:  indented text of 'key: value' lines.
+ * json:   one JSON object per line, which has the name of record as key.
+ * binary: length-prefixed records in little endian:
+ *           type (u8), length of key (u8), key, length of payload (u32),
+ *           payload
+ *         The payload of object or list is the sequence of records for its
+ *         members, of which the key is empty in list. The payload of string
+ *         is the bytes without terminator, of integer is s64, of boolean is
+ *         u8.
+ *
+ * With negative file descriptor, the records are kept in the buffer till
+ * they are merged into the other output of the same format, e.g. to write
+ * the records built by threads in a fixed order.
+ */
+
+#ifndef DUMP_OUTPUT_H
+#define DUMP_OUTPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define DUMP_OUTPUT_MAX_DEPTH	16
+/* Written out once the records in buffer exceed it. */
+#define DUMP_OUTPUT_FLUSH_BYTES	65536
+/* The column of values in human backend. */
+#define DUMP_OUTPUT_HUMAN_COLUMN	24
+
+enum dump_output_format {
+	DUMP_OUTPUT_HUMAN = 0,
+	DUMP_OUTPUT_JSON,
+	DUMP_OUTPUT_BINARY,
+	DUMP_OUTPUT_FORMAT_COUNT,
+};
+
+static const char *const dump_output_format_labels[] = {
+	[DUMP_OUTPUT_HUMAN]	= "human",
+	[DUMP_OUTPUT_JSON]	= "json",
+	[DUMP_OUTPUT_BINARY]	= "binary",
+};
+
+enum dump_output_type {
+	DUMP_OUTPUT_TYPE_OBJECT = 1,
+	DUMP_OUTPUT_TYPE_LIST,
+	DUMP_OUTPUT_TYPE_STRING,
+	DUMP_OUTPUT_TYPE_INTEGER,
+	DUMP_OUTPUT_TYPE_BOOLEAN,
+};
+
+struct dump_output {
+	enum dump_output_format format;
+	int fd;
+
+	char *buf;
+	size_t len;
+	size_t size;
+
+	/* The containers currently opened. */
+	unsigned int depth;
+	bool lists[DUMP_OUTPUT_MAX_DEPTH];
+	unsigned int members[DUMP_OUTPUT_MAX_DEPTH];
+	/* The offset of the length field of the container in binary. */
+	size_t offsets[DUMP_OUTPUT_MAX_DEPTH];
+
+	/* The first error is kept till dump_output_fini(). */
+	int err;
+};
+
+static inline int dump_output_parse_format(const char *label)
+{
+	int i;
+
+	for (i = 0; i < DUMP_OUTPUT_FORMAT_COUNT; ++i) {
+		if (strcmp(label, dump_output_format_labels[i]) == 0)
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+static inline void dump_output_init(struct dump_output *out,
+				    enum dump_output_format format, int fd)
+{
+	memset(out, 0, sizeof(*out));
+	out->format = format;
+	out->fd = fd;
+}
+
+static inline char *dump_output_reserve(struct dump_output *out, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (out->err < 0)
+		return NULL;
+
+	if (out->len + len > out->size) {
+		size = out->size > 0 ? out->size : DUMP_OUTPUT_FLUSH_BYTES;
+		while (size < out->len + len)
+			size *= 2;
+		buf = realloc(out->buf, size);
+		if (buf == NULL) {
+			out->err = -ENOMEM;
+			return NULL;
+		}
+		out->buf = buf;
+		out->size = size;
+	}
+
+	buf = out->buf + out->len;
+	out->len += len;
+	return buf;
+}
+
+static inline void dump_output_append(struct dump_output *out,
+				      const void *data, size_t len)
+{
+	char *buf;
+
+	if (len == 0)
+		return;
+	buf = dump_output_reserve(out, len);
+	if (buf != NULL)
+		memcpy(buf, data, len);
+}
+
+static inline void dump_output_printf(struct dump_output *out,
+				      const char *fmt, ...)
+{
+	char text[64];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+
+	if (len > 0)
+		dump_output_append(out, text, len < sizeof(text) ? len :
+						sizeof(text) - 1);
+}
+
+static inline void dump_output_spaces(struct dump_output *out,
+				      unsigned int count)
+{
+	char *buf = dump_output_reserve(out, count);
+
+	if (buf != NULL)
+		memset(buf, ' ', count);
+}
+
+static inline void dump_output_put_le(struct dump_output *out, uint64_t val,
+				      unsigned int bytes)
+{
+	unsigned char *buf = (unsigned char *)dump_output_reserve(out, bytes);
+	unsigned int i;
+
+	if (buf == NULL)
+		return;
+	for (i = 0; i < bytes; ++i)
+		buf[i] = val >> (8 * i);
+}
+
+static inline void dump_output_json_string(struct dump_output *out,
+					   const char *str)
+{
+	const unsigned char *c;
+
+	dump_output_append(out, "\"", 1);
+	for (c = (const unsigned char *)str; *c != '\0'; ++c) {
+		if (*c == '"' || *c == '\\') {
+			dump_output_append(out, "\\", 1);
+			dump_output_append(out, c, 1);
+		} else if (*c < 0x20) {
+			dump_output_printf(out, "\\u%04x", *c);
+		} else {
+			dump_output_append(out, c, 1);
+		}
+	}
+	dump_output_append(out, "\"", 1);
+}
+
+static inline int dump_output_flush(struct dump_output *out)
+{
+	size_t done = 0;
+	ssize_t len;
+
+	if (out->fd < 0)
+		return out->err;
+
+	while (out->err == 0 && done < out->len) {
+		len = write(out->fd, out->buf + done, out->len - done);
+		if (len < 0) {
+			if (errno != EINTR)
+				out->err = -errno;
+			continue;
+		}
+		done += len;
+	}
+	out->len = 0;
+
+	return out->err;
+}
+
+/*
+ * Begin a member with its key; the payload of binary record follows the
+ * returned offset of length field.
+ */
+static inline size_t dump_output_member(struct dump_output *out,
+					const char *key,
+					enum dump_output_type type)
+{
+	bool in_list = out->depth > 0 && out->lists[out->depth - 1];
+	unsigned int index = out->depth > 0 ? out->members[out->depth - 1] : 0;
+	size_t key_len = in_list || key == NULL ? 0 : strlen(key);
+	unsigned int indent, width;
+	size_t offset = 0;
+
+	if (out->depth > 0)
+		++out->members[out->depth - 1];
+
+	switch (out->format) {
+	case DUMP_OUTPUT_HUMAN:
+		/* The members of list are in the same line. */
+		if (in_list) {
+			if (index > 0)
+				dump_output_append(out, ", ", 2);
+			break;
+		}
+		indent = out->depth * 2;
+		dump_output_spaces(out, indent);
+		dump_output_append(out, key, key_len);
+		dump_output_append(out, ":", 1);
+		if (type == DUMP_OUTPUT_TYPE_OBJECT) {
+			dump_output_append(out, "\n", 1);
+			break;
+		}
+		width = indent + key_len + 1;
+		dump_output_spaces(out, width < DUMP_OUTPUT_HUMAN_COLUMN ?
+					DUMP_OUTPUT_HUMAN_COLUMN - width : 1);
+		break;
+	case DUMP_OUTPUT_JSON:
+		if (out->depth == 0)
+			dump_output_append(out, "{", 1);
+		else if (index > 0)
+			dump_output_append(out, ",", 1);
+		if (!in_list) {
+			dump_output_json_string(out, key);
+			dump_output_append(out, ":", 1);
+		}
+		break;
+	case DUMP_OUTPUT_BINARY:
+		if (key_len > UINT8_MAX)
+			key_len = UINT8_MAX;
+		dump_output_put_le(out, type, 1);
+		dump_output_put_le(out, key_len, 1);
+		dump_output_append(out, key, key_len);
+		offset = out->len;
+		dump_output_put_le(out, 0, 4);
+		break;
+	default:
+		break;
+	}
+
+	return offset;
+}
+
+/* Fill the length field of binary record. */
+static inline void dump_output_patch(struct dump_output *out, size_t offset)
+{
+	uint32_t len = out->len - offset - 4;
+	unsigned int i;
+
+	if (out->err < 0 || out->format != DUMP_OUTPUT_BINARY)
+		return;
+	for (i = 0; i < 4; ++i)
+		out->buf[offset + i] = len >> (8 * i);
+}
+
+static inline void dump_output_open(struct dump_output *out, const char *key,
+				    bool list)
+{
+	size_t offset;
+
+	if (out->depth >= DUMP_OUTPUT_MAX_DEPTH) {
+		out->err = -E2BIG;
+		return;
+	}
+
+	offset = dump_output_member(out, key, list ? DUMP_OUTPUT_TYPE_LIST :
+						     DUMP_OUTPUT_TYPE_OBJECT);
+	if (out->format == DUMP_OUTPUT_JSON)
+		dump_output_append(out, list ? "[" : "{", 1);
+
+	out->lists[out->depth] = list;
+	out->members[out->depth] = 0;
+	out->offsets[out->depth] = offset;
+	++out->depth;
+}
+
+/* The record at top level is an object. */
+static inline void dump_output_begin(struct dump_output *out, const char *key)
+{
+	dump_output_open(out, key, false);
+}
+
+/* The members of list are scalar values. */
+static inline void dump_output_begin_list(struct dump_output *out,
+					  const char *key)
+{
+	dump_output_open(out, key, true);
+}
+
+static inline void dump_output_end(struct dump_output *out)
+{
+	bool list;
+
+	if (out->depth == 0)
+		return;
+	--out->depth;
+	list = out->lists[out->depth];
+
+	switch (out->format) {
+	case DUMP_OUTPUT_HUMAN:
+		if (list)
+			dump_output_append(out, "\n", 1);
+		break;
+	case DUMP_OUTPUT_JSON:
+		dump_output_append(out, list ? "]" : "}", 1);
+		if (out->depth == 0)
+			dump_output_append(out, "}\n", 2);
+		break;
+	case DUMP_OUTPUT_BINARY:
+		dump_output_patch(out, out->offsets[out->depth]);
+		break;
+	default:
+		break;
+	}
+
+	if (out->depth == 0 && out->len >= DUMP_OUTPUT_FLUSH_BYTES)
+		dump_output_flush(out);
+}
+
+static inline void dump_output_text(struct dump_output *out, const char *key,
+				    const char *value, bool quote)
+{
+	bool in_list = out->depth > 0 && out->lists[out->depth - 1];
+	size_t offset;
+
+	if (value == NULL)
+		value = "";
+
+	offset = dump_output_member(out, key, DUMP_OUTPUT_TYPE_STRING);
+	switch (out->format) {
+	case DUMP_OUTPUT_HUMAN:
+		if (quote)
+			dump_output_append(out, "'", 1);
+		dump_output_append(out, value, strlen(value));
+		if (quote)
+			dump_output_append(out, "'", 1);
+		if (!in_list)
+			dump_output_append(out, "\n", 1);
+		break;
+	case DUMP_OUTPUT_JSON:
+		dump_output_json_string(out, value);
+		break;
+	case DUMP_OUTPUT_BINARY:
+		dump_output_append(out, value, strlen(value));
+		dump_output_patch(out, offset);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The string given by the kernel or user; quoted in human backend. */
+static inline void dump_output_string(struct dump_output *out,
+				      const char *key, const char *value)
+{
+	dump_output_text(out, key, value, true);
+}
+
+/* The name of constant. */
+static inline void dump_output_label(struct dump_output *out, const char *key,
+				     const char *label)
+{
+	dump_output_text(out, key, label, false);
+}
+
+static inline void dump_output_int(struct dump_output *out, const char *key,
+				   int64_t value)
+{
+	bool in_list = out->depth > 0 && out->lists[out->depth - 1];
+	size_t offset;
+
+	offset = dump_output_member(out, key, DUMP_OUTPUT_TYPE_INTEGER);
+	if (out->format == DUMP_OUTPUT_BINARY) {
+		dump_output_put_le(out, value, 8);
+		dump_output_patch(out, offset);
+		return;
+	}
+
+	dump_output_printf(out, "%lld", (long long)value);
+	if (out->format == DUMP_OUTPUT_HUMAN && !in_list)
+		dump_output_append(out, "\n", 1);
+}
+
+static inline void dump_output_bool(struct dump_output *out, const char *key,
+				    bool value)
+{
+	bool in_list = out->depth > 0 && out->lists[out->depth - 1];
+	size_t offset;
+
+	offset = dump_output_member(out, key, DUMP_OUTPUT_TYPE_BOOLEAN);
+	switch (out->format) {
+	case DUMP_OUTPUT_HUMAN:
+		dump_output_printf(out, "%s%s", value ? "yes" : "no",
+				   in_list ? "" : "\n");
+		break;
+	case DUMP_OUTPUT_JSON:
+		dump_output_printf(out, "%s", value ? "true" : "false");
+		break;
+	case DUMP_OUTPUT_BINARY:
+		dump_output_put_le(out, value, 1);
+		dump_output_patch(out, offset);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Move the whole records in the buffered output to the end of the other. */
+static inline int dump_output_merge(struct dump_output *out,
+				    struct dump_output *part)
+{
+	char *buf;
+
+	while (part->depth > 0)
+		dump_output_end(part);
+	if (part->err < 0 && out->err == 0)
+		out->err = part->err;
+
+	if (out->depth == 0 && part->len > 0) {
+		buf = dump_output_reserve(out, part->len);
+		if (buf != NULL)
+			memcpy(buf, part->buf, part->len);
+		if (out->len >= DUMP_OUTPUT_FLUSH_BYTES)
+			dump_output_flush(out);
+	}
+	part->len = 0;
+
+	return out->err;
+}
+
+/* Write the rest, then release the buffer. Returns the first error. */
+static inline int dump_output_fini(struct dump_output *out)
+{
+	int err;
+
+	while (out->depth > 0)
+		dump_output_end(out);
+	err = dump_output_flush(out);
+	free(out->buf);
+	out->buf = NULL;
+	out->size = 0;
+
+	return err;
+}
+
+#endif
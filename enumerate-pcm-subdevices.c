@@ -6,6 +6,9 @@
  * Licensed under the terms of the GNU General Public License, version 3.
  */
 
+/* For CPU affinity of threads. */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -21,9 +24,90 @@
 #include <sys/ioctl.h>
 
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sound/asound.h>
 
+#include "latency.h"
+#include "pcm-stream.h"
+#include "pcm-cache.h"
+#include "dump-output.h"
+
+/* Samples of latency to keep for each substream in each step. */
+#define MAX_LATENCY_SAMPLES     65536
+/* For the operations which occur at start and at XRUN. */
+#define MAX_RARE_SAMPLES        1024
+
+enum stress_ioctl {
+    STRESS_IOCTL_PREPARE = 0,
+    STRESS_IOCTL_START,
+    STRESS_IOCTL_WRITEI_FRAMES,
+    STRESS_IOCTL_READI_FRAMES,
+    STRESS_IOCTL_STATUS,
+    STRESS_IOCTL_DROP,
+    STRESS_IOCTL_COUNT,
+};
+
+static const char *const stress_ioctl_labels[] = {
+    [STRESS_IOCTL_PREPARE]          = "SNDRV_PCM_IOCTL_PREPARE",
+    [STRESS_IOCTL_START]            = "SNDRV_PCM_IOCTL_START",
+    [STRESS_IOCTL_WRITEI_FRAMES]    = "SNDRV_PCM_IOCTL_WRITEI_FRAMES",
+    [STRESS_IOCTL_READI_FRAMES]     = "SNDRV_PCM_IOCTL_READI_FRAMES",
+    [STRESS_IOCTL_STATUS]           = "SNDRV_PCM_IOCTL_STATUS",
+    [STRESS_IOCTL_DROP]             = "SNDRV_PCM_IOCTL_DROP",
+};
+
+static const unsigned int stress_ioctl_samples[] = {
+    [STRESS_IOCTL_PREPARE]          = MAX_RARE_SAMPLES,
+    [STRESS_IOCTL_START]            = MAX_RARE_SAMPLES,
+    [STRESS_IOCTL_WRITEI_FRAMES]    = MAX_LATENCY_SAMPLES,
+    [STRESS_IOCTL_READI_FRAMES]     = MAX_LATENCY_SAMPLES,
+    [STRESS_IOCTL_STATUS]           = MAX_LATENCY_SAMPLES,
+    [STRESS_IOCTL_DROP]             = MAX_RARE_SAMPLES,
+};
+
+/* The threads start at once. */
+struct stress_gate {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool go;
+    /* Some threads failed to start; the others quit. */
+    bool cancel;
+};
+
+struct substream {
+    int card;
+    int device;
+    int subdevice;
+    int direction;
+    struct pcm_stream stream;
+    void *buf;
+
+    unsigned int cpu;
+    unsigned int seconds;
+    struct stress_gate *gate;
+
+    unsigned long long frames;
+    unsigned long xruns;
+    struct latency_record latency[STRESS_IOCTL_COUNT];
+    int err;
+};
+
+struct substream_list {
+    struct substream *entries;
+    unsigned int count;
+};
+
+/* The results of PCM_INFO to be stored into the cache. */
+struct cache_list {
+    struct pcm_cache_key key;
+    struct pcm_cache_entry *entries;
+    unsigned int count;
+    /* The partial list is not stored. */
+    int err;
+};
+
 static const char *const class_labels[] = {
     [SNDRV_PCM_CLASS_GENERIC]   = "generic",
     [SNDRV_PCM_CLASS_MULTI]     = "multi",
@@ -39,16 +123,82 @@ static const char *const direction_labels[] = {
     [SNDRV_PCM_STREAM_CAPTURE]  = "capture"
 };
 
-static void dump_pcm_info(const struct snd_pcm_info *info)
+static void dump_pcm_info(struct dump_output *out,
+                          const struct snd_pcm_info *info)
 {
-    printf("        id:             %s\n", info->id);
-    printf("        name:           %s\n", info->name);
-    printf("        subname:        %s\n", info->subname);
-    printf("        dev_class:      %s\n", class_labels[info->dev_class]);
-    printf("        dev_subclass:   %s\n", subclass_labels[info->dev_subclass]);
+    dump_output_string(out, "id", (const char *)info->id);
+    dump_output_string(out, "name", (const char *)info->name);
+    dump_output_string(out, "subname", (const char *)info->subname);
+    dump_output_label(out, "dev_class", class_labels[info->dev_class]);
+    dump_output_label(out, "dev_subclass",
+                      subclass_labels[info->dev_subclass]);
 }
 
-static int enumerate_pcm_subdevices(int fd, int card, int device)
+static int add_substream(struct substream_list *list, int card, int device,
+                         int subdevice, int direction)
+{
+    struct substream *entries;
+
+    entries = realloc(list->entries, sizeof(*entries) * (list->count + 1));
+    if (entries == NULL)
+        return -ENOMEM;
+    list->entries = entries;
+
+    memset(&entries[list->count], 0, sizeof(*entries));
+    entries[list->count].card = card;
+    entries[list->count].device = device;
+    entries[list->count].subdevice = subdevice;
+    entries[list->count].direction = direction;
+    entries[list->count].stream.fd = -1;
+    ++list->count;
+
+    return 0;
+}
+
+static int add_cache_entry(struct cache_list *cached,
+                           const struct snd_pcm_info *info)
+{
+    struct pcm_cache_entry *entries;
+    int err;
+
+    entries = realloc(cached->entries, sizeof(*entries) * (cached->count + 1));
+    if (entries == NULL)
+        return -ENOMEM;
+    cached->entries = entries;
+
+    err = pcm_cache_init_entry(&entries[cached->count], &cached->key,
+                               info->card, info->device, info->subdevice,
+                               info->stream);
+    if (err < 0)
+        return err;
+    entries[cached->count].flags = PCM_CACHE_INFO | PCM_CACHE_LISTED;
+    entries[cached->count].info = *info;
+    ++cached->count;
+
+    return 0;
+}
+
+static void dump_substream(struct dump_output *out,
+                           const struct snd_pcm_info *info)
+{
+    char node[32];
+
+    snprintf(node, sizeof(node), "pcmC%dD%d%c", info->card, info->device,
+             info->stream == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
+
+    dump_output_begin(out, "substream");
+    dump_output_int(out, "device", info->device);
+    dump_output_label(out, "direction", direction_labels[info->stream]);
+    dump_output_string(out, "node", node);
+    dump_output_int(out, "subdevice", info->subdevice);
+    dump_pcm_info(out, info);
+    dump_output_end(out);
+}
+
+static int enumerate_pcm_subdevices(int fd, int card, int device,
+                                    struct dump_output *out,
+                                    struct substream_list *list,
+                                    struct cache_list *cached)
 {
     static const int dirs[SNDRV_PCM_STREAM_LAST + 1] = {
         [0] = SNDRV_PCM_STREAM_PLAYBACK,
@@ -69,21 +219,20 @@ static int enumerate_pcm_subdevices(int fd, int card, int device)
 
             if (ioctl(fd, SNDRV_CTL_IOCTL_PCM_INFO, &info) < 0) {
                 if (errno != ENOENT) {
-                    printf("ioctl(2) with PCM_INFO: %s\n", strerror(errno));
+                    fprintf(stderr, "ioctl(2) with PCM_INFO: %s\n",
+                            strerror(errno));
                     return -errno;
                 }
             } else {
-                if (subdevice == 0) {
-                    printf("    direction:          %s\n",
-                           direction_labels[dirs[i]]);
-                    printf("    node:               pcmC%dD%d%c\n",
-                           card, device,
-                           dirs[i] == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
-                }
+                dump_substream(out, &info);
 
-                printf("      subdevice:        %u\n", info.subdevice);
+                if (cached != NULL && cached->err == 0)
+                    cached->err = add_cache_entry(cached, &info);
 
-                dump_pcm_info(&info);
+                if (list != NULL &&
+                    add_substream(list, card, device, info.subdevice,
+                                  dirs[i]) < 0)
+                    return -ENOMEM;
             }
 
             if (++subdevice >= info.subdevices_count)
@@ -94,49 +243,445 @@ static int enumerate_pcm_subdevices(int fd, int card, int device)
     return 0;
 }
 
-static void enumerate_pcm_devices(int fd, int card)
+static void enumerate_pcm_devices(int fd, int card, struct dump_output *out,
+                                  struct substream_list *list,
+                                  struct cache_list *cached)
 {
     int device;
 
     device = -1;
     while (1) {
         if (ioctl(fd, SNDRV_CTL_IOCTL_PCM_NEXT_DEVICE, &device) < 0) {
-            printf("ioctl(2) with PCM_NEXT_DEVICE: %s\n", strerror(errno));
+            fprintf(stderr, "ioctl(2) with PCM_NEXT_DEVICE: %s\n",
+                    strerror(errno));
             return;
         }
         if (device < 0)
             break;
 
-        printf("  device:               %d\n", device);
-
-        enumerate_pcm_subdevices(fd, card, device);
+        enumerate_pcm_subdevices(fd, card, device, out, list, cached);
         ++device;
     }
 }
 
-static int dump_card_info(int fd, struct snd_ctl_card_info *info)
+static int dump_card_info(int fd, const char *path, struct dump_output *out,
+                          struct snd_ctl_card_info *info)
 {
     if (ioctl(fd, SNDRV_CTL_IOCTL_CARD_INFO, info) < 0) {
-        printf("ioctl(2) for card info: %s\n", strerror(errno));
+        fprintf(stderr, "ioctl(2) for card info: %s\n", strerror(errno));
         return -errno;
     }
 
-    printf("  card:                 %d\n", info->card);
-    printf("  id:                   %s\n", info->id);
-    printf("  driver:               %s\n", info->driver);
-    printf("  name:                 %s\n", info->name);
-    printf("  longname:             %s\n", info->longname);
-    printf("  mixername:            %s\n", info->mixername);
-    printf("  component:            %s\n", info->components);
+    dump_output_begin(out, "card");
+    dump_output_string(out, "path", path);
+    dump_output_int(out, "card", info->card);
+    dump_output_string(out, "id", (const char *)info->id);
+    dump_output_string(out, "driver", (const char *)info->driver);
+    dump_output_string(out, "name", (const char *)info->name);
+    dump_output_string(out, "longname", (const char *)info->longname);
+    dump_output_string(out, "mixername", (const char *)info->mixername);
+    dump_output_string(out, "component", (const char *)info->components);
+    dump_output_end(out);
 
     return 0;
 }
 
+/* The errno is kept for the caller. */
+static int timed_ioctl(struct substream *sub, enum stress_ioctl index,
+                       unsigned long command, void *arg)
+{
+    uint64_t begin;
+    int saved;
+    int err;
+
+    begin = latency_now();
+    err = ioctl(sub->stream.fd, command, arg);
+    saved = errno;
+    latency_record_push(&sub->latency[index], latency_now() - begin);
+    errno = saved;
+
+    return err;
+}
+
+static bool wait_gate(struct stress_gate *gate)
+{
+    bool go;
+
+    pthread_mutex_lock(&gate->lock);
+    while (!gate->go)
+        pthread_cond_wait(&gate->cond, &gate->lock);
+    go = !gate->cancel;
+    pthread_mutex_unlock(&gate->lock);
+
+    return go;
+}
+
+static void *drive_substream(void *arg)
+{
+    struct substream *sub = arg;
+    struct pcm_stream *stream = &sub->stream;
+    struct snd_xferi xferi = {0};
+    struct snd_pcm_status status;
+    enum stress_ioctl transfer;
+    unsigned long command;
+    uint64_t end;
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(sub->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    if (sub->direction == SNDRV_PCM_STREAM_PLAYBACK) {
+        command = SNDRV_PCM_IOCTL_WRITEI_FRAMES;
+        transfer = STRESS_IOCTL_WRITEI_FRAMES;
+    } else {
+        command = SNDRV_PCM_IOCTL_READI_FRAMES;
+        transfer = STRESS_IOCTL_READI_FRAMES;
+    }
+
+    if (timed_ioctl(sub, STRESS_IOCTL_PREPARE, SNDRV_PCM_IOCTL_PREPARE,
+                    NULL) < 0) {
+        sub->err = -errno;
+        return NULL;
+    }
+
+    /* Start all of substreams at the same time. */
+    if (!wait_gate(sub->gate))
+        return NULL;
+
+    if (sub->direction == SNDRV_PCM_STREAM_CAPTURE &&
+        timed_ioctl(sub, STRESS_IOCTL_START, SNDRV_PCM_IOCTL_START,
+                    NULL) < 0) {
+        sub->err = -errno;
+        return NULL;
+    }
+
+    end = latency_now() + (uint64_t)sub->seconds * 1000000000ull;
+    while (latency_now() < end) {
+        xferi.buf = sub->buf;
+        xferi.frames = stream->config.period_size;
+        if (timed_ioctl(sub, transfer, command, &xferi) < 0) {
+            if (errno != EPIPE) {
+                sub->err = -errno;
+                break;
+            }
+            ++sub->xruns;
+            if (timed_ioctl(sub, STRESS_IOCTL_PREPARE,
+                            SNDRV_PCM_IOCTL_PREPARE, NULL) < 0 ||
+                (sub->direction == SNDRV_PCM_STREAM_CAPTURE &&
+                 timed_ioctl(sub, STRESS_IOCTL_START,
+                             SNDRV_PCM_IOCTL_START, NULL) < 0)) {
+                sub->err = -errno;
+                break;
+            }
+            continue;
+        }
+        sub->frames += xferi.result;
+
+        /* It takes the same locks as the other operations. */
+        memset(&status, 0, sizeof(status));
+        timed_ioctl(sub, STRESS_IOCTL_STATUS, SNDRV_PCM_IOCTL_STATUS,
+                    &status);
+    }
+
+    timed_ioctl(sub, STRESS_IOCTL_DROP, SNDRV_PCM_IOCTL_DROP, NULL);
+
+    return NULL;
+}
+
+static int open_substream(int ctl_fd, struct substream *sub, bool prefer)
+{
+    struct pcm_stream_config config = {
+        .access = SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct snd_pcm_info info = {0};
+    char path[32];
+    int err;
+
+    /* It is valid for the thread which opens the PCM character device. */
+    if (prefer &&
+        ioctl(ctl_fd, SNDRV_CTL_IOCTL_PCM_PREFER_SUBDEVICE,
+              &sub->subdevice) < 0)
+        return -errno;
+
+    snprintf(path, sizeof(path), "/dev/snd/pcmC%dD%d%c",
+             sub->card, sub->device,
+             sub->direction == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
+
+    err = pcm_stream_open(&sub->stream, path, O_RDWR);
+    if (err < 0)
+        return err;
+
+    /* Without preference, the kernel picks any available one. */
+    if (ioctl(sub->stream.fd, SNDRV_PCM_IOCTL_INFO, &info) < 0)
+        return -errno;
+    sub->subdevice = info.subdevice;
+
+    err = pcm_stream_configure(&sub->stream, &config);
+    if (err < 0)
+        return err;
+
+    sub->buf = calloc(sub->stream.config.period_size,
+                      sub->stream.frame_bits / 8);
+    if (sub->buf == NULL)
+        return -ENOMEM;
+
+    return 0;
+}
+
+/* The samples are sorted in place. */
+static void dump_stress_latency(struct dump_output *out, unsigned int count,
+                                struct latency_record *rec)
+{
+    qsort(rec->samples, rec->count, sizeof(*rec->samples), latency_compare);
+
+    dump_output_begin(out, "stress-latency");
+    dump_output_int(out, "streams", count);
+    dump_output_label(out, "ioctl", rec->label);
+    dump_output_int(out, "count", rec->count);
+    dump_output_int(out, "min-ns", rec->samples[0]);
+    dump_output_int(out, "p50-ns", latency_percentile(rec, 500));
+    dump_output_int(out, "p99-ns", latency_percentile(rec, 990));
+    dump_output_int(out, "p99.9-ns", latency_percentile(rec, 999));
+    dump_output_int(out, "max-ns", rec->samples[rec->count - 1]);
+    dump_output_end(out);
+}
+
+static void run_stress_step(struct substream *subs, unsigned int count,
+                            unsigned int seconds, struct dump_output *out)
+{
+    struct stress_gate gate = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    struct latency_record merged;
+    const struct latency_record *rec;
+    pthread_t *threads;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long long frames = 0;
+    unsigned int i, j, k, started;
+    char node[32];
+    int err = 0;
+
+    threads = calloc(count, sizeof(*threads));
+    if (threads == NULL)
+        return;
+
+    for (started = 0; started < count; ++started) {
+        subs[started].cpu = started % (cpus > 0 ? cpus : 1);
+        subs[started].seconds = seconds;
+        subs[started].gate = &gate;
+        subs[started].frames = 0;
+        subs[started].xruns = 0;
+        for (k = 0; k < STRESS_IOCTL_COUNT; ++k)
+            subs[started].latency[k].count = 0;
+        subs[started].err = 0;
+        err = -pthread_create(&threads[started], NULL, drive_substream,
+                              &subs[started]);
+        if (err < 0)
+            break;
+    }
+
+    /* The threads started quit at once on failure. */
+    pthread_mutex_lock(&gate.lock);
+    gate.cancel = err < 0;
+    gate.go = true;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (err < 0) {
+        dump_output_begin(out, "stress");
+        dump_output_int(out, "streams", count);
+        dump_output_string(out, "error", strerror(-err));
+        dump_output_end(out);
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        frames += subs[i].frames;
+        snprintf(node, sizeof(node), "pcmC%dD%d%c", subs[i].card,
+                 subs[i].device,
+                 subs[i].direction == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
+
+        dump_output_begin(out, "stress-substream");
+        dump_output_int(out, "streams", count);
+        dump_output_string(out, "node", node);
+        dump_output_int(out, "subdevice", subs[i].subdevice);
+        dump_output_int(out, "frames-per-sec", subs[i].frames / seconds);
+        dump_output_int(out, "xruns", subs[i].xruns);
+        if (subs[i].err < 0)
+            dump_output_string(out, "error", strerror(-subs[i].err));
+        dump_output_end(out);
+    }
+
+    dump_output_begin(out, "stress");
+    dump_output_int(out, "streams", count);
+    dump_output_int(out, "frames-per-sec", frames / seconds);
+    dump_output_end(out);
+
+    for (k = 0; k < STRESS_IOCTL_COUNT; ++k) {
+        if (latency_record_init(&merged, stress_ioctl_labels[k],
+                                count * stress_ioctl_samples[k]) < 0)
+            return;
+        for (i = 0; i < count; ++i) {
+            rec = &subs[i].latency[k];
+            for (j = 0; j < rec->count; ++j)
+                latency_record_push(&merged, rec->samples[j]);
+        }
+        if (merged.count > 0)
+            dump_stress_latency(out, count, &merged);
+        latency_record_fini(&merged);
+    }
+}
+
+/*
+ * Open every available substream, then drive the first 1, 2, ... N of them
+ * concurrently, each from a thread pinned to a CPU.
+ */
+static int stress_substreams(int ctl_fd, struct substream_list *list,
+                             unsigned int seconds, bool prefer,
+                             struct dump_output *out)
+{
+    struct substream *subs;
+    unsigned int count = 0;
+    unsigned int i, k;
+    int err;
+
+    subs = calloc(list->count, sizeof(*subs));
+    if (subs == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < list->count; ++i) {
+        subs[count] = list->entries[i];
+        err = open_substream(ctl_fd, &subs[count], prefer);
+        if (err < 0) {
+            fprintf(stderr, "pcmC%dD%d%c sub %d is not available: %s\n",
+                    subs[count].card, subs[count].device,
+                    subs[count].direction == SNDRV_PCM_STREAM_CAPTURE ?
+                                                                'c' : 'p',
+                    subs[count].subdevice, strerror(-err));
+            pcm_stream_close(&subs[count].stream);
+            free(subs[count].buf);
+            continue;
+        }
+
+        for (k = 0; k < STRESS_IOCTL_COUNT; ++k) {
+            err = latency_record_init(&subs[count].latency[k],
+                                      stress_ioctl_labels[k],
+                                      stress_ioctl_samples[k]);
+            if (err < 0)
+                break;
+        }
+        if (err < 0) {
+            while (k > 0)
+                latency_record_fini(&subs[count].latency[--k]);
+            pcm_stream_close(&subs[count].stream);
+            free(subs[count].buf);
+            break;
+        }
+        ++count;
+    }
+
+    for (i = 1; i <= count; ++i)
+        run_stress_step(subs, i, seconds, out);
+
+    for (i = 0; i < count; ++i) {
+        for (k = 0; k < STRESS_IOCTL_COUNT; ++k)
+            latency_record_fini(&subs[i].latency[k]);
+        pcm_stream_close(&subs[i].stream);
+        free(subs[i].buf);
+    }
+    free(subs);
+
+    return 0;
+}
+
+/* In the order of enumeration. */
+static int compare_cache_entries(const void *a, const void *b)
+{
+    const struct pcm_cache_entry *const *l = a;
+    const struct pcm_cache_entry *const *r = b;
+
+    if ((*l)->device != (*r)->device)
+        return (*l)->device < (*r)->device ? -1 : 1;
+    if ((*l)->stream != (*r)->stream)
+        return (*l)->stream < (*r)->stream ? -1 : 1;
+    if ((*l)->subdevice != (*r)->subdevice)
+        return (*l)->subdevice < (*r)->subdevice ? -1 : 1;
+    return 0;
+}
+
+/*
+ * All of substreams in the card are dumped from the cache, or none of them
+ * when any entry is stale.
+ */
+static int enumerate_from_cache(const char *cache_path,
+                                const struct cache_list *cached, int card,
+                                struct dump_output *out)
+{
+    const struct pcm_cache_entry **entries;
+    const struct pcm_cache_entry *entry;
+    struct pcm_cache cache;
+    unsigned int i, count = 0;
+    int err;
+
+    err = pcm_cache_open(&cache, cache_path);
+    if (err < 0)
+        return err;
+
+    entries = calloc(cache.count > 0 ? cache.count : 1, sizeof(*entries));
+    if (entries == NULL) {
+        pcm_cache_close(&cache);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < cache.count; ++i) {
+        entry = &cache.entries[i];
+        if (memcmp(&entry->key, &cached->key, sizeof(entry->key)) ||
+            entry->card != card || !(entry->flags & PCM_CACHE_LISTED))
+            continue;
+        if (!pcm_cache_entry_fresh(entry)) {
+            count = 0;
+            break;
+        }
+        entries[count++] = entry;
+    }
+    if (count == 0) {
+        err = -ENOENT;
+        goto end;
+    }
+
+    qsort(entries, count, sizeof(*entries), compare_cache_entries);
+
+    for (i = 0; i < count; ++i)
+        dump_substream(out, &entries[i]->info);
+end:
+    free(entries);
+    pcm_cache_close(&cache);
+    return err;
+}
+
 int main(int argc, const char *const argv[])
 {
     const char *path;
+    const char *cache_path = NULL;
     struct snd_ctl_card_info info = {0};
+    struct substream_list list = {0};
+    struct cache_list cached = {0};
+    struct dump_output out;
+    int format = DUMP_OUTPUT_HUMAN;
+    unsigned int seconds = 0;
+    bool prefer = false;
+    int arg = 2;
     int fd;
+    int err;
 
     if (argc < 2) {
         printf("At least, one argument is required for control character "
@@ -145,16 +690,69 @@ int main(int argc, const char *const argv[])
     }
     path = argv[1];
 
+    if (argc > arg && dump_output_parse_format(argv[arg]) >= 0)
+        format = dump_output_parse_format(argv[arg++]);
+
+    if (argc > arg + 1 && strcmp(argv[arg], "stress") == 0) {
+        seconds = strtoul(argv[arg + 1], NULL, 10);
+        prefer = argc > arg + 2 && strcmp(argv[arg + 2], "prefer") == 0;
+    } else if (argc > arg + 1 && strcmp(argv[arg], "cache") == 0) {
+        cache_path = argv[arg + 1];
+    }
+    if (argc > arg && seconds == 0 && cache_path == NULL) {
+        printf("Usage: %s CONTROL-DEVICE [human|json|binary] "
+               "[stress SECONDS [prefer] | cache FILE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
     fd = open(path, O_RDONLY);
     if (fd < 0) {
         printf("open(2): %s\n", strerror(errno));
         return EXIT_FAILURE;
     }
 
-    printf("%s:\n", path);
-    dump_card_info(fd, &info);
+    dump_output_init(&out, format, STDOUT_FILENO);
+    dump_card_info(fd, path, &out, &info);
+
+    if (cache_path != NULL) {
+        /* The card information is still required for the key. */
+        err = pcm_cache_make_key(&info, &cached.key);
+        if (err < 0) {
+            fprintf(stderr, "uname(2): %s\n", strerror(-err));
+            dump_output_fini(&out);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+
+        if (enumerate_from_cache(cache_path, &cached, info.card, &out) == 0) {
+            dump_output_fini(&out);
+            close(fd);
+            return EXIT_SUCCESS;
+        }
+
+        enumerate_pcm_devices(fd, info.card, &out, NULL, &cached);
+
+        if (cached.err == 0 && cached.count > 0) {
+            err = pcm_cache_store(cache_path, cached.entries, cached.count);
+            if (err < 0)
+                fprintf(stderr, "Fail to store the cache: %s\n",
+                        strerror(-err));
+        }
+        free(cached.entries);
+
+        dump_output_fini(&out);
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+
+    enumerate_pcm_devices(fd, info.card, &out, seconds > 0 ? &list : NULL,
+                          NULL);
 
-    enumerate_pcm_devices(fd, info.card);
+    /* The report of stress follows in the same format. */
+    if (seconds > 0)
+        stress_substreams(fd, &list, seconds, prefer, &out);
+    free(list.entries);
+    dump_output_fini(&out);
 
     close(fd);
     return EXIT_SUCCESS;
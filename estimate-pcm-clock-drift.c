@@ -0,0 +1,307 @@
+/*
+ * estimate-pcm-clock-drift.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Sample audio_tstamp, tstamp and hw_ptr of a running PCM substream for each
+ * type of audio timestamp, fit linear regression online, and report the
+ * drift of audio clock against CLOCK_MONOTONIC in ppm with confidence
+ * interval, the residual and the cost of SNDRV_PCM_IOCTL_STATUS_EXT.
+ *
+ * Link with libm.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+
+/* Seconds between reports during the measurement. */
+#define REPORT_INTERVAL     10
+
+/* Online linear regression of clock offset (y) against system time (x). */
+struct regression {
+    const char *label;
+    unsigned int info_flag;
+    unsigned int type;
+    bool available;
+
+    int64_t x0;
+    int64_t y0;
+    uint64_t count;
+    double mean_x;
+    double mean_y;
+    double sxx;
+    double sxy;
+    double syy;
+
+    struct latency_record cost;
+    uint64_t invalid;
+};
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static void regression_add(struct regression *reg, int64_t x_ns, int64_t y_ns)
+{
+    double x, y, dx, dy;
+
+    if (reg->count == 0) {
+        reg->x0 = x_ns;
+        reg->y0 = y_ns;
+    }
+
+    /*
+     * In seconds from the first sample. The offset between both clocks is
+     * fitted instead of audio time itself, to keep precision of double.
+     */
+    x = (x_ns - reg->x0) / 1e9;
+    y = ((y_ns - reg->y0) - (x_ns - reg->x0)) / 1e9;
+
+    ++reg->count;
+    dx = x - reg->mean_x;
+    dy = y - reg->mean_y;
+    reg->mean_x += dx / reg->count;
+    reg->mean_y += dy / reg->count;
+    reg->sxx += dx * (x - reg->mean_x);
+    reg->sxy += dx * (y - reg->mean_y);
+    reg->syy += dy * (y - reg->mean_y);
+}
+
+static void regression_dump(const struct regression *reg)
+{
+    double slope, residual, stderr_slope;
+
+    if (!reg->available) {
+        printf("    %-16s unavailable\n", reg->label);
+        return;
+    }
+    if (reg->count < 3 || reg->sxx <= 0) {
+        printf("    %-16s %" PRIu64 " samples\n", reg->label, reg->count);
+        return;
+    }
+
+    slope = reg->sxy / reg->sxx;
+    residual = (reg->syy - slope * reg->sxy) / (reg->count - 2);
+    if (residual < 0)
+        residual = 0;
+    stderr_slope = sqrt(residual / reg->sxx);
+
+    /* 95% confidence by normal approximation. */
+    printf("    %-16s %8" PRIu64 " samples, drift %+10.3f ppm +/- %8.3f, "
+           "residual %10.1f ns", reg->label, reg->count,
+           slope * 1e6, 1.96 * stderr_slope * 1e6,
+           sqrt(residual) * 1e9);
+    if (reg->invalid > 0)
+        printf(", %" PRIu64 " invalid", reg->invalid);
+    printf("\n");
+}
+
+/* Layout of audio_tstamp_data in the report from the kernel. */
+static bool audio_tstamp_valid(__u32 data, unsigned int type)
+{
+    return (data & 0x1) && ((data >> 1) & 0xf) == type;
+}
+
+static int sample_type(struct pcm_stream *stream, struct regression *reg,
+                       struct regression *position)
+{
+    struct snd_pcm_status status = {0};
+    uint64_t begin;
+
+    /* The type is requested in the lowest 4 bits. */
+    status.audio_tstamp_data = reg->type & 0xf;
+
+    begin = latency_now();
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS_EXT, &status) < 0)
+        return -errno;
+    latency_record_push(&reg->cost, latency_now() - begin);
+
+    if (status.state != SNDRV_PCM_STATE_RUNNING)
+        return -EPIPE;
+
+    if (audio_tstamp_valid(status.audio_tstamp_data, reg->type))
+        regression_add(reg, timespec_to_ns(&status.tstamp),
+                       timespec_to_ns(&status.audio_tstamp));
+    else
+        ++reg->invalid;
+
+    if (position != NULL)
+        regression_add(position, timespec_to_ns(&status.tstamp),
+                       (int64_t)status.hw_ptr * 1000000000ll /
+                       stream->config.rate);
+
+    return 0;
+}
+
+static void dump_regressions(struct regression *regs, unsigned int count,
+                             struct regression *position, double elapsed)
+{
+    unsigned int i;
+
+    printf("  After %.1f seconds:\n", elapsed);
+    regression_dump(position);
+    for (i = 0; i < count; ++i)
+        regression_dump(&regs[i]);
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct regression regs[] = {
+        {
+            .label = "default",
+            .type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT,
+            .info_flag = 0,
+        },
+        {
+            .label = "link",
+            .type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK,
+            .info_flag = SNDRV_PCM_INFO_HAS_LINK_ATIME,
+        },
+        {
+            .label = "link-absolute",
+            .type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE,
+            .info_flag = SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME,
+        },
+        {
+            .label = "link-estimated",
+            .type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED,
+            .info_flag = SNDRV_PCM_INFO_HAS_LINK_ESTIMATED_ATIME,
+        },
+    };
+    struct regression position = {
+        .label = "hw_ptr",
+        .available = true,
+    };
+    const unsigned int count = sizeof(regs) / sizeof(regs[0]);
+    struct pcm_stream_config config = {
+        .access = SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct snd_pcm_sw_params sw_params;
+    struct pcm_stream stream;
+    struct timespec interval;
+    unsigned int seconds, interval_ms;
+    uint64_t begin, now, next_report, samples;
+    unsigned int i;
+    int err;
+
+    if (argc < 3) {
+        printf("Usage: %s PCM-DEVICE SECONDS [INTERVAL-MS [RATE]]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+    seconds = strtoul(argv[2], NULL, 10);
+    interval_ms = argc > 3 ? strtoul(argv[3], NULL, 10) : 100;
+    if (argc > 4)
+        config.rate = strtoul(argv[4], NULL, 10);
+    if (interval_ms == 0)
+        interval_ms = 1;
+    interval.tv_sec = interval_ms / 1000;
+    interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+    err = pcm_stream_open(&stream, argv[1], O_RDWR);
+    if (err < 0) {
+        printf("open(2): %s\n", strerror(-err));
+        return EXIT_FAILURE;
+    }
+
+    err = pcm_stream_configure(&stream, &config);
+    if (err < 0) {
+        printf("ioctl(HW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    /* Both of tstamp and trigger_tstamp are in CLOCK_MONOTONIC. */
+    pcm_stream_init_sw_params(&stream, &sw_params);
+    pcm_stream_free_running(&stream, &sw_params);
+    err = pcm_stream_set_sw_params(&stream, &sw_params);
+    if (err < 0) {
+        printf("ioctl(SW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    samples = (uint64_t)seconds * 1000 / interval_ms + 1;
+    for (i = 0; i < count; ++i) {
+        regs[i].available = regs[i].info_flag == 0 ||
+                            (stream.info & regs[i].info_flag);
+        err = latency_record_init(&regs[i].cost, regs[i].label, samples);
+        if (err < 0)
+            goto end;
+    }
+
+    if (ioctl(stream.fd, SNDRV_PCM_IOCTL_PREPARE) < 0 ||
+        ioctl(stream.fd, SNDRV_PCM_IOCTL_START) < 0) {
+        err = -errno;
+        printf("ioctl(START): %s\n", strerror(-err));
+        goto end;
+    }
+
+    printf("%s, rate %u, sampling every %u ms:\n", argv[1], config.rate,
+           interval_ms);
+
+    begin = latency_now();
+    next_report = begin + REPORT_INTERVAL * 1000000000ull;
+    while (1) {
+        now = latency_now();
+        if (now - begin >= (uint64_t)seconds * 1000000000ull)
+            break;
+
+        if (now >= next_report) {
+            dump_regressions(regs, count, &position, (now - begin) / 1e9);
+            next_report += REPORT_INTERVAL * 1000000000ull;
+        }
+
+        for (i = 0; i < count; ++i) {
+            if (!regs[i].available)
+                continue;
+            err = sample_type(&stream, &regs[i], i == 0 ? &position : NULL);
+            if (err < 0) {
+                printf("Sampling aborts: %s\n", strerror(-err));
+                goto report;
+            }
+        }
+
+        nanosleep(&interval, NULL);
+    }
+report:
+    dump_regressions(regs, count, &position,
+                     (latency_now() - begin) / 1e9);
+
+    printf("  Cost of STATUS_EXT per type:\n");
+    latency_dump_header();
+    for (i = 0; i < count; ++i)
+        latency_record_dump(&regs[i].cost);
+end:
+    for (i = 0; i < count; ++i)
+        latency_record_fini(&regs[i].cost);
+    ioctl(stream.fd, SNDRV_PCM_IOCTL_DROP);
+    pcm_stream_close(&stream);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
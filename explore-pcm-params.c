@@ -0,0 +1,495 @@
+/*
+ * explore-pcm-params.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Walk the configuration space of PCM substreams by SNDRV_PCM_IOCTL_HW_REFINE;
+ * access, format, channels and rate, then the ranges of period and buffer for
+ * each combination. The walk is pruned as soon as a parameter becomes empty.
+ * Substreams of all cards, or the given nodes, are explored in parallel by
+ * worker threads, and the set of valid configurations is printed. A run of
+ * rates or channels wider than PCM_REFINE_EXACT_VALUES is probed sparsely and
+ * marked with '~', since a hole in it can be missed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+#include "pcm-refine.h"
+
+#define MAX_CARDS   32
+
+/* Wider runs of channels are printed as a range at once. */
+#define MAX_CHANNELS_TO_ENUMERATE   64
+
+struct exploration {
+    char path[64];
+    int card;
+    int subdevice;
+
+    char *output;
+    size_t output_size;
+    uint64_t configurations;
+    unsigned long refines;
+    uint64_t elapsed;
+    int err;
+};
+
+struct explorer {
+    struct exploration *entries;
+    unsigned int count;
+    unsigned int next;
+    pthread_mutex_t lock;
+};
+
+static int add_exploration(struct explorer *explorer, const char *path,
+                           int card, int subdevice)
+{
+    struct exploration *entries;
+    struct exploration *entry;
+
+    entries = realloc(explorer->entries,
+                      sizeof(*entries) * (explorer->count + 1));
+    if (entries == NULL)
+        return -ENOMEM;
+    explorer->entries = entries;
+
+    entry = &entries[explorer->count];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->card = card;
+    entry->subdevice = subdevice;
+    ++explorer->count;
+
+    return 0;
+}
+
+/* All of substreams in the card, for each of subdevices. */
+static int collect_substreams(struct explorer *explorer, int card)
+{
+    struct snd_pcm_info info;
+    char path[64];
+    int device = -1;
+    int fd, dir, subdevice;
+    int err = 0;
+
+    snprintf(path, sizeof(path), "/dev/snd/controlC%d", card);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    while (err >= 0) {
+        if (ioctl(fd, SNDRV_CTL_IOCTL_PCM_NEXT_DEVICE, &device) < 0) {
+            err = -errno;
+            break;
+        }
+        if (device < 0)
+            break;
+
+        for (dir = 0; dir <= SNDRV_PCM_STREAM_LAST; ++dir) {
+            memset(&info, 0, sizeof(info));
+            info.device = device;
+            info.stream = dir;
+            if (ioctl(fd, SNDRV_CTL_IOCTL_PCM_INFO, &info) < 0)
+                continue;
+
+            snprintf(path, sizeof(path), "/dev/snd/pcmC%dD%d%c", card, device,
+                     dir == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
+            for (subdevice = 0; subdevice < info.subdevices_count;
+                 ++subdevice) {
+                err = add_exploration(explorer, path, card, subdevice);
+                if (err < 0)
+                    break;
+            }
+        }
+    }
+
+    close(fd);
+    return err;
+}
+
+static void print_segment(FILE *out, const char *label,
+                          const struct pcm_refine_segment *segment)
+{
+    char buf[32];
+
+    if (segment->min == segment->max)
+        snprintf(buf, sizeof(buf), "%u", segment->min);
+    else
+        snprintf(buf, sizeof(buf), "%u-%u%s", segment->min, segment->max,
+                 segment->exact ? "" : "~");
+    fprintf(out, " %s %-12s", label, buf);
+}
+
+static void print_bounds(FILE *out, struct snd_pcm_hw_params *params,
+                         snd_pcm_hw_param_t type, const char *label)
+{
+    struct pcm_refine_segment bounds;
+
+    pcm_refine_bounds(params, type, &bounds.min, &bounds.max);
+    bounds.exact = true;
+    print_segment(out, label, &bounds);
+}
+
+static const char *format_label(unsigned int format, char *buf, size_t size)
+{
+    if (format < sizeof(pcm_stream_format_labels) /
+                 sizeof(pcm_stream_format_labels[0]) &&
+        pcm_stream_format_labels[format] != NULL)
+        return pcm_stream_format_labels[format];
+
+    snprintf(buf, size, "format-%u", format);
+    return buf;
+}
+
+/* Rates, then ranges of period and buffer for each run of rates. */
+static int explore_rates(int fd, FILE *out, const char *prefix,
+                         struct snd_pcm_hw_params *base,
+                         struct exploration *entry,
+                         uint64_t combinations)
+{
+    struct pcm_refine_segment *rates;
+    struct snd_pcm_hw_params params;
+    unsigned int count, i;
+    int err;
+
+    err = pcm_refine_walk(fd, base, SNDRV_PCM_HW_PARAM_RATE, &rates, &count,
+                          &entry->refines);
+    for (i = 0; err >= 0 && i < count; ++i) {
+        params = *base;
+        pcm_refine_set_range(&params, SNDRV_PCM_HW_PARAM_RATE, rates[i].min,
+                             rates[i].max);
+        err = pcm_refine(fd, &params, &entry->refines);
+        if (err == -EINVAL) {
+            err = 0;
+            continue;
+        }
+        if (err < 0)
+            break;
+
+        fprintf(out, "%s", prefix);
+        print_segment(out, "rate", &rates[i]);
+        print_bounds(out, &params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                     "period-size");
+        print_bounds(out, &params, SNDRV_PCM_HW_PARAM_PERIODS, "periods");
+        print_bounds(out, &params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE,
+                     "buffer-size");
+        fprintf(out, "\n");
+
+        entry->configurations +=
+                        combinations * (rates[i].max - rates[i].min + 1);
+    }
+
+    free(rates);
+    return err;
+}
+
+static const char *format_run(char *buf, size_t size, const char *prefix,
+                              const struct pcm_refine_segment *run)
+{
+    if (run->min == run->max)
+        snprintf(buf, size, "%s channels %-6u", prefix, run->min);
+    else
+        snprintf(buf, size, "%s channels %u-%u%s", prefix, run->min,
+                 run->max, run->exact ? "" : "~");
+    return buf;
+}
+
+static int explore_channels(int fd, FILE *out, const char *prefix,
+                            struct snd_pcm_hw_params *base,
+                            struct exploration *entry)
+{
+    struct pcm_refine_segment *channels;
+    struct pcm_refine_segment run;
+    struct snd_pcm_hw_params params;
+    char label[128];
+    unsigned int count, i, ch;
+    bool at_once;
+    int err;
+
+    err = pcm_refine_walk(fd, base, SNDRV_PCM_HW_PARAM_CHANNELS, &channels,
+                          &count, &entry->refines);
+    for (i = 0; err >= 0 && i < count; ++i) {
+        at_once = channels[i].max - channels[i].min >=
+                  MAX_CHANNELS_TO_ENUMERATE;
+        run = channels[i];
+        for (ch = run.min; ch <= channels[i].max; ++ch) {
+            if (!at_once)
+                run.min = run.max = ch;
+
+            params = *base;
+            pcm_refine_set_range(&params, SNDRV_PCM_HW_PARAM_CHANNELS,
+                                 run.min, run.max);
+            err = pcm_refine(fd, &params, &entry->refines);
+            if (err == -EINVAL)
+                err = 0;
+            else if (err >= 0)
+                err = explore_rates(fd, out, format_run(label, sizeof(label),
+                                                        prefix, &run),
+                                    &params, entry, run.max - run.min + 1);
+            if (err < 0 || at_once)
+                break;
+        }
+    }
+
+    free(channels);
+    return err;
+}
+
+static int explore_space(int fd, FILE *out, struct exploration *entry)
+{
+    struct snd_pcm_hw_params base, by_access, by_format;
+    char prefix[96], buf[32];
+    unsigned int access, format;
+    int err;
+
+    pcm_stream_init_hw_params(&base);
+    pcm_stream_set_mask(&base, SNDRV_PCM_HW_PARAM_SUBFORMAT,
+                        SNDRV_PCM_SUBFORMAT_STD);
+    err = pcm_refine(fd, &base, &entry->refines);
+    if (err < 0)
+        return err;
+
+    for (access = 0; access <= SNDRV_PCM_ACCESS_LAST; ++access) {
+        if (!pcm_refine_mask_test(&base, SNDRV_PCM_HW_PARAM_ACCESS, access))
+            continue;
+        by_access = base;
+        pcm_stream_set_mask(&by_access, SNDRV_PCM_HW_PARAM_ACCESS, access);
+        err = pcm_refine(fd, &by_access, &entry->refines);
+        if (err == -EINVAL)
+            continue;
+        if (err < 0)
+            return err;
+
+        for (format = 0; format <= SNDRV_PCM_FORMAT_LAST; ++format) {
+            if (!pcm_refine_mask_test(&by_access, SNDRV_PCM_HW_PARAM_FORMAT,
+                                      format))
+                continue;
+            by_format = by_access;
+            pcm_stream_set_mask(&by_format, SNDRV_PCM_HW_PARAM_FORMAT, format);
+            err = pcm_refine(fd, &by_format, &entry->refines);
+            if (err == -EINVAL)
+                continue;
+            if (err < 0)
+                return err;
+
+            snprintf(prefix, sizeof(prefix), "    %-24s %-10s",
+                     pcm_stream_access_labels[access],
+                     format_label(format, buf, sizeof(buf)));
+            err = explore_channels(fd, out, prefix, &by_format, entry);
+            if (err < 0)
+                return err;
+        }
+    }
+
+    return 0;
+}
+
+/* The preference is valid for the thread which opens the control device. */
+static int open_substream(struct exploration *entry, struct pcm_stream *stream,
+                          int *subdevice)
+{
+    struct snd_pcm_info info = {0};
+    char path[64];
+    int ctl_fd = -1;
+    int err;
+
+    /* The output is defined even on error. */
+    *subdevice = entry->subdevice;
+
+    if (entry->card >= 0) {
+        snprintf(path, sizeof(path), "/dev/snd/controlC%d", entry->card);
+        ctl_fd = open(path, O_RDONLY);
+        if (ctl_fd < 0)
+            return -errno;
+        if (ioctl(ctl_fd, SNDRV_CTL_IOCTL_PCM_PREFER_SUBDEVICE,
+                  &entry->subdevice) < 0) {
+            err = -errno;
+            close(ctl_fd);
+            return err;
+        }
+    }
+
+    err = pcm_stream_open(stream, entry->path, O_RDWR | O_NONBLOCK);
+    if (ctl_fd >= 0)
+        close(ctl_fd);
+    if (err < 0)
+        return err;
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_INFO, &info) < 0)
+        return -errno;
+    *subdevice = info.subdevice;
+
+    return 0;
+}
+
+static void explore_substream(struct exploration *entry)
+{
+    struct pcm_stream stream = { .fd = -1 };
+    uint64_t begin;
+    FILE *out;
+    int subdevice;
+    int err;
+
+    out = open_memstream(&entry->output, &entry->output_size);
+    if (out == NULL) {
+        entry->err = -errno;
+        return;
+    }
+
+    /* Busy substream is just reported. */
+    begin = latency_now();
+    err = open_substream(entry, &stream, &subdevice);
+    if (err < 0) {
+        fprintf(out, "%s sub %d: %s\n", entry->path, entry->subdevice,
+                strerror(-err));
+        pcm_stream_close(&stream);
+        fclose(out);
+        return;
+    }
+
+    fprintf(out, "%s sub %d:\n", entry->path, subdevice);
+    if (entry->subdevice >= 0 && subdevice != entry->subdevice)
+        fprintf(out, "  Subdevice %d is busy; %d is explored instead.\n",
+                entry->subdevice, subdevice);
+
+    entry->err = explore_space(stream.fd, out, entry);
+    entry->elapsed = latency_now() - begin;
+
+    if (entry->err < 0)
+        fprintf(out, "  Exploration aborts: %s\n", strerror(-entry->err));
+    fprintf(out, "  %" PRIu64 " configurations, %lu refines in %.3f ms\n",
+            entry->configurations, entry->refines, entry->elapsed / 1e6);
+
+    pcm_stream_close(&stream);
+    fclose(out);
+}
+
+static void *run_worker(void *arg)
+{
+    struct explorer *explorer = arg;
+    unsigned int index;
+
+    while (1) {
+        pthread_mutex_lock(&explorer->lock);
+        index = explorer->next++;
+        pthread_mutex_unlock(&explorer->lock);
+
+        if (index >= explorer->count)
+            break;
+        explore_substream(&explorer->entries[index]);
+    }
+
+    return NULL;
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct explorer explorer = {0};
+    pthread_t *threads;
+    unsigned long workers, refines = 0;
+    uint64_t begin, configurations = 0;
+    unsigned int i, started;
+    int card;
+    int err;
+
+    if (argc > 1)
+        workers = strtoul(argv[1], NULL, 10);
+    else
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers == 0) {
+        printf("Usage: %s [WORKERS [PCM-DEVICE ...]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 2) {
+        for (i = 2; i < argc; ++i) {
+            if (add_exploration(&explorer, argv[i], -1, -1) < 0)
+                return EXIT_FAILURE;
+        }
+    } else {
+        for (card = 0; card < MAX_CARDS; ++card) {
+            err = collect_substreams(&explorer, card);
+            if (err < 0 && err != -ENOENT) {
+                printf("Card %d: %s\n", card, strerror(-err));
+                free(explorer.entries);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (explorer.count == 0) {
+        printf("No PCM substream is found.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (workers > explorer.count)
+        workers = explorer.count;
+    threads = calloc(workers, sizeof(*threads));
+    if (threads == NULL) {
+        free(explorer.entries);
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&explorer.lock, NULL);
+
+    begin = latency_now();
+    for (started = 0; started < workers; ++started) {
+        err = -pthread_create(&threads[started], NULL, run_worker, &explorer);
+        if (err < 0) {
+            printf("pthread_create(3): %s; %u of %lu workers run.\n",
+                   strerror(-err), started, workers);
+            workers = started;
+            break;
+        }
+    }
+    /* The queue is shared, thus the started workers take the rest. */
+    if (started == 0) {
+        workers = 1;
+        run_worker(&explorer);
+    }
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    /* In the order of collection, regardless of the order of completion. */
+    err = 0;
+    for (i = 0; i < explorer.count; ++i) {
+        if (explorer.entries[i].output != NULL)
+            fwrite(explorer.entries[i].output, 1,
+                   explorer.entries[i].output_size, stdout);
+        free(explorer.entries[i].output);
+
+        configurations += explorer.entries[i].configurations;
+        refines += explorer.entries[i].refines;
+        if (explorer.entries[i].err < 0)
+            err = explorer.entries[i].err;
+    }
+    printf("%u substreams by %lu workers: %" PRIu64 " configurations, "
+           "%lu refines in %.3f ms\n", explorer.count, workers,
+           configurations, refines, (latency_now() - begin) / 1e6);
+
+    pthread_mutex_destroy(&explorer.lock);
+    free(threads);
+    free(explorer.entries);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
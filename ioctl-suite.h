@@ -0,0 +1,554 @@
+/*
+ * ioctl-suite.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Table-driven engine of the check programs. Each case of ioctl is a
+ * descriptor of the command, the size of its argument, an optional
+ * initializer of the argument and the errnos accepted besides success. A
+ * suite is the table of cases for one kind of node in /dev/snd; it runs
+ * against the default node, in rounds for latency profile, or against every
+ * matching node on the system by worker threads, with the results and the
+ * timings aggregated.
+ */
+
+#ifndef IOCTL_SUITE_H
+#define IOCTL_SUITE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+
+#include "latency.h"
+
+#define IOCTL_SUITE_DIR		"/dev/snd"
+#define IOCTL_SUITE_NAME_MAX	32
+/* Larger than any argument of ioctl in ALSA uAPI. */
+#define IOCTL_CASE_MAX_SIZE	4096
+#define IOCTL_CASE_MAX_ERRNOS	4
+
+struct ioctl_case {
+	const char *label;
+	unsigned long command;
+	/* Zero for the command without argument. */
+	size_t size;
+	/* Called for the argument cleared by zero, if given. */
+	void (*init)(void *arg);
+	/* Accepted besides success, terminated by zero. */
+	int errnos[IOCTL_CASE_MAX_ERRNOS];
+};
+
+/* The rest of arguments are the accepted errnos, or zero for none. */
+#define IOCTL_CASE(command, type, init, ...)				\
+	{ #command, command, sizeof(type), init, { __VA_ARGS__ } }
+#define IOCTL_CASE_NO_ARG(command, ...)					\
+	{ #command, command, 0, NULL, { __VA_ARGS__ } }
+
+struct ioctl_suite {
+	/* For the message of abort, e.g. 'Ctl'. */
+	const char *label;
+	const char *node;
+	/* The pattern of names of the nodes in /dev/snd. */
+	const char *pattern;
+	int flags;
+	const struct ioctl_case *cases;
+	unsigned int count;
+	/* The modes which the program has besides, for the message of usage. */
+	const char *usage;
+};
+
+struct ioctl_suite_node {
+	/* The directory, the separator and the name. */
+	char path[sizeof(IOCTL_SUITE_DIR) + IOCTL_SUITE_NAME_MAX + 1];
+	int err;
+	/* The errno in the first failed round for each case, or zero. */
+	int *errors;
+	/* The rounds failed for each case. */
+	unsigned int *failures;
+	unsigned int failed;
+	/* The samples of each case in rounds, in the order of cases. */
+	uint64_t *samples;
+	uint64_t elapsed;
+};
+
+struct ioctl_suite_run {
+	const struct ioctl_suite *suite;
+	struct ioctl_suite_node *nodes;
+	unsigned int node_count;
+	unsigned int next;
+	unsigned int rounds;
+	pthread_mutex_t lock;
+};
+
+/* Zero for the result accepted, else the negative errno. */
+static inline int ioctl_case_run(int fd, const struct ioctl_case *c,
+				 uint64_t *elapsed)
+{
+	union {
+		uint64_t align;
+		unsigned char bytes[IOCTL_CASE_MAX_SIZE];
+	} buf;
+	void *arg = NULL;
+	uint64_t begin;
+	unsigned int i;
+	int err;
+
+	if (c->size > sizeof(buf))
+		return -E2BIG;
+
+	if (c->size > 0) {
+		memset(buf.bytes, 0, c->size);
+		if (c->init != NULL)
+			c->init(buf.bytes);
+		arg = buf.bytes;
+	}
+
+	begin = latency_now();
+	err = ioctl(fd, c->command, arg);
+	*elapsed = latency_now() - begin;
+	if (err >= 0)
+		return 0;
+
+	err = errno;
+	for (i = 0; i < IOCTL_CASE_MAX_ERRNOS && c->errnos[i] != 0; ++i) {
+		if (err == c->errnos[i])
+			return 0;
+	}
+
+	return -err;
+}
+
+/* Run the cases in order and stop at the first failure, with report. */
+static inline bool ioctl_suite_check(const struct ioctl_suite *suite, int fd)
+{
+	uint64_t elapsed;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < suite->count; ++i) {
+		err = ioctl_case_run(fd, &suite->cases[i], &elapsed);
+		if (err < 0) {
+			printf("%s: %s\n", suite->cases[i].label,
+			       strerror(-err));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Run the whole table of cases for the given rounds and report the
+ * distribution of each case in nano seconds. Running the table in rounds
+ * keeps the order of the cases, thus pairs such as create/delete or
+ * start/stop are still balanced.
+ */
+static inline bool ioctl_suite_profile(const struct ioctl_suite *suite, int fd,
+				       unsigned int iterations)
+{
+	struct latency_record *recs;
+	uint64_t elapsed;
+	unsigned int i, j;
+	bool result = true;
+	int err;
+
+	recs = calloc(suite->count, sizeof(*recs));
+	if (recs == NULL) {
+		printf("calloc(3): %s\n", strerror(ENOMEM));
+		return false;
+	}
+
+	for (i = 0; i < suite->count; ++i) {
+		if (latency_record_init(&recs[i], suite->cases[i].label,
+					iterations) < 0) {
+			printf("calloc(3): %s\n", strerror(ENOMEM));
+			result = false;
+			goto end;
+		}
+	}
+
+	for (j = 0; j < iterations && result; ++j) {
+		for (i = 0; i < suite->count; ++i) {
+			err = ioctl_case_run(fd, &suite->cases[i], &elapsed);
+			latency_record_push(&recs[i], elapsed);
+			if (err < 0) {
+				printf("%s: %s\n", suite->cases[i].label,
+				       strerror(-err));
+				result = false;
+				break;
+			}
+		}
+	}
+
+	latency_dump_header();
+	for (i = 0; i < suite->count; ++i)
+		latency_record_dump(&recs[i]);
+end:
+	for (i = 0; i < suite->count; ++i)
+		latency_record_fini(&recs[i]);
+	free(recs);
+
+	return result;
+}
+
+/* Every case runs even after a failure, to report all of them. */
+static inline void ioctl_suite_run_node(const struct ioctl_suite *suite,
+					struct ioctl_suite_node *node,
+					unsigned int rounds)
+{
+	uint64_t begin, elapsed;
+	unsigned int i, j;
+	int fd;
+	int err;
+
+	begin = latency_now();
+	fd = open(node->path, suite->flags);
+	if (fd < 0) {
+		node->err = -errno;
+		return;
+	}
+
+	for (j = 0; j < rounds; ++j) {
+		for (i = 0; i < suite->count; ++i) {
+			err = ioctl_case_run(fd, &suite->cases[i], &elapsed);
+			node->samples[i * rounds + j] = elapsed;
+			if (err < 0) {
+				if (node->failures[i]++ == 0)
+					node->errors[i] = -err;
+			}
+		}
+	}
+
+	for (i = 0; i < suite->count; ++i) {
+		if (node->errors[i] != 0)
+			++node->failed;
+	}
+
+	close(fd);
+	node->elapsed = latency_now() - begin;
+}
+
+static inline void *ioctl_suite_run_worker(void *arg)
+{
+	struct ioctl_suite_run *run = arg;
+	unsigned int index;
+
+	while (1) {
+		pthread_mutex_lock(&run->lock);
+		index = run->next++;
+		pthread_mutex_unlock(&run->lock);
+		if (index >= run->node_count)
+			break;
+
+		ioctl_suite_run_node(run->suite, &run->nodes[index],
+				     run->rounds);
+	}
+
+	return NULL;
+}
+
+/* The numbers in the names are compared by value, thus C10 after C9. */
+static inline int ioctl_suite_compare_nodes(const void *a, const void *b)
+{
+	const char *x = ((const struct ioctl_suite_node *)a)->path;
+	const char *y = ((const struct ioctl_suite_node *)b)->path;
+	unsigned long m, n;
+	char *end;
+
+	while (*x != '\0' && *y != '\0') {
+		if (*x >= '0' && *x <= '9' && *y >= '0' && *y <= '9') {
+			m = strtoul(x, &end, 10);
+			x = end;
+			n = strtoul(y, &end, 10);
+			y = end;
+			if (m != n)
+				return (m > n) - (m < n);
+			continue;
+		}
+		if (*x != *y)
+			break;
+		++x;
+		++y;
+	}
+
+	return (unsigned char)*x - (unsigned char)*y;
+}
+
+static inline void ioctl_suite_free_nodes(struct ioctl_suite_node *nodes,
+					  unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		free(nodes[i].errors);
+		free(nodes[i].failures);
+		free(nodes[i].samples);
+	}
+	free(nodes);
+}
+
+static inline int ioctl_suite_collect_nodes(const struct ioctl_suite *suite,
+					    unsigned int rounds,
+					    struct ioctl_suite_node **nodes,
+					    unsigned int *count)
+{
+	struct ioctl_suite_node *entries = NULL, *entry;
+	unsigned int space = 0;
+	struct dirent *dirent;
+	DIR *dir;
+	int err = 0;
+
+	*nodes = NULL;
+	*count = 0;
+
+	dir = opendir(IOCTL_SUITE_DIR);
+	if (dir == NULL)
+		return -errno;
+
+	while ((dirent = readdir(dir)) != NULL) {
+		if (fnmatch(suite->pattern, dirent->d_name, 0) != 0)
+			continue;
+		/* No node of ALSA has such a long name. */
+		if (strlen(dirent->d_name) >= IOCTL_SUITE_NAME_MAX)
+			continue;
+
+		if (*count == space) {
+			entry = realloc(entries, sizeof(*entry) * (space + 16));
+			if (entry == NULL) {
+				err = -ENOMEM;
+				break;
+			}
+			entries = entry;
+			space += 16;
+		}
+
+		entry = &entries[*count];
+		memset(entry, 0, sizeof(*entry));
+		snprintf(entry->path, sizeof(entry->path), "%s/%.*s",
+			 IOCTL_SUITE_DIR, IOCTL_SUITE_NAME_MAX, dirent->d_name);
+		entry->errors = calloc(suite->count, sizeof(*entry->errors));
+		entry->failures = calloc(suite->count,
+					 sizeof(*entry->failures));
+		entry->samples = calloc((size_t)suite->count * rounds,
+					sizeof(*entry->samples));
+		++*count;
+		if (entry->errors == NULL || entry->failures == NULL ||
+		    entry->samples == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+	}
+	closedir(dir);
+
+	if (err < 0) {
+		ioctl_suite_free_nodes(entries, *count);
+		*count = 0;
+		return err;
+	}
+
+	qsort(entries, *count, sizeof(*entries), ioctl_suite_compare_nodes);
+	*nodes = entries;
+
+	return 0;
+}
+
+static inline void ioctl_suite_report(const struct ioctl_suite_run *run,
+				      uint64_t elapsed)
+{
+	const struct ioctl_suite *suite = run->suite;
+	const struct ioctl_suite_node *node;
+	struct latency_record rec;
+	unsigned int failed_nodes = 0, failures;
+	const uint64_t *samples;
+	unsigned int i, j, k;
+	uint64_t sum = 0;
+
+	for (i = 0; i < run->node_count; ++i) {
+		node = &run->nodes[i];
+		if (node->err < 0) {
+			printf("%s: %s\n", node->path, strerror(-node->err));
+			++failed_nodes;
+			continue;
+		}
+
+		printf("%s: %u cases, %u failed, %.3f ms\n", node->path,
+		       suite->count, node->failed, node->elapsed / 1e6);
+		for (j = 0; j < suite->count; ++j) {
+			if (node->errors[j] != 0)
+				printf("  %s: %s in %u of %u rounds\n",
+				       suite->cases[j].label,
+				       strerror(node->errors[j]),
+				       node->failures[j], run->rounds);
+		}
+		if (node->failed > 0)
+			++failed_nodes;
+		sum += node->elapsed;
+	}
+
+	/* The distribution of each case over the nodes opened. */
+	if (latency_record_init(&rec, NULL,
+				run->node_count * run->rounds) == 0) {
+		latency_dump_header();
+		for (j = 0; j < suite->count; ++j) {
+			rec.label = suite->cases[j].label;
+			rec.count = 0;
+			failures = 0;
+			for (i = 0; i < run->node_count; ++i) {
+				node = &run->nodes[i];
+				if (node->err < 0)
+					continue;
+				samples = node->samples + j * run->rounds;
+				for (k = 0; k < run->rounds; ++k)
+					latency_record_push(&rec, samples[k]);
+				if (node->errors[j] != 0)
+					++failures;
+			}
+			latency_record_dump(&rec);
+			if (failures > 0)
+				printf("%-40s failed on %u nodes\n", "",
+				       failures);
+		}
+		latency_record_fini(&rec);
+	}
+
+	printf("%u nodes, %u failed, %.3f ms elapsed, %.3f ms in sum\n",
+	       run->node_count, failed_nodes, elapsed / 1e6, sum / 1e6);
+}
+
+/* Returns the number of nodes failed, or the negative errno. */
+static inline int ioctl_suite_run_all(const struct ioctl_suite *suite,
+				      unsigned int workers,
+				      unsigned int rounds)
+{
+	struct ioctl_suite_run run = {0};
+	pthread_t *threads;
+	unsigned int i, started;
+	uint64_t begin;
+	int failed = 0;
+	int err;
+
+	err = ioctl_suite_collect_nodes(suite, rounds, &run.nodes,
+					&run.node_count);
+	if (err < 0)
+		return err;
+	if (run.node_count == 0) {
+		printf("No node matches %s/%s\n", IOCTL_SUITE_DIR,
+		       suite->pattern);
+		return -ENODEV;
+	}
+
+	if (workers > run.node_count)
+		workers = run.node_count;
+	threads = calloc(workers, sizeof(*threads));
+	if (threads == NULL) {
+		ioctl_suite_free_nodes(run.nodes, run.node_count);
+		return -ENOMEM;
+	}
+
+	run.suite = suite;
+	run.rounds = rounds;
+	pthread_mutex_init(&run.lock, NULL);
+
+	printf("%s suite: %u cases on %u nodes by %u workers, %u rounds\n",
+	       suite->label, suite->count, run.node_count, workers, rounds);
+
+	begin = latency_now();
+	for (started = 0; started < workers; ++started) {
+		if (pthread_create(&threads[started], NULL,
+				   ioctl_suite_run_worker, &run) != 0)
+			break;
+	}
+	/* No thread is available; process the nodes here. */
+	if (started == 0)
+		ioctl_suite_run_worker(&run);
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	ioctl_suite_report(&run, latency_now() - begin);
+
+	for (i = 0; i < run.node_count; ++i) {
+		if (run.nodes[i].err < 0 || run.nodes[i].failed > 0)
+			++failed;
+	}
+
+	pthread_mutex_destroy(&run.lock);
+	free(threads);
+	ioctl_suite_free_nodes(run.nodes, run.node_count);
+
+	return failed;
+}
+
+/*
+ * The common command line of the check programs: with no argument, the
+ * default node is checked till the first failure.
+ */
+static inline int ioctl_suite_main(const struct ioctl_suite *suite, int argc,
+				   const char *const argv[])
+{
+	unsigned int iterations = 0;
+	unsigned int workers = 4;
+	unsigned int rounds = 1;
+	int fd;
+	int err;
+
+	if (argc > 1 && strcmp(argv[1], "all") == 0) {
+		if (argc > 2)
+			workers = strtoul(argv[2], NULL, 10);
+		if (argc > 3)
+			rounds = strtoul(argv[3], NULL, 10);
+		if (workers > 0 && rounds > 0) {
+			err = ioctl_suite_run_all(suite, workers, rounds);
+			if (err != 0) {
+				printf("%s test aborts.\n", suite->label);
+				return EXIT_FAILURE;
+			}
+			return EXIT_SUCCESS;
+		}
+	} else if (argc > 2 && strcmp(argv[1], "profile") == 0) {
+		iterations = strtoul(argv[2], NULL, 10);
+	}
+
+	if (argc > 1 && iterations == 0) {
+		printf("Usage: %s [profile ITERATIONS | "
+		       "all [WORKERS [ROUNDS]]%s]\n", argv[0],
+		       suite->usage != NULL ? suite->usage : "");
+		return EXIT_FAILURE;
+	}
+
+	fd = open(suite->node, suite->flags);
+	if (fd < 0) {
+		printf("%s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (iterations > 0) {
+		if (!ioctl_suite_profile(suite, fd, iterations)) {
+			printf("%s test aborts.\n", suite->label);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (!ioctl_suite_check(suite, fd)) {
+		printf("%s test aborts.\n", suite->label);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#endif
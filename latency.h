@@ -0,0 +1,108 @@
+/*
+ * latency.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Helpers to collect per-ioctl latency samples with CLOCK_MONOTONIC_RAW and
+ * to report their distribution.
+ *
+ * This and the other headers shared by the programs define every helper as
+ * static inline, so that each program still builds from a single translation
+ * unit.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+struct latency_record {
+	const char *label;
+	uint64_t *samples;
+	unsigned int count;
+	unsigned int size;
+};
+
+static inline uint64_t latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline int latency_record_init(struct latency_record *rec,
+				      const char *label, unsigned int size)
+{
+	rec->samples = calloc(size, sizeof(*rec->samples));
+	if (rec->samples == NULL)
+		return -ENOMEM;
+	rec->label = label;
+	rec->count = 0;
+	rec->size = size;
+
+	return 0;
+}
+
+static inline void latency_record_push(struct latency_record *rec,
+				       uint64_t ns)
+{
+	if (rec->count < rec->size)
+		rec->samples[rec->count++] = ns;
+}
+
+static inline void latency_record_fini(struct latency_record *rec)
+{
+	free(rec->samples);
+	rec->samples = NULL;
+	rec->count = 0;
+	rec->size = 0;
+}
+
+static inline int latency_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The samples should be sorted in advance. */
+static inline uint64_t latency_percentile(const struct latency_record *rec,
+					  unsigned int permille)
+{
+	return rec->samples[(uint64_t)(rec->count - 1) * permille / 1000];
+}
+
+static inline void latency_dump_header(void)
+{
+	printf("%-40s %10s %10s %10s %10s %10s %10s\n", "ioctl", "count",
+	       "min", "p50", "p99", "p99.9", "max");
+}
+
+/* The samples are sorted in place. */
+static inline void latency_record_dump(struct latency_record *rec)
+{
+	if (rec->count == 0)
+		return;
+
+	qsort(rec->samples, rec->count, sizeof(*rec->samples),
+	      latency_compare);
+
+	printf("%-40s %10u %10llu %10llu %10llu %10llu %10llu\n",
+	       rec->label, rec->count,
+	       (unsigned long long)rec->samples[0],
+	       (unsigned long long)latency_percentile(rec, 500),
+	       (unsigned long long)latency_percentile(rec, 990),
+	       (unsigned long long)latency_percentile(rec, 999),
+	       (unsigned long long)rec->samples[rec->count - 1]);
+}
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * link-pcm-substreams.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Link the given PCM substreams by SNDRV_PCM_IOCTL_LINK, start them at once
+ * and measure how far apart they actually start, as well as the cost of
+ * LINK/UNLINK and START for each size of group. Sequential start without
+ * link is measured for comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+
+struct group_result {
+    struct latency_record link;
+    struct latency_record start;
+    struct latency_record unlink;
+    struct latency_record trigger_spread;
+    struct latency_record position_spread;
+};
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static int64_t get_spread(const int64_t *values, unsigned int count)
+{
+    int64_t min = values[0];
+    int64_t max = values[0];
+    unsigned int i;
+
+    for (i = 1; i < count; ++i) {
+        if (values[i] < min)
+            min = values[i];
+        if (values[i] > max)
+            max = values[i];
+    }
+
+    return max - min;
+}
+
+/*
+ * The trigger timestamp is shared in a linked group, thus the start is
+ * also estimated by the position of hardware pointer at the tstamp.
+ */
+static int collect_starts(struct pcm_stream *streams, unsigned int count,
+                          struct group_result *result)
+{
+    struct snd_pcm_status status;
+    int64_t triggers[count];
+    int64_t starts[count];
+    struct timespec settle;
+    int64_t ns;
+    unsigned int i;
+
+    /* Let the hardware pointers move for two periods. */
+    ns = 2 * streams[0].config.period_size * 1000000000ll /
+         streams[0].config.rate;
+    settle.tv_sec = ns / 1000000000;
+    settle.tv_nsec = ns % 1000000000;
+    nanosleep(&settle, NULL);
+
+    for (i = 0; i < count; ++i) {
+        memset(&status, 0, sizeof(status));
+        if (ioctl(streams[i].fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+            return -errno;
+
+        triggers[i] = timespec_to_ns(&status.trigger_tstamp);
+        starts[i] = timespec_to_ns(&status.tstamp) -
+                    (int64_t)status.hw_ptr * 1000000000ll /
+                    streams[i].config.rate;
+    }
+
+    latency_record_push(&result->trigger_spread, get_spread(triggers, count));
+    latency_record_push(&result->position_spread, get_spread(starts, count));
+
+    return 0;
+}
+
+/* Leave the members stopped and standalone for the next trial. */
+static void release_group(struct pcm_stream *streams, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        ioctl(streams[i].fd, SNDRV_PCM_IOCTL_DROP);
+        /* The unlinked member is just refused by EALREADY. */
+        if (i > 0)
+            ioctl(streams[i].fd, SNDRV_PCM_IOCTL_UNLINK);
+    }
+}
+
+static int run_linked_trial(struct pcm_stream *streams, unsigned int count,
+                            struct group_result *result)
+{
+    uint64_t begin;
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < count; ++i) {
+        if (ioctl(streams[i].fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
+            err = -errno;
+            goto error;
+        }
+    }
+
+    for (i = 1; i < count; ++i) {
+        begin = latency_now();
+        if (ioctl(streams[0].fd, SNDRV_PCM_IOCTL_LINK, streams[i].fd) < 0) {
+            err = -errno;
+            goto error;
+        }
+        latency_record_push(&result->link, latency_now() - begin);
+    }
+
+    begin = latency_now();
+    if (ioctl(streams[0].fd, SNDRV_PCM_IOCTL_START) < 0) {
+        err = -errno;
+        goto error;
+    }
+    latency_record_push(&result->start, latency_now() - begin);
+
+    err = collect_starts(streams, count, result);
+
+    /* Drop the whole of group. */
+    ioctl(streams[0].fd, SNDRV_PCM_IOCTL_DROP);
+
+    for (i = 1; i < count; ++i) {
+        begin = latency_now();
+        if (ioctl(streams[i].fd, SNDRV_PCM_IOCTL_UNLINK) < 0) {
+            err = -errno;
+            goto error;
+        }
+        latency_record_push(&result->unlink, latency_now() - begin);
+    }
+
+    return err;
+error:
+    release_group(streams, count);
+    return err;
+}
+
+static int run_sequential_trial(struct pcm_stream *streams,
+                                unsigned int count,
+                                struct group_result *result)
+{
+    uint64_t begin;
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < count; ++i) {
+        if (ioctl(streams[i].fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
+            err = -errno;
+            goto end;
+        }
+    }
+
+    begin = latency_now();
+    for (i = 0; i < count; ++i) {
+        if (ioctl(streams[i].fd, SNDRV_PCM_IOCTL_START) < 0) {
+            err = -errno;
+            goto end;
+        }
+    }
+    latency_record_push(&result->start, latency_now() - begin);
+
+    err = collect_starts(streams, count, result);
+end:
+    for (i = 0; i < count; ++i)
+        ioctl(streams[i].fd, SNDRV_PCM_IOCTL_DROP);
+
+    return err;
+}
+
+static int init_result(struct group_result *result, unsigned int trials,
+                       unsigned int count)
+{
+    int err;
+
+    memset(result, 0, sizeof(*result));
+
+    err = latency_record_init(&result->link, "LINK", trials * count);
+    if (err >= 0)
+        err = latency_record_init(&result->start, "START", trials);
+    if (err >= 0)
+        err = latency_record_init(&result->unlink, "UNLINK", trials * count);
+    if (err >= 0)
+        err = latency_record_init(&result->trigger_spread,
+                                  "spread of trigger_tstamp", trials);
+    if (err >= 0)
+        err = latency_record_init(&result->position_spread,
+                                  "spread of start by position", trials);
+
+    return err;
+}
+
+static void dump_result(struct group_result *result)
+{
+    latency_dump_header();
+    latency_record_dump(&result->link);
+    latency_record_dump(&result->start);
+    latency_record_dump(&result->unlink);
+    latency_record_dump(&result->trigger_spread);
+    latency_record_dump(&result->position_spread);
+
+    latency_record_fini(&result->link);
+    latency_record_fini(&result->start);
+    latency_record_fini(&result->unlink);
+    latency_record_fini(&result->trigger_spread);
+    latency_record_fini(&result->position_spread);
+}
+
+static int measure_groups(struct pcm_stream *streams, unsigned int count,
+                          unsigned int trials)
+{
+    int (*const funcs[])(struct pcm_stream *, unsigned int,
+                         struct group_result *) = {
+        run_linked_trial,
+        run_sequential_trial,
+    };
+    static const char *const labels[] = {
+        "linked",
+        "sequential",
+    };
+    struct group_result result;
+    unsigned int size, i, j;
+    int err = 0;
+
+    for (size = 2; size <= count; ++size) {
+        for (i = 0; i < 2; ++i) {
+            err = init_result(&result, trials, size);
+            if (err < 0)
+                return err;
+
+            for (j = 0; j < trials; ++j) {
+                err = funcs[i](streams, size, &result);
+                if (err < 0)
+                    break;
+            }
+
+            printf("Group of %u substreams, %s:\n", size, labels[i]);
+            dump_result(&result);
+
+            if (err < 0) {
+                printf("Trial aborts: %s\n", strerror(-err));
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct pcm_stream_config config = {
+        .access = SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct snd_pcm_sw_params sw_params;
+    struct pcm_stream *streams;
+    unsigned int trials;
+    unsigned int count;
+    unsigned int i;
+    int err = 0;
+
+    if (argc < 4 || strtoul(argv[1], NULL, 10) == 0) {
+        printf("Usage: %s TRIALS PCM-DEVICE PCM-DEVICE [PCM-DEVICE ...]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+    trials = strtoul(argv[1], NULL, 10);
+    count = argc - 2;
+
+    streams = calloc(count, sizeof(*streams));
+    if (streams == NULL)
+        return EXIT_FAILURE;
+    for (i = 0; i < count; ++i)
+        streams[i].fd = -1;
+
+    for (i = 0; i < count; ++i) {
+        err = pcm_stream_open(&streams[i], argv[i + 2], O_RDWR);
+        if (err < 0) {
+            printf("open(2) for %s: %s\n", argv[i + 2], strerror(-err));
+            goto end;
+        }
+
+        err = pcm_stream_configure(&streams[i], &config);
+        if (err < 0) {
+            printf("ioctl(HW_PARAMS) for %s: %s\n", argv[i + 2],
+                   strerror(-err));
+            goto end;
+        }
+
+        /* Playback substreams can start without any data. */
+        pcm_stream_init_sw_params(&streams[i], &sw_params);
+        pcm_stream_free_running(&streams[i], &sw_params);
+        err = pcm_stream_set_sw_params(&streams[i], &sw_params);
+        if (err < 0) {
+            printf("ioctl(SW_PARAMS) for %s: %s\n", argv[i + 2],
+                   strerror(-err));
+            goto end;
+        }
+    }
+
+    err = measure_groups(streams, count, trials);
+end:
+    for (i = 0; i < count; ++i)
+        pcm_stream_close(&streams[i]);
+    free(streams);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+/*
+ * lookup-ctl-elems.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Resolve control elements by the tuple of identifier, by numid or by a
+ * prefix of name with the index in ctl-elem-index.h, and measure the rate
+ * of lookup over a synthetic set of identifiers against linear scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <unistd.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "ctl-elem-index.h"
+
+/* A few of typical names; the synthetic identifiers are numbered by them. */
+static const char *const name_patterns[] = {
+    "Analogue Out %u Playback Volume",
+    "Analogue Out %u Playback Switch",
+    "Analogue In %u Capture Volume",
+    "Mixer Input %u Capture Route",
+    "S/PDIF Out %u Playback Route",
+    "ADAT In %u Capture Volume",
+    "Master Playback Volume %u",
+    "PCM %u Playback Volume",
+};
+
+static const char *const iface_labels[] = {
+    [SNDRV_CTL_ELEM_IFACE_CARD]         = "card",
+    [SNDRV_CTL_ELEM_IFACE_HWDEP]        = "hwdep",
+    [SNDRV_CTL_ELEM_IFACE_MIXER]        = "mixer",
+    [SNDRV_CTL_ELEM_IFACE_PCM]          = "pcm",
+    [SNDRV_CTL_ELEM_IFACE_RAWMIDI]      = "rawmidi",
+    [SNDRV_CTL_ELEM_IFACE_TIMER]        = "timer",
+    [SNDRV_CTL_ELEM_IFACE_SEQUENCER]    = "sequencer",
+};
+
+static int parse_iface(const char *label)
+{
+    int i;
+
+    for (i = 0; i <= SNDRV_CTL_ELEM_IFACE_LAST; ++i) {
+        if (strcmp(label, iface_labels[i]) == 0)
+            return i;
+    }
+
+    return -EINVAL;
+}
+
+static void print_id(const struct snd_ctl_elem_id *id)
+{
+    printf("  numid %u: iface %s, device %u, subdevice %u, '%s', index %u\n",
+           id->numid, id->iface <= SNDRV_CTL_ELEM_IFACE_LAST ?
+                      iface_labels[id->iface] : "unknown",
+           id->device, id->subdevice, id->name, id->index);
+}
+
+static int lookup(const char *path, int argc, const char *const argv[])
+{
+    struct ctl_elem_index index;
+    const struct snd_ctl_elem_id *id = NULL;
+    unsigned int fields[4] = { SNDRV_CTL_ELEM_IFACE_MIXER, 0, 0, 0 };
+    unsigned int first, count;
+    uint64_t begin, elapsed;
+    unsigned int i;
+    int iface;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("open(2): %s\n", strerror(errno));
+        return -errno;
+    }
+
+    begin = latency_now();
+    err = ctl_elem_index_load(&index, fd);
+    elapsed = latency_now() - begin;
+    close(fd);
+    if (err < 0) {
+        printf("Fail to index elements: %s\n", strerror(-err));
+        return err;
+    }
+    printf("%s: %u elements indexed in %.3f ms\n", path, index.count,
+           (double)elapsed / 1000000);
+
+    if (strcmp(argv[0], "find") == 0) {
+        /* INDEX, IFACE, DEVICE and SUBDEVICE follow the name. */
+        if (argc > 2)
+            fields[3] = strtoul(argv[2], NULL, 10);
+        if (argc > 3) {
+            iface = parse_iface(argv[3]);
+            if (iface < 0) {
+                printf("Unknown iface: %s\n", argv[3]);
+                ctl_elem_index_free(&index);
+                return iface;
+            }
+            fields[0] = iface;
+        }
+        for (i = 4; i < argc && i < 6; ++i)
+            fields[i - 3] = strtoul(argv[i], NULL, 10);
+        id = ctl_elem_index_find(&index, fields[0], fields[1], fields[2],
+                                 argv[1], fields[3]);
+    } else if (strcmp(argv[0], "numid") == 0) {
+        id = ctl_elem_index_find_numid(&index, strtoul(argv[1], NULL, 10));
+    } else {
+        count = ctl_elem_index_prefix(&index, argv[1], &first);
+        printf("%u elements start with '%s':\n", count, argv[1]);
+        for (i = 0; i < count; ++i)
+            print_id(ctl_elem_index_sorted(&index, first + i));
+        ctl_elem_index_free(&index);
+        return 0;
+    }
+
+    if (id != NULL) {
+        print_id(id);
+    } else {
+        printf("No such element.\n");
+        err = -ENOENT;
+    }
+
+    ctl_elem_index_free(&index);
+    return err;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    /* xorshift32 */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void make_ids(struct snd_ctl_elem_id *ids, unsigned int count)
+{
+    const unsigned int patterns =
+                        sizeof(name_patterns) / sizeof(name_patterns[0]);
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        memset(&ids[i], 0, sizeof(ids[i]));
+        ids[i].numid = i + 1;
+        ids[i].iface = SNDRV_CTL_ELEM_IFACE_MIXER;
+        /* Four elements in each name, as multiple channels of a device. */
+        ids[i].index = i % 4;
+        snprintf((char *)ids[i].name, sizeof(ids[i].name),
+                 name_patterns[(i / 4) % patterns], i / 4 / patterns);
+    }
+}
+
+static const struct snd_ctl_elem_id *scan_ids(
+                                    const struct snd_ctl_elem_id *ids,
+                                    unsigned int count,
+                                    const struct snd_ctl_elem_id *key)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        if (ids[i].iface == key->iface && ids[i].device == key->device &&
+            ids[i].subdevice == key->subdevice &&
+            ids[i].index == key->index &&
+            strncmp((const char *)ids[i].name, (const char *)key->name,
+                    sizeof(ids[i].name)) == 0)
+            return &ids[i];
+    }
+
+    return NULL;
+}
+
+static void report_rate(const char *label, uint64_t lookups,
+                        uint64_t elapsed, uint64_t misses)
+{
+    printf("  %-20s%12.0f lookups/sec, %8.1f ns/lookup, %lu misses\n",
+           label, lookups * 1e9 / elapsed, (double)elapsed / lookups,
+           (unsigned long)misses);
+}
+
+/* Each kind of lookup runs for the duration in seconds. */
+static int bench(unsigned int count, unsigned int seconds)
+{
+    struct ctl_elem_index index;
+    struct snd_ctl_elem_id *ids;
+    const struct snd_ctl_elem_id *key, *id;
+    char prefix[SNDRV_CTL_ELEM_ID_NAME_MAXLEN];
+    uint64_t begin, elapsed, end, lookups, misses, matches;
+    uint32_t state = 2463534242u;
+    unsigned int first;
+    unsigned int kind;
+    unsigned int i;
+    int err;
+
+    ids = calloc(count, sizeof(*ids));
+    if (ids == NULL)
+        return -ENOMEM;
+    make_ids(ids, count);
+
+    begin = latency_now();
+    err = ctl_elem_index_build(&index, ids, count);
+    elapsed = latency_now() - begin;
+    if (err < 0) {
+        free(ids);
+        return err;
+    }
+    printf("%u elements indexed in %.3f ms, %u slots for each table\n",
+           count, (double)elapsed / 1000000, index.mask + 1);
+
+    for (kind = 0; kind < 4; ++kind) {
+        lookups = misses = matches = 0;
+        begin = latency_now();
+        end = begin + seconds * 1000000000ull;
+        do {
+            /* Check the clock every 1024 lookups. */
+            for (i = 0; i < 1024; ++i) {
+                key = &ids[next_random(&state) % count];
+                switch (kind) {
+                case 0:
+                    id = ctl_elem_index_find(&index, key->iface, key->device,
+                                             key->subdevice,
+                                             (const char *)key->name,
+                                             key->index);
+                    break;
+                case 1:
+                    id = ctl_elem_index_find_numid(&index, key->numid);
+                    break;
+                case 2:
+                    /* A half of the name, like completion of client. */
+                    snprintf(prefix, sizeof(prefix), "%.*s",
+                             (int)strlen((const char *)key->name) / 2,
+                             key->name);
+                    matches += ctl_elem_index_prefix(&index, prefix, &first);
+                    id = ctl_elem_index_sorted(&index, first);
+                    break;
+                default:
+                    id = scan_ids(ids, count, key);
+                    break;
+                }
+                if (id == NULL)
+                    ++misses;
+                ++lookups;
+            }
+            elapsed = latency_now() - begin;
+        } while (latency_now() < end);
+
+        switch (kind) {
+        case 0:
+            report_rate("hash of identifier:", lookups, elapsed, misses);
+            break;
+        case 1:
+            report_rate("hash of numid:", lookups, elapsed, misses);
+            break;
+        case 2:
+            report_rate("prefix of name:", lookups, elapsed, misses);
+            printf("  %-20s%12.1f elements/lookup\n", "",
+                   (double)matches / lookups);
+            break;
+        default:
+            report_rate("linear scan:", lookups, elapsed, misses);
+            break;
+        }
+    }
+
+    ctl_elem_index_free(&index);
+    free(ids);
+    return 0;
+}
+
+int main(int argc, const char *const argv[])
+{
+    unsigned int count = 16384;
+    unsigned int seconds = 1;
+    int err;
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        if (argc > 2)
+            count = strtoul(argv[2], NULL, 10);
+        if (argc > 3)
+            seconds = strtoul(argv[3], NULL, 10);
+        if (count == 0 || seconds == 0) {
+            printf("Usage: %s bench [ELEMENTS [SECONDS]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        err = bench(count, seconds);
+    } else if (argc > 3 && (strcmp(argv[2], "find") == 0 ||
+                            strcmp(argv[2], "numid") == 0 ||
+                            strcmp(argv[2], "prefix") == 0)) {
+        err = lookup(argv[1], argc - 2, argv + 2);
+    } else {
+        printf("Usage:\n");
+        printf("  %s CONTROL-DEVICE find NAME [INDEX [IFACE [DEVICE "
+               "[SUBDEVICE]]]]\n", argv[0]);
+        printf("  %s CONTROL-DEVICE numid NUMID\n", argv[0]);
+        printf("  %s CONTROL-DEVICE prefix PREFIX\n", argv[0]);
+        printf("  %s bench [ELEMENTS [SECONDS]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
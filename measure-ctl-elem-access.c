@@ -0,0 +1,398 @@
+/*
+ * measure-ctl-elem-access.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Measure the throughput and the latency of ELEM_WRITE and ELEM_READ to
+ * user-defined elements while M writer threads and N reader threads run
+ * concurrently, for growing M and N. Each thread opens its own file, like
+ * independent clients of the control core. No hardware is required.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+
+#define BENCH_ELEM_NAME         "Access Bench Volume"
+/* The per-thread samples, replaced at random once filled. */
+#define MAX_LATENCY_SAMPLES     262144
+
+struct worker {
+    pthread_t thread;
+    struct run *run;
+    bool writer;
+    unsigned int serial;
+
+    struct latency_record latency;
+    uint64_t seen;
+    uint32_t state;
+    unsigned long ops;
+    int err;
+};
+
+struct run {
+    const char *path;
+    const struct snd_ctl_elem_id *ids;
+    unsigned int elements;
+    unsigned int channels;
+    uint64_t end;
+
+    /* The threads start at once. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool go;
+};
+
+static uint32_t next_random(uint32_t *state)
+{
+    /* xorshift32 */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/* Reservoir sampling keeps the distribution over the whole run. */
+static void record_latency(struct worker *worker, uint64_t ns)
+{
+    uint64_t slot;
+
+    if (worker->latency.count < worker->latency.size) {
+        latency_record_push(&worker->latency, ns);
+    } else {
+        slot = ((uint64_t)next_random(&worker->state) << 32 |
+                next_random(&worker->state)) % (worker->seen + 1);
+        if (slot < worker->latency.size)
+            worker->latency.samples[slot] = ns;
+    }
+    ++worker->seen;
+}
+
+static void *run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    struct run *run = worker->run;
+    struct snd_ctl_elem_value value = {0};
+    unsigned long request;
+    uint64_t begin, now;
+    unsigned int elem;
+    unsigned int i;
+    int fd;
+
+    fd = open(run->path, worker->writer ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        worker->err = -errno;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&run->lock);
+    while (!run->go)
+        pthread_cond_wait(&run->cond, &run->lock);
+    pthread_mutex_unlock(&run->lock);
+
+    request = worker->writer ? SNDRV_CTL_IOCTL_ELEM_WRITE :
+                               SNDRV_CTL_IOCTL_ELEM_READ;
+    elem = worker->serial % run->elements;
+
+    now = latency_now();
+    while (now < run->end) {
+        value.id = run->ids[elem];
+        if (worker->writer) {
+            /* The same value would not be written to the element. */
+            for (i = 0; i < run->channels; ++i)
+                value.value.integer.value[i] = (worker->ops + i) & 0xffff;
+        }
+
+        begin = now;
+        if (ioctl(fd, request, &value) < 0) {
+            worker->err = -errno;
+            break;
+        }
+        now = latency_now();
+
+        record_latency(worker, now - begin);
+        ++worker->ops;
+        /* Like faders moved one after another. */
+        elem = (elem + 1) % run->elements;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/* Gather the samples of the workers in the role. */
+static void merge_latency(struct worker *workers, unsigned int count,
+                          struct latency_record *rec)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        memcpy(rec->samples + rec->count, workers[i].latency.samples,
+               sizeof(*rec->samples) * workers[i].latency.count);
+        rec->count += workers[i].latency.count;
+    }
+}
+
+static void report_role(struct worker *workers, unsigned int count,
+                        unsigned int seconds, struct latency_record *rec)
+{
+    unsigned long ops = 0;
+    unsigned int i;
+
+    if (count == 0) {
+        printf(" %12s %8s %8s %8s", "-", "-", "-", "-");
+        return;
+    }
+
+    for (i = 0; i < count; ++i)
+        ops += workers[i].ops;
+
+    rec->count = 0;
+    merge_latency(workers, count, rec);
+    qsort(rec->samples, rec->count, sizeof(*rec->samples), latency_compare);
+
+    printf(" %12.0f %8llu %8llu %8llu", (double)ops / seconds,
+           (unsigned long long)latency_percentile(rec, 500),
+           (unsigned long long)latency_percentile(rec, 990),
+           (unsigned long long)latency_percentile(rec, 999));
+}
+
+static int run_once(struct run *run, unsigned int writers,
+                    unsigned int readers, unsigned int seconds,
+                    struct latency_record *rec)
+{
+    struct worker *workers;
+    unsigned int count = writers + readers;
+    unsigned int i, started;
+    int err = 0;
+
+    workers = calloc(count, sizeof(*workers));
+    if (workers == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < count; ++i) {
+        workers[i].run = run;
+        workers[i].writer = i < writers;
+        workers[i].serial = i < writers ? i : i - writers;
+        workers[i].state = 2463534242u + i;
+        err = latency_record_init(&workers[i].latency, NULL,
+                                  MAX_LATENCY_SAMPLES);
+        if (err < 0)
+            goto end;
+    }
+
+    run->go = false;
+    for (started = 0; started < count; ++started) {
+        err = -pthread_create(&workers[started].thread, NULL, run_worker,
+                              &workers[started]);
+        if (err < 0)
+            break;
+    }
+
+    pthread_mutex_lock(&run->lock);
+    /* The threads started quit at once on failure. */
+    run->end = err < 0 ? 0 : latency_now() + seconds * 1000000000ull;
+    run->go = true;
+    pthread_cond_broadcast(&run->cond);
+    pthread_mutex_unlock(&run->lock);
+
+    for (i = 0; i < started; ++i)
+        pthread_join(workers[i].thread, NULL);
+    if (err < 0)
+        goto end;
+
+    for (i = 0; i < count; ++i) {
+        if (workers[i].err < 0) {
+            err = workers[i].err;
+            goto end;
+        }
+    }
+
+    printf("%7u %7u", writers, readers);
+    report_role(workers, writers, seconds, rec);
+    report_role(workers + writers, readers, seconds, rec);
+    printf("\n");
+end:
+    for (i = 0; i < count; ++i)
+        latency_record_fini(&workers[i].latency);
+    free(workers);
+    return err;
+}
+
+static int add_elems(int fd, struct snd_ctl_elem_id *ids,
+                     unsigned int elements, unsigned int channels)
+{
+    struct snd_ctl_elem_info info;
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < elements; ++i) {
+        memset(&info, 0, sizeof(info));
+        info.id.iface = SNDRV_CTL_ELEM_IFACE_MIXER;
+        snprintf((char *)info.id.name, sizeof(info.id.name),
+                 BENCH_ELEM_NAME);
+        info.id.index = i;
+        info.type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+        info.access = SNDRV_CTL_ELEM_ACCESS_READWRITE;
+        info.count = channels;
+        info.value.integer.min = 0;
+        info.value.integer.max = 0xffff;
+        info.value.integer.step = 1;
+
+        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_ADD, &info) < 0) {
+            err = -errno;
+            /* Left by the previous run which was killed. */
+            if (err == -EBUSY &&
+                ioctl(fd, SNDRV_CTL_IOCTL_ELEM_REMOVE, &info.id) == 0 &&
+                ioctl(fd, SNDRV_CTL_IOCTL_ELEM_ADD, &info) == 0)
+                err = 0;
+            if (err < 0)
+                goto error;
+        }
+        ids[i] = info.id;
+
+        /* The element added is locked for the file, else EPERM to write. */
+        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_UNLOCK, &ids[i]) < 0) {
+            err = -errno;
+            ++i;
+            goto error;
+        }
+    }
+
+    return 0;
+error:
+    while (i > 0)
+        ioctl(fd, SNDRV_CTL_IOCTL_ELEM_REMOVE, &ids[--i]);
+    return err;
+}
+
+static int measure(const char *path, unsigned int seconds,
+                   unsigned int max_writers, unsigned int max_readers,
+                   unsigned int elements)
+{
+    struct run run = {0};
+    struct snd_ctl_elem_id *ids;
+    struct latency_record rec;
+    unsigned int writers, readers;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        printf("open(2): %s\n", strerror(errno));
+        return -errno;
+    }
+
+    ids = calloc(elements, sizeof(*ids));
+    if (ids == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+    /* Two channels, as the volume of stereo pair. */
+    err = add_elems(fd, ids, elements, 2);
+    if (err < 0) {
+        printf("ioctl(ELEM_ADD): %s\n", strerror(-err));
+        goto end;
+    }
+
+    err = latency_record_init(&rec, NULL,
+                    MAX_LATENCY_SAMPLES * (max_writers > max_readers ?
+                                           max_writers : max_readers));
+    if (err < 0)
+        goto remove;
+
+    run.path = path;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.cond, NULL);
+    run.ids = ids;
+    run.elements = elements;
+    run.channels = 2;
+
+    printf("%u elements, %u seconds for each, latency in nano seconds\n",
+           elements, seconds);
+    printf("%7s %7s %12s %8s %8s %8s %12s %8s %8s %8s\n",
+           "writers", "readers", "writes/sec", "p50", "p99", "p99.9",
+           "reads/sec", "p50", "p99", "p99.9");
+
+    /* Doubling each of them, till the maximum. */
+    writers = 1;
+    while (1) {
+        readers = 0;
+        while (1) {
+            err = run_once(&run, writers, readers, seconds, &rec);
+            if (err < 0) {
+                printf("Fail to run: %s\n", strerror(-err));
+                goto fini;
+            }
+            if (readers >= max_readers)
+                break;
+            readers = readers > 0 ? readers * 2 : 1;
+            if (readers > max_readers)
+                readers = max_readers;
+        }
+        if (writers >= max_writers)
+            break;
+        writers *= 2;
+        if (writers > max_writers)
+            writers = max_writers;
+    }
+fini:
+    pthread_cond_destroy(&run.cond);
+    pthread_mutex_destroy(&run.lock);
+    latency_record_fini(&rec);
+remove:
+    for (writers = 0; writers < elements; ++writers)
+        ioctl(fd, SNDRV_CTL_IOCTL_ELEM_REMOVE, &ids[writers]);
+end:
+    free(ids);
+    close(fd);
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    unsigned int seconds = 1;
+    unsigned int max_writers = 4;
+    unsigned int max_readers = 4;
+    unsigned int elements = 8;
+
+    if (argc < 2) {
+        printf("Usage: %s CONTROL-DEVICE [SECONDS [MAX-WRITERS "
+               "[MAX-READERS [ELEMENTS]]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 2)
+        seconds = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        max_writers = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        max_readers = strtoul(argv[4], NULL, 10);
+    if (argc > 5)
+        elements = strtoul(argv[5], NULL, 10);
+    if (seconds == 0 || max_writers == 0 || elements == 0) {
+        printf("Seconds, writers and elements should be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (measure(argv[1], seconds, max_writers, max_readers, elements) < 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+/*
+ * measure-period-wakeups.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Block in poll(2) on a running PCM substream and timestamp every wakeup,
+ * then report histograms of the jitter against the expected boundary of
+ * period and of the scheduling delay since the boundary. Optionally the
+ * period wakeup is disabled and a timerfd wakes the program instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "pcm-stream.h"
+
+/* Buckets of power of two in micro seconds, for each sign. */
+#define HISTOGRAM_BUCKETS   24
+
+struct histogram {
+    const char *label;
+    uint64_t negative[HISTOGRAM_BUCKETS];
+    uint64_t positive[HISTOGRAM_BUCKETS];
+    int64_t min;
+    int64_t max;
+    double sum;
+    uint64_t count;
+};
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static int64_t get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+static void histogram_add(struct histogram *hist, int64_t ns)
+{
+    uint64_t us = (ns < 0 ? -ns : ns) / 1000;
+    unsigned int bucket = 0;
+
+    while (us > 0 && bucket < HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    if (ns < 0)
+        ++hist->negative[bucket];
+    else
+        ++hist->positive[bucket];
+
+    if (hist->count == 0 || ns < hist->min)
+        hist->min = ns;
+    if (hist->count == 0 || ns > hist->max)
+        hist->max = ns;
+    hist->sum += ns;
+    ++hist->count;
+}
+
+static void dump_bucket(int sign, unsigned int bucket, uint64_t count,
+                        uint64_t total)
+{
+    unsigned int width = count * 50 / total;
+    unsigned int i;
+
+    if (bucket == 0)
+        printf("      %c%9s us: %10" PRIu64 " ", sign, "<1", count);
+    else
+        printf("      %c%9u us: %10" PRIu64 " ", sign, 1u << (bucket - 1),
+               count);
+    for (i = 0; i < width; ++i)
+        printf("#");
+    printf("\n");
+}
+
+static void histogram_dump(const struct histogram *hist)
+{
+    int i;
+
+    printf("  %s:\n", hist->label);
+    if (hist->count == 0)
+        return;
+
+    printf("    min:    %" PRId64 " ns\n", hist->min);
+    printf("    max:    %" PRId64 " ns\n", hist->max);
+    printf("    mean:   %.1f ns\n", hist->sum / hist->count);
+    printf("    distribution (lower bound of bucket):\n");
+
+    for (i = HISTOGRAM_BUCKETS - 1; i >= 0; --i) {
+        if (hist->negative[i] > 0)
+            dump_bucket('-', i, hist->negative[i], hist->count);
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (hist->positive[i] > 0)
+            dump_bucket('+', i, hist->positive[i], hist->count);
+    }
+}
+
+static int arm_timer(int fd, int64_t period_ns)
+{
+    struct itimerspec spec = {0};
+
+    spec.it_interval.tv_sec = period_ns / 1000000000;
+    spec.it_interval.tv_nsec = period_ns % 1000000000;
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+        return -errno;
+    return 0;
+}
+
+static int wait_wakeups(struct pcm_stream *stream, int timer_fd,
+                        unsigned int seconds, struct histogram *jitter,
+                        struct histogram *delay, struct histogram *interval)
+{
+    struct pollfd pfd;
+    struct snd_pcm_status status;
+    snd_pcm_uframes_t period = stream->config.period_size;
+    int64_t period_ns = (int64_t)period * 1000000000ll / stream->config.rate;
+    int64_t trigger, expected, boundary, now, prev = 0, end;
+    /* Two periods, at least a second. */
+    int timeout = 1000 + (int)(period_ns * 2 / 1000000);
+    uint64_t expirations;
+    int err;
+
+    if (timer_fd >= 0) {
+        pfd.fd = timer_fd;
+        pfd.events = POLLIN;
+    } else {
+        pfd.fd = stream->fd;
+        pfd.events =
+            stream->direction == SNDRV_PCM_STREAM_PLAYBACK ? POLLOUT : POLLIN;
+    }
+
+    memset(&status, 0, sizeof(status));
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+        return -errno;
+    trigger = timespec_to_ns(&status.trigger_tstamp);
+
+    end = get_time() + (int64_t)seconds * 1000000000ll;
+
+    while (1) {
+        err = poll(&pfd, 1, timeout);
+        if (err < 0)
+            return -errno;
+        /* No wakeup for two periods; the substream stalls. */
+        if (err == 0)
+            return -ETIMEDOUT;
+        now = get_time();
+        if (now >= end)
+            break;
+
+        if (timer_fd >= 0 &&
+            read(timer_fd, &expirations, sizeof(expirations)) < 0)
+            return -errno;
+
+        /* Query the position; it updates hw_ptr and tstamp as well. */
+        memset(&status, 0, sizeof(status));
+        if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+            return -errno;
+        if (status.state != SNDRV_PCM_STATE_RUNNING) {
+            printf("The substream stops in state %d.\n", status.state);
+            return -EPIPE;
+        }
+
+        /* The boundary which the hardware pointer passed most recently. */
+        expected = trigger + (int64_t)(status.hw_ptr / period) * period_ns;
+        histogram_add(jitter, now - expected);
+
+        /* Estimate the time of the boundary by the audio position. */
+        boundary = timespec_to_ns(&status.tstamp) -
+                   (int64_t)(status.hw_ptr % period) * 1000000000ll /
+                   stream->config.rate;
+        histogram_add(delay, now - boundary);
+
+        if (prev > 0)
+            histogram_add(interval, now - prev - period_ns);
+        prev = now;
+
+        /* Consume all of available frames without any transmission. */
+        err = pcm_stream_commit(stream, (status.appl_ptr + status.avail) %
+                                        stream->boundary);
+        if (err < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct pcm_stream_config config = {
+        .access = SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct histogram jitter = {
+        .label = "Jitter against expected boundary of period",
+    };
+    struct histogram delay = {
+        .label = "Scheduling delay since boundary estimated by tstamp",
+    };
+    struct histogram interval = {
+        .label = "Deviation of interval between wakeups from period",
+    };
+    struct pcm_stream stream;
+    struct snd_pcm_sw_params sw_params;
+    const char *path;
+    unsigned int seconds;
+    bool by_timer = false;
+    int timer_fd = -1;
+    int err;
+
+    if (argc < 3) {
+        printf("Usage: %s PCM-DEVICE SECONDS "
+               "[RATE [PERIOD-SIZE [PERIODS [timer]]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    path = argv[1];
+    seconds = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        config.rate = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        config.period_size = strtoul(argv[4], NULL, 10);
+    if (argc > 5)
+        config.periods = strtoul(argv[5], NULL, 10);
+    if (argc > 6 && strcmp(argv[6], "timer") == 0) {
+        by_timer = true;
+        config.flags |= SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
+    }
+
+    err = pcm_stream_open(&stream, path, O_RDWR | O_NONBLOCK);
+    if (err < 0) {
+        printf("open(2): %s\n", strerror(-err));
+        return EXIT_FAILURE;
+    }
+
+    err = pcm_stream_configure(&stream, &config);
+    if (err < 0) {
+        printf("ioctl(HW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    if (by_timer && !(stream.info & SNDRV_PCM_INFO_NO_PERIOD_WAKEUP))
+        printf("The driver does not support no-period-wakeup; "
+               "period wakeups are still enabled.\n");
+
+    pcm_stream_init_sw_params(&stream, &sw_params);
+    pcm_stream_free_running(&stream, &sw_params);
+    err = pcm_stream_set_sw_params(&stream, &sw_params);
+    if (err < 0) {
+        printf("ioctl(SW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    /* Optional; SNDRV_PCM_IOCTL_SYNC_PTR is used instead. */
+    if (pcm_stream_map_pointers(&stream) < 0)
+        printf("Status/control pages are not available.\n");
+
+    if (by_timer) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timer_fd < 0) {
+            err = -errno;
+            printf("timerfd_create(2): %s\n", strerror(-err));
+            goto end;
+        }
+    }
+
+    if (ioctl(stream.fd, SNDRV_PCM_IOCTL_PREPARE) < 0 ||
+        ioctl(stream.fd, SNDRV_PCM_IOCTL_START) < 0) {
+        err = -errno;
+        printf("ioctl(START): %s\n", strerror(-err));
+        goto end;
+    }
+
+    if (timer_fd >= 0) {
+        err = arm_timer(timer_fd, (int64_t)stream.config.period_size *
+                                  1000000000ll / stream.config.rate);
+        if (err < 0) {
+            printf("timerfd_settime(2): %s\n", strerror(-err));
+            goto end;
+        }
+    }
+
+    printf("%s\n", path);
+    printf("  rate:         %u\n", stream.config.rate);
+    printf("  period-size:  %lu\n", stream.config.period_size);
+    printf("  buffer-size:  %lu\n", stream.buffer_size);
+    printf("  wakeup:       %s\n", by_timer ? "timerfd" : "period");
+
+    err = wait_wakeups(&stream, timer_fd, seconds, &jitter, &delay,
+                       &interval);
+    if (err < 0)
+        printf("Measurement aborts: %s\n", strerror(-err));
+
+    histogram_dump(&jitter);
+    histogram_dump(&delay);
+    histogram_dump(&interval);
+end:
+    if (timer_fd >= 0)
+        close(timer_fd);
+    ioctl(stream.fd, SNDRV_PCM_IOCTL_DROP);
+    pcm_stream_close(&stream);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,623 @@
+/*
+ * monitor-ctl-events.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Monitor the events of control elements on all control character devices
+ * by one epoll(7) loop, and keep a model of element values up to date by
+ * reading only the elements notified. The benchmark mode measures latency
+ * from ELEM_WRITE in a second thread to the notification, and the rate of
+ * events, with a user-defined element.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "ctl-snapshot.h"
+
+/* Events read by one read(2). */
+#define EVENT_BATCH             64
+#define MAX_CARDS               32
+#define MAX_LATENCY_SAMPLES     65536
+#define BENCH_ELEM_NAME         "Monitor Event Bench"
+
+/* The value of element kept by its numid. */
+struct model_slot {
+    struct ctl_snapshot_elem elem;
+    bool present;
+};
+
+struct card_model {
+    int fd;
+    char path[32];
+
+    struct model_slot *slots;
+    unsigned int slot_count;
+    unsigned char *values;
+    size_t size;
+    size_t capacity;
+
+    unsigned long events;
+    unsigned long reads;
+};
+
+struct bench {
+    int fd;
+    struct snd_ctl_elem_id id;
+    unsigned int seconds;
+
+    /* Shared between the writer and the reader. */
+    uint64_t written_at;
+    unsigned long writes;
+    unsigned long acked;
+    bool ping_pong;
+    bool stop;
+    int err;
+
+    /* The period of the burst, measured by the writer. */
+    uint64_t burst_begin;
+    uint64_t burst_end;
+
+    struct latency_record latency;
+};
+
+static int grow_slots(struct card_model *model, unsigned int numid)
+{
+    struct model_slot *slots;
+    unsigned int count;
+
+    if (numid < model->slot_count)
+        return 0;
+
+    count = model->slot_count > 0 ? model->slot_count : 64;
+    while (count <= numid)
+        count *= 2;
+    slots = realloc(model->slots, sizeof(*slots) * count);
+    if (slots == NULL)
+        return -ENOMEM;
+    memset(slots + model->slot_count, 0,
+           sizeof(*slots) * (count - model->slot_count));
+    model->slots = slots;
+    model->slot_count = count;
+
+    return 0;
+}
+
+static int reserve_values(struct card_model *model, size_t size)
+{
+    unsigned char *values;
+    size_t capacity;
+
+    if (model->size + size <= model->capacity)
+        return 0;
+
+    capacity = model->capacity > 0 ? model->capacity : 4096;
+    while (capacity < model->size + size)
+        capacity *= 2;
+    values = realloc(model->values, capacity);
+    if (values == NULL)
+        return -ENOMEM;
+    model->values = values;
+    model->capacity = capacity;
+
+    return 0;
+}
+
+/*
+ * Read the element again. Returns the number of changed members, or the
+ * number of members for the element which newly appears.
+ */
+static int update_model(struct card_model *model, unsigned int numid)
+{
+    struct snd_ctl_elem_info info = {0};
+    struct snd_ctl_elem_value value = {0};
+    struct model_slot *slot;
+    unsigned char packed[sizeof(value.value)];
+    size_t member, size;
+    unsigned int i;
+    int changed = 0;
+    int err;
+
+    err = grow_slots(model, numid);
+    if (err < 0)
+        return err;
+    slot = &model->slots[numid];
+
+    info.id.numid = numid;
+    if (ioctl(model->fd, SNDRV_CTL_IOCTL_ELEM_INFO, &info) < 0) {
+        if (errno != ENOENT)
+            return -errno;
+        slot->present = false;
+        return 0;
+    }
+    member = ctl_snapshot_member_size(info.type);
+    if (!(info.access & SNDRV_CTL_ELEM_ACCESS_READ) || member == 0) {
+        slot->present = false;
+        return 0;
+    }
+
+    value.id = info.id;
+    if (ioctl(model->fd, SNDRV_CTL_IOCTL_ELEM_READ, &value) < 0)
+        return errno == ENOENT || errno == EPERM ? 0 : -errno;
+    ++model->reads;
+
+    if (info.type == SNDRV_CTL_ELEM_TYPE_IEC958)
+        info.count = 1;
+    size = info.count * member;
+
+    /* The space for the element in the other shape is not reused. */
+    if (!slot->present || slot->elem.type != info.type ||
+        slot->elem.count != info.count) {
+        err = reserve_values(model, size);
+        if (err < 0)
+            return err;
+        slot->elem.offset = model->size;
+        model->size += size;
+        changed = info.count;
+    }
+    slot->elem.id = info.id;
+    slot->elem.type = info.type;
+    slot->elem.access = info.access;
+    slot->elem.count = info.count;
+
+    ctl_snapshot_pack(&slot->elem, &value, packed);
+    if (slot->present && changed == 0) {
+        for (i = 0; i < info.count; ++i) {
+            if (memcmp(packed + i * member,
+                       model->values + slot->elem.offset + i * member,
+                       member))
+                ++changed;
+        }
+    }
+    memcpy(model->values + slot->elem.offset, packed, size);
+    slot->present = true;
+
+    return changed;
+}
+
+static int init_model(struct card_model *model)
+{
+    struct snd_ctl_elem_id *ids;
+    unsigned int i, count;
+    int err;
+
+    err = ctl_snapshot_list_ids(model->fd, &ids, &count);
+    if (err < 0)
+        return err;
+
+    for (i = 0; i < count; ++i) {
+        err = update_model(model, ids[i].numid);
+        if (err < 0)
+            break;
+    }
+    free(ids);
+
+    return err < 0 ? err : 0;
+}
+
+static void free_model(struct card_model *model)
+{
+    if (model->fd >= 0)
+        close(model->fd);
+    free(model->slots);
+    free(model->values);
+}
+
+static int open_model(struct card_model *model, const char *path, int epfd)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int subscribe = 1;
+    int err;
+
+    memset(model, 0, sizeof(*model));
+    snprintf(model->path, sizeof(model->path), "%s", path);
+
+    model->fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (model->fd < 0)
+        return -errno;
+
+    if (ioctl(model->fd, SNDRV_CTL_IOCTL_SUBSCRIBE_EVENTS, &subscribe) < 0)
+        return -errno;
+
+    /* Subscribe in advance so that no change is lost during the walk. */
+    err = init_model(model);
+    if (err < 0)
+        return err;
+
+    ev.data.ptr = model;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, model->fd, &ev) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static void dump_event(const struct card_model *model,
+                       const struct snd_ctl_event *ev, int changed)
+{
+    static const struct {
+        unsigned int mask;
+        const char *label;
+    } masks[] = {
+        { SNDRV_CTL_EVENT_MASK_VALUE,   "value" },
+        { SNDRV_CTL_EVENT_MASK_INFO,    "info" },
+        { SNDRV_CTL_EVENT_MASK_ADD,     "add" },
+        { SNDRV_CTL_EVENT_MASK_TLV,     "tlv" },
+    };
+    unsigned int i;
+
+    printf("%s: numid %u '%s',%u:", model->path, ev->data.elem.id.numid,
+           ev->data.elem.id.name, ev->data.elem.id.index);
+
+    if (ev->data.elem.mask == SNDRV_CTL_EVENT_MASK_REMOVE) {
+        printf(" remove\n");
+        return;
+    }
+    for (i = 0; i < sizeof(masks) / sizeof(masks[0]); ++i) {
+        if (ev->data.elem.mask & masks[i].mask)
+            printf(" %s", masks[i].label);
+    }
+    printf(", %d members changed\n", changed);
+}
+
+/* Read all of queued events in batches, then refresh notified elements. */
+static int handle_events(struct card_model *model, struct bench *bench,
+                         bool verbose)
+{
+    struct snd_ctl_event events[EVENT_BATCH];
+    struct snd_ctl_event *ev;
+    unsigned int i, count;
+    uint64_t now;
+    ssize_t len;
+    int changed;
+
+    while (true) {
+        len = read(model->fd, events, sizeof(events));
+        if (len < 0)
+            return errno == EAGAIN ? 0 : -errno;
+        now = latency_now();
+
+        count = len / sizeof(events[0]);
+        for (i = 0; i < count; ++i) {
+            ev = &events[i];
+            if (ev->type != SNDRV_CTL_EVENT_ELEM)
+                continue;
+            ++model->events;
+
+            /* Notified before the model is updated. */
+            if (bench != NULL && ev->data.elem.id.numid == bench->id.numid &&
+                (ev->data.elem.mask & SNDRV_CTL_EVENT_MASK_VALUE) &&
+                ev->data.elem.mask != SNDRV_CTL_EVENT_MASK_REMOVE &&
+                __atomic_load_n(&bench->ping_pong, __ATOMIC_ACQUIRE)) {
+                latency_record_push(&bench->latency,
+                                    now - __atomic_load_n(&bench->written_at,
+                                                          __ATOMIC_ACQUIRE));
+                __atomic_add_fetch(&bench->acked, 1, __ATOMIC_RELEASE);
+            }
+
+            if (ev->data.elem.mask == SNDRV_CTL_EVENT_MASK_REMOVE) {
+                if (ev->data.elem.id.numid < model->slot_count)
+                    model->slots[ev->data.elem.id.numid].present = false;
+                changed = 0;
+            } else if (ev->data.elem.mask & (SNDRV_CTL_EVENT_MASK_VALUE |
+                                             SNDRV_CTL_EVENT_MASK_INFO |
+                                             SNDRV_CTL_EVENT_MASK_ADD)) {
+                changed = update_model(model, ev->data.elem.id.numid);
+                if (changed < 0)
+                    return changed;
+            } else {
+                changed = 0;
+            }
+
+            if (verbose)
+                dump_event(model, ev, changed);
+        }
+    }
+}
+
+static int monitor_cards(unsigned int seconds)
+{
+    struct card_model models[MAX_CARDS];
+    struct epoll_event events[MAX_CARDS];
+    struct card_model *model;
+    unsigned int i, count = 0;
+    uint64_t end = 0;
+    glob_t paths;
+    int epfd;
+    int timeout;
+    int ready;
+    int err;
+
+    if (glob("/dev/snd/controlC*", 0, NULL, &paths) != 0) {
+        printf("No control character device found.\n");
+        return -ENODEV;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        err = -errno;
+        globfree(&paths);
+        return err;
+    }
+
+    for (i = 0; i < paths.gl_pathc && count < MAX_CARDS; ++i) {
+        err = open_model(&models[count], paths.gl_pathv[i], epfd);
+        if (err < 0) {
+            printf("%s: %s\n", paths.gl_pathv[i], strerror(-err));
+            free_model(&models[count]);
+            continue;
+        }
+        printf("%s: %u elements in model\n", models[count].path,
+               (unsigned int)models[count].reads);
+        ++count;
+    }
+    globfree(&paths);
+
+    if (seconds > 0)
+        end = latency_now() + seconds * 1000000000ull;
+
+    err = 0;
+    while (count > 0 && err == 0) {
+        timeout = -1;
+        if (seconds > 0) {
+            if (latency_now() >= end)
+                break;
+            timeout = (end - latency_now()) / 1000000 + 1;
+        }
+
+        ready = epoll_wait(epfd, events, MAX_CARDS, timeout);
+        if (ready < 0) {
+            if (errno != EINTR)
+                err = -errno;
+            continue;
+        }
+
+        for (i = 0; i < ready; ++i) {
+            model = events[i].data.ptr;
+            err = handle_events(model, NULL, true);
+            if (err < 0) {
+                printf("%s: %s\n", model->path, strerror(-err));
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        printf("%s: %lu events, %lu reads\n", models[i].path,
+               models[i].events, models[i].reads);
+        free_model(&models[i]);
+    }
+    close(epfd);
+
+    return err;
+}
+
+static int add_bench_elem(struct bench *bench)
+{
+    struct snd_ctl_elem_info info = {0};
+
+    info.id.iface = SNDRV_CTL_ELEM_IFACE_MIXER;
+    snprintf((char *)info.id.name, sizeof(info.id.name), BENCH_ELEM_NAME);
+    info.type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+    info.access = SNDRV_CTL_ELEM_ACCESS_READWRITE;
+    info.count = 1;
+    info.value.integer.min = 0;
+    info.value.integer.max = INT32_MAX;
+    info.value.integer.step = 1;
+
+    if (ioctl(bench->fd, SNDRV_CTL_IOCTL_ELEM_ADD, &info) < 0)
+        return -errno;
+    bench->id = info.id;
+
+    return 0;
+}
+
+/* The value should differ from the last one, else no event is queued. */
+static int write_bench_elem(struct bench *bench)
+{
+    struct snd_ctl_elem_value value = {0};
+
+    value.id = bench->id;
+    value.value.integer.value[0] = (bench->writes + 1) % INT32_MAX;
+
+    if (ioctl(bench->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &value) < 0)
+        return -errno;
+    ++bench->writes;
+
+    return 0;
+}
+
+static void *write_bench(void *arg)
+{
+    struct bench *bench = arg;
+    uint64_t end, written_at;
+    unsigned long writes;
+    int err = 0;
+
+    /* One write in flight at a time, for latency. */
+    end = latency_now() + bench->seconds * 500000000ull;
+    while (latency_now() < end && err == 0) {
+        writes = bench->writes;
+        written_at = latency_now();
+        __atomic_store_n(&bench->written_at, written_at, __ATOMIC_RELEASE);
+        err = write_bench_elem(bench);
+        while (err == 0 &&
+               __atomic_load_n(&bench->acked, __ATOMIC_ACQUIRE) <= writes &&
+               !__atomic_load_n(&bench->stop, __ATOMIC_ACQUIRE)) {
+            if (latency_now() - written_at > 1000000000ull)
+                err = -ETIMEDOUT;
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&bench->ping_pong, false, __ATOMIC_RELEASE);
+
+    /* Writes in a burst, for rate. */
+    __atomic_store_n(&bench->writes, 0, __ATOMIC_RELEASE);
+    bench->burst_begin = latency_now();
+    end = bench->burst_begin + bench->seconds * 500000000ull;
+    while (latency_now() < end && err == 0)
+        err = write_bench_elem(bench);
+    bench->burst_end = latency_now();
+
+    bench->err = err;
+    __atomic_store_n(&bench->stop, true, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static int run_bench(const char *path, unsigned int seconds)
+{
+    struct card_model model;
+    struct epoll_event ev;
+    struct bench bench = {0};
+    pthread_t thread;
+    unsigned long events;
+    uint64_t received_at, elapsed;
+    bool in_burst;
+    int epfd;
+    int ready;
+    int err;
+
+    bench.seconds = seconds;
+    bench.ping_pong = true;
+    err = latency_record_init(&bench.latency, "write-to-event",
+                              MAX_LATENCY_SAMPLES);
+    if (err < 0)
+        return err;
+
+    /* The writer uses the other file, which is not subscribed. */
+    bench.fd = open(path, O_RDWR);
+    if (bench.fd < 0) {
+        err = -errno;
+        printf("open(2): %s\n", strerror(errno));
+        latency_record_fini(&bench.latency);
+        return err;
+    }
+    err = add_bench_elem(&bench);
+    if (err < 0) {
+        printf("ioctl(ELEM_ADD): %s\n", strerror(-err));
+        goto end;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        err = -errno;
+        goto remove;
+    }
+    err = open_model(&model, path, epfd);
+    if (err < 0) {
+        printf("%s: %s\n", path, strerror(-err));
+        goto close_model;
+    }
+
+    err = -pthread_create(&thread, NULL, write_bench, &bench);
+    if (err < 0)
+        goto close_model;
+
+    in_burst = false;
+    received_at = 0;
+    events = 0;
+    while (true) {
+        ready = epoll_wait(epfd, &ev, 1, 100);
+        if (ready < 0 && errno != EINTR) {
+            err = -errno;
+            __atomic_store_n(&bench.stop, true, __ATOMIC_RELEASE);
+            break;
+        }
+        if (ready > 0) {
+            /* The burst begins when the writer leaves ping-pong. */
+            if (!in_burst &&
+                !__atomic_load_n(&bench.ping_pong, __ATOMIC_ACQUIRE)) {
+                in_burst = true;
+                events = model.events;
+            }
+            err = handle_events(&model, &bench, false);
+            if (err < 0) {
+                __atomic_store_n(&bench.stop, true, __ATOMIC_RELEASE);
+                break;
+            }
+            if (in_burst)
+                received_at = latency_now();
+        } else if (__atomic_load_n(&bench.stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+    events = model.events - events;
+
+    pthread_join(thread, NULL);
+    if (err == 0)
+        err = bench.err;
+
+    /* Without the idle tail which the reader waits for to stop. */
+    elapsed = bench.burst_end - bench.burst_begin;
+
+    printf("%s:\n", path);
+    latency_dump_header();
+    latency_record_dump(&bench.latency);
+    if (in_burst && elapsed > 0) {
+        printf("  burst writes/sec:   %.1f\n",
+               (double)bench.writes * 1000000000 / elapsed);
+        /* Till the last event of the burst is received. */
+        if (received_at > bench.burst_begin)
+            elapsed = received_at - bench.burst_begin;
+        printf("  burst events/sec:   %.1f\n",
+               (double)events * 1000000000 / elapsed);
+        printf("  coalesced:          %lu\n",
+               bench.writes > events ? bench.writes - events : 0);
+    }
+close_model:
+    free_model(&model);
+    close(epfd);
+remove:
+    ioctl(bench.fd, SNDRV_CTL_IOCTL_ELEM_REMOVE, &bench.id);
+end:
+    close(bench.fd);
+    latency_record_fini(&bench.latency);
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    unsigned int seconds = 0;
+    int err;
+
+    if (argc > 2 && strcmp(argv[1], "bench") == 0) {
+        seconds = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+        if (seconds == 0) {
+            printf("Usage: %s bench CONTROL-DEVICE [SECONDS]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        err = run_bench(argv[2], seconds);
+    } else if (argc > 2) {
+        printf("Usage: %s [SECONDS]\n", argv[0]);
+        printf("       %s bench CONTROL-DEVICE [SECONDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    } else {
+        if (argc > 1)
+            seconds = strtoul(argv[1], NULL, 10);
+        err = monitor_cards(seconds);
+    }
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
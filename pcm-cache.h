@@ -0,0 +1,373 @@
+/*
+ * pcm-cache.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * On-disk cache of snd_pcm_info and refined snd_pcm_hw_params, to skip the
+ * probe by SNDRV_CTL_IOCTL_PCM_INFO and SNDRV_PCM_IOCTL_HW_REFINE. Entries
+ * are keyed by id, driver and components of the card, the version of PCM
+ * protocol and the release of kernel, and looked up in the mapped file. An
+ * entry is stale once the character device of control or PCM is created
+ * again, since its ctime changes.
+ */
+
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/utsname.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sound/asound.h>
+
+#define PCM_CACHE_MAGIC		"PCMCACHE"
+#define PCM_CACHE_VERSION	1
+
+/* Which results the entry holds. */
+#define PCM_CACHE_INFO		(1u << 0)
+#define PCM_CACHE_PARAMS	(1u << 1)
+/* Stored together with all of the other substreams in the card. */
+#define PCM_CACHE_LISTED	(1u << 2)
+
+/* Matches any subdevice in lookup. */
+#define PCM_CACHE_ANY		-1
+
+struct pcm_cache_key {
+	char id[16];
+	char driver[16];
+	char components[128];
+	char release[65];
+	unsigned int pversion;
+};
+
+struct pcm_cache_entry {
+	struct pcm_cache_key key;
+	int card;
+	int device;
+	int subdevice;
+	int stream;
+	int64_t ctl_ctime;
+	int64_t node_ctime;
+	unsigned int flags;
+	int refine_err;
+	struct snd_pcm_info info;
+	struct snd_pcm_hw_params params;
+};
+
+struct pcm_cache_header {
+	char magic[8];
+	uint32_t version;
+	/* Detects change of layout of the structures in uAPI. */
+	uint32_t entry_size;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct pcm_cache {
+	void *map;
+	size_t size;
+	const struct pcm_cache_entry *entries;
+	unsigned int count;
+};
+
+static inline int pcm_cache_make_key(const struct snd_ctl_card_info *info,
+				     struct pcm_cache_key *key)
+{
+	struct utsname name;
+
+	if (uname(&name) < 0)
+		return -errno;
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key->id, info->id, sizeof(key->id));
+	memcpy(key->driver, info->driver, sizeof(key->driver));
+	memcpy(key->components, info->components, sizeof(key->components));
+	snprintf(key->release, sizeof(key->release), "%s", name.release);
+	/* The protocol which this program speaks. */
+	key->pversion = SNDRV_PCM_VERSION;
+
+	return 0;
+}
+
+static inline int pcm_cache_get_ctime(const char *path, int64_t *ctime)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return -errno;
+	*ctime = (int64_t)st.st_ctim.tv_sec * 1000000000ll + st.st_ctim.tv_nsec;
+
+	return 0;
+}
+
+static inline int pcm_cache_get_ctimes(int card, int device, int stream,
+				       int64_t *ctl_ctime, int64_t *node_ctime)
+{
+	char path[64];
+	int err;
+
+	snprintf(path, sizeof(path), "/dev/snd/controlC%d", card);
+	err = pcm_cache_get_ctime(path, ctl_ctime);
+	if (err < 0)
+		return err;
+
+	snprintf(path, sizeof(path), "/dev/snd/pcmC%dD%d%c", card, device,
+		 stream == SNDRV_PCM_STREAM_CAPTURE ? 'c' : 'p');
+	return pcm_cache_get_ctime(path, node_ctime);
+}
+
+static inline int pcm_cache_init_entry(struct pcm_cache_entry *entry,
+				       const struct pcm_cache_key *key,
+				       int card, int device, int subdevice,
+				       int stream)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->key = *key;
+	entry->card = card;
+	entry->device = device;
+	entry->subdevice = subdevice;
+	entry->stream = stream;
+
+	return pcm_cache_get_ctimes(card, device, stream, &entry->ctl_ctime,
+				    &entry->node_ctime);
+}
+
+/* The missing file is an empty cache. */
+static inline int pcm_cache_open(struct pcm_cache *cache, const char *path)
+{
+	const struct pcm_cache_header *header;
+	struct stat st;
+	int fd;
+	int err;
+
+	memset(cache, 0, sizeof(*cache));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	if (st.st_size < sizeof(*header)) {
+		close(fd);
+		return 0;
+	}
+
+	cache->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (cache->map == MAP_FAILED) {
+		cache->map = NULL;
+		return err;
+	}
+	cache->size = st.st_size;
+
+	/* Written by the other build or version; just ignored. */
+	header = cache->map;
+	if (memcmp(header->magic, PCM_CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != PCM_CACHE_VERSION ||
+	    header->entry_size != sizeof(struct pcm_cache_entry) ||
+	    header->count > (cache->size - sizeof(*header)) /
+			    sizeof(struct pcm_cache_entry))
+		return 0;
+
+	cache->entries = (const void *)(header + 1);
+	cache->count = header->count;
+
+	return 0;
+}
+
+static inline void pcm_cache_close(struct pcm_cache *cache)
+{
+	if (cache->map != NULL)
+		munmap(cache->map, cache->size);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static inline bool pcm_cache_entry_fresh(const struct pcm_cache_entry *entry)
+{
+	int64_t ctl_ctime = 0, node_ctime = 0;
+
+	if (pcm_cache_get_ctimes(entry->card, entry->device, entry->stream,
+				 &ctl_ctime, &node_ctime) < 0)
+		return false;
+
+	return ctl_ctime == entry->ctl_ctime && node_ctime == entry->node_ctime;
+}
+
+/* Returns NULL for missing or stale entry. */
+static inline const struct pcm_cache_entry *pcm_cache_lookup(
+					const struct pcm_cache *cache,
+					const struct pcm_cache_key *key,
+					int card, int device, int subdevice,
+					int stream, unsigned int flags)
+{
+	const struct pcm_cache_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < cache->count; ++i) {
+		entry = &cache->entries[i];
+		if (memcmp(&entry->key, key, sizeof(*key)) ||
+		    entry->card != card || entry->device != device ||
+		    entry->stream != stream ||
+		    (subdevice != PCM_CACHE_ANY &&
+		     entry->subdevice != subdevice) ||
+		    (entry->flags & flags) != flags)
+			continue;
+
+		if (!pcm_cache_entry_fresh(entry))
+			return NULL;
+		return entry;
+	}
+
+	return NULL;
+}
+
+static inline bool pcm_cache_replaces(const struct pcm_cache_entry *old,
+				      const struct pcm_cache_entry *entries,
+				      unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		/* The card at the number is no longer the same. */
+		if (old->card == entries[i].card &&
+		    memcmp(&old->key, &entries[i].key, sizeof(old->key)))
+			return true;
+		if (old->card == entries[i].card &&
+		    old->device == entries[i].device &&
+		    old->subdevice == entries[i].subdevice &&
+		    old->stream == entries[i].stream)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The results which the new entry lacks are kept from the old one, unless the
+ * card or the node has changed since the old one was stored.
+ */
+static inline void pcm_cache_merge(struct pcm_cache_entry *entry,
+				   const struct pcm_cache *cache)
+{
+	const struct pcm_cache_entry *old;
+	unsigned int i;
+
+	for (i = 0; i < cache->count; ++i) {
+		old = &cache->entries[i];
+		if (memcmp(&old->key, &entry->key, sizeof(old->key)) ||
+		    old->card != entry->card || old->device != entry->device ||
+		    old->subdevice != entry->subdevice ||
+		    old->stream != entry->stream)
+			continue;
+		if (!pcm_cache_entry_fresh(old))
+			break;
+
+		if (!(entry->flags & PCM_CACHE_PARAMS) &&
+		    (old->flags & PCM_CACHE_PARAMS)) {
+			entry->params = old->params;
+			entry->refine_err = old->refine_err;
+		}
+		entry->flags |= old->flags &
+				(PCM_CACHE_PARAMS | PCM_CACHE_LISTED);
+		break;
+	}
+}
+
+/*
+ * Store the given entries with the others in the file. The entries for the
+ * same substreams are merged and replaced. The file is replaced at once by
+ * rename(2) so that concurrent readers see either of the old or new one.
+ */
+static inline int pcm_cache_store(const char *path,
+				  const struct pcm_cache_entry *entries,
+				  unsigned int count)
+{
+	struct pcm_cache_header header = {0};
+	struct pcm_cache_entry *merged;
+	struct pcm_cache cache;
+	char tmp[PATH_MAX];
+	unsigned int i;
+	FILE *file;
+	int fd;
+	int err;
+
+	err = pcm_cache_open(&cache, path);
+	if (err < 0)
+		return err;
+
+	merged = malloc(sizeof(*merged) * (count > 0 ? count : 1));
+	if (merged == NULL) {
+		pcm_cache_close(&cache);
+		return -ENOMEM;
+	}
+	for (i = 0; i < count; ++i) {
+		merged[i] = entries[i];
+		pcm_cache_merge(&merged[i], &cache);
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		err = -errno;
+		free(merged);
+		pcm_cache_close(&cache);
+		return err;
+	}
+	fchmod(fd, 0644);
+	file = fdopen(fd, "w");
+	if (file == NULL) {
+		err = -errno;
+		close(fd);
+		goto end;
+	}
+
+	memcpy(header.magic, PCM_CACHE_MAGIC, sizeof(header.magic));
+	header.version = PCM_CACHE_VERSION;
+	header.entry_size = sizeof(struct pcm_cache_entry);
+	for (i = 0; i < cache.count; ++i) {
+		if (!pcm_cache_replaces(&cache.entries[i], entries, count))
+			++header.count;
+	}
+	header.count += count;
+
+	fwrite(&header, sizeof(header), 1, file);
+	for (i = 0; i < cache.count; ++i) {
+		if (!pcm_cache_replaces(&cache.entries[i], entries, count))
+			fwrite(&cache.entries[i], sizeof(cache.entries[i]), 1,
+			       file);
+	}
+	fwrite(merged, sizeof(*merged), count, file);
+
+	if (ferror(file))
+		err = -EIO;
+	if (fclose(file) != 0 && err == 0)
+		err = -errno;
+	if (err == 0 && rename(tmp, path) < 0)
+		err = -errno;
+end:
+	if (err < 0)
+		unlink(tmp);
+	free(merged);
+	pcm_cache_close(&cache);
+	return err;
+}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * pcm-refine.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Helpers to narrow the configuration space of a PCM substream by
+ * SNDRV_PCM_IOCTL_HW_REFINE, for the programs which explore it.
+ */
+
+#ifndef PCM_REFINE_H
+#define PCM_REFINE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sound/asound.h>
+
+#include "pcm-stream.h"
+
+/*
+ * Values in a run wider than this are probed sparsely, thus holes in it can
+ * be missed.
+ */
+#define PCM_REFINE_EXACT_VALUES	4096
+
+/* A run of valid values of interval parameter. */
+struct pcm_refine_segment {
+	unsigned int min;
+	unsigned int max;
+	/* Every value in the run is probed. */
+	bool exact;
+};
+
+/*
+ * Every parameter is refined again, not only the changed ones. Returns
+ * -EINVAL when the space becomes empty.
+ */
+static inline int pcm_refine(int fd, struct snd_pcm_hw_params *params,
+			     unsigned long *refines)
+{
+	snd_pcm_hw_param_t type;
+
+	for (type = SNDRV_PCM_HW_PARAM_FIRST_MASK;
+	     type <= SNDRV_PCM_HW_PARAM_LAST_MASK; ++type)
+		params->rmask |= 1 << type;
+	for (type = SNDRV_PCM_HW_PARAM_FIRST_INTERVAL;
+	     type <= SNDRV_PCM_HW_PARAM_LAST_INTERVAL; ++type)
+		params->rmask |= 1 << type;
+
+	if (refines != NULL)
+		++*refines;
+	if (ioctl(fd, SNDRV_PCM_IOCTL_HW_REFINE, params) < 0)
+		return -errno;
+	return 0;
+}
+
+static inline bool pcm_refine_mask_test(struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t type,
+					unsigned int val)
+{
+	struct snd_mask *mask = pcm_stream_mask(params, type);
+
+	return mask->bits[val / 32] & (1u << (val % 32));
+}
+
+/* The closed bounds of the interval parameter. */
+static inline void pcm_refine_bounds(struct snd_pcm_hw_params *params,
+				     snd_pcm_hw_param_t type,
+				     unsigned int *min, unsigned int *max)
+{
+	struct snd_interval *interval = pcm_stream_interval(params, type);
+
+	*min = interval->min + (interval->openmin ? 1 : 0);
+	*max = interval->max - (interval->openmax ? 1 : 0);
+}
+
+static inline void pcm_refine_set_range(struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t type,
+					unsigned int min, unsigned int max)
+{
+	struct snd_interval *interval = pcm_stream_interval(params, type);
+
+	memset(interval, 0, sizeof(*interval));
+	interval->min = min;
+	interval->max = max;
+	interval->integer = 1;
+	params->rmask |= 1 << type;
+}
+
+/* Returns 1 if the value is valid on the given space, 0 if not. */
+static inline int pcm_refine_test(int fd,
+				  const struct snd_pcm_hw_params *base,
+				  snd_pcm_hw_param_t type, unsigned int val,
+				  unsigned long *refines)
+{
+	struct snd_pcm_hw_params params = *base;
+	int err;
+
+	if (type <= SNDRV_PCM_HW_PARAM_LAST_MASK)
+		pcm_stream_set_mask(&params, type, val);
+	else
+		pcm_stream_set_interval(&params, type, val);
+
+	err = pcm_refine(fd, &params, refines);
+	if (err == -EINVAL)
+		return 0;
+	if (err < 0)
+		return err;
+	return 1;
+}
+
+static inline int pcm_refine_add_segment(struct pcm_refine_segment **segments,
+					 unsigned int *count,
+					 unsigned int min, unsigned int max,
+					 bool exact)
+{
+	struct pcm_refine_segment *entries;
+
+	entries = realloc(*segments, sizeof(*entries) * (*count + 1));
+	if (entries == NULL)
+		return -ENOMEM;
+	entries[*count].min = min;
+	entries[*count].max = max;
+	entries[*count].exact = exact;
+	*segments = entries;
+	++*count;
+
+	return 0;
+}
+
+/*
+ * The end of the run of valid values from the given one. The first
+ * PCM_REFINE_EXACT_VALUES values are probed one by one, then by probes with
+ * doubling step up to the bound and by bisection of the gap to the first
+ * invalid probe. A hole between two valid probes is missed in the latter
+ * case, thus the run is reported as not exact.
+ */
+static inline int pcm_refine_run_end(int fd,
+				     const struct snd_pcm_hw_params *base,
+				     snd_pcm_hw_param_t type, unsigned int val,
+				     unsigned int bound, unsigned int *end,
+				     bool *exact, unsigned long *refines)
+{
+	unsigned int valid = val, invalid = 0, probe, step = 1;
+	bool found = false;
+	int err;
+
+	*exact = true;
+
+	while (valid < bound) {
+		probe = bound - valid > step ? valid + step : bound;
+		err = pcm_refine_test(fd, base, type, probe, refines);
+		if (err < 0)
+			return err;
+		if (err == 0) {
+			invalid = probe;
+			found = true;
+			break;
+		}
+		if (probe - valid > 1)
+			*exact = false;
+		valid = probe;
+		if (valid - val >= PCM_REFINE_EXACT_VALUES)
+			step *= 2;
+	}
+
+	while (found && invalid - valid > 1) {
+		*exact = false;
+		probe = valid + (invalid - valid) / 2;
+		err = pcm_refine_test(fd, base, type, probe, refines);
+		if (err < 0)
+			return err;
+		if (err > 0)
+			valid = probe;
+		else
+			invalid = probe;
+	}
+
+	*end = valid;
+	return 0;
+}
+
+/*
+ * Collect the valid values of the interval parameter on the given space in
+ * ascending order. The lower bound refined for the range above the last run
+ * gives the next candidate, thus a list of discrete values costs a few
+ * refines per value. A continuous range costs a refine per value up to
+ * PCM_REFINE_EXACT_VALUES, then logarithmic refines.
+ */
+static inline int pcm_refine_walk(int fd,
+				  const struct snd_pcm_hw_params *base,
+				  snd_pcm_hw_param_t type,
+				  struct pcm_refine_segment **segments,
+				  unsigned int *count, unsigned long *refines)
+{
+	struct snd_pcm_hw_params params = *base;
+	unsigned int val, hi, cand, bound, end;
+	bool exact;
+	int err;
+
+	*segments = NULL;
+	*count = 0;
+
+	pcm_refine_bounds(&params, type, &val, &hi);
+	while (val <= hi) {
+		params = *base;
+		pcm_refine_set_range(&params, type, val, hi);
+		err = pcm_refine(fd, &params, refines);
+		if (err == -EINVAL)
+			break;
+		if (err < 0)
+			return err;
+		pcm_refine_bounds(&params, type, &cand, &bound);
+		if (cand < val)
+			cand = val;
+		if (bound > hi)
+			bound = hi;
+		if (cand > bound)
+			break;
+
+		/* The refined bound is not always tight. */
+		err = pcm_refine_test(fd, base, type, cand, refines);
+		if (err < 0)
+			return err;
+		if (err == 0) {
+			val = cand + 1;
+			continue;
+		}
+
+		err = pcm_refine_run_end(fd, base, type, cand, bound, &end,
+					 &exact, refines);
+		if (err < 0)
+			return err;
+
+		err = pcm_refine_add_segment(segments, count, cand, end, exact);
+		if (err < 0)
+			return err;
+		if (end == UINT_MAX)
+			break;
+		val = end + 1;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,626 @@
+/*
+ * pcm-stream.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Helpers to bring a PCM substream into running state by ioctl(2) only, for
+ * the programs which measure the behaviour of ALSA PCM core.
+ */
+
+#ifndef PCM_STREAM_H
+#define PCM_STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <linux/version.h>
+
+#include <sound/asound.h>
+
+struct pcm_stream_config {
+	snd_pcm_access_t access;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate;
+	/* Zero lets the kernel choose. */
+	snd_pcm_uframes_t period_size;
+	unsigned int periods;
+	/* SNDRV_PCM_HW_PARAMS_XXX. */
+	unsigned int flags;
+};
+
+/* The place of samples for one channel in the mapped buffer. */
+struct pcm_stream_area {
+	unsigned char *addr;
+	/* The distance between samples in bytes. */
+	unsigned int step;
+};
+
+struct pcm_stream {
+	int fd;
+	int direction;
+	struct pcm_stream_config config;
+	snd_pcm_uframes_t buffer_size;
+	unsigned int frame_bits;
+	unsigned int sample_bits;
+	snd_pcm_uframes_t boundary;
+	/* SNDRV_PCM_INFO_XXX for the configured parameters. */
+	unsigned int info;
+
+	volatile struct snd_pcm_mmap_status *status;
+	volatile struct snd_pcm_mmap_control *control;
+	size_t page_size;
+
+	void *data;
+	size_t data_bytes;
+	struct pcm_stream_area *areas;
+
+	/* Scratch buffer of the whole size for readwrite access. */
+	void *scratch;
+	void **scratches;
+};
+
+static const char *const pcm_stream_access_labels[] = {
+	[SNDRV_PCM_ACCESS_MMAP_INTERLEAVED]	= "mmap-interleaved",
+	[SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED]	= "mmap-noninterleaved",
+	[SNDRV_PCM_ACCESS_MMAP_COMPLEX]		= "mmap-complex",
+	[SNDRV_PCM_ACCESS_RW_INTERLEAVED]	= "readwrite-interleaved",
+	[SNDRV_PCM_ACCESS_RW_NONINTERLEAVED]	= "readwrite-noninterleaved",
+};
+
+/* Linear formats which the measurement programs can generate. */
+static const char *const pcm_stream_format_labels[] = {
+	[SNDRV_PCM_FORMAT_S8]		= "s8",
+	[SNDRV_PCM_FORMAT_U8]		= "u8",
+	[SNDRV_PCM_FORMAT_S16_LE]	= "s16-le",
+	[SNDRV_PCM_FORMAT_S16_BE]	= "s16-be",
+	[SNDRV_PCM_FORMAT_U16_LE]	= "u16-le",
+	[SNDRV_PCM_FORMAT_U16_BE]	= "u16-be",
+	[SNDRV_PCM_FORMAT_S24_LE]	= "s24-le",
+	[SNDRV_PCM_FORMAT_S24_BE]	= "s24-be",
+	[SNDRV_PCM_FORMAT_U24_LE]	= "u24-le",
+	[SNDRV_PCM_FORMAT_U24_BE]	= "u24-be",
+	[SNDRV_PCM_FORMAT_S32_LE]	= "s32-le",
+	[SNDRV_PCM_FORMAT_S32_BE]	= "s32-be",
+	[SNDRV_PCM_FORMAT_U32_LE]	= "u32-le",
+	[SNDRV_PCM_FORMAT_U32_BE]	= "u32-be",
+	[SNDRV_PCM_FORMAT_FLOAT_LE]	= "float-le",
+	[SNDRV_PCM_FORMAT_FLOAT_BE]	= "float-be",
+	[SNDRV_PCM_FORMAT_FLOAT64_LE]	= "float64-le",
+	[SNDRV_PCM_FORMAT_FLOAT64_BE]	= "float64-be",
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
+	[SNDRV_PCM_FORMAT_S20_LE]	= "s20-le",
+	[SNDRV_PCM_FORMAT_S20_BE]	= "s20-be",
+	[SNDRV_PCM_FORMAT_U20_LE]	= "u20-le",
+	[SNDRV_PCM_FORMAT_U20_BE]	= "u20-be",
+#endif
+	[SNDRV_PCM_FORMAT_S24_3LE]	= "s24-3le",
+	[SNDRV_PCM_FORMAT_S24_3BE]	= "s24-3be",
+	[SNDRV_PCM_FORMAT_U24_3LE]	= "u24-3le",
+	[SNDRV_PCM_FORMAT_U24_3BE]	= "u24-3be",
+	[SNDRV_PCM_FORMAT_S20_3LE]	= "s20-3le",
+	[SNDRV_PCM_FORMAT_S20_3BE]	= "s20-3be",
+	[SNDRV_PCM_FORMAT_U20_3LE]	= "u20-3le",
+	[SNDRV_PCM_FORMAT_U20_3BE]	= "u20-3be",
+	[SNDRV_PCM_FORMAT_S18_3LE]	= "s18-3le",
+	[SNDRV_PCM_FORMAT_S18_3BE]	= "s18-3be",
+	[SNDRV_PCM_FORMAT_U18_3LE]	= "u18-3le",
+	[SNDRV_PCM_FORMAT_U18_3BE]	= "u18-3be",
+};
+
+/* Returns -EINVAL for unknown label. */
+static inline int pcm_stream_parse_label(const char *const labels[],
+					 unsigned int count, const char *label)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		if (labels[i] != NULL && strcmp(labels[i], label) == 0)
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+static inline int pcm_stream_parse_access(const char *label)
+{
+	return pcm_stream_parse_label(pcm_stream_access_labels,
+		sizeof(pcm_stream_access_labels) /
+		sizeof(pcm_stream_access_labels[0]), label);
+}
+
+static inline int pcm_stream_parse_format(const char *label)
+{
+	return pcm_stream_parse_label(pcm_stream_format_labels,
+		sizeof(pcm_stream_format_labels) /
+		sizeof(pcm_stream_format_labels[0]), label);
+}
+
+static inline struct snd_mask *pcm_stream_mask(
+					struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t type)
+{
+	return &params->masks[type - SNDRV_PCM_HW_PARAM_FIRST_MASK];
+}
+
+static inline struct snd_interval *pcm_stream_interval(
+					struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t type)
+{
+	return &params->intervals[type - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL];
+}
+
+static inline void pcm_stream_init_hw_params(struct snd_pcm_hw_params *params)
+{
+	snd_pcm_hw_param_t type;
+	struct snd_interval *interval;
+
+	memset(params, 0, sizeof(*params));
+
+	for (type = SNDRV_PCM_HW_PARAM_FIRST_MASK;
+	     type <= SNDRV_PCM_HW_PARAM_LAST_MASK; ++type) {
+		memset(pcm_stream_mask(params, type), 0xff,
+		       sizeof(struct snd_mask));
+		params->rmask |= 1 << type;
+	}
+
+	for (type = SNDRV_PCM_HW_PARAM_FIRST_INTERVAL;
+	     type <= SNDRV_PCM_HW_PARAM_LAST_INTERVAL; ++type) {
+		interval = pcm_stream_interval(params, type);
+		interval->min = 0;
+		interval->max = UINT_MAX;
+		params->rmask |= 1 << type;
+	}
+}
+
+static inline void pcm_stream_set_mask(struct snd_pcm_hw_params *params,
+				       snd_pcm_hw_param_t type,
+				       unsigned int val)
+{
+	struct snd_mask *mask = pcm_stream_mask(params, type);
+
+	memset(mask, 0, sizeof(*mask));
+	mask->bits[val / 32] = 1u << (val % 32);
+	params->rmask |= 1 << type;
+}
+
+static inline void pcm_stream_set_interval(struct snd_pcm_hw_params *params,
+					   snd_pcm_hw_param_t type,
+					   unsigned int val)
+{
+	struct snd_interval *interval = pcm_stream_interval(params, type);
+
+	memset(interval, 0, sizeof(*interval));
+	interval->min = val;
+	interval->max = val;
+	interval->integer = 1;
+	params->rmask |= 1 << type;
+}
+
+/* The interval should be fixed by SNDRV_PCM_IOCTL_HW_PARAMS in advance. */
+static inline unsigned int pcm_stream_get_interval(
+					struct snd_pcm_hw_params *params,
+					snd_pcm_hw_param_t type)
+{
+	return pcm_stream_interval(params, type)->min;
+}
+
+static inline int pcm_stream_open(struct pcm_stream *stream, const char *path,
+				  int flags)
+{
+	int version = SNDRV_PCM_VERSION;
+	struct snd_pcm_info info = {0};
+	int err;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->page_size = sysconf(_SC_PAGESIZE);
+
+	stream->fd = open(path, flags);
+	if (stream->fd < 0)
+		return -errno;
+
+	/* Tell the protocol which this program speaks; old kernels lack it. */
+	if ((ioctl(stream->fd, SNDRV_PCM_IOCTL_USER_PVERSION, &version) < 0 &&
+	     errno != ENOTTY) ||
+	    ioctl(stream->fd, SNDRV_PCM_IOCTL_INFO, &info) < 0) {
+		err = -errno;
+		close(stream->fd);
+		stream->fd = -1;
+		return err;
+	}
+	stream->direction = info.stream;
+
+	return 0;
+}
+
+/*
+ * Parameters which are not given by the configuration are chosen by the
+ * kernel in SNDRV_PCM_IOCTL_HW_PARAMS. The chosen values are written back.
+ */
+static inline int pcm_stream_configure(struct pcm_stream *stream,
+				       const struct pcm_stream_config *config)
+{
+	struct snd_pcm_hw_params params;
+
+	pcm_stream_init_hw_params(&params);
+
+	pcm_stream_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS, config->access);
+	pcm_stream_set_mask(&params, SNDRV_PCM_HW_PARAM_FORMAT, config->format);
+	pcm_stream_set_mask(&params, SNDRV_PCM_HW_PARAM_SUBFORMAT,
+			    SNDRV_PCM_SUBFORMAT_STD);
+	pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_CHANNELS,
+				config->channels);
+	pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_RATE,
+				config->rate);
+	if (config->period_size > 0)
+		pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+					config->period_size);
+	if (config->periods > 0)
+		pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_PERIODS,
+					config->periods);
+	params.flags = config->flags;
+
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params) < 0)
+		return -errno;
+
+	stream->config = *config;
+	stream->config.period_size = pcm_stream_get_interval(&params,
+						SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+	stream->config.periods = pcm_stream_get_interval(&params,
+						SNDRV_PCM_HW_PARAM_PERIODS);
+	stream->buffer_size = pcm_stream_get_interval(&params,
+						SNDRV_PCM_HW_PARAM_BUFFER_SIZE);
+	stream->frame_bits = pcm_stream_get_interval(&params,
+						SNDRV_PCM_HW_PARAM_FRAME_BITS);
+	stream->sample_bits = pcm_stream_get_interval(&params,
+						SNDRV_PCM_HW_PARAM_SAMPLE_BITS);
+	stream->info = params.info;
+
+	/* As the same way as ALSA PCM core computes it. */
+	stream->boundary = stream->buffer_size;
+	while (stream->boundary * 2 <= LONG_MAX - stream->buffer_size)
+		stream->boundary *= 2;
+
+	return 0;
+}
+
+/* Fill software parameters which the caller can adjust before applying. */
+static inline void pcm_stream_init_sw_params(struct pcm_stream *stream,
+					     struct snd_pcm_sw_params *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->tstamp_mode = SNDRV_PCM_TSTAMP_ENABLE;
+	params->tstamp_type = SNDRV_PCM_TSTAMP_TYPE_MONOTONIC;
+	params->period_step = 1;
+	params->avail_min = stream->config.period_size;
+	params->xfer_align = 1;
+	params->start_threshold = stream->buffer_size;
+	params->stop_threshold = stream->buffer_size;
+	params->boundary = stream->boundary;
+	params->proto = SNDRV_PCM_VERSION;
+}
+
+/*
+ * Let the stream run without any data transmission. The hardware pointer
+ * keeps moving over the buffer filled with silence by the kernel.
+ */
+static inline void pcm_stream_free_running(struct pcm_stream *stream,
+					   struct snd_pcm_sw_params *params)
+{
+	params->start_threshold = 1;
+	params->stop_threshold = stream->boundary;
+	params->silence_threshold = 0;
+	params->silence_size = stream->boundary;
+}
+
+static inline int pcm_stream_set_sw_params(struct pcm_stream *stream,
+					   struct snd_pcm_sw_params *params)
+{
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_SW_PARAMS, params) < 0)
+		return -errno;
+	return 0;
+}
+
+/* The kernel refuses it for some architectures and for compat layer. */
+static inline int pcm_stream_map_pointers(struct pcm_stream *stream)
+{
+	void *status;
+	void *control;
+
+	status = mmap(NULL, stream->page_size, PROT_READ, MAP_FILE | MAP_SHARED,
+		      stream->fd, SNDRV_PCM_MMAP_OFFSET_STATUS);
+	if (status == MAP_FAILED)
+		return -errno;
+
+	control = mmap(NULL, stream->page_size, PROT_READ | PROT_WRITE,
+		       MAP_FILE | MAP_SHARED, stream->fd,
+		       SNDRV_PCM_MMAP_OFFSET_CONTROL);
+	if (control == MAP_FAILED) {
+		munmap(status, stream->page_size);
+		return -errno;
+	}
+
+	stream->status = status;
+	stream->control = control;
+
+	return 0;
+}
+
+/* For SNDRV_PCM_ACCESS_MMAP_INTERLEAVED/NONINTERLEAVED. */
+static inline int pcm_stream_map_data(struct pcm_stream *stream)
+{
+	struct snd_pcm_channel_info info;
+	unsigned int ch;
+	int err;
+
+	stream->areas = calloc(stream->config.channels,
+			       sizeof(*stream->areas));
+	if (stream->areas == NULL)
+		return -ENOMEM;
+
+	stream->data_bytes = stream->buffer_size * stream->frame_bits / 8;
+	stream->data_bytes = (stream->data_bytes + stream->page_size - 1) /
+			     stream->page_size * stream->page_size;
+	stream->data = mmap(NULL, stream->data_bytes, PROT_READ | PROT_WRITE,
+			    MAP_FILE | MAP_SHARED, stream->fd,
+			    SNDRV_PCM_MMAP_OFFSET_DATA);
+	if (stream->data == MAP_FAILED) {
+		err = -errno;
+		stream->data = NULL;
+		goto error;
+	}
+
+	for (ch = 0; ch < stream->config.channels; ++ch) {
+		memset(&info, 0, sizeof(info));
+		info.channel = ch;
+		if (ioctl(stream->fd, SNDRV_PCM_IOCTL_CHANNEL_INFO,
+			  &info) < 0) {
+			err = -errno;
+			goto error;
+		}
+
+		/* The area should be in the mapping for data. */
+		if (info.offset + info.first / 8 >= stream->data_bytes ||
+		    info.first % 8 || info.step % 8) {
+			err = -ENXIO;
+			goto error;
+		}
+
+		stream->areas[ch].addr = (unsigned char *)stream->data +
+					 info.offset + info.first / 8;
+		stream->areas[ch].step = info.step / 8;
+	}
+
+	return 0;
+error:
+	/* Callers retry the mapping as long as the data pointer is NULL. */
+	if (stream->data != NULL)
+		munmap(stream->data, stream->data_bytes);
+	stream->data = NULL;
+	free(stream->areas);
+	stream->areas = NULL;
+	return err;
+}
+
+/* The number of frames which the application can transfer. */
+static inline snd_pcm_uframes_t pcm_stream_avail(struct pcm_stream *stream,
+						 snd_pcm_uframes_t hw_ptr,
+						 snd_pcm_uframes_t appl_ptr)
+{
+	snd_pcm_sframes_t avail;
+
+	if (stream->direction == SNDRV_PCM_STREAM_PLAYBACK)
+		avail = hw_ptr + stream->buffer_size - appl_ptr;
+	else
+		avail = hw_ptr - appl_ptr;
+	if (avail < 0)
+		avail += stream->boundary;
+	else if ((snd_pcm_uframes_t)avail >= stream->boundary)
+		avail -= stream->boundary;
+
+	return avail;
+}
+
+/*
+ * Read the state and the pointers, through the mapped pages if available.
+ * Returns 1 when ioctl(2) is issued for it.
+ */
+static inline int pcm_stream_sync(struct pcm_stream *stream,
+				  snd_pcm_state_t *state,
+				  snd_pcm_uframes_t *hw_ptr,
+				  snd_pcm_uframes_t *appl_ptr)
+{
+	struct snd_pcm_sync_ptr ptr = {0};
+
+	/* The outputs are defined even on error. */
+	*state = SNDRV_PCM_STATE_OPEN;
+	*hw_ptr = 0;
+	*appl_ptr = 0;
+
+	if (stream->status != NULL && stream->control != NULL) {
+		*state = stream->status->state;
+		*hw_ptr = stream->status->hw_ptr;
+		*appl_ptr = stream->control->appl_ptr;
+		return 0;
+	}
+
+	ptr.flags = SNDRV_PCM_SYNC_PTR_HWSYNC | SNDRV_PCM_SYNC_PTR_APPL |
+		    SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_SYNC_PTR, &ptr) < 0)
+		return -errno;
+
+	*state = ptr.s.status.state;
+	*hw_ptr = ptr.s.status.hw_ptr;
+	*appl_ptr = ptr.c.control.appl_ptr;
+	return 1;
+}
+
+/*
+ * Move the application pointer, through the mapped page if available.
+ * Returns 1 when ioctl(2) is issued for it.
+ */
+static inline int pcm_stream_commit(struct pcm_stream *stream,
+				    snd_pcm_uframes_t appl_ptr)
+{
+	struct snd_pcm_sync_ptr ptr = {0};
+
+	if (stream->control != NULL) {
+		stream->control->appl_ptr = appl_ptr;
+		return 0;
+	}
+
+	ptr.flags = SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+	ptr.c.control.appl_ptr = appl_ptr;
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_SYNC_PTR, &ptr) < 0)
+		return -errno;
+
+	return 1;
+}
+
+/*
+ * Transfer frames of silence for playback, or discard frames for capture,
+ * by the configured access. Returns the number of transferred frames, which
+ * can be less than requested, or negative error; -EPIPE at XRUN.
+ */
+static inline snd_pcm_sframes_t pcm_stream_transfer(struct pcm_stream *stream,
+						    snd_pcm_uframes_t frames)
+{
+	bool playback = stream->direction == SNDRV_PCM_STREAM_PLAYBACK;
+	unsigned int sample_bytes = stream->sample_bits / 8;
+	struct snd_xferi xferi = {0};
+	struct snd_xfern xfern = {0};
+	snd_pcm_state_t state;
+	snd_pcm_uframes_t hw_ptr, appl_ptr, avail, offset;
+	unsigned int ch;
+	unsigned char *dst;
+	snd_pcm_uframes_t i;
+	int err;
+
+	if (frames > stream->buffer_size)
+		frames = stream->buffer_size;
+
+	switch (stream->config.access) {
+	case SNDRV_PCM_ACCESS_RW_INTERLEAVED:
+		if (stream->scratch == NULL) {
+			stream->scratch = calloc(stream->buffer_size,
+						 stream->frame_bits / 8);
+			if (stream->scratch == NULL)
+				return -ENOMEM;
+		}
+		xferi.buf = stream->scratch;
+		xferi.frames = frames;
+		if (ioctl(stream->fd, playback ? SNDRV_PCM_IOCTL_WRITEI_FRAMES :
+						 SNDRV_PCM_IOCTL_READI_FRAMES,
+			  &xferi) < 0)
+			return errno == EAGAIN ? 0 : -errno;
+		return xferi.result;
+	case SNDRV_PCM_ACCESS_RW_NONINTERLEAVED:
+		if (stream->scratches == NULL) {
+			stream->scratches = calloc(stream->config.channels,
+						   sizeof(void *));
+			if (stream->scratches == NULL)
+				return -ENOMEM;
+			for (ch = 0; ch < stream->config.channels; ++ch) {
+				stream->scratches[ch] =
+					calloc(stream->buffer_size,
+					       sample_bytes);
+				if (stream->scratches[ch] == NULL)
+					return -ENOMEM;
+			}
+		}
+		xfern.bufs = stream->scratches;
+		xfern.frames = frames;
+		if (ioctl(stream->fd, playback ? SNDRV_PCM_IOCTL_WRITEN_FRAMES :
+						 SNDRV_PCM_IOCTL_READN_FRAMES,
+			  &xfern) < 0)
+			return errno == EAGAIN ? 0 : -errno;
+		return xfern.result;
+	case SNDRV_PCM_ACCESS_MMAP_INTERLEAVED:
+	case SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED:
+		if (stream->data == NULL) {
+			err = pcm_stream_map_data(stream);
+			if (err < 0)
+				return err;
+		}
+
+		err = pcm_stream_sync(stream, &state, &hw_ptr, &appl_ptr);
+		if (err < 0)
+			return err;
+		if (state == SNDRV_PCM_STATE_XRUN)
+			return -EPIPE;
+
+		avail = pcm_stream_avail(stream, hw_ptr, appl_ptr);
+		offset = appl_ptr % stream->buffer_size;
+		if (frames > avail)
+			frames = avail;
+		if (frames > stream->buffer_size - offset)
+			frames = stream->buffer_size - offset;
+
+		if (playback) {
+			for (ch = 0; ch < stream->config.channels; ++ch) {
+				dst = stream->areas[ch].addr +
+				      offset * stream->areas[ch].step;
+				for (i = 0; i < frames; ++i) {
+					memset(dst, 0, sample_bytes);
+					dst += stream->areas[ch].step;
+				}
+			}
+		}
+
+		appl_ptr += frames;
+		if (appl_ptr >= stream->boundary)
+			appl_ptr -= stream->boundary;
+		err = pcm_stream_commit(stream, appl_ptr);
+		if (err < 0)
+			return err;
+		return frames;
+	default:
+		return -ENXIO;
+	}
+}
+
+static inline void pcm_stream_close(struct pcm_stream *stream)
+{
+	unsigned int ch;
+
+	free(stream->scratch);
+	stream->scratch = NULL;
+	if (stream->scratches != NULL) {
+		for (ch = 0; ch < stream->config.channels; ++ch)
+			free(stream->scratches[ch]);
+		free(stream->scratches);
+	}
+	stream->scratches = NULL;
+
+	if (stream->data != NULL)
+		munmap(stream->data, stream->data_bytes);
+	stream->data = NULL;
+	free(stream->areas);
+	stream->areas = NULL;
+
+	if (stream->control != NULL)
+		munmap((void *)stream->control, stream->page_size);
+	if (stream->status != NULL)
+		munmap((void *)stream->status, stream->page_size);
+	stream->control = NULL;
+	stream->status = NULL;
+
+	if (stream->fd >= 0)
+		close(stream->fd);
+	stream->fd = -1;
+}
+
+#endif
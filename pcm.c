@@ -11,236 +11,320 @@
 #include <errno.h>
 #include <string.h>
 
-#include <sound/asound.h>
-
-#define TEST_IOCTL(fd, command, argument, expected)			\
-	if (ioctl(fd, command, argument) < 0 && errno != expected) {	\
-		printf("%s: %s\n", #command, strerror(errno));		\
-		return false;						\
-	}								\
-	return true;							\
-
-static bool check_pversion(int fd)
-{
-	int version = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_PVERSION, &version, 0);
-}
+#include <pthread.h>
 
-static bool check_info(int fd)
-{
-	struct snd_pcm_info info = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_INFO, &info, 0);
-}
+#include <sound/asound.h>
 
-static bool check_tstamp(int fd)
+#include "latency.h"
+#include "ioctl-suite.h"
+#include "pcm-stream.h"
+
+static const struct ioctl_case cases[] = {
+	IOCTL_CASE(SNDRV_PCM_IOCTL_PVERSION, int, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_INFO, struct snd_pcm_info, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_TSTAMP, int, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_TTSTAMP, int, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_HW_REFINE, struct snd_pcm_hw_params,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_HW_PARAMS, struct snd_pcm_hw_params,
+		   NULL, EINVAL),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_HW_FREE, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_SW_PARAMS, struct snd_pcm_sw_params,
+		   NULL, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_STATUS, struct snd_pcm_status, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_DELAY, snd_pcm_sframes_t, NULL, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_HWSYNC, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_SYNC_PTR, struct snd_pcm_sync_ptr, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_STATUS_EXT, struct snd_pcm_status, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_CHANNEL_INFO, struct snd_pcm_channel_info,
+		   NULL, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_PREPARE, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_RESET, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_START, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_DROP, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_DRAIN, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_PAUSE, int, NULL, ENOSYS),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_REWIND, snd_pcm_uframes_t, NULL, 0),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_RESUME, ENOSYS),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_XRUN, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_FORWARD, snd_pcm_uframes_t, NULL, 0),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_WRITEI_FRAMES, struct snd_xferi,
+		   NULL, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_READI_FRAMES, struct snd_xferi,
+		   NULL, ENOTTY),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_WRITEN_FRAMES, struct snd_xfern,
+		   NULL, EBADFD),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_READN_FRAMES, struct snd_xfern,
+		   NULL, ENOTTY),
+	IOCTL_CASE(SNDRV_PCM_IOCTL_LINK, int, NULL, EBADFD),
+	IOCTL_CASE_NO_ARG(SNDRV_PCM_IOCTL_UNLINK, EALREADY),
+};
+
+static const struct ioctl_suite suite = {
+	.label = "PCM",
+	.node = "/dev/snd/pcmC0D0p",
+	.pattern = "pcmC*D*p",
+	.flags = O_RDONLY,
+	.cases = cases,
+	.count = sizeof(cases) / sizeof(cases[0]),
+	.usage = " | ptr-cost ITERATIONS [LOAD-THREADS]",
+};
+
+static int read_pointers_by_pages(struct pcm_stream *stream,
+				  snd_pcm_uframes_t *hw_ptr,
+				  snd_pcm_uframes_t *appl_ptr)
 {
-	int tstamp = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_TSTAMP, &tstamp, 0);
+	*hw_ptr = stream->status->hw_ptr;
+	*appl_ptr = stream->control->appl_ptr;
+	return 0;
 }
 
-static bool check_ttstamp(int fd)
+static int read_pointers_by_sync_ptr(struct pcm_stream *stream,
+				     unsigned int flags,
+				     snd_pcm_uframes_t *hw_ptr,
+				     snd_pcm_uframes_t *appl_ptr)
 {
-	int tstamp = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_TTSTAMP, &tstamp, 0);
-}
+	struct snd_pcm_sync_ptr ptr = {0};
 
-static bool check_hw_refine(int fd)
-{
-	struct snd_pcm_hw_params params = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_HW_REFINE, &params, EINVAL);
-}
+	/* Get appl_ptr and avail_min from the kernel, not set them. */
+	ptr.flags = flags | SNDRV_PCM_SYNC_PTR_APPL |
+		    SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_SYNC_PTR, &ptr) < 0)
+		return -errno;
 
-static bool check_hw_params(int fd)
-{
-	struct snd_pcm_hw_params params = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params, EINVAL);
+	*hw_ptr = ptr.s.status.hw_ptr;
+	*appl_ptr = ptr.c.control.appl_ptr;
+	return 0;
 }
 
-static bool check_hw_free(int fd)
+static int read_pointers_by_sync_ptr_hwsync(struct pcm_stream *stream,
+					    snd_pcm_uframes_t *hw_ptr,
+					    snd_pcm_uframes_t *appl_ptr)
 {
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_HW_FREE, NULL, EBADFD);
+	return read_pointers_by_sync_ptr(stream, SNDRV_PCM_SYNC_PTR_HWSYNC,
+					 hw_ptr, appl_ptr);
 }
 
-static bool check_sw_params(int fd)
+static int read_pointers_by_sync_ptr_cached(struct pcm_stream *stream,
+					    snd_pcm_uframes_t *hw_ptr,
+					    snd_pcm_uframes_t *appl_ptr)
 {
-	struct snd_pcm_sw_params params = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_SW_PARAMS, &params, EBADFD);
+	return read_pointers_by_sync_ptr(stream, 0, hw_ptr, appl_ptr);
 }
 
-static bool check_status(int fd)
+static int read_pointers_by_status(struct pcm_stream *stream,
+				   snd_pcm_uframes_t *hw_ptr,
+				   snd_pcm_uframes_t *appl_ptr)
 {
 	struct snd_pcm_status status = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_STATUS, &status, 0);
-}
 
-static bool check_delay(int fd)
-{
-	snd_pcm_sframes_t delay = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_DELAY, &delay, EBADFD);
-}
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+		return -errno;
 
-static bool check_hwsync(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_HWSYNC, NULL, EBADFD);
+	*hw_ptr = status.hw_ptr;
+	*appl_ptr = status.appl_ptr;
+	return 0;
 }
 
-static bool check_sync_ptr(int fd)
-{
-	struct snd_pcm_sync_ptr ptr = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_SYNC_PTR, &ptr, 0);
-}
-
-static bool check_status_ext(int fd)
+static int read_pointers_by_status_ext(struct pcm_stream *stream,
+				       snd_pcm_uframes_t *hw_ptr,
+				       snd_pcm_uframes_t *appl_ptr)
 {
 	struct snd_pcm_status status = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_STATUS_EXT, &status, 0);
-}
 
-static bool check_channel_info(int fd)
-{
-	struct snd_pcm_channel_info info = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_CHANNEL_INFO, &info, EBADFD);
-}
+	if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS_EXT, &status) < 0)
+		return -errno;
 
-static bool check_prepare(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_PREPARE, NULL, EBADFD);
+	*hw_ptr = status.hw_ptr;
+	*appl_ptr = status.appl_ptr;
+	return 0;
 }
 
-static bool check_reset(int fd)
+/* To estimate the cost of clock_gettime(2) itself. */
+static int read_pointers_by_nothing(struct pcm_stream *stream,
+				    snd_pcm_uframes_t *hw_ptr,
+				    snd_pcm_uframes_t *appl_ptr)
 {
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_RESET, NULL, EBADFD);
-}
+	(void)stream;
+	(void)hw_ptr;
+	(void)appl_ptr;
 
-static bool check_start(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_START, NULL, EBADFD);
+	return 0;
 }
 
-static bool check_drop(int fd)
+static void *generate_load(void *arg)
 {
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_DROP, NULL, EBADFD);
-}
+	volatile const bool *running = arg;
+	const size_t size = 8 * 1024 * 1024;
+	unsigned char *area;
+	size_t pos = 0;
+
+	/* Keep the CPU and the caches busy. */
+	area = malloc(size);
+	if (area == NULL)
+		return NULL;
+	memset(area, 0, size);
+
+	while (*running) {
+		area[pos] += 1;
+		pos = (pos + 64) % size;
+	}
 
-static bool check_drain(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_DRAIN, NULL, EBADFD);
+	free(area);
+	return NULL;
 }
 
-static bool check_pause(int fd)
+static int measure_pointer_costs(struct pcm_stream *stream,
+				 unsigned int iterations)
 {
-	int pause = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_PAUSE, &pause, ENOSYS);
-}
+	static const struct {
+		const char *label;
+		int (*read)(struct pcm_stream *stream,
+			    snd_pcm_uframes_t *hw_ptr,
+			    snd_pcm_uframes_t *appl_ptr);
+		bool mapped;
+	} readers[] = {
+		{ "clock_gettime (baseline)", read_pointers_by_nothing, false },
+		{ "mmap status/control page", read_pointers_by_pages, true },
+		{ "SYNC_PTR (hwsync)", read_pointers_by_sync_ptr_hwsync,
+		  false },
+		{ "SYNC_PTR", read_pointers_by_sync_ptr_cached, false },
+		{ "STATUS", read_pointers_by_status, false },
+		{ "STATUS_EXT", read_pointers_by_status_ext, false },
+	};
+	struct latency_record rec;
+	snd_pcm_uframes_t hw_ptr, appl_ptr;
+	uint64_t begin;
+	unsigned int i, j;
+	int err = 0;
+
+	latency_dump_header();
+
+	for (i = 0; i < sizeof(readers) / sizeof(readers[0]); ++i) {
+		if (readers[i].mapped && stream->status == NULL)
+			continue;
+
+		err = latency_record_init(&rec, readers[i].label, iterations);
+		if (err < 0)
+			return err;
+
+		for (j = 0; j < iterations; ++j) {
+			begin = latency_now();
+			err = readers[i].read(stream, &hw_ptr, &appl_ptr);
+			latency_record_push(&rec, latency_now() - begin);
+			if (err < 0)
+				break;
+		}
 
-static bool check_rewind(int fd)
-{
-	snd_pcm_uframes_t frames = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_REWIND, &frames, 0);
-}
+		latency_record_dump(&rec);
+		latency_record_fini(&rec);
 
-static bool check_resume(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_RESUME, NULL, ENOSYS);
-}
+		if (err < 0) {
+			printf("%s: %s\n", readers[i].label, strerror(-err));
+			return err;
+		}
+	}
 
-static bool check_xrun(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_XRUN, NULL, EBADFD);
+	return 0;
 }
 
-static bool check_forward(int fd)
+/*
+ * Compare the cost to read hw_ptr/appl_ptr through the mapped status and
+ * control pages with the cost through ioctl(2), for a running substream.
+ */
+static int compare_pointer_costs(unsigned int iterations,
+				 unsigned int load_threads)
 {
-	snd_pcm_uframes_t frames = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_FORWARD, &frames, 0);
-}
+	const struct pcm_stream_config config = {
+		.access = SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+		.format = SNDRV_PCM_FORMAT_S16_LE,
+		.channels = 2,
+		.rate = 48000,
+	};
+	struct pcm_stream stream;
+	struct snd_pcm_sw_params sw_params;
+	pthread_t *threads;
+	volatile bool running;
+	unsigned int i;
+	int err;
 
-static bool check_writei_frames(int fd)
-{
-	struct snd_xferi xferi = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &xferi, EBADFD);
-}
+	err = pcm_stream_open(&stream, "/dev/snd/pcmC0D0p", O_RDWR);
+	if (err < 0) {
+		printf("open(2): %s\n", strerror(-err));
+		return err;
+	}
 
-static bool check_readi_frames(int fd)
-{
-	struct snd_xferi xferi = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_READI_FRAMES, &xferi, ENOTTY);
-}
+	err = pcm_stream_configure(&stream, &config);
+	if (err < 0) {
+		printf("SNDRV_PCM_IOCTL_HW_PARAMS: %s\n", strerror(-err));
+		goto end;
+	}
 
-static bool check_writen_frames(int fd)
-{
-	struct snd_xfern xfern = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &xfern, EBADFD);
-}
+	pcm_stream_init_sw_params(&stream, &sw_params);
+	pcm_stream_free_running(&stream, &sw_params);
+	err = pcm_stream_set_sw_params(&stream, &sw_params);
+	if (err < 0) {
+		printf("SNDRV_PCM_IOCTL_SW_PARAMS: %s\n", strerror(-err));
+		goto end;
+	}
 
-static bool check_readn_frames(int fd)
-{
-	struct snd_xfern xfern = {0};
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_READN_FRAMES, &xfern, ENOTTY);
-}
+	err = pcm_stream_map_pointers(&stream);
+	if (err < 0)
+		printf("mmap(2) for status/control: %s, skipped.\n",
+		       strerror(-err));
 
-static bool check_link(int fd)
-{
-	int link = 0;
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_LINK, &link, EBADFD);
-}
+	if (ioctl(stream.fd, SNDRV_PCM_IOCTL_PREPARE) < 0 ||
+	    ioctl(stream.fd, SNDRV_PCM_IOCTL_START) < 0) {
+		err = -errno;
+		printf("SNDRV_PCM_IOCTL_START: %s\n", strerror(-err));
+		goto end;
+	}
 
-static bool check_unlink(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_PCM_IOCTL_UNLINK, NULL, EALREADY);
-}
+	printf("Busy-poll, period %lu frames, buffer %lu frames:\n",
+	       stream.config.period_size, stream.buffer_size);
+	err = measure_pointer_costs(&stream, iterations);
+	if (err < 0 || load_threads == 0)
+		goto end;
 
-int main(void)
-{
-	bool (*const funcs[])(int) = {
-		check_pversion,
-		check_info,
-		check_tstamp,
-		check_ttstamp,
-		check_hw_refine,
-		check_hw_params,
-		check_hw_free,
-		check_sw_params,
-		check_status,
-		check_delay,
-		check_hwsync,
-		check_sync_ptr,
-		check_status_ext,
-		check_channel_info,
-		check_prepare,
-		check_reset,
-		check_start,
-		check_drop,
-		check_drain,
-		check_pause,
-		check_rewind,
-		check_resume,
-		check_xrun,
-		check_forward,
-		check_writei_frames,
-		check_readi_frames,
-		check_writen_frames,
-		check_readn_frames,
-		check_link,
-		check_unlink,
-		NULL,
-	};
-	unsigned int i;
-	int fd;
+	threads = calloc(load_threads, sizeof(*threads));
+	if (threads == NULL) {
+		err = -ENOMEM;
+		goto end;
+	}
 
-	fd = open("/dev/snd/pcmC0D0p", O_RDONLY);
-	if (fd < 0) {
-		printf("%s\n", strerror(errno));
-		return EXIT_FAILURE;
+	running = true;
+	for (i = 0; i < load_threads; ++i) {
+		if (pthread_create(&threads[i], NULL, generate_load,
+				   (void *)&running) != 0)
+			break;
 	}
 
-	i = 0;
-	while (funcs[i]) {
-		if (!funcs[i++](fd)) {
-			printf("PCM test aborts.\n");
-			return EXIT_FAILURE;
+	printf("Under load of %u threads:\n", i);
+	err = measure_pointer_costs(&stream, iterations);
+
+	running = false;
+	while (i > 0)
+		pthread_join(threads[--i], NULL);
+	free(threads);
+end:
+	ioctl(stream.fd, SNDRV_PCM_IOCTL_DROP);
+	pcm_stream_close(&stream);
+	return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+	unsigned int iterations;
+
+	if (argc > 2 && strcmp(argv[1], "ptr-cost") == 0) {
+		iterations = strtoul(argv[2], NULL, 10);
+		if (iterations > 0) {
+			if (compare_pointer_costs(iterations,
+				argc > 3 ? strtoul(argv[3], NULL, 10) : 0) < 0)
+				return EXIT_FAILURE;
+			return EXIT_SUCCESS;
 		}
 	}
 
-	return EXIT_SUCCESS;
+	return ioctl_suite_main(&suite, argc, argv);
 }
@@ -13,79 +13,38 @@
 
 #include <sound/asound.h>
 
-#define TEST_IOCTL(fd, command, argument, expected)			\
-	if (ioctl(fd, command, argument) < 0 && errno != expected) {	\
-		printf("%s: %s\n", #command, strerror(errno));		\
-		return false;						\
-	}								\
-	return true;							\
+#include "ioctl-suite.h"
 
-static bool check_pversion(int fd)
+static void init_params(void *arg)
 {
-	int version;
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_PVERSION, &version, 0);
-}
+	struct snd_rawmidi_params *params = arg;
 
-static bool check_info(int fd)
-{
-	struct snd_rawmidi_info info = {0};
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_INFO, &info, 0);
-}
-
-static bool check_params(int fd)
-{
-	struct snd_rawmidi_params params = {0};
-	params.stream = SNDRV_RAWMIDI_STREAM_OUTPUT;
-	params.buffer_size = 1024;
-	params.avail_min = 2;
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_PARAMS, &params, 0);
+	params->stream = SNDRV_RAWMIDI_STREAM_OUTPUT;
+	params->buffer_size = 1024;
+	params->avail_min = 2;
 }
 
-static bool check_status(int fd)
+static const struct ioctl_case cases[] = {
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_PVERSION, int, NULL, 0),
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_INFO, struct snd_rawmidi_info, NULL, 0),
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_PARAMS, struct snd_rawmidi_params,
+		   init_params, 0),
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_STATUS, struct snd_rawmidi_status,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_DROP, int, NULL, 0),
+	IOCTL_CASE(SNDRV_RAWMIDI_IOCTL_DRAIN, int, NULL, 0),
+};
+
+static const struct ioctl_suite suite = {
+	.label = "Rawmidi",
+	.node = "/dev/snd/midiC0D0",
+	.pattern = "midiC*D*",
+	.flags = O_RDWR,
+	.cases = cases,
+	.count = sizeof(cases) / sizeof(cases[0]),
+};
+
+int main(int argc, const char *const argv[])
 {
-	struct snd_rawmidi_status status = {0};
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_STATUS, &status, 0);
-}
-
-static bool check_drop(int fd)
-{
-	int drop = 0;
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_DROP, &drop, 0);
-}
-
-static bool check_drain(int fd)
-{
-	int drain = 0;
-	TEST_IOCTL(fd, SNDRV_RAWMIDI_IOCTL_DRAIN, &drain, 0);
-}
-
-int main(void)
-{
-	bool (*const funcs[])(int) = {
-		check_pversion,
-		check_info,
-		check_params,
-		check_status,
-		check_drop,
-		check_drain,
-		NULL,
-	};
-	unsigned int i;
-	int fd;
-
-	fd = open("/dev/snd/midiC0D0", O_RDWR);
-	if (fd < 0) {
-		printf("%s\n", strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	i = 0;
-	while (funcs[i]) {
-		if (!funcs[i++](fd)) {
-			printf("Rawmidi test aborts.\n");
-			return EXIT_FAILURE;
-		}
-	}
-
-	return EXIT_SUCCESS;
+	return ioctl_suite_main(&suite, argc, argv);
 }
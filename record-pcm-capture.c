@@ -0,0 +1,605 @@
+/*
+ * record-pcm-capture.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Record a PCM capture substream to a file or a pipe directly from the mapped
+ * ring buffer, by vmsplice(2) and splice(2) into a regular file or by
+ * write(2), without copy in user space. The output is raw samples or WAV,
+ * whose header is fixed up periodically. The sustained throughput, the
+ * headroom of the buffer and the periods dropped by overrun are reported.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+
+/* Seconds between reports and between fix-ups of WAV header. */
+#define REPORT_INTERVAL     10
+#define FIXUP_INTERVAL      1
+
+#define WAV_HEADER_BYTES    44
+#define MAX_WRITE_SAMPLES   (1 << 20)
+
+struct sink {
+    int fd;
+    bool wav;
+    bool seekable;
+    bool by_splice;
+    /* For splice(2) into file. */
+    int pipe_fds[2];
+    unsigned int pipe_bytes;
+    uint64_t data_bytes;
+};
+
+struct headroom {
+    snd_pcm_uframes_t min;
+    double sum;
+    uint64_t count;
+};
+
+static const struct {
+    snd_pcm_format_t format;
+    unsigned int tag;
+    unsigned int bits;
+} wav_formats[] = {
+    { SNDRV_PCM_FORMAT_U8,          1,  8 },
+    { SNDRV_PCM_FORMAT_S16_LE,      1, 16 },
+    { SNDRV_PCM_FORMAT_S24_3LE,     1, 24 },
+    { SNDRV_PCM_FORMAT_S32_LE,      1, 32 },
+    { SNDRV_PCM_FORMAT_FLOAT_LE,    3, 32 },
+    { SNDRV_PCM_FORMAT_FLOAT64_LE,  3, 64 },
+};
+
+static void put_le16(unsigned char *pos, uint16_t val)
+{
+    pos[0] = val;
+    pos[1] = val >> 8;
+}
+
+static void put_le32(unsigned char *pos, uint32_t val)
+{
+    put_le16(pos, val);
+    put_le16(pos + 2, val >> 16);
+}
+
+/* The sizes are saturated for the data more than 4 GiB. */
+static uint32_t wav_size(uint64_t bytes)
+{
+    return bytes > UINT32_MAX ? UINT32_MAX : bytes;
+}
+
+static int write_wav_header(struct sink *sink,
+                            const struct pcm_stream_config *config)
+{
+    unsigned char header[WAV_HEADER_BYTES];
+    unsigned int block, i;
+    ssize_t result;
+
+    for (i = 0; i < sizeof(wav_formats) / sizeof(wav_formats[0]); ++i) {
+        if (wav_formats[i].format == config->format)
+            break;
+    }
+    if (i == sizeof(wav_formats) / sizeof(wav_formats[0]))
+        return -EINVAL;
+
+    block = config->channels * wav_formats[i].bits / 8;
+
+    /* The sizes are for unknown length until the first fix-up. */
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, UINT32_MAX);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    put_le16(header + 20, wav_formats[i].tag);
+    put_le16(header + 22, config->channels);
+    put_le32(header + 24, config->rate);
+    put_le32(header + 28, config->rate * block);
+    put_le16(header + 32, block);
+    put_le16(header + 34, wav_formats[i].bits);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, UINT32_MAX);
+
+    result = write(sink->fd, header, sizeof(header));
+    if (result < 0)
+        return -errno;
+    if (result != sizeof(header))
+        return -EIO;
+
+    return 0;
+}
+
+static int fixup_wav_header(struct sink *sink)
+{
+    unsigned char size[4];
+
+    if (!sink->wav || !sink->seekable)
+        return 0;
+
+    put_le32(size, wav_size(sink->data_bytes + WAV_HEADER_BYTES - 8));
+    if (pwrite(sink->fd, size, sizeof(size), 4) < 0)
+        return -errno;
+    put_le32(size, wav_size(sink->data_bytes));
+    if (pwrite(sink->fd, size, sizeof(size), 40) < 0)
+        return -errno;
+
+    return 0;
+}
+
+/* Unprivileged process can not exceed /proc/sys/fs/pipe-max-size. */
+static int resize_pipe(int fd, unsigned int bytes)
+{
+    int size;
+
+    size = fcntl(fd, F_SETPIPE_SZ, bytes);
+    if (size < 0)
+        size = fcntl(fd, F_GETPIPE_SZ);
+    if (size < 0)
+        return -errno;
+
+    return size;
+}
+
+static int open_sink(struct sink *sink, const char *path, bool wav,
+                     bool by_splice, unsigned int buffer_bytes)
+{
+    struct stat st;
+    int size;
+
+    memset(sink, 0, sizeof(*sink));
+    sink->pipe_fds[0] = sink->pipe_fds[1] = -1;
+    sink->wav = wav;
+    sink->by_splice = by_splice;
+
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink->fd < 0)
+        return -errno;
+
+    if (fstat(sink->fd, &st) < 0)
+        return -errno;
+    sink->seekable = S_ISREG(st.st_mode);
+
+    if (!by_splice)
+        return 0;
+
+    /*
+     * The pipe refers to pages of the ring buffer until the reader consumes
+     * them, while the pages are returned to hardware just after. The splice(2)
+     * into regular file copies them to page cache before returning, but the
+     * other readers such as FIFO or socket can keep the reference.
+     */
+    if (!S_ISREG(st.st_mode)) {
+        printf("vmsplice(2) is not safe for %s; fall back to write(2).\n",
+               path);
+        sink->by_splice = false;
+        return 0;
+    }
+
+    if (pipe(sink->pipe_fds) < 0)
+        return -errno;
+    size = resize_pipe(sink->pipe_fds[1], buffer_bytes);
+    if (size < 0)
+        return size;
+    sink->pipe_bytes = size;
+
+    return 0;
+}
+
+static void close_sink(struct sink *sink)
+{
+    if (sink->pipe_fds[0] >= 0)
+        close(sink->pipe_fds[0]);
+    if (sink->pipe_fds[1] >= 0)
+        close(sink->pipe_fds[1]);
+    if (sink->fd >= 0)
+        close(sink->fd);
+}
+
+static int write_by_write(struct sink *sink, const unsigned char *addr,
+                          size_t bytes)
+{
+    ssize_t result;
+
+    while (bytes > 0) {
+        result = write(sink->fd, addr, bytes);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        addr += result;
+        bytes -= result;
+    }
+
+    return 0;
+}
+
+/* The bytes in the file are reported even on error. */
+static int write_by_splice(struct sink *sink, const unsigned char *addr,
+                           size_t bytes, size_t *written)
+{
+    struct iovec iov;
+    ssize_t result, moved, len;
+    size_t chunk;
+
+    *written = 0;
+
+    while (bytes > 0) {
+        chunk = bytes < sink->pipe_bytes ? bytes : sink->pipe_bytes;
+        iov.iov_base = (void *)addr;
+        iov.iov_len = chunk;
+
+        result = vmsplice(sink->pipe_fds[1], &iov, 1, 0);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        /* Drain the pipe before the ring buffer is released to hardware. */
+        moved = 0;
+        while (moved < result) {
+            len = splice(sink->pipe_fds[0], NULL, sink->fd, NULL,
+                         result - moved, SPLICE_F_MOVE);
+            if (len < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -errno;
+            }
+            moved += len;
+            *written += len;
+        }
+
+        addr += result;
+        bytes -= result;
+    }
+
+    return 0;
+}
+
+static int write_sink(struct sink *sink, const unsigned char *addr,
+                      size_t bytes)
+{
+    size_t written;
+    int err;
+
+    if (sink->by_splice) {
+        err = write_by_splice(sink, addr, bytes, &written);
+        sink->data_bytes += written;
+        /* Some mappings of DMA buffer are not available for vmsplice(2). */
+        if (err == -EFAULT || err == -EINVAL) {
+            printf("vmsplice(2): %s; fall back to write(2).\n",
+                   strerror(-err));
+            sink->by_splice = false;
+            /* Continue from the bytes not in the file yet. */
+            addr += written;
+            bytes -= written;
+        } else {
+            return err;
+        }
+    }
+
+    err = write_by_write(sink, addr, bytes);
+    if (err == 0)
+        sink->data_bytes += bytes;
+    return err;
+}
+
+static void headroom_add(struct headroom *headroom, snd_pcm_uframes_t frames)
+{
+    if (headroom->count == 0 || frames < headroom->min)
+        headroom->min = frames;
+    headroom->sum += frames;
+    ++headroom->count;
+}
+
+static void headroom_dump(const struct headroom *headroom, unsigned int rate)
+{
+    if (headroom->count == 0)
+        return;
+    printf("    headroom:       min %.3f ms, mean %.3f ms\n",
+           headroom->min * 1000.0 / rate,
+           headroom->sum / headroom->count * 1000.0 / rate);
+}
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+/*
+ * The periods lost during overrun are estimated by the trigger timestamps
+ * at the stop and at the restart, and by the frames overwritten before it.
+ */
+static int recover_overrun(struct pcm_stream *stream, uint64_t *dropped)
+{
+    struct snd_pcm_status status = {0};
+    snd_pcm_uframes_t period = stream->config.period_size;
+    int64_t stopped, frames;
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+        return -errno;
+    stopped = timespec_to_ns(&status.trigger_tstamp);
+    frames = status.avail > stream->buffer_size ?
+             status.avail - stream->buffer_size : 0;
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0 ||
+        ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0)
+        return -errno;
+
+    memset(&status, 0, sizeof(status));
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+        return -errno;
+    frames += (timespec_to_ns(&status.trigger_tstamp) - stopped) *
+              stream->config.rate / 1000000000ll;
+
+    *dropped += (frames + period - 1) / period;
+
+    return 0;
+}
+
+static int record(struct pcm_stream *stream, struct sink *sink,
+                  unsigned int seconds, struct latency_record *writes)
+{
+    unsigned int frame_bytes = stream->frame_bits / 8;
+    struct pollfd pfd = { .fd = stream->fd, .events = POLLIN };
+    struct headroom total = {0}, recent = {0};
+    snd_pcm_uframes_t hw_ptr, appl_ptr, avail, offset, frames;
+    snd_pcm_state_t state;
+    uint64_t begin, now, end, last_report, next_report, next_fixup, start;
+    uint64_t reported_bytes = 0, dropped = 0, overruns = 0;
+    int err;
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0 ||
+        ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0)
+        return -errno;
+
+    begin = latency_now();
+    end = begin + (uint64_t)seconds * 1000000000ull;
+    last_report = begin;
+    next_report = begin + REPORT_INTERVAL * 1000000000ull;
+    next_fixup = begin + FIXUP_INTERVAL * 1000000000ull;
+
+    while ((now = latency_now()) < end) {
+        if (now >= next_fixup) {
+            err = fixup_wav_header(sink);
+            if (err < 0)
+                return err;
+            next_fixup += FIXUP_INTERVAL * 1000000000ull;
+        }
+
+        if (now >= next_report) {
+            printf("  At %.0f seconds:\n", (now - begin) / 1e9);
+            printf("    throughput:     %.3f MB/s\n",
+                   (sink->data_bytes - reported_bytes) * 1e3 /
+                   (now - last_report));
+            headroom_dump(&recent, stream->config.rate);
+            printf("    dropped:        %" PRIu64 " periods by %" PRIu64
+                   " overruns\n", dropped, overruns);
+            memset(&recent, 0, sizeof(recent));
+            reported_bytes = sink->data_bytes;
+            last_report = now;
+            next_report += REPORT_INTERVAL * 1000000000ull;
+        }
+
+        if (poll(&pfd, 1, 1000) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        err = pcm_stream_sync(stream, &state, &hw_ptr, &appl_ptr);
+        if (err < 0)
+            return err;
+        avail = pcm_stream_avail(stream, hw_ptr, appl_ptr);
+
+        if (state == SNDRV_PCM_STATE_XRUN || avail > stream->buffer_size) {
+            ++overruns;
+            err = recover_overrun(stream, &dropped);
+            if (err < 0)
+                return err;
+            continue;
+        }
+
+        /* The frames which hardware can still write before overrun. */
+        headroom_add(&total, stream->buffer_size - avail);
+        headroom_add(&recent, stream->buffer_size - avail);
+
+        while (avail > 0) {
+            offset = appl_ptr % stream->buffer_size;
+            frames = avail;
+            if (frames > stream->buffer_size - offset)
+                frames = stream->buffer_size - offset;
+
+            start = latency_now();
+            err = write_sink(sink, (unsigned char *)stream->data +
+                                   offset * frame_bytes,
+                             frames * frame_bytes);
+            if (err < 0)
+                return err;
+            latency_record_push(writes, latency_now() - start);
+
+            appl_ptr += frames;
+            if (appl_ptr >= stream->boundary)
+                appl_ptr -= stream->boundary;
+            avail -= frames;
+        }
+
+        err = pcm_stream_commit(stream, appl_ptr);
+        if (err < 0)
+            return err;
+    }
+
+    now = latency_now();
+    printf("  Total of %.1f seconds:\n", (now - begin) / 1e9);
+    printf("    recorded:       %" PRIu64 " bytes\n", sink->data_bytes);
+    printf("    throughput:     %.3f MB/s\n",
+           sink->data_bytes * 1e3 / (now - begin));
+    headroom_dump(&total, stream->config.rate);
+    printf("    dropped:        %" PRIu64 " periods by %" PRIu64
+           " overruns\n", dropped, overruns);
+
+    return fixup_wav_header(sink);
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct pcm_stream_config config = {
+        .access = SNDRV_PCM_ACCESS_MMAP_INTERLEAVED,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct latency_record writes = {0};
+    struct snd_pcm_sw_params sw_params;
+    struct pcm_stream stream;
+    struct sink sink = { .fd = -1, .pipe_fds = { -1, -1 } };
+    unsigned int seconds, frame_bytes;
+    bool wav = false, by_splice = true;
+    int format;
+    int err;
+
+    if (argc < 4 ||
+        (argc > 4 && strcmp(argv[4], "raw") && strcmp(argv[4], "wav")) ||
+        (argc > 5 && strcmp(argv[5], "splice") && strcmp(argv[5], "write"))) {
+        printf("Usage: %s PCM-DEVICE OUTPUT SECONDS [raw|wav [splice|write "
+               "[FORMAT [CHANNELS [RATE [PERIOD-SIZE [PERIODS]]]]]]]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+    seconds = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        wav = strcmp(argv[4], "wav") == 0;
+    if (argc > 5)
+        by_splice = strcmp(argv[5], "splice") == 0;
+    if (argc > 6) {
+        format = pcm_stream_parse_format(argv[6]);
+        if (format < 0) {
+            printf("Unsupported format: %s\n", argv[6]);
+            return EXIT_FAILURE;
+        }
+        config.format = format;
+    }
+    if (argc > 7)
+        config.channels = strtoul(argv[7], NULL, 10);
+    if (argc > 8)
+        config.rate = strtoul(argv[8], NULL, 10);
+    if (argc > 9)
+        config.period_size = strtoul(argv[9], NULL, 10);
+    if (argc > 10)
+        config.periods = strtoul(argv[10], NULL, 10);
+
+    /* The data is mapped with PROT_WRITE as well. */
+    err = pcm_stream_open(&stream, argv[1], O_RDWR | O_NONBLOCK);
+    if (err < 0) {
+        printf("open(2): %s\n", strerror(-err));
+        return EXIT_FAILURE;
+    }
+    if (stream.direction != SNDRV_PCM_STREAM_CAPTURE) {
+        printf("%s is not for capture.\n", argv[1]);
+        err = -EINVAL;
+        goto end;
+    }
+
+    err = pcm_stream_configure(&stream, &config);
+    if (err < 0) {
+        printf("ioctl(HW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    /* Start explicitly, and let the substream stop at overrun. */
+    pcm_stream_init_sw_params(&stream, &sw_params);
+    sw_params.start_threshold = stream.boundary;
+    err = pcm_stream_set_sw_params(&stream, &sw_params);
+    if (err < 0) {
+        printf("ioctl(SW_PARAMS): %s\n", strerror(-err));
+        goto end;
+    }
+
+    /* Optional; SNDRV_PCM_IOCTL_SYNC_PTR is used instead. */
+    pcm_stream_map_pointers(&stream);
+
+    err = pcm_stream_map_data(&stream);
+    if (err < 0) {
+        printf("mmap(2) for data: %s\n", strerror(-err));
+        goto end;
+    }
+
+    /* The frames should be contiguous to be written at once. */
+    frame_bytes = stream.frame_bits / 8;
+    if (stream.areas[0].addr != stream.data ||
+        stream.areas[0].step != frame_bytes) {
+        printf("The buffer is not in interleaved layout.\n");
+        err = -ENXIO;
+        goto end;
+    }
+
+    err = open_sink(&sink, argv[2], wav, by_splice,
+                    stream.buffer_size * frame_bytes);
+    if (err < 0) {
+        printf("Output to %s: %s\n", argv[2], strerror(-err));
+        goto end;
+    }
+    if (wav) {
+        err = write_wav_header(&sink, &stream.config);
+        if (err == -EINVAL)
+            printf("WAV is not available for %s; use raw.\n",
+                   pcm_stream_format_labels[stream.config.format]);
+        if (err < 0)
+            goto end;
+    }
+
+    err = latency_record_init(&writes,
+                              sink.by_splice ? "vmsplice/splice" : "write",
+                              MAX_WRITE_SAMPLES);
+    if (err < 0)
+        goto end;
+
+    printf("%s to %s by %s:\n", argv[1], argv[2],
+           sink.by_splice ? "vmsplice/splice" : "write");
+    printf("  format:         %s\n",
+           pcm_stream_format_labels[stream.config.format]);
+    printf("  channels:       %u\n", stream.config.channels);
+    printf("  rate:           %u\n", stream.config.rate);
+    printf("  period-size:    %lu\n", stream.config.period_size);
+    printf("  buffer-size:    %lu\n", stream.buffer_size);
+
+    err = record(&stream, &sink, seconds, &writes);
+    if (err < 0)
+        printf("Recording aborts: %s\n", strerror(-err));
+
+    printf("  Cost of each output:\n");
+    latency_dump_header();
+    latency_record_dump(&writes);
+end:
+    latency_record_fini(&writes);
+    close_sink(&sink);
+    ioctl(stream.fd, SNDRV_PCM_IOCTL_DROP);
+    pcm_stream_close(&stream);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
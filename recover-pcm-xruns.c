@@ -0,0 +1,292 @@
+/*
+ * recover-pcm-xruns.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Inject XRUN into a running PCM substream on purpose, by
+ * SNDRV_PCM_IOCTL_XRUN or by starving the buffer, then time each step of
+ * the recovery; PREPARE, refill up to start threshold, START and the first
+ * period successfully transferred. The steps are reported per access.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "pcm-stream.h"
+
+enum recovery_step {
+    STEP_PREPARE = 0,
+    STEP_REFILL,
+    STEP_START,
+    STEP_FIRST_PERIOD,
+    STEP_TOTAL,
+    STEP_COUNT,
+};
+
+static const char *const step_labels[] = {
+    [STEP_PREPARE]      = "PREPARE",
+    [STEP_REFILL]       = "refill to start threshold",
+    [STEP_START]        = "START",
+    [STEP_FIRST_PERIOD] = "first period",
+    [STEP_TOTAL]        = "total",
+};
+
+/* Transfer the given frames, waiting for space by poll(2). */
+static int transfer_frames(struct pcm_stream *stream, snd_pcm_uframes_t frames,
+                           bool wait)
+{
+    struct pollfd pfd = { .fd = stream->fd };
+    snd_pcm_sframes_t result;
+    int err;
+
+    pfd.events =
+        stream->direction == SNDRV_PCM_STREAM_PLAYBACK ? POLLOUT : POLLIN;
+
+    while (frames > 0) {
+        if (wait) {
+            err = poll(&pfd, 1, 1000);
+            if (err < 0)
+                return -errno;
+            /* The hardware stalls. */
+            if (err == 0)
+                return -ETIMEDOUT;
+        }
+
+        result = pcm_stream_transfer(stream, frames);
+        if (result < 0)
+            return result;
+        if (result == 0 && !wait)
+            return -EAGAIN;
+        frames -= result;
+    }
+
+    return 0;
+}
+
+static int wait_xrun(struct pcm_stream *stream)
+{
+    struct snd_pcm_status status;
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = 500000 };
+    uint64_t end = latency_now() + 5000000000ull;
+
+    while (latency_now() < end) {
+        memset(&status, 0, sizeof(status));
+        if (ioctl(stream->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+            return -errno;
+        if (status.state == SNDRV_PCM_STATE_XRUN)
+            return 0;
+        nanosleep(&interval, NULL);
+    }
+
+    return -ETIMEDOUT;
+}
+
+static int run_trial(struct pcm_stream *stream, bool starve,
+                     struct latency_record *recs)
+{
+    bool playback = stream->direction == SNDRV_PCM_STREAM_PLAYBACK;
+    snd_pcm_uframes_t period = stream->config.period_size;
+    uint64_t steps[STEP_COUNT + 1];
+    unsigned int i;
+    int err;
+
+    /* Bring the substream into steady state. */
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0)
+        return -errno;
+    if (playback) {
+        err = transfer_frames(stream, stream->buffer_size, false);
+        if (err < 0)
+            return err;
+    }
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0)
+        return -errno;
+    for (i = 0; i < 2; ++i) {
+        err = transfer_frames(stream, period, true);
+        if (err < 0)
+            return err;
+    }
+
+    /* Inject XRUN. */
+    if (starve) {
+        err = wait_xrun(stream);
+        if (err < 0)
+            return err;
+    } else if (ioctl(stream->fd, SNDRV_PCM_IOCTL_XRUN) < 0) {
+        return -errno;
+    }
+
+    steps[STEP_PREPARE] = latency_now();
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0)
+        return -errno;
+
+    /* Capture substream starts without any data. */
+    steps[STEP_REFILL] = latency_now();
+    if (playback) {
+        err = transfer_frames(stream, stream->buffer_size, false);
+        if (err < 0)
+            return err;
+    }
+
+    steps[STEP_START] = latency_now();
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0)
+        return -errno;
+
+    steps[STEP_FIRST_PERIOD] = latency_now();
+    err = transfer_frames(stream, period, true);
+    if (err < 0)
+        return err;
+    steps[STEP_TOTAL] = latency_now();
+
+    for (i = STEP_PREPARE; i < STEP_TOTAL; ++i) {
+        if (i == STEP_REFILL && !playback)
+            continue;
+        latency_record_push(&recs[i], steps[i + 1] - steps[i]);
+    }
+    latency_record_push(&recs[STEP_TOTAL],
+                        steps[STEP_TOTAL] - steps[STEP_PREPARE]);
+
+    ioctl(stream->fd, SNDRV_PCM_IOCTL_DROP);
+
+    return 0;
+}
+
+static int measure_access(const char *path, snd_pcm_access_t access,
+                          unsigned int trials, bool starve)
+{
+    struct pcm_stream_config config = {
+        .access = access,
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct latency_record recs[STEP_COUNT] = {0};
+    struct snd_pcm_sw_params sw_params;
+    struct pcm_stream stream;
+    unsigned int i;
+    int err;
+
+    err = pcm_stream_open(&stream, path, O_RDWR | O_NONBLOCK);
+    if (err < 0) {
+        printf("open(2): %s\n", strerror(-err));
+        return err;
+    }
+
+    err = pcm_stream_configure(&stream, &config);
+    if (err < 0) {
+        printf("  %s: unavailable, %s\n", pcm_stream_access_labels[access],
+               strerror(-err));
+        pcm_stream_close(&stream);
+        return 0;
+    }
+
+    /* Start explicitly, to time START apart from refill. */
+    pcm_stream_init_sw_params(&stream, &sw_params);
+    sw_params.start_threshold = stream.boundary;
+    err = pcm_stream_set_sw_params(&stream, &sw_params);
+    if (err < 0) {
+        printf("ioctl(SW_PARAMS): %s\n", strerror(-err));
+        pcm_stream_close(&stream);
+        return err;
+    }
+
+    /* Optional; SNDRV_PCM_IOCTL_SYNC_PTR is used instead. */
+    if (access == SNDRV_PCM_ACCESS_MMAP_INTERLEAVED ||
+        access == SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED)
+        pcm_stream_map_pointers(&stream);
+
+    for (i = 0; i < STEP_COUNT; ++i) {
+        err = latency_record_init(&recs[i], step_labels[i], trials);
+        if (err < 0)
+            goto end;
+    }
+
+    for (i = 0; i < trials; ++i) {
+        err = run_trial(&stream, starve, recs);
+        if (err < 0) {
+            printf("Trial aborts: %s\n", strerror(-err));
+            break;
+        }
+    }
+
+    printf("  %s, period %lu, buffer %lu:\n", pcm_stream_access_labels[access],
+           stream.config.period_size, stream.buffer_size);
+    latency_dump_header();
+    for (i = 0; i < STEP_COUNT; ++i)
+        latency_record_dump(&recs[i]);
+end:
+    for (i = 0; i < STEP_COUNT; ++i)
+        latency_record_fini(&recs[i]);
+    ioctl(stream.fd, SNDRV_PCM_IOCTL_DROP);
+    pcm_stream_close(&stream);
+
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    static const snd_pcm_access_t accesses[] = {
+        SNDRV_PCM_ACCESS_RW_INTERLEAVED,
+        SNDRV_PCM_ACCESS_RW_NONINTERLEAVED,
+        SNDRV_PCM_ACCESS_MMAP_INTERLEAVED,
+        SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED,
+    };
+    const char *path;
+    unsigned int trials;
+    bool starve;
+    int access;
+    int i;
+    int err = 0;
+
+    if (argc < 4 || strtoul(argv[2], NULL, 10) == 0 ||
+        (strcmp(argv[3], "ioctl") != 0 && strcmp(argv[3], "starve") != 0)) {
+        printf("Usage: %s PCM-DEVICE TRIALS ioctl|starve [ACCESS ...]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+    path = argv[1];
+    trials = strtoul(argv[2], NULL, 10);
+    starve = strcmp(argv[3], "starve") == 0;
+
+    printf("%s, XRUN by %s:\n", path, argv[3]);
+
+    if (argc == 4) {
+        for (i = 0; i < sizeof(accesses) / sizeof(accesses[0]); ++i) {
+            err = measure_access(path, accesses[i], trials, starve);
+            if (err < 0)
+                break;
+        }
+    } else {
+        for (i = 4; i < argc; ++i) {
+            access = pcm_stream_parse_access(argv[i]);
+            if (access < 0 || access == SNDRV_PCM_ACCESS_MMAP_COMPLEX) {
+                printf("Unsupported access: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            err = measure_access(path, access, trials, starve);
+            if (err < 0)
+                break;
+        }
+    }
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
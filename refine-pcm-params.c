@@ -21,9 +21,18 @@
 #include <sys/ioctl.h>
 
 #include <unistd.h>
+#include <poll.h>
 
 #include <sound/asound.h>
 
+#include "latency.h"
+#include "pcm-cache.h"
+#include "pcm-refine.h"
+#include "dump-output.h"
+
+/* Candidates to try by streaming at most. */
+#define MAX_SOLVE_TRIALS    32
+
 #define ARRAY_SIZE(array)   (sizeof(array) / sizeof(array[0]))
 
 static const char *const class_labels[] = {
@@ -227,7 +236,8 @@ static unsigned int get_interval_index(unsigned int index)
     return index + SNDRV_PCM_HW_PARAM_FIRST_INTERVAL;
 }
 
-static void dump_mask_param(struct snd_pcm_hw_params *hw_params,
+static void dump_mask_param(struct dump_output *out,
+                            struct snd_pcm_hw_params *hw_params,
                             snd_pcm_hw_param_t type, const char *const labels[],
                             unsigned int label_entries)
 {
@@ -239,7 +249,7 @@ static void dump_mask_param(struct snd_pcm_hw_params *hw_params,
         type > SNDRV_PCM_HW_PARAM_LAST_MASK ||
         type >= ARRAY_SIZE(param_labels))
         return;
-    printf("    %s:\n", param_labels[type]);
+    dump_output_begin_list(out, param_labels[type]);
 
     mask = get_mask(hw_params, type);
 
@@ -247,14 +257,17 @@ static void dump_mask_param(struct snd_pcm_hw_params *hw_params,
         for (j = 0; j < sizeof(mask->bits[0]) * 8; ++j) {
             index = i * sizeof(mask->bits[0]) * 8 + j;
             if (index >= label_entries)
-                return;
+                break;
             if ((mask->bits[i] & (1 << j)) && labels[index] != NULL)
-                printf("      %s\n", labels[index]);
+                dump_output_label(out, NULL, labels[index]);
         }
     }
+
+    dump_output_end(out);
 }
 
-static void dump_interval_param(struct snd_pcm_hw_params *hw_params,
+static void dump_interval_param(struct dump_output *out,
+                                struct snd_pcm_hw_params *hw_params,
                                 snd_pcm_hw_param_t type)
 {
     const struct snd_interval *interval;
@@ -263,18 +276,18 @@ static void dump_interval_param(struct snd_pcm_hw_params *hw_params,
         type > SNDRV_PCM_HW_PARAM_LAST_INTERVAL ||
         type >= ARRAY_SIZE(param_labels))
         return;
-    printf("    %s:\n", param_labels[type]);
+    dump_output_begin(out, param_labels[type]);
 
     interval = get_interval(hw_params, type);
 
-    printf("      %c%u, %u%c, ",
-           interval->openmin ? '(' : '[', interval->min,
-           interval->max, interval->openmax ? ')' : ']');
-    if (interval->integer > 0)
-        printf("integer, ");
-    if (interval->empty > 0)
-        printf("empty, ");
-    printf("\n");
+    dump_output_int(out, "min", interval->min);
+    dump_output_int(out, "max", interval->max);
+    dump_output_bool(out, "openmin", interval->openmin);
+    dump_output_bool(out, "openmax", interval->openmax);
+    dump_output_bool(out, "integer", interval->integer);
+    dump_output_bool(out, "empty", interval->empty);
+
+    dump_output_end(out);
 }
 
 static void initialize_hw_params(struct snd_pcm_hw_params *params)
@@ -302,100 +315,858 @@ static void initialize_hw_params(struct snd_pcm_hw_params *params)
     params->info = 0;
 }
 
-static int dump_pcm_caps(int fd)
+static int refine_pcm_caps(int fd, struct snd_pcm_hw_params *hw_params)
 {
-    struct snd_pcm_hw_params hw_params = {0};
-    int i;
-
-    initialize_hw_params(&hw_params);
+    memset(hw_params, 0, sizeof(*hw_params));
+    initialize_hw_params(hw_params);
 
-    if (ioctl(fd, SNDRV_PCM_IOCTL_HW_REFINE, &hw_params) < 0) {
-        printf("  ioctl(HW_REFINE): %s\n", strerror(errno));
+    if (ioctl(fd, SNDRV_PCM_IOCTL_HW_REFINE, hw_params) < 0) {
+        fprintf(stderr, "ioctl(HW_REFINE): %s\n", strerror(errno));
         return -errno;
     }
 
-    printf("  Changed parameters:\n");
+    return 0;
+}
 
+static void dump_pcm_caps(struct dump_output *out,
+                          struct snd_pcm_hw_params *hw_params)
+{
+    int i;
+
+    dump_output_begin(out, "hw-params");
+
+    dump_output_begin_list(out, "changed");
     for (i = 0; i < ARRAY_SIZE(param_labels); ++i) {
-        if (hw_params.cmask & (1 << i))
-            printf("    %s\n", param_labels[i]);
+        if (hw_params->cmask & (1 << i))
+            dump_output_label(out, NULL, param_labels[i]);
     }
+    dump_output_end(out);
 
-    printf("  Runtime parameters:\n");
-
-    dump_mask_param(&hw_params, SNDRV_PCM_HW_PARAM_ACCESS, access_labels,
+    dump_mask_param(out, hw_params, SNDRV_PCM_HW_PARAM_ACCESS, access_labels,
                     ARRAY_SIZE(access_labels));
-    dump_mask_param(&hw_params, SNDRV_PCM_HW_PARAM_FORMAT, format_labels,
+    dump_mask_param(out, hw_params, SNDRV_PCM_HW_PARAM_FORMAT, format_labels,
                     ARRAY_SIZE(format_labels));
-    dump_mask_param(&hw_params, SNDRV_PCM_HW_PARAM_SUBFORMAT, subformat_labels,
-                    ARRAY_SIZE(subformat_labels));
-
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_FRAME_BITS);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_CHANNELS);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_RATE);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_PERIOD_TIME);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_PERIODS);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_BUFFER_TIME);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_BUFFER_BYTES);
-    dump_interval_param(&hw_params, SNDRV_PCM_HW_PARAM_TICK_TIME);
-
-    if (hw_params.flags > 0) {
-        printf("      flags: \n");
-        for (i = 0; i < ARRAY_SIZE(flag_labels); ++i) {
-            if (hw_params.flags & (1 << i))
-                printf("  %s\n", flag_labels[i]);
-        }
+    dump_mask_param(out, hw_params, SNDRV_PCM_HW_PARAM_SUBFORMAT,
+                    subformat_labels, ARRAY_SIZE(subformat_labels));
+
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_FRAME_BITS);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_CHANNELS);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_RATE);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_PERIOD_TIME);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_PERIODS);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_BUFFER_TIME);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_BUFFER_BYTES);
+    dump_interval_param(out, hw_params, SNDRV_PCM_HW_PARAM_TICK_TIME);
+
+    dump_output_begin_list(out, "flags");
+    for (i = 0; i < ARRAY_SIZE(flag_labels); ++i) {
+        if (hw_params->flags & (1 << i))
+            dump_output_label(out, NULL, flag_labels[i]);
     }
+    dump_output_end(out);
 
-    printf("    info:\n");
+    dump_output_begin_list(out, "info");
     for (i = 0; i < ARRAY_SIZE(info_flags); ++i) {
-        if (hw_params.info & info_flags[i])
-            printf("      %s\n", info_labels[i]);
+        if (hw_params->info & info_flags[i])
+            dump_output_label(out, NULL, info_labels[i]);
     }
+    dump_output_end(out);
+
+    dump_output_int(out, "most-significant-bits", hw_params->msbits);
+    dump_output_int(out, "rate_num", hw_params->rate_num);
+    dump_output_int(out, "rate_den", hw_params->rate_den);
 
-    if (hw_params.msbits > 0)
-        printf("      most-significant-bits:    %u\n", hw_params.msbits);
+    dump_output_end(out);
+}
 
-    if (hw_params.rate_num > 0 && hw_params.rate_den > 0) {
-        printf("      rate_num: %u\n", hw_params.rate_num);
-        printf("      rate_den: %u\n", hw_params.rate_den);
+static int get_pcm_info(int fd, struct snd_pcm_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    if (ioctl(fd, SNDRV_PCM_IOCTL_INFO, info) < 0) {
+        fprintf(stderr, "ioctl(2): %s\n", strerror(errno));
+        return -errno;
     }
 
     return 0;
 }
 
-static int dump_pcm_info(int fd)
+static void dump_pcm_info(struct dump_output *out, const char *path,
+                          const struct snd_pcm_info *info, bool cached)
+{
+    dump_output_begin(out, "substream");
+    dump_output_string(out, "path", path);
+    dump_output_bool(out, "cached", cached);
+    dump_output_int(out, "device", info->device);
+    dump_output_int(out, "subdevice", info->subdevice);
+    dump_output_label(out, "direction", direction_labels[info->stream]);
+    dump_output_int(out, "card", info->card);
+    dump_output_string(out, "id", (const char *)info->id);
+    dump_output_string(out, "name", (const char *)info->name);
+    dump_output_string(out, "subname", (const char *)info->subname);
+    dump_output_label(out, "dev-class", class_labels[info->dev_class]);
+    dump_output_label(out, "dev-subclass",
+                      subclass_labels[info->dev_subclass]);
+    dump_output_int(out, "subdevices-count", info->subdevices_count);
+    dump_output_int(out, "subdevices-avail", info->subdevices_avail);
+    dump_output_end(out);
+}
+
+/* The cache is keyed by the card which has the node. */
+static int load_cache_key(const char *path, struct pcm_cache_key *key,
+                          int *card, int *device, int *stream)
 {
-    struct snd_pcm_info info = {0};
+    struct snd_ctl_card_info info = {0};
+    const char *name;
+    char ctl_path[32];
+    char dir;
+    int fd;
+    int err;
 
-    if (ioctl(fd, SNDRV_PCM_IOCTL_INFO, &info) < 0) {
-        printf("ioctl(2): %s\n", strerror(errno));
+    name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    if (sscanf(name, "pcmC%dD%d%c", card, device, &dir) != 3 ||
+        (dir != 'p' && dir != 'c'))
+        return -EINVAL;
+    *stream = dir == 'c' ? SNDRV_PCM_STREAM_CAPTURE :
+                           SNDRV_PCM_STREAM_PLAYBACK;
+
+    snprintf(ctl_path, sizeof(ctl_path), "/dev/snd/controlC%d", *card);
+    fd = open(ctl_path, O_RDONLY);
+    if (fd < 0)
         return -errno;
+    if (ioctl(fd, SNDRV_CTL_IOCTL_CARD_INFO, &info) < 0) {
+        err = -errno;
+        close(fd);
+        return err;
+    }
+    close(fd);
+
+    return pcm_cache_make_key(&info, key);
+}
+
+static int dump_from_cache(const char *path, const char *cache_path,
+                           struct dump_output *out)
+{
+    const struct pcm_cache_entry *entry;
+    struct pcm_cache_entry copy;
+    struct pcm_cache_key key;
+    struct pcm_cache cache;
+    int card, device, stream;
+    int err;
+
+    err = load_cache_key(path, &key, &card, &device, &stream);
+    if (err < 0)
+        return err;
+
+    err = pcm_cache_open(&cache, cache_path);
+    if (err < 0)
+        return err;
+
+    entry = pcm_cache_lookup(&cache, &key, card, device, PCM_CACHE_ANY,
+                             stream, PCM_CACHE_INFO | PCM_CACHE_PARAMS);
+    if (entry == NULL) {
+        pcm_cache_close(&cache);
+        return -ENOENT;
     }
+    copy = *entry;
+    pcm_cache_close(&cache);
 
-    printf("  Substream information:\n");
-    printf("    device:       %u\n", info.device);
-    printf("    subdevice:    %u\n", info.subdevice);
-    printf("    direction:    %s\n", direction_labels[info.stream]);
-    printf("    card:         %d\n", info.card);
-    printf("    id:           '%s'\n", info.id);
-    printf("    name:         '%s'\n", info.name);
-    printf("    subname:      '%s'\n", info.subname);
-    printf("    dev-class:    %s\n", class_labels[info.dev_class]);
-    printf("    dev-subclass: %s\n", subclass_labels[info.dev_subclass]);
-    printf("    subdevices-count:   %u\n", info.subdevices_count);
-    printf("    subdevices-avail:   %u\n", info.subdevices_avail);
+    dump_pcm_info(out, path, &copy.info, true);
+    dump_pcm_caps(out, &copy.params);
 
     return 0;
 }
 
+static void store_to_cache(const char *path, const char *cache_path,
+                           const struct snd_pcm_info *info,
+                           const struct snd_pcm_hw_params *hw_params)
+{
+    struct pcm_cache_entry entry;
+    struct pcm_cache_key key;
+    int card, device, stream;
+    int err;
+
+    err = load_cache_key(path, &key, &card, &device, &stream);
+    if (err >= 0)
+        err = pcm_cache_init_entry(&entry, &key, card, device,
+                                   info->subdevice, stream);
+    if (err >= 0) {
+        entry.flags = PCM_CACHE_INFO | PCM_CACHE_PARAMS;
+        entry.info = *info;
+        entry.params = *hw_params;
+        err = pcm_cache_store(cache_path, &entry, 1);
+    }
+    if (err < 0)
+        fprintf(stderr, "Cache is not updated: %s\n", strerror(-err));
+}
+
+/* The buffer geometry of a candidate to try by streaming. */
+struct solution {
+    snd_pcm_uframes_t period_size;
+    unsigned int periods;
+    snd_pcm_uframes_t buffer_size;
+};
+
+/*
+ * The least valid value of the interval parameter, not less than the given
+ * one. The upper end of the range which the kernel accepts is bisected, then
+ * the value is confirmed since the refined space is not always tight.
+ */
+static int find_least_value(int fd, const struct snd_pcm_hw_params *base,
+                            snd_pcm_hw_param_t type, unsigned int from,
+                            unsigned int *val, unsigned long *refines)
+{
+    struct snd_pcm_hw_params params = *base;
+    unsigned int min, max, lo, hi, mid;
+    int err;
+
+    pcm_refine_bounds(&params, type, &min, &max);
+    if (from < min)
+        from = min;
+
+    while (from <= max) {
+        params = *base;
+        pcm_refine_set_range(&params, type, from, max);
+        err = pcm_refine(fd, &params, refines);
+        if (err == -EINVAL)
+            return -ENOENT;
+        if (err < 0)
+            return err;
+
+        /* The refined lower bound is below any valid value. */
+        pcm_refine_bounds(&params, type, &lo, &hi);
+        if (lo < from)
+            lo = from;
+        hi = max;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            params = *base;
+            pcm_refine_set_range(&params, type, from, mid);
+            err = pcm_refine(fd, &params, refines);
+            if (err == 0)
+                hi = mid;
+            else if (err == -EINVAL)
+                lo = mid + 1;
+            else
+                return err;
+        }
+
+        err = pcm_refine_test(fd, base, type, lo, refines);
+        if (err < 0)
+            return err;
+        if (err > 0) {
+            *val = lo;
+            return 0;
+        }
+        if (lo == UINT_MAX)
+            break;
+        from = lo + 1;
+    }
+
+    return -ENOENT;
+}
+
+/*
+ * The least buffer not less than the given size, then the least periods for
+ * it, so that the substream wakes up as few as possible for the latency.
+ */
+static int solve_candidate(int fd, const struct snd_pcm_hw_params *base,
+                           snd_pcm_uframes_t from, struct solution *sol,
+                           unsigned long *refines)
+{
+    struct snd_pcm_hw_params params;
+    unsigned int buffer_size, periods = 0, period_size = 0;
+    int err;
+
+    while (true) {
+        err = find_least_value(fd, base, SNDRV_PCM_HW_PARAM_BUFFER_SIZE, from,
+                               &buffer_size, refines);
+        if (err < 0)
+            return err;
+
+        params = *base;
+        pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_BUFFER_SIZE,
+                                buffer_size);
+        err = find_least_value(fd, &params, SNDRV_PCM_HW_PARAM_PERIODS, 0,
+                               &periods, refines);
+        if (err == 0) {
+            pcm_stream_set_interval(&params, SNDRV_PCM_HW_PARAM_PERIODS,
+                                    periods);
+            err = find_least_value(fd, &params,
+                                   SNDRV_PCM_HW_PARAM_PERIOD_SIZE, 0,
+                                   &period_size, refines);
+        }
+        if (err == 0)
+            break;
+        if (err != -ENOENT)
+            return err;
+
+        /* Any combination for the buffer size is not available. */
+        from = buffer_size + 1;
+    }
+
+    sol->buffer_size = buffer_size;
+    sol->periods = periods;
+    sol->period_size = period_size;
+
+    return 0;
+}
+
+/*
+ * Returns -EPIPE when XRUN occurs in the given seconds. Playback substream is
+ * filled up to the start threshold at first.
+ */
+static int run_trial(struct pcm_stream *stream,
+                     const struct snd_pcm_sw_params *sw_params,
+                     unsigned int seconds)
+{
+    bool playback = stream->direction == SNDRV_PCM_STREAM_PLAYBACK;
+    struct pollfd pfd = { .fd = stream->fd };
+    snd_pcm_sframes_t result;
+    uint64_t end;
+    int err;
+
+    pfd.events = playback ? POLLOUT : POLLIN;
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0)
+        return -errno;
+
+    /* Playback substream starts at the threshold by the first transfer. */
+    if (playback) {
+        result = pcm_stream_transfer(stream, sw_params->start_threshold <
+                                             stream->buffer_size ?
+                                             sw_params->start_threshold :
+                                             stream->buffer_size);
+        if (result < 0)
+            return result;
+    } else if (ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0) {
+        return -errno;
+    }
+
+    end = latency_now() + seconds * 1000000000ull;
+    err = 0;
+    while (latency_now() < end) {
+        err = poll(&pfd, 1, 1000);
+        if (err < 0) {
+            err = -errno;
+            break;
+        }
+        if (err == 0) {
+            err = -ETIMEDOUT;
+            break;
+        }
+
+        result = pcm_stream_transfer(stream, stream->config.period_size);
+        if (result < 0) {
+            err = result;
+            break;
+        }
+        err = 0;
+    }
+
+    ioctl(stream->fd, SNDRV_PCM_IOCTL_DROP);
+
+    return err;
+}
+
+static const char *trial_result(int err)
+{
+    if (err == 0)
+        return "ok";
+    if (err == -EPIPE)
+        return "xrun";
+    return strerror(-err);
+}
+
+/*
+ * The lowest start threshold of playback, by halves down to a period, which
+ * streams without XRUN; the less data is queued before the start, the less
+ * latency at the start. Capture substream is started explicitly.
+ */
+static int tune_sw_params(struct pcm_stream *stream,
+                          struct snd_pcm_sw_params *sw_params,
+                          unsigned int seconds, struct dump_output *out)
+{
+    struct snd_pcm_sw_params trial;
+    int err;
+
+    if (stream->direction != SNDRV_PCM_STREAM_PLAYBACK)
+        return 0;
+
+    while (sw_params->start_threshold / 2 >= stream->config.period_size) {
+        trial = *sw_params;
+        trial.start_threshold /= 2;
+        err = pcm_stream_set_sw_params(stream, &trial);
+        if (err < 0)
+            return err;
+
+        err = run_trial(stream, &trial, seconds);
+        dump_output_begin(out, "threshold-trial");
+        dump_output_int(out, "start-threshold", trial.start_threshold);
+        dump_output_label(out, "result", trial_result(err));
+        dump_output_end(out);
+        /* Each trial takes seconds. */
+        dump_output_flush(out);
+        if (err == -EPIPE)
+            break;
+        if (err < 0)
+            return err;
+        *sw_params = trial;
+    }
+
+    return pcm_stream_set_sw_params(stream, sw_params);
+}
+
+static void dump_solution(struct dump_output *out, const char *path,
+                          struct pcm_stream *stream,
+                          const struct snd_pcm_sw_params *sw_params,
+                          unsigned long refines)
+{
+    dump_output_begin(out, "solution");
+    dump_output_string(out, "path", path);
+
+    dump_output_begin(out, "hw-params");
+    dump_output_label(out, "access",
+                      pcm_stream_access_labels[stream->config.access]);
+    dump_output_label(out, "format",
+                      pcm_stream_format_labels[stream->config.format]);
+    dump_output_int(out, "channels", stream->config.channels);
+    dump_output_int(out, "rate", stream->config.rate);
+    dump_output_int(out, "period-size", stream->config.period_size);
+    dump_output_int(out, "periods", stream->config.periods);
+    dump_output_int(out, "buffer-size", stream->buffer_size);
+    dump_output_end(out);
+
+    dump_output_begin(out, "sw-params");
+    /* A period, not tuned; the process is woken at period interrupts. */
+    dump_output_int(out, "avail-min", sw_params->avail_min);
+    dump_output_int(out, "start-threshold", sw_params->start_threshold);
+    /* Capture substream is started by ioctl(START), not the threshold. */
+    dump_output_bool(out, "explicit-start",
+                     stream->direction != SNDRV_PCM_STREAM_PLAYBACK);
+    dump_output_int(out, "stop-threshold", sw_params->stop_threshold);
+    dump_output_end(out);
+
+    dump_output_int(out, "latency-us", (uint64_t)stream->buffer_size *
+                                       1000000 / stream->config.rate);
+    dump_output_int(out, "refines", refines);
+    dump_output_end(out);
+}
+
+/*
+ * Search the lowest buffer with at least the given periods, by HW_REFINE
+ * with bisection. Each candidate is confirmed by streaming without XRUN,
+ * else the next larger buffer is tried. Then the start threshold is tuned.
+ */
+static int solve_latency(const char *path, struct pcm_stream_config *config,
+                         unsigned int seconds, int format)
+{
+    struct snd_pcm_hw_params base;
+    struct snd_pcm_sw_params sw_params;
+    struct pcm_stream stream;
+    struct dump_output out;
+    struct solution sol = {0};
+    snd_pcm_uframes_t from = 0;
+    unsigned long refines = 0;
+    unsigned int trials;
+    int fini;
+    int err;
+
+    err = pcm_stream_open(&stream, path, O_RDWR | O_NONBLOCK);
+    if (err < 0) {
+        fprintf(stderr, "open(2): %s\n", strerror(-err));
+        return err;
+    }
+
+    dump_output_init(&out, format, STDOUT_FILENO);
+
+    pcm_stream_init_hw_params(&base);
+    pcm_stream_set_mask(&base, SNDRV_PCM_HW_PARAM_ACCESS, config->access);
+    pcm_stream_set_mask(&base, SNDRV_PCM_HW_PARAM_FORMAT, config->format);
+    pcm_stream_set_mask(&base, SNDRV_PCM_HW_PARAM_SUBFORMAT,
+                        SNDRV_PCM_SUBFORMAT_STD);
+    pcm_stream_set_interval(&base, SNDRV_PCM_HW_PARAM_CHANNELS,
+                            config->channels);
+    pcm_stream_set_interval(&base, SNDRV_PCM_HW_PARAM_RATE, config->rate);
+    pcm_refine_set_range(&base, SNDRV_PCM_HW_PARAM_PERIODS, config->periods,
+                         UINT_MAX);
+    err = pcm_refine(stream.fd, &base, &refines);
+    if (err < 0) {
+        fprintf(stderr, "ioctl(HW_REFINE): %s\n", strerror(-err));
+        goto end;
+    }
+
+    for (trials = 0; trials < MAX_SOLVE_TRIALS; ++trials) {
+        err = solve_candidate(stream.fd, &base, from, &sol, &refines);
+        if (err < 0) {
+            fprintf(stderr, "No candidate: %s\n", strerror(-err));
+            goto end;
+        }
+
+        config->period_size = sol.period_size;
+        config->periods = sol.periods;
+        err = pcm_stream_configure(&stream, config);
+        if (err < 0) {
+            fprintf(stderr, "ioctl(HW_PARAMS): %s\n", strerror(-err));
+            goto end;
+        }
+
+        pcm_stream_init_sw_params(&stream, &sw_params);
+        err = pcm_stream_set_sw_params(&stream, &sw_params);
+        if (err < 0) {
+            fprintf(stderr, "ioctl(SW_PARAMS): %s\n", strerror(-err));
+            goto end;
+        }
+
+        err = run_trial(&stream, &sw_params, seconds);
+        dump_output_begin(&out, "candidate-trial");
+        dump_output_int(&out, "period-size", sol.period_size);
+        dump_output_int(&out, "periods", sol.periods);
+        dump_output_int(&out, "buffer-size", sol.buffer_size);
+        dump_output_label(&out, "result", trial_result(err));
+        dump_output_end(&out);
+        dump_output_flush(&out);
+        if (err == 0)
+            break;
+        if (err != -EPIPE)
+            goto end;
+
+        /* The scratch buffer is sized for the last buffer. */
+        ioctl(stream.fd, SNDRV_PCM_IOCTL_HW_FREE);
+        free(stream.scratch);
+        stream.scratch = NULL;
+        from = sol.buffer_size + 1;
+    }
+    if (trials == MAX_SOLVE_TRIALS) {
+        fprintf(stderr, "No candidate streams without XRUN in %u trials.\n",
+                MAX_SOLVE_TRIALS);
+        err = -EPIPE;
+        goto end;
+    }
+
+    err = tune_sw_params(&stream, &sw_params, seconds, &out);
+    if (err < 0) {
+        fprintf(stderr, "Tuning sw_params aborts: %s\n", strerror(-err));
+        goto end;
+    }
+
+    dump_solution(&out, path, &stream, &sw_params, refines);
+end:
+    pcm_stream_close(&stream);
+    fini = dump_output_fini(&out);
+    return err < 0 ? err : fini;
+}
+
+static int parse_solve_args(int argc, const char *const argv[],
+                            struct pcm_stream_config *config,
+                            unsigned int *seconds, int *output)
+{
+    int arg = 3;
+    int format;
+
+    /* The format of output precedes the format of samples. */
+    *output = DUMP_OUTPUT_HUMAN;
+    if (argc > arg && dump_output_parse_format(argv[arg]) >= 0)
+        *output = dump_output_parse_format(argv[arg++]);
+
+    if (argc < arg + 3 || argc > arg + 5)
+        return -EINVAL;
+
+    format = pcm_stream_parse_format(argv[arg]);
+    if (format < 0)
+        return -EINVAL;
+
+    memset(config, 0, sizeof(*config));
+    config->access = SNDRV_PCM_ACCESS_RW_INTERLEAVED;
+    config->format = format;
+    config->channels = strtoul(argv[arg + 1], NULL, 10);
+    config->rate = strtoul(argv[arg + 2], NULL, 10);
+    config->periods = argc > arg + 3 ? strtoul(argv[arg + 3], NULL, 10) : 2;
+    *seconds = argc > arg + 4 ? strtoul(argv[arg + 4], NULL, 10) : 5;
+    if (config->channels == 0 || config->rate == 0 || config->periods == 0 ||
+        *seconds == 0)
+        return -EINVAL;
+
+    return 0;
+}
+
+/* The parameters which change after narrowing each parameter. */
+struct refine_graph {
+    /* Bits of destination parameters, indexed by source parameter. */
+    unsigned int cmask_edges[ARRAY_SIZE(param_labels)];
+    unsigned int delta_edges[ARRAY_SIZE(param_labels)];
+    /* Bits of parameters narrowed to a single value. */
+    unsigned int narrowed;
+    unsigned long refines;
+    uint64_t elapsed;
+};
+
+static bool param_differs(struct snd_pcm_hw_params *lhs,
+                          struct snd_pcm_hw_params *rhs,
+                          snd_pcm_hw_param_t type)
+{
+    const struct snd_interval *l, *r;
+
+    if (type <= SNDRV_PCM_HW_PARAM_LAST_MASK)
+        return memcmp(get_mask(lhs, type), get_mask(rhs, type),
+                      sizeof(struct snd_mask)) != 0;
+
+    l = get_interval(lhs, type);
+    r = get_interval(rhs, type);
+    return l->min != r->min || l->max != r->max ||
+           l->openmin != r->openmin || l->openmax != r->openmax ||
+           l->empty != r->empty;
+}
+
+/*
+ * Narrow the parameter to a single value which is valid on the base, then
+ * refine the others. Returns -ENOENT when the parameter has one value
+ * already, or no value is found.
+ */
+static int narrow_param(int fd, const struct snd_pcm_hw_params *base,
+                        snd_pcm_hw_param_t type,
+                        struct snd_pcm_hw_params *params,
+                        unsigned long *refines)
+{
+    unsigned int candidates[3];
+    unsigned int i, count = 0;
+    int err;
+
+    *params = *base;
+
+    if (type <= SNDRV_PCM_HW_PARAM_LAST_MASK) {
+        for (i = 0; i < SNDRV_MASK_MAX; ++i) {
+            if (!pcm_refine_mask_test(params, type, i))
+                continue;
+            if (count < ARRAY_SIZE(candidates))
+                candidates[count] = i;
+            ++count;
+        }
+        if (count < 2)
+            return -ENOENT;
+        if (count > ARRAY_SIZE(candidates))
+            count = ARRAY_SIZE(candidates);
+    } else {
+        pcm_refine_bounds(params, type, &candidates[0], &candidates[1]);
+        if (candidates[0] >= candidates[1])
+            return -ENOENT;
+        /* The bounds are not always valid. */
+        candidates[2] = candidates[0] + (candidates[1] - candidates[0]) / 2;
+        count = 3;
+    }
+
+    for (i = 0; i < count; ++i) {
+        err = pcm_refine_test(fd, base, type, candidates[i], refines);
+        if (err < 0)
+            return err;
+        if (err > 0)
+            break;
+    }
+    if (i == count)
+        return -ENOENT;
+
+    if (type <= SNDRV_PCM_HW_PARAM_LAST_MASK)
+        pcm_stream_set_mask(params, type, candidates[i]);
+    else
+        pcm_stream_set_interval(params, type, candidates[i]);
+    params->cmask = 0;
+
+    return pcm_refine(fd, params, refines);
+}
+
+static int extract_graph(int fd, struct refine_graph *graph)
+{
+    struct snd_pcm_hw_params base, params;
+    snd_pcm_hw_param_t from, to;
+    uint64_t begin;
+    int err;
+
+    memset(graph, 0, sizeof(*graph));
+    begin = latency_now();
+
+    pcm_stream_init_hw_params(&base);
+    err = pcm_refine(fd, &base, &graph->refines);
+    if (err < 0)
+        return err;
+
+    for (from = 0; from < ARRAY_SIZE(param_labels); ++from) {
+        if (param_labels[from] == NULL)
+            continue;
+
+        err = narrow_param(fd, &base, from, &params, &graph->refines);
+        if (err == -ENOENT)
+            continue;
+        if (err < 0)
+            return err;
+        graph->narrowed |= 1u << from;
+
+        for (to = 0; to < ARRAY_SIZE(param_labels); ++to) {
+            if (param_labels[to] == NULL || to == from)
+                continue;
+            if (params.cmask & (1u << to))
+                graph->cmask_edges[from] |= 1u << to;
+            if (param_differs(&base, &params, to))
+                graph->delta_edges[from] |= 1u << to;
+        }
+    }
+
+    graph->elapsed = latency_now() - begin;
+
+    return 0;
+}
+
+/*
+ * The order to set parameters in negotiation; the parameter which narrows
+ * more of the others comes first.
+ */
+static void sort_graph(const struct refine_graph *graph,
+                       snd_pcm_hw_param_t *order, unsigned int *count)
+{
+    snd_pcm_hw_param_t type, tmp;
+    unsigned int i, j, edges[2];
+
+    *count = 0;
+    for (type = 0; type < ARRAY_SIZE(param_labels); ++type) {
+        if (graph->narrowed & (1u << type))
+            order[(*count)++] = type;
+    }
+
+    for (i = 1; i < *count; ++i) {
+        for (j = i; j > 0; --j) {
+            edges[0] = __builtin_popcount(graph->cmask_edges[order[j - 1]] |
+                                          graph->delta_edges[order[j - 1]]);
+            edges[1] = __builtin_popcount(graph->cmask_edges[order[j]] |
+                                          graph->delta_edges[order[j]]);
+            if (edges[0] >= edges[1])
+                break;
+            tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+}
+
+static void dump_graph_dot(const char *path, const struct refine_graph *graph,
+                           const snd_pcm_hw_param_t *order, unsigned int count)
+{
+    snd_pcm_hw_param_t from, to;
+    unsigned int bits;
+    unsigned int i;
+
+    printf("digraph \"%s\" {\n", path);
+    printf("    /* refines: %lu, elapsed: %lu us */\n", graph->refines,
+           (unsigned long)(graph->elapsed / 1000));
+    printf("    /* order:");
+    for (i = 0; i < count; ++i)
+        printf(" %s", param_labels[order[i]]);
+    printf(" */\n");
+
+    for (from = 0; from < ARRAY_SIZE(param_labels); ++from) {
+        if (graph->narrowed & (1u << from))
+            printf("    \"%s\";\n", param_labels[from]);
+    }
+
+    /* Solid for the change reported by cmask, dashed for the others. */
+    for (from = 0; from < ARRAY_SIZE(param_labels); ++from) {
+        bits = graph->cmask_edges[from] | graph->delta_edges[from];
+        for (to = 0; to < ARRAY_SIZE(param_labels); ++to) {
+            if (!(bits & (1u << to)))
+                continue;
+            printf("    \"%s\" -> \"%s\"%s;\n",
+                   param_labels[from], param_labels[to],
+                   graph->cmask_edges[from] & (1u << to) ? "" :
+                                                           " [style=dashed]");
+        }
+    }
+
+    printf("}\n");
+}
+
+static void dump_graph(struct dump_output *out, const char *path,
+                       const struct refine_graph *graph,
+                       const snd_pcm_hw_param_t *order, unsigned int count)
+{
+    snd_pcm_hw_param_t from, to;
+    unsigned int bits;
+    unsigned int i;
+
+    for (from = 0; from < ARRAY_SIZE(param_labels); ++from) {
+        bits = graph->cmask_edges[from] | graph->delta_edges[from];
+        for (to = 0; to < ARRAY_SIZE(param_labels); ++to) {
+            if (!(bits & (1u << to)))
+                continue;
+            dump_output_begin(out, "edge");
+            dump_output_label(out, "from", param_labels[from]);
+            dump_output_label(out, "to", param_labels[to]);
+            dump_output_bool(out, "cmask",
+                             graph->cmask_edges[from] & (1u << to));
+            dump_output_bool(out, "delta",
+                             graph->delta_edges[from] & (1u << to));
+            dump_output_end(out);
+        }
+    }
+
+    dump_output_begin(out, "graph");
+    dump_output_string(out, "path", path);
+    dump_output_begin_list(out, "order");
+    for (i = 0; i < count; ++i)
+        dump_output_label(out, NULL, param_labels[order[i]]);
+    dump_output_end(out);
+    dump_output_int(out, "refines", graph->refines);
+    dump_output_int(out, "elapsed-ns", graph->elapsed);
+    dump_output_end(out);
+}
+
+/* The negative format is for DOT. */
+static int dump_refine_graph(const char *path, int format)
+{
+    snd_pcm_hw_param_t order[ARRAY_SIZE(param_labels)];
+    struct refine_graph graph;
+    struct dump_output out;
+    unsigned int count;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "open(2): %s\n", strerror(errno));
+        return -errno;
+    }
+    err = extract_graph(fd, &graph);
+    close(fd);
+    if (err < 0) {
+        fprintf(stderr, "ioctl(HW_REFINE): %s\n", strerror(-err));
+        return err;
+    }
+
+    sort_graph(&graph, order, &count);
+
+    if (format < 0) {
+        dump_graph_dot(path, &graph, order, count);
+        return 0;
+    }
+
+    dump_output_init(&out, format, STDOUT_FILENO);
+    dump_graph(&out, path, &graph, order, count);
+    return dump_output_fini(&out);
+}
+
 int main(int argc, const char *const argv[])
 {
+    struct snd_pcm_hw_params hw_params;
+    struct snd_pcm_info info;
+    struct pcm_stream_config config;
+    struct dump_output out;
+    int format = DUMP_OUTPUT_HUMAN;
+    const char *cache_path = NULL;
     const char *path;
+    unsigned int seconds;
+    int arg = 2;
     int fd;
+    int err;
 
     if (argc < 2) {
         printf("At least, one argument is required for PCM character "
@@ -404,22 +1175,78 @@ int main(int argc, const char *const argv[])
     }
     path = argv[1];
 
+    if (argc > 2 && strcmp(argv[2], "solve") == 0) {
+        if (parse_solve_args(argc, argv, &config, &seconds, &format) < 0) {
+            printf("Usage: %s PCM-DEVICE solve [human|json|binary] "
+                   "FORMAT CHANNELS RATE [MIN-PERIODS [SECONDS]]\n",
+                   argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (solve_latency(path, &config, seconds, format) < 0)
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "graph") == 0) {
+        format = -1;
+        if (argc > 3 && strcmp(argv[3], "dot") != 0) {
+            format = dump_output_parse_format(argv[3]);
+            if (format < 0) {
+                printf("Usage: %s PCM-DEVICE graph [dot|human|json|binary]\n",
+                       argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        if (dump_refine_graph(path, format) < 0)
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    /* Any unknown word is rejected, not taken as the path of cache. */
+    if (argc > arg && dump_output_parse_format(argv[arg]) >= 0)
+        format = dump_output_parse_format(argv[arg++]);
+    if (argc == arg + 2 && strcmp(argv[arg], "cache") == 0)
+        cache_path = argv[arg + 1];
+    else if (argc != arg)
+        format = -EINVAL;
+    if (format < 0) {
+        printf("Usage: %s PCM-DEVICE [human|json|binary] [cache FILE]\n",
+               argv[0]);
+        printf("       %s PCM-DEVICE solve [human|json|binary] "
+               "FORMAT CHANNELS RATE [MIN-PERIODS [SECONDS]]\n", argv[0]);
+        printf("       %s PCM-DEVICE graph [dot|human|json|binary]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    dump_output_init(&out, format, STDOUT_FILENO);
+
+    if (cache_path != NULL && dump_from_cache(path, cache_path, &out) == 0)
+        return dump_output_fini(&out) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
     fd = open(path, O_RDONLY);
     if (fd < 0) {
-        printf("open(2): %s\n", strerror(errno));
+        fprintf(stderr, "open(2): %s\n", strerror(errno));
+        dump_output_fini(&out);
         return EXIT_FAILURE;
     }
 
-    printf("%s\n", path);
-    if (dump_pcm_info(fd) < 0) {
-        close(fd);
+    err = get_pcm_info(fd, &info);
+    if (err >= 0)
+        err = refine_pcm_caps(fd, &hw_params);
+    close(fd);
+    if (err < 0) {
+        dump_output_fini(&out);
         return EXIT_FAILURE;
     }
 
-    if (dump_pcm_caps(fd) < 0) {
-        close(fd);
+    dump_pcm_info(&out, path, &info, false);
+    dump_pcm_caps(&out, &hw_params);
+    if (dump_output_fini(&out) < 0)
         return EXIT_FAILURE;
-    }
+
+    if (cache_path != NULL)
+        store_to_cache(path, cache_path, &info, &hw_params);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,785 @@
+/*
+ * sample-conversion.h
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Conversion between float and linear PCM formats, and interleave or
+ * deinterleave of samples, to build and check payload for the measurement
+ * programs. Each operation has scalar implementation and, on x86, SSE2 and
+ * AVX2 implementations for containers of 2 or 4 bytes. All of
+ * implementations give the same result.
+ */
+
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include <linux/version.h>
+
+#include <sound/asound.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SAMPLE_CONVERSION_X86
+#include <immintrin.h>
+#endif
+
+enum sample_impl {
+	SAMPLE_IMPL_SCALAR = 0,
+	SAMPLE_IMPL_SSE2,
+	SAMPLE_IMPL_AVX2,
+	SAMPLE_IMPL_COUNT,
+};
+
+static const char *const sample_impl_labels[] = {
+	[SAMPLE_IMPL_SCALAR]	= "scalar",
+	[SAMPLE_IMPL_SSE2]	= "sse2",
+	[SAMPLE_IMPL_AVX2]	= "avx2",
+};
+
+struct sample_layout {
+	/* Bytes in the container. */
+	unsigned int phys_bytes;
+	/* Significant bits, LSB-justified in the container. */
+	unsigned int bits;
+	bool is_signed;
+	bool big_endian;
+	bool is_float;
+};
+
+/* The linear formats. */
+static const struct {
+	snd_pcm_format_t format;
+	struct sample_layout layout;
+} sample_layouts[] = {
+	{ SNDRV_PCM_FORMAT_S8,		{ 1,  8, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_U8,		{ 1,  8, false, false, false } },
+	{ SNDRV_PCM_FORMAT_S16_LE,	{ 2, 16, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S16_BE,	{ 2, 16, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U16_LE,	{ 2, 16, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U16_BE,	{ 2, 16, false, true,  false } },
+	{ SNDRV_PCM_FORMAT_S24_LE,	{ 4, 24, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S24_BE,	{ 4, 24, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U24_LE,	{ 4, 24, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U24_BE,	{ 4, 24, false, true,  false } },
+	{ SNDRV_PCM_FORMAT_S32_LE,	{ 4, 32, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S32_BE,	{ 4, 32, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U32_LE,	{ 4, 32, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U32_BE,	{ 4, 32, false, true,  false } },
+	{ SNDRV_PCM_FORMAT_FLOAT_LE,	{ 4, 32, true,  false, true  } },
+	{ SNDRV_PCM_FORMAT_FLOAT_BE,	{ 4, 32, true,  true,  true  } },
+	{ SNDRV_PCM_FORMAT_FLOAT64_LE,	{ 8, 64, true,  false, true  } },
+	{ SNDRV_PCM_FORMAT_FLOAT64_BE,	{ 8, 64, true,  true,  true  } },
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
+	{ SNDRV_PCM_FORMAT_S20_LE,	{ 4, 20, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S20_BE,	{ 4, 20, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U20_LE,	{ 4, 20, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U20_BE,	{ 4, 20, false, true,  false } },
+#endif
+	{ SNDRV_PCM_FORMAT_S24_3LE,	{ 3, 24, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S24_3BE,	{ 3, 24, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U24_3LE,	{ 3, 24, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U24_3BE,	{ 3, 24, false, true,  false } },
+	{ SNDRV_PCM_FORMAT_S20_3LE,	{ 3, 20, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S20_3BE,	{ 3, 20, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U20_3LE,	{ 3, 20, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U20_3BE,	{ 3, 20, false, true,  false } },
+	{ SNDRV_PCM_FORMAT_S18_3LE,	{ 3, 18, true,  false, false } },
+	{ SNDRV_PCM_FORMAT_S18_3BE,	{ 3, 18, true,  true,  false } },
+	{ SNDRV_PCM_FORMAT_U18_3LE,	{ 3, 18, false, false, false } },
+	{ SNDRV_PCM_FORMAT_U18_3BE,	{ 3, 18, false, true,  false } },
+};
+
+/* Returns -EINVAL for the formats not in the above. */
+static inline int sample_get_layout(snd_pcm_format_t format,
+				    struct sample_layout *layout)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sample_layouts) / sizeof(sample_layouts[0]);
+	     ++i) {
+		if (sample_layouts[i].format == format) {
+			*layout = sample_layouts[i].layout;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* The implementations which this CPU can run. */
+static inline bool sample_impl_available(enum sample_impl impl)
+{
+	switch (impl) {
+	case SAMPLE_IMPL_SCALAR:
+		return true;
+#ifdef SAMPLE_CONVERSION_X86
+	case SAMPLE_IMPL_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case SAMPLE_IMPL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+static inline enum sample_impl sample_best_impl(void)
+{
+	if (sample_impl_available(SAMPLE_IMPL_AVX2))
+		return SAMPLE_IMPL_AVX2;
+	if (sample_impl_available(SAMPLE_IMPL_SSE2))
+		return SAMPLE_IMPL_SSE2;
+	return SAMPLE_IMPL_SCALAR;
+}
+
+/*
+ * Scalar implementation for any linear format. Float is scaled by
+ * 2^(bits - 1), clamped and rounded to nearest, as the vector instructions
+ * do.
+ */
+
+static inline float sample_scale(unsigned int bits)
+{
+	return (float)(1ull << (bits - 1));
+}
+
+/* The largest float which is representable in the integer. */
+static inline float sample_max(unsigned int bits)
+{
+	return bits < 25 ? sample_scale(bits) - 1.0f : 2147483520.0f;
+}
+
+static inline void sample_store(unsigned char *dst,
+				const struct sample_layout *layout,
+				uint64_t raw)
+{
+	unsigned int i;
+
+	for (i = 0; i < layout->phys_bytes; ++i) {
+		if (layout->big_endian)
+			dst[layout->phys_bytes - 1 - i] = raw >> (i * 8);
+		else
+			dst[i] = raw >> (i * 8);
+	}
+}
+
+static inline uint64_t sample_load(const unsigned char *src,
+				   const struct sample_layout *layout)
+{
+	uint64_t raw = 0;
+	unsigned int i;
+
+	for (i = 0; i < layout->phys_bytes; ++i) {
+		if (layout->big_endian)
+			raw |= (uint64_t)src[layout->phys_bytes - 1 - i] <<
+			       (i * 8);
+		else
+			raw |= (uint64_t)src[i] << (i * 8);
+	}
+
+	return raw;
+}
+
+static inline void sample_from_float_scalar(const struct sample_layout *layout,
+					    const float *src, void *dst,
+					    size_t samples)
+{
+	unsigned char *pos = dst;
+	float scale = sample_scale(layout->bits);
+	float max = sample_max(layout->bits);
+	uint32_t raw;
+	uint64_t raw64;
+	float val;
+	double val64;
+	size_t i;
+
+	for (i = 0; i < samples; ++i, pos += layout->phys_bytes) {
+		if (layout->is_float) {
+			if (layout->phys_bytes == 8) {
+				val64 = src[i];
+				memcpy(&raw64, &val64, sizeof(raw64));
+			} else {
+				memcpy(&raw, &src[i], sizeof(raw));
+				raw64 = raw;
+			}
+			sample_store(pos, layout, raw64);
+			continue;
+		}
+
+		val = fminf(fmaxf(src[i] * scale, -scale), max);
+		raw = (uint32_t)(int32_t)lrintf(val);
+		/* Offset binary; the carry out of the bits is cut. */
+		if (!layout->is_signed)
+			raw += 1u << (layout->bits - 1);
+		if (!layout->is_signed && layout->bits < 32)
+			raw &= (1u << layout->bits) - 1;
+		sample_store(pos, layout, raw);
+	}
+}
+
+static inline void sample_to_float_scalar(const struct sample_layout *layout,
+					  const void *src, float *dst,
+					  size_t samples)
+{
+	const unsigned char *pos = src;
+	float ratio = 1.0f / sample_scale(layout->bits);
+	unsigned int shift = 32 - layout->bits;
+	uint64_t raw64;
+	uint32_t raw;
+	double val64;
+	size_t i;
+
+	for (i = 0; i < samples; ++i, pos += layout->phys_bytes) {
+		raw64 = sample_load(pos, layout);
+
+		if (layout->is_float) {
+			if (layout->phys_bytes == 8) {
+				memcpy(&val64, &raw64, sizeof(val64));
+				dst[i] = val64;
+			} else {
+				raw = raw64;
+				memcpy(&dst[i], &raw, sizeof(raw));
+			}
+			continue;
+		}
+
+		raw = raw64;
+		if (!layout->is_signed)
+			raw ^= 1u << (layout->bits - 1);
+		/* Sign extension from the significant bits. */
+		dst[i] = (float)((int32_t)(raw << shift) >> shift) * ratio;
+	}
+}
+
+#ifdef SAMPLE_CONVERSION_X86
+
+/*
+ * SSE2 and AVX2 implementations for the formats in container of 2 or 4
+ * bytes; integer in any signedness and endianness, and 32 bit float. The
+ * others fall back to scalar implementation.
+ */
+
+static inline bool sample_vector_supported(const struct sample_layout *layout)
+{
+	if (layout->is_float)
+		return layout->phys_bytes == 4;
+	return layout->phys_bytes == 2 || layout->phys_bytes == 4;
+}
+
+static inline uint32_t sample_mask(unsigned int bits)
+{
+	return bits < 32 ? (1u << bits) - 1 : ~0u;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sample_swap16_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sample_swap32_sse2(__m128i v)
+{
+	v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+	return sample_swap16_sse2(v);
+}
+
+/* Into signed integer in 32 bits, or raw bits of float. */
+__attribute__((target("sse2")))
+static inline __m128i sample_quantize_sse2(const struct sample_layout *layout,
+					   const float *src, __m128 scale,
+					   __m128 min, __m128 max)
+{
+	__m128 v = _mm_loadu_ps(src);
+
+	if (layout->is_float)
+		return _mm_castps_si128(v);
+
+	v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, scale), min), max);
+	return _mm_cvtps_epi32(v);
+}
+
+/* From the value in 4 bytes container into 32 bits in host order. */
+__attribute__((target("sse2")))
+static inline __m128i sample_encode32_sse2(const struct sample_layout *layout,
+					   __m128i v)
+{
+	if (!layout->is_float && !layout->is_signed) {
+		v = _mm_add_epi32(v, _mm_set1_epi32(1u << (layout->bits - 1)));
+		v = _mm_and_si128(v, _mm_set1_epi32(sample_mask(layout->bits)));
+	}
+	if (layout->big_endian)
+		v = sample_swap32_sse2(v);
+	return v;
+}
+
+__attribute__((target("sse2")))
+static inline size_t sample_from_float_sse2(const struct sample_layout *layout,
+					    const float *src, void *dst,
+					    size_t samples)
+{
+	__m128 scale = _mm_set1_ps(sample_scale(layout->bits));
+	__m128 min = _mm_set1_ps(-sample_scale(layout->bits));
+	__m128 max = _mm_set1_ps(sample_max(layout->bits));
+	__m128i a, b, v;
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		a = sample_quantize_sse2(layout, src + i, scale, min, max);
+		b = sample_quantize_sse2(layout, src + i + 4, scale, min,
+					  max);
+
+		if (layout->phys_bytes == 2) {
+			v = _mm_packs_epi32(a, b);
+			if (!layout->is_signed)
+				v = _mm_xor_si128(v, _mm_set1_epi16(0x8000));
+			if (layout->big_endian)
+				v = sample_swap16_sse2(v);
+			_mm_storeu_si128((__m128i *)((int16_t *)dst + i), v);
+		} else {
+			_mm_storeu_si128((__m128i *)((int32_t *)dst + i),
+					 sample_encode32_sse2(layout, a));
+			_mm_storeu_si128((__m128i *)((int32_t *)dst + i + 4),
+					 sample_encode32_sse2(layout, b));
+		}
+	}
+
+	return i;
+}
+
+/* From 4 bytes container into float. */
+__attribute__((target("sse2")))
+static inline __m128 sample_decode32_sse2(const struct sample_layout *layout,
+					  const void *src)
+{
+	__m128i shift = _mm_cvtsi32_si128(32 - layout->bits);
+	__m128 ratio = _mm_set1_ps(1.0f / sample_scale(layout->bits));
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+
+	if (layout->big_endian)
+		v = sample_swap32_sse2(v);
+	if (layout->is_float)
+		return _mm_castsi128_ps(v);
+
+	if (!layout->is_signed)
+		v = _mm_xor_si128(v, _mm_set1_epi32(1u << (layout->bits - 1)));
+	v = _mm_sra_epi32(_mm_sll_epi32(v, shift), shift);
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), ratio);
+}
+
+__attribute__((target("sse2")))
+static inline size_t sample_to_float_sse2(const struct sample_layout *layout,
+					  const void *src, float *dst,
+					  size_t samples)
+{
+	__m128 ratio = _mm_set1_ps(1.0f / sample_scale(layout->bits));
+	__m128i v, a, b;
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		if (layout->phys_bytes == 2) {
+			v = _mm_loadu_si128((const __m128i *)
+					    ((const int16_t *)src + i));
+			if (layout->big_endian)
+				v = sample_swap16_sse2(v);
+			if (!layout->is_signed)
+				v = _mm_xor_si128(v, _mm_set1_epi16(0x8000));
+			a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(dst + i,
+				      _mm_mul_ps(_mm_cvtepi32_ps(a), ratio));
+			_mm_storeu_ps(dst + i + 4,
+				      _mm_mul_ps(_mm_cvtepi32_ps(b), ratio));
+		} else {
+			_mm_storeu_ps(dst + i, sample_decode32_sse2(layout,
+					(const int32_t *)src + i));
+			_mm_storeu_ps(dst + i + 4, sample_decode32_sse2(layout,
+					(const int32_t *)src + i + 4));
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sample_swap16_avx2(__m256i v)
+{
+	const __m256i order = _mm256_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+	return _mm256_shuffle_epi8(v, order);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sample_swap32_avx2(__m256i v)
+{
+	const __m256i order = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	return _mm256_shuffle_epi8(v, order);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sample_quantize_avx2(const struct sample_layout *layout,
+					   const float *src, __m256 scale,
+					   __m256 min, __m256 max)
+{
+	__m256 v = _mm256_loadu_ps(src);
+
+	if (layout->is_float)
+		return _mm256_castps_si256(v);
+
+	v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(v, scale), min), max);
+	return _mm256_cvtps_epi32(v);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sample_encode32_avx2(const struct sample_layout *layout,
+					   __m256i v)
+{
+	if (!layout->is_float && !layout->is_signed) {
+		v = _mm256_add_epi32(v,
+				_mm256_set1_epi32(1u << (layout->bits - 1)));
+		v = _mm256_and_si256(v,
+				_mm256_set1_epi32(sample_mask(layout->bits)));
+	}
+	if (layout->big_endian)
+		v = sample_swap32_avx2(v);
+	return v;
+}
+
+__attribute__((target("avx2")))
+static inline size_t sample_from_float_avx2(const struct sample_layout *layout,
+					    const float *src, void *dst,
+					    size_t samples)
+{
+	__m256 scale = _mm256_set1_ps(sample_scale(layout->bits));
+	__m256 min = _mm256_set1_ps(-sample_scale(layout->bits));
+	__m256 max = _mm256_set1_ps(sample_max(layout->bits));
+	__m256i a, b, v;
+	size_t i = 0;
+
+	for (; i + 16 <= samples; i += 16) {
+		a = sample_quantize_avx2(layout, src + i, scale, min, max);
+		b = sample_quantize_avx2(layout, src + i + 8, scale, min,
+					  max);
+
+		if (layout->phys_bytes == 2) {
+			/* The pack works in each lane of 128 bits. */
+			v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+						     0xd8);
+			if (!layout->is_signed)
+				v = _mm256_xor_si256(v,
+						_mm256_set1_epi16(0x8000));
+			if (layout->big_endian)
+				v = sample_swap16_avx2(v);
+			_mm256_storeu_si256((__m256i *)((int16_t *)dst + i), v);
+		} else {
+			_mm256_storeu_si256((__m256i *)((int32_t *)dst + i),
+					    sample_encode32_avx2(layout, a));
+			_mm256_storeu_si256((__m256i *)((int32_t *)dst + i + 8),
+					    sample_encode32_avx2(layout, b));
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256 sample_decode32_avx2(const struct sample_layout *layout,
+					  const void *src)
+{
+	__m128i shift = _mm_cvtsi32_si128(32 - layout->bits);
+	__m256 ratio = _mm256_set1_ps(1.0f / sample_scale(layout->bits));
+	__m256i v = _mm256_loadu_si256((const __m256i *)src);
+
+	if (layout->big_endian)
+		v = sample_swap32_avx2(v);
+	if (layout->is_float)
+		return _mm256_castsi256_ps(v);
+
+	if (!layout->is_signed)
+		v = _mm256_xor_si256(v,
+				_mm256_set1_epi32(1u << (layout->bits - 1)));
+	v = _mm256_sra_epi32(_mm256_sll_epi32(v, shift), shift);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(v), ratio);
+}
+
+__attribute__((target("avx2")))
+static inline size_t sample_to_float_avx2(const struct sample_layout *layout,
+					  const void *src, float *dst,
+					  size_t samples)
+{
+	__m256 ratio = _mm256_set1_ps(1.0f / sample_scale(layout->bits));
+	__m256i v, a, b;
+	size_t i = 0;
+
+	for (; i + 16 <= samples; i += 16) {
+		if (layout->phys_bytes == 2) {
+			v = _mm256_loadu_si256((const __m256i *)
+					       ((const int16_t *)src + i));
+			if (layout->big_endian)
+				v = sample_swap16_avx2(v);
+			if (!layout->is_signed)
+				v = _mm256_xor_si256(v,
+						_mm256_set1_epi16(0x8000));
+			a = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+			b = _mm256_cvtepi16_epi32(
+					_mm256_extracti128_si256(v, 1));
+			_mm256_storeu_ps(dst + i,
+				_mm256_mul_ps(_mm256_cvtepi32_ps(a), ratio));
+			_mm256_storeu_ps(dst + i + 8,
+				_mm256_mul_ps(_mm256_cvtepi32_ps(b), ratio));
+		} else {
+			_mm256_storeu_ps(dst + i, sample_decode32_avx2(layout,
+					(const int32_t *)src + i));
+			_mm256_storeu_ps(dst + i + 8,
+				sample_decode32_avx2(layout,
+					(const int32_t *)src + i + 8));
+		}
+	}
+
+	return i;
+}
+
+#endif
+
+static inline int sample_from_float_impl(enum sample_impl impl,
+					 snd_pcm_format_t format,
+					 const float *src, void *dst,
+					 size_t samples)
+{
+	struct sample_layout layout;
+	size_t done = 0;
+
+	if (sample_get_layout(format, &layout) < 0)
+		return -EINVAL;
+	if (!sample_impl_available(impl))
+		return -ENOTSUP;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (sample_vector_supported(&layout)) {
+		if (impl == SAMPLE_IMPL_AVX2)
+			done = sample_from_float_avx2(&layout, src, dst,
+						      samples);
+		else if (impl == SAMPLE_IMPL_SSE2)
+			done = sample_from_float_sse2(&layout, src, dst,
+						      samples);
+	}
+#endif
+
+	/* The rest. */
+	sample_from_float_scalar(&layout, src + done,
+				 (unsigned char *)dst +
+						done * layout.phys_bytes,
+				 samples - done);
+
+	return 0;
+}
+
+static inline int sample_to_float_impl(enum sample_impl impl,
+				       snd_pcm_format_t format,
+				       const void *src, float *dst,
+				       size_t samples)
+{
+	struct sample_layout layout;
+	size_t done = 0;
+
+	if (sample_get_layout(format, &layout) < 0)
+		return -EINVAL;
+	if (!sample_impl_available(impl))
+		return -ENOTSUP;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (sample_vector_supported(&layout)) {
+		if (impl == SAMPLE_IMPL_AVX2)
+			done = sample_to_float_avx2(&layout, src, dst, samples);
+		else if (impl == SAMPLE_IMPL_SSE2)
+			done = sample_to_float_sse2(&layout, src, dst, samples);
+	}
+#endif
+
+	/* The rest. */
+	sample_to_float_scalar(&layout,
+			       (const unsigned char *)src +
+						done * layout.phys_bytes,
+			       dst + done, samples - done);
+
+	return 0;
+}
+
+static inline int sample_from_float(snd_pcm_format_t format, const float *src,
+				    void *dst, size_t samples)
+{
+	return sample_from_float_impl(sample_best_impl(), format, src, dst,
+				      samples);
+}
+
+static inline int sample_to_float(snd_pcm_format_t format, const void *src,
+				  float *dst, size_t samples)
+{
+	return sample_to_float_impl(sample_best_impl(), format, src, dst,
+				    samples);
+}
+
+/*
+ * Interleave and deinterleave for SNDRV_PCM_ACCESS_XXX_NONINTERLEAVED,
+ * with SSE2 implementation for two channels of 2 or 4 bytes.
+ */
+
+#ifdef SAMPLE_CONVERSION_X86
+
+__attribute__((target("sse2")))
+static inline size_t sample_interleave_sse2(void *dst,
+					    const void *const *srcs,
+					    unsigned int bytes, size_t frames)
+{
+	__m128i l, r;
+	size_t i = 0;
+
+	if (bytes == 4) {
+		for (; i + 4 <= frames; i += 4) {
+			l = _mm_loadu_si128((const __m128i *)
+					    ((const int32_t *)srcs[0] + i));
+			r = _mm_loadu_si128((const __m128i *)
+					    ((const int32_t *)srcs[1] + i));
+			_mm_storeu_si128((__m128i *)((int32_t *)dst + i * 2),
+					 _mm_unpacklo_epi32(l, r));
+			_mm_storeu_si128((__m128i *)
+					 ((int32_t *)dst + i * 2 + 4),
+					 _mm_unpackhi_epi32(l, r));
+		}
+	} else {
+		for (; i + 8 <= frames; i += 8) {
+			l = _mm_loadu_si128((const __m128i *)
+					    ((const int16_t *)srcs[0] + i));
+			r = _mm_loadu_si128((const __m128i *)
+					    ((const int16_t *)srcs[1] + i));
+			_mm_storeu_si128((__m128i *)((int16_t *)dst + i * 2),
+					 _mm_unpacklo_epi16(l, r));
+			_mm_storeu_si128((__m128i *)
+					 ((int16_t *)dst + i * 2 + 8),
+					 _mm_unpackhi_epi16(l, r));
+		}
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static inline size_t sample_deinterleave_sse2(void *const *dsts,
+					      const void *src,
+					      unsigned int bytes,
+					      size_t frames)
+{
+	__m128 a, b;
+	__m128i x, y, lx, ly;
+	size_t i = 0;
+
+	if (bytes == 4) {
+		for (; i + 4 <= frames; i += 4) {
+			a = _mm_loadu_ps((const float *)src + i * 2);
+			b = _mm_loadu_ps((const float *)src + i * 2 + 4);
+			_mm_storeu_ps((float *)dsts[0] + i,
+				      _mm_shuffle_ps(a, b, 0x88));
+			_mm_storeu_ps((float *)dsts[1] + i,
+				      _mm_shuffle_ps(a, b, 0xdd));
+		}
+	} else {
+		/* Sign extension keeps the pack from saturation. */
+		for (; i + 8 <= frames; i += 8) {
+			x = _mm_loadu_si128((const __m128i *)
+					    ((const int16_t *)src + i * 2));
+			y = _mm_loadu_si128((const __m128i *)
+					    ((const int16_t *)src + i * 2 + 8));
+			lx = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+			ly = _mm_srai_epi32(_mm_slli_epi32(y, 16), 16);
+			_mm_storeu_si128((__m128i *)((int16_t *)dsts[0] + i),
+					 _mm_packs_epi32(lx, ly));
+			_mm_storeu_si128((__m128i *)((int16_t *)dsts[1] + i),
+				_mm_packs_epi32(_mm_srai_epi32(x, 16),
+						_mm_srai_epi32(y, 16)));
+		}
+	}
+
+	return i;
+}
+
+#endif
+
+static inline void sample_interleave_impl(enum sample_impl impl, void *dst,
+					  const void *const *srcs,
+					  unsigned int channels,
+					  unsigned int bytes, size_t frames)
+{
+	unsigned char *pos = dst;
+	unsigned int ch;
+	size_t i = 0;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (impl != SAMPLE_IMPL_SCALAR && sample_impl_available(impl) &&
+	    channels == 2 && (bytes == 2 || bytes == 4))
+		i = sample_interleave_sse2(dst, srcs, bytes, frames);
+#endif
+
+	pos += i * channels * bytes;
+	for (; i < frames; ++i) {
+		for (ch = 0; ch < channels; ++ch) {
+			memcpy(pos, (const unsigned char *)srcs[ch] + i * bytes,
+			       bytes);
+			pos += bytes;
+		}
+	}
+}
+
+static inline void sample_deinterleave_impl(enum sample_impl impl,
+					    void *const *dsts, const void *src,
+					    unsigned int channels,
+					    unsigned int bytes, size_t frames)
+{
+	const unsigned char *pos = src;
+	unsigned int ch;
+	size_t i = 0;
+
+#ifdef SAMPLE_CONVERSION_X86
+	if (impl != SAMPLE_IMPL_SCALAR && sample_impl_available(impl) &&
+	    channels == 2 && (bytes == 2 || bytes == 4))
+		i = sample_deinterleave_sse2(dsts, src, bytes, frames);
+#endif
+
+	pos += i * channels * bytes;
+	for (; i < frames; ++i) {
+		for (ch = 0; ch < channels; ++ch) {
+			memcpy((unsigned char *)dsts[ch] + i * bytes, pos,
+			       bytes);
+			pos += bytes;
+		}
+	}
+}
+
+static inline void sample_interleave(void *dst, const void *const *srcs,
+				     unsigned int channels, unsigned int bytes,
+				     size_t frames)
+{
+	sample_interleave_impl(sample_best_impl(), dst, srcs, channels, bytes,
+			       frames);
+}
+
+static inline void sample_deinterleave(void *const *dsts, const void *src,
+				       unsigned int channels,
+				       unsigned int bytes, size_t frames)
+{
+	sample_deinterleave_impl(sample_best_impl(), dsts, src, channels, bytes,
+				 frames);
+}
+
+#endif
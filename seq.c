@@ -15,254 +15,96 @@
 
 #include <sound/asequencer.h>
 
-#define TEST_IOCTL(fd, command, argument, expected)			\
-	if (ioctl(fd, command, argument) < 0 && errno != expected) {	\
-		printf("%s: %s\n", #command, strerror(errno));		\
-		return false;						\
-	}								\
-	return true;							\
-
-static bool check_pversion(int fd)
-{
-	int version;
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_PVERSION, &version, 0);
-}
-
-static bool check_client_id(int fd)
-{
-	int id;
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_CLIENT_ID, &id, 0);
-}
-
-static bool check_system_info(int fd)
-{
-	struct snd_seq_system_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SYSTEM_INFO, &info, 0);
-}
-
-static bool check_running_mode(int fd)
-{
-	struct snd_seq_running_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_RUNNING_MODE, &info, 0);
-}
-
-static bool check_get_client_info(int fd)
-{
-	struct snd_seq_client_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_CLIENT_INFO, &info, 0);
-}
-
-static bool check_set_client_info(int fd)
-{
-	struct snd_seq_client_info info = {0};
-	info.client = INT_MAX;
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_CLIENT_INFO, &info, EPERM);
-}
-
-static bool check_create_port(int fd)
-{
-	struct snd_seq_port_info info = {0};
-	info.addr.client = UCHAR_MAX;
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_CREATE_PORT, &info, EPERM);
-}
-
-static bool check_delete_port(int fd)
-{
-	struct snd_seq_port_info info = {0};
-	info.addr.client = UCHAR_MAX;
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_DELETE_PORT, &info, EPERM);
-}
-
-static bool check_get_port_info(int fd)
-{
-	struct snd_seq_port_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_PORT_INFO, &info, 0);
-}
-
-static bool check_set_port_info(int fd)
-{
-	struct snd_seq_port_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_PORT_INFO, &info, EPERM);
-}
-
-static bool check_subscribe_port(int fd)
-{
-	struct snd_seq_port_subscribe subscribe = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SUBSCRIBE_PORT, &subscribe, EPERM);
-}
-
-static bool check_unsubscribe_port(int fd)
-{
-	struct snd_seq_port_subscribe subscribe = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_UNSUBSCRIBE_PORT, &subscribe, EPERM);
-}
-
-static bool check_create_queue(int fd)
-{
-	struct snd_seq_queue_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_CREATE_QUEUE, &info, 0);
-}
-
-static bool check_delete_queue(int fd)
-{
-	struct snd_seq_queue_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_DELETE_QUEUE, &info, 0);
-}
-
-static bool check_get_queue_info(int fd)
-{
-	struct snd_seq_queue_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_QUEUE_INFO, &info, EINVAL);
-}
-
-static bool check_set_queue_info(int fd)
-{
-	struct snd_seq_queue_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_QUEUE_INFO, &info, EINVAL);
-}
-
-static bool check_get_named_queue(int fd)
-{
-	struct snd_seq_queue_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_NAMED_QUEUE, &info, EINVAL);
-}
-
-static bool check_get_queue_status(int fd)
-{
-	struct snd_seq_queue_status status = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_QUEUE_STATUS, &status, EINVAL);
-}
-
-static bool check_get_queue_tempo(int fd)
-{
-	struct snd_seq_queue_status tempo = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_QUEUE_TEMPO, &tempo, EINVAL);
-}
-
-static bool check_set_queue_tempo(int fd)
-{
-	struct snd_seq_queue_tempo tempo = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_QUEUE_TEMPO, &tempo, EPERM);
-}
-
-static bool check_get_queue_timer(int fd)
-{
-	struct snd_seq_queue_timer timer = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_QUEUE_TIMER, &timer, EINVAL);
-}
-
-static bool check_set_queue_timer(int fd)
-{
-	struct snd_seq_queue_timer timer = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_QUEUE_TIMER, &timer, EPERM);
-}
-
-static bool check_get_queue_client(int fd)
-{
-	struct snd_seq_queue_client client = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_QUEUE_CLIENT, &client, EINVAL);
-}
-
-static bool check_set_queue_client(int fd)
-{
-	struct snd_seq_queue_client client = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_QUEUE_CLIENT, &client, EINVAL);
-}
-
-static bool check_get_client_pool(int fd)
-{
-	struct snd_seq_client_pool pool = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_CLIENT_POOL, &pool, EINVAL);
-}
-
-static bool check_set_client_pool(int fd)
-{
-	struct snd_seq_client_pool pool = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_SET_CLIENT_POOL, &pool, EINVAL);
-}
-
-static bool check_remove_events(int fd)
-{
-	struct snd_seq_remove_events events = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_REMOVE_EVENTS, &events, 0);
-}
-
-static bool check_query_subs(int fd)
-{
-	struct snd_seq_query_subs subs = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_QUERY_SUBS, &subs, ENOENT);
-}
-
-static bool check_get_subscription(int fd)
-{
-	struct snd_seq_query_subs subs = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_GET_SUBSCRIPTION, &subs, ENOENT);
-}
-
-static bool check_query_next_client(int fd)
-{
-	struct snd_seq_client_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_QUERY_NEXT_CLIENT, &info, 0);
-}
-
-static bool check_query_next_port(int fd)
-{
-	struct snd_seq_port_info info = {0};
-	TEST_IOCTL(fd, SNDRV_SEQ_IOCTL_QUERY_NEXT_PORT, &info, 0);
-}
-
-int main(void)
-{
-	bool (*const funcs[])(int) = {
-		check_pversion,
-		check_client_id,
-		check_system_info,
-		check_running_mode,
-		check_get_client_info,
-		check_set_client_info,
-		check_create_port,
-		check_delete_port,
-		check_get_port_info,
-		check_set_port_info,
-		check_subscribe_port,
-		check_unsubscribe_port,
-		check_create_queue,
-		check_delete_queue,
-		check_get_queue_info,
-		check_set_queue_info,
-		check_get_named_queue,
-		check_get_queue_status,
-		check_get_queue_tempo,
-		check_set_queue_tempo,
-		check_get_queue_timer,
-		check_set_queue_timer,
-		check_get_queue_client,
-		check_set_queue_client,
-		check_get_client_pool,
-		check_set_client_pool,
-		check_remove_events,
-		check_query_subs,
-		check_get_subscription,
-		check_query_next_client,
-		check_query_next_port,
-		NULL,
-	};
-	unsigned int i;
-	int fd;
-
-	fd = open("/dev/snd/seq", O_RDONLY);
-	if (fd < 0) {
-		printf("%s\n", strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	i = 0;
-	while (funcs[i]) {
-		if (!funcs[i++](fd)) {
-			printf("Seq test aborts.\n");
-			return EXIT_FAILURE;
-		}
-	}
-
-	return EXIT_SUCCESS;
+#include "ioctl-suite.h"
+
+static void init_set_client_info(void *arg)
+{
+	struct snd_seq_client_info *info = arg;
+
+	info->client = INT_MAX;
+}
+
+/* For the port of the other client, which is not permitted. */
+static void init_port_of_other_client(void *arg)
+{
+	struct snd_seq_port_info *info = arg;
+
+	info->addr.client = UCHAR_MAX;
+}
+
+static const struct ioctl_case cases[] = {
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_PVERSION, int, NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_CLIENT_ID, int, NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SYSTEM_INFO, struct snd_seq_system_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_RUNNING_MODE, struct snd_seq_running_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_CLIENT_INFO, struct snd_seq_client_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_CLIENT_INFO, struct snd_seq_client_info,
+		   init_set_client_info, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_CREATE_PORT, struct snd_seq_port_info,
+		   init_port_of_other_client, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_DELETE_PORT, struct snd_seq_port_info,
+		   init_port_of_other_client, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_PORT_INFO, struct snd_seq_port_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_PORT_INFO, struct snd_seq_port_info,
+		   NULL, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SUBSCRIBE_PORT,
+		   struct snd_seq_port_subscribe, NULL, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_UNSUBSCRIBE_PORT,
+		   struct snd_seq_port_subscribe, NULL, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_CREATE_QUEUE, struct snd_seq_queue_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_DELETE_QUEUE, struct snd_seq_queue_info,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_QUEUE_INFO, struct snd_seq_queue_info,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_QUEUE_INFO, struct snd_seq_queue_info,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_NAMED_QUEUE, struct snd_seq_queue_info,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_QUEUE_STATUS,
+		   struct snd_seq_queue_status, NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_QUEUE_TEMPO, struct snd_seq_queue_status,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_QUEUE_TEMPO, struct snd_seq_queue_tempo,
+		   NULL, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_QUEUE_TIMER, struct snd_seq_queue_timer,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_QUEUE_TIMER, struct snd_seq_queue_timer,
+		   NULL, EPERM),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_QUEUE_CLIENT,
+		   struct snd_seq_queue_client, NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_QUEUE_CLIENT,
+		   struct snd_seq_queue_client, NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_CLIENT_POOL, struct snd_seq_client_pool,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_SET_CLIENT_POOL, struct snd_seq_client_pool,
+		   NULL, EINVAL),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_REMOVE_EVENTS, struct snd_seq_remove_events,
+		   NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_QUERY_SUBS, struct snd_seq_query_subs,
+		   NULL, ENOENT),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_GET_SUBSCRIPTION, struct snd_seq_query_subs,
+		   NULL, ENOENT),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_QUERY_NEXT_CLIENT,
+		   struct snd_seq_client_info, NULL, 0),
+	IOCTL_CASE(SNDRV_SEQ_IOCTL_QUERY_NEXT_PORT, struct snd_seq_port_info,
+		   NULL, 0),
+};
+
+static const struct ioctl_suite suite = {
+	.label = "Seq",
+	.node = "/dev/snd/seq",
+	.pattern = "seq",
+	.flags = O_RDONLY,
+	.cases = cases,
+	.count = sizeof(cases) / sizeof(cases[0]),
+};
+
+int main(int argc, const char *const argv[])
+{
+	return ioctl_suite_main(&suite, argc, argv);
 }
@@ -0,0 +1,367 @@
+/*
+ * snapshot-ctl-elems.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Save the values of all readable control elements into a packed snapshot,
+ * compare two snapshots member by member, and restore a snapshot by writing
+ * only the elements which differ from the current state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+
+#include <sound/asound.h>
+
+#include "latency.h"
+#include "ctl-snapshot.h"
+#include "dump-output.h"
+
+static const char *const iface_labels[] = {
+    [SNDRV_CTL_ELEM_IFACE_CARD]         = "card",
+    [SNDRV_CTL_ELEM_IFACE_HWDEP]        = "hwdep",
+    [SNDRV_CTL_ELEM_IFACE_MIXER]        = "mixer",
+    [SNDRV_CTL_ELEM_IFACE_PCM]          = "pcm",
+    [SNDRV_CTL_ELEM_IFACE_RAWMIDI]      = "rawmidi",
+    [SNDRV_CTL_ELEM_IFACE_TIMER]        = "timer",
+    [SNDRV_CTL_ELEM_IFACE_SEQUENCER]    = "sequencer",
+};
+
+struct diff_context {
+    struct dump_output *out;
+    const struct ctl_snapshot *old;
+    const struct ctl_snapshot *new;
+};
+
+struct restore_context {
+    const struct ctl_snapshot *live;
+    const struct ctl_snapshot *saved;
+    /* Indexed by the element in the saved snapshot. */
+    bool *changed;
+};
+
+/* The path to control character device gives the current state. */
+static int open_snapshot(const char *path, struct ctl_snapshot *snap)
+{
+    struct stat st;
+    int fd;
+    int err;
+
+    if (stat(path, &st) < 0)
+        return -errno;
+    if (!S_ISCHR(st.st_mode))
+        return ctl_snapshot_load(snap, path);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    err = ctl_snapshot_take(fd, snap);
+    close(fd);
+
+    return err;
+}
+
+static void dump_id(struct dump_output *out, const struct snd_ctl_elem_id *id)
+{
+    dump_output_int(out, "numid", id->numid);
+    dump_output_label(out, "iface", id->iface <= SNDRV_CTL_ELEM_IFACE_LAST ?
+                                    iface_labels[id->iface] : NULL);
+    dump_output_int(out, "device", id->device);
+    dump_output_int(out, "subdevice", id->subdevice);
+    dump_output_string(out, "name", (const char *)id->name);
+    dump_output_int(out, "index", id->index);
+}
+
+static void dump_member(struct dump_output *out, const char *key,
+                        const struct ctl_snapshot *snap,
+                        const struct ctl_snapshot_elem *elem,
+                        unsigned int member)
+{
+    const unsigned char *src;
+    char hex[sizeof(struct snd_aes_iec958) * 2 + 1];
+    int32_t integer;
+    uint32_t item;
+    int64_t integer64;
+    unsigned int i;
+
+    if (member >= elem->count) {
+        dump_output_label(out, key, "absent");
+        return;
+    }
+    src = ctl_snapshot_member(snap, elem, member);
+
+    switch (elem->type) {
+    case SNDRV_CTL_ELEM_TYPE_BOOLEAN:
+        dump_output_bool(out, key, src[0]);
+        break;
+    case SNDRV_CTL_ELEM_TYPE_INTEGER:
+        memcpy(&integer, src, sizeof(integer));
+        dump_output_int(out, key, integer);
+        break;
+    case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+        memcpy(&item, src, sizeof(item));
+        dump_output_int(out, key, item);
+        break;
+    case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+        memcpy(&integer64, src, sizeof(integer64));
+        dump_output_int(out, key, integer64);
+        break;
+    case SNDRV_CTL_ELEM_TYPE_BYTES:
+        dump_output_int(out, key, src[0]);
+        break;
+    case SNDRV_CTL_ELEM_TYPE_IEC958:
+        for (i = 0; i < sizeof(struct snd_aes_iec958); ++i)
+            snprintf(hex + i * 2, 3, "%02x", src[i]);
+        dump_output_string(out, key, hex);
+        break;
+    default:
+        break;
+    }
+}
+
+static void dump_change(void *private, const struct ctl_snapshot_elem *old,
+                        const struct ctl_snapshot_elem *new,
+                        unsigned int member)
+{
+    struct diff_context *ctx = private;
+
+    if (old == NULL || new == NULL) {
+        dump_output_begin(ctx->out, old == NULL ? "added" : "removed");
+        dump_id(ctx->out, old == NULL ? &new->id : &old->id);
+        dump_output_end(ctx->out);
+        return;
+    }
+
+    dump_output_begin(ctx->out, "changed");
+    dump_id(ctx->out, &new->id);
+    dump_output_int(ctx->out, "member", member);
+    dump_member(ctx->out, "old", ctx->old, old, member);
+    dump_member(ctx->out, "new", ctx->new, new, member);
+    dump_output_end(ctx->out);
+}
+
+static int diff_snapshots(const char *old_path, const char *new_path,
+                          int format)
+{
+    struct ctl_snapshot old, new;
+    struct diff_context ctx;
+    struct dump_output out;
+    unsigned int changes;
+    int err;
+
+    err = open_snapshot(old_path, &old);
+    if (err < 0) {
+        fprintf(stderr, "%s: %s\n", old_path, strerror(-err));
+        return err;
+    }
+    err = open_snapshot(new_path, &new);
+    if (err < 0) {
+        fprintf(stderr, "%s: %s\n", new_path, strerror(-err));
+        ctl_snapshot_free(&old);
+        return err;
+    }
+
+    dump_output_init(&out, format, STDOUT_FILENO);
+    ctx.out = &out;
+    ctx.old = &old;
+    ctx.new = &new;
+    changes = ctl_snapshot_diff(&old, &new, dump_change, &ctx);
+
+    dump_output_begin(&out, "summary");
+    dump_output_int(&out, "old-elements", old.count);
+    dump_output_int(&out, "new-elements", new.count);
+    dump_output_int(&out, "changes", changes);
+    dump_output_end(&out);
+    err = dump_output_fini(&out);
+
+    ctl_snapshot_free(&old);
+    ctl_snapshot_free(&new);
+
+    return err;
+}
+
+static int save_snapshot(const char *path, const char *snap_path)
+{
+    struct ctl_snapshot snap;
+    uint64_t begin, elapsed;
+    int fd;
+    int err;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("open(2): %s\n", strerror(errno));
+        return -errno;
+    }
+
+    begin = latency_now();
+    err = ctl_snapshot_take(fd, &snap);
+    elapsed = latency_now() - begin;
+    close(fd);
+    if (err < 0) {
+        printf("Fail to take snapshot: %s\n", strerror(-err));
+        return err;
+    }
+
+    err = ctl_snapshot_save(&snap, snap_path);
+    if (err < 0)
+        printf("Fail to save snapshot: %s\n", strerror(-err));
+    else
+        printf("%s: %u elements, %zu bytes of values, %.3f ms\n", path,
+               snap.count, snap.size, (double)elapsed / 1000000);
+
+    ctl_snapshot_free(&snap);
+    return err;
+}
+
+static void mark_change(void *private, const struct ctl_snapshot_elem *live,
+                        const struct ctl_snapshot_elem *saved,
+                        unsigned int member)
+{
+    struct restore_context *ctx = private;
+
+    /* The whole element is written at once. */
+    (void)member;
+
+    if (live != NULL && saved != NULL)
+        ctx->changed[saved - ctx->saved->elems] = true;
+}
+
+/*
+ * Write the saved values of the elements which differ from the current
+ * state. The elements of which type or existence differs are not touched.
+ */
+static int restore_snapshot(const char *path, const char *snap_path)
+{
+    struct ctl_snapshot live, saved;
+    struct restore_context ctx;
+    struct snd_ctl_elem_value value;
+    const struct ctl_snapshot_elem *elem, *current;
+    unsigned int written = 0, skipped = 0, failed = 0, writable = 0;
+    uint64_t begin, elapsed;
+    unsigned int i;
+    int fd;
+    int err;
+
+    err = ctl_snapshot_load(&saved, snap_path);
+    if (err < 0) {
+        printf("%s: %s\n", snap_path, strerror(-err));
+        return err;
+    }
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        err = -errno;
+        printf("open(2): %s\n", strerror(errno));
+        ctl_snapshot_free(&saved);
+        return err;
+    }
+
+    begin = latency_now();
+
+    err = ctl_snapshot_take(fd, &live);
+    if (err < 0) {
+        printf("Fail to take snapshot: %s\n", strerror(-err));
+        goto end;
+    }
+
+    ctx.live = &live;
+    ctx.saved = &saved;
+    ctx.changed = calloc(saved.count > 0 ? saved.count : 1, sizeof(bool));
+    if (ctx.changed == NULL) {
+        err = -ENOMEM;
+        ctl_snapshot_free(&live);
+        goto end;
+    }
+    ctl_snapshot_diff(&live, &saved, mark_change, &ctx);
+
+    for (i = 0; i < live.count; ++i) {
+        if (live.elems[i].access & SNDRV_CTL_ELEM_ACCESS_WRITE)
+            ++writable;
+    }
+
+    for (i = 0; i < saved.count; ++i) {
+        if (!ctx.changed[i])
+            continue;
+        elem = &saved.elems[i];
+
+        current = bsearch(elem, live.elems, live.count, sizeof(*live.elems),
+                          ctl_snapshot_compare_elems);
+        if (current == NULL ||
+            !(current->access & SNDRV_CTL_ELEM_ACCESS_WRITE) ||
+            (current->access & SNDRV_CTL_ELEM_ACCESS_INACTIVE) ||
+            current->count != elem->count) {
+            ++skipped;
+            continue;
+        }
+
+        /* The numeric ID in this boot. */
+        ctl_snapshot_unpack(elem, ctl_snapshot_member(&saved, elem, 0),
+                            &value);
+        value.id = current->id;
+        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &value) < 0) {
+            printf("  %s,%u: %s\n", current->id.name, current->id.index,
+                   strerror(errno));
+            ++failed;
+            continue;
+        }
+        ++written;
+    }
+
+    elapsed = latency_now() - begin;
+
+    printf("%s:\n", path);
+    printf("  writable elements:  %u\n", writable);
+    printf("  written:            %u\n", written);
+    printf("  skipped:            %u\n", skipped);
+    printf("  failed:             %u\n", failed);
+    printf("  elapsed:            %.3f ms\n", (double)elapsed / 1000000);
+
+    free(ctx.changed);
+    ctl_snapshot_free(&live);
+    if (failed > 0)
+        err = -EIO;
+end:
+    close(fd);
+    ctl_snapshot_free(&saved);
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    int format = DUMP_OUTPUT_HUMAN;
+    int err;
+
+    if (argc > 3 && strcmp(argv[1], "save") == 0) {
+        err = save_snapshot(argv[2], argv[3]);
+    } else if (argc > 3 && strcmp(argv[1], "restore") == 0) {
+        err = restore_snapshot(argv[2], argv[3]);
+    } else if (argc > 3 && strcmp(argv[1], "diff") == 0 &&
+               (argc == 4 ||
+                (format = dump_output_parse_format(argv[4])) >= 0)) {
+        err = diff_snapshots(argv[2], argv[3], format);
+    } else {
+        printf("Usage:\n");
+        printf("  %s save CONTROL-DEVICE FILE\n", argv[0]);
+        printf("  %s diff OLD NEW [human|json|binary]\n", argv[0]);
+        printf("  %s restore CONTROL-DEVICE FILE\n", argv[0]);
+        printf("OLD and NEW are snapshot files or control devices.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,344 @@
+/*
+ * stream-pcm-frames.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Push frames to a playback substream for a while by one of four data
+ * paths, then report the throughput. Any PCM device is available, e.g.
+ * the ones of snd-dummy or snd-aloop when no sound card is on the system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sound/asound.h>
+
+#include "pcm-stream.h"
+#include "latency.h"
+
+struct bench {
+    struct pcm_stream stream;
+
+    /* For readwrite access. */
+    void *buf;
+    void **bufs;
+
+    /* For mmap access, which starts the stream when the buffer is full. */
+    bool started;
+
+    unsigned long long frames;
+    unsigned long long syscalls;
+    unsigned long xruns;
+};
+
+/* The wall clock is latency_now(); this is for the CPU time consumed. */
+static uint64_t get_cpu_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int recover_xrun(struct bench *bench)
+{
+    ++bench->xruns;
+    ++bench->syscalls;
+    bench->started = false;
+    if (ioctl(bench->stream.fd, SNDRV_PCM_IOCTL_PREPARE) < 0)
+        return -errno;
+    return 0;
+}
+
+static int write_by_rw_interleaved(struct bench *bench)
+{
+    struct snd_xferi xferi = {0};
+
+    xferi.buf = bench->buf;
+    xferi.frames = bench->stream.config.period_size;
+
+    ++bench->syscalls;
+    if (ioctl(bench->stream.fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &xferi) < 0) {
+        if (errno == EPIPE)
+            return recover_xrun(bench);
+        return -errno;
+    }
+
+    bench->frames += xferi.result;
+    return 0;
+}
+
+static int write_by_rw_noninterleaved(struct bench *bench)
+{
+    struct snd_xfern xfern = {0};
+
+    xfern.bufs = bench->bufs;
+    xfern.frames = bench->stream.config.period_size;
+
+    ++bench->syscalls;
+    if (ioctl(bench->stream.fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &xfern) < 0) {
+        if (errno == EPIPE)
+            return recover_xrun(bench);
+        return -errno;
+    }
+
+    bench->frames += xfern.result;
+    return 0;
+}
+
+static int write_by_mmap(struct bench *bench)
+{
+    struct pcm_stream *stream = &bench->stream;
+    struct pollfd pfd = { .fd = stream->fd, .events = POLLOUT };
+    snd_pcm_sframes_t frames;
+
+    frames = pcm_stream_transfer(stream, stream->config.period_size);
+
+    /* SNDRV_PCM_IOCTL_SYNC_PTR substitutes for the pages not mapped. */
+    if (stream->status == NULL || stream->control == NULL)
+        ++bench->syscalls;
+    if (frames >= 0 && stream->control == NULL)
+        ++bench->syscalls;
+
+    if (frames == -EPIPE)
+        return recover_xrun(bench);
+    if (frames < 0)
+        return frames;
+
+    if (frames > 0) {
+        bench->frames += frames;
+        return 0;
+    }
+
+    /* The buffer is full, thus start it. */
+    if (!bench->started) {
+        ++bench->syscalls;
+        if (ioctl(stream->fd, SNDRV_PCM_IOCTL_START) < 0)
+            return -errno;
+        bench->started = true;
+        return 0;
+    }
+
+    ++bench->syscalls;
+    if (poll(&pfd, 1, 1000) < 0)
+        return -errno;
+    return 0;
+}
+
+static int prepare_buffers(struct bench *bench)
+{
+    struct pcm_stream *stream = &bench->stream;
+    size_t bytes;
+    unsigned int ch;
+    int err;
+
+    switch (stream->config.access) {
+    case SNDRV_PCM_ACCESS_RW_INTERLEAVED:
+        bytes = stream->config.period_size * stream->frame_bits / 8;
+        bench->buf = calloc(1, bytes);
+        if (bench->buf == NULL)
+            return -ENOMEM;
+        break;
+    case SNDRV_PCM_ACCESS_RW_NONINTERLEAVED:
+        bytes = stream->config.period_size * stream->sample_bits / 8;
+        bench->bufs = calloc(stream->config.channels, sizeof(void *));
+        if (bench->bufs == NULL)
+            return -ENOMEM;
+        for (ch = 0; ch < stream->config.channels; ++ch) {
+            bench->bufs[ch] = calloc(1, bytes);
+            if (bench->bufs[ch] == NULL)
+                return -ENOMEM;
+        }
+        break;
+    case SNDRV_PCM_ACCESS_MMAP_INTERLEAVED:
+    case SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED:
+        err = pcm_stream_map_data(stream);
+        if (err < 0) {
+            printf("mmap(2) for data: %s\n", strerror(-err));
+            return err;
+        }
+        /* Optional; SNDRV_PCM_IOCTL_SYNC_PTR is used instead. */
+        if (pcm_stream_map_pointers(stream) < 0)
+            printf("Status/control pages are not available.\n");
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static void release_buffers(struct bench *bench)
+{
+    unsigned int ch;
+
+    free(bench->buf);
+    if (bench->bufs != NULL) {
+        for (ch = 0; ch < bench->stream.config.channels; ++ch)
+            free(bench->bufs[ch]);
+        free(bench->bufs);
+    }
+}
+
+static int run_bench(struct bench *bench, unsigned int seconds)
+{
+    int (*const funcs[])(struct bench *bench) = {
+        [SNDRV_PCM_ACCESS_MMAP_INTERLEAVED]     = write_by_mmap,
+        [SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED]  = write_by_mmap,
+        [SNDRV_PCM_ACCESS_MMAP_COMPLEX]         = NULL,
+        [SNDRV_PCM_ACCESS_RW_INTERLEAVED]       = write_by_rw_interleaved,
+        [SNDRV_PCM_ACCESS_RW_NONINTERLEAVED]    = write_by_rw_noninterleaved,
+    };
+    struct pcm_stream *stream = &bench->stream;
+    struct snd_pcm_sw_params sw_params;
+    uint64_t begin, end, cpu_begin, cpu_end;
+    double elapsed;
+    int err;
+
+    pcm_stream_init_sw_params(stream, &sw_params);
+    err = pcm_stream_set_sw_params(stream, &sw_params);
+    if (err < 0) {
+        printf("ioctl(SW_PARAMS): %s\n", strerror(-err));
+        return err;
+    }
+
+    if (ioctl(stream->fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
+        err = -errno;
+        printf("ioctl(PREPARE): %s\n", strerror(-err));
+        return err;
+    }
+
+    begin = latency_now();
+    cpu_begin = get_cpu_time();
+    end = begin + (uint64_t)seconds * 1000000000ull;
+
+    while (latency_now() < end) {
+        err = funcs[stream->config.access](bench);
+        if (err < 0) {
+            printf("Streaming aborts: %s\n", strerror(-err));
+            break;
+        }
+    }
+
+    cpu_end = get_cpu_time();
+    elapsed = (latency_now() - begin) / 1e9;
+
+    ioctl(stream->fd, SNDRV_PCM_IOCTL_DROP);
+
+    printf("  Results:\n");
+    printf("    frames:         %llu\n", bench->frames);
+    printf("    seconds:        %.3f\n", elapsed);
+    printf("    frames/sec:     %.1f\n", bench->frames / elapsed);
+    printf("    syscalls/sec:   %.1f\n", bench->syscalls / elapsed);
+    if (bench->frames > 0)
+        printf("    cpu-ns/frame:   %.2f\n",
+               (double)(cpu_end - cpu_begin) / bench->frames);
+    printf("    xruns:          %lu\n", bench->xruns);
+
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    struct pcm_stream_config config = {
+        .format = SNDRV_PCM_FORMAT_S16_LE,
+        .channels = 2,
+        .rate = 48000,
+    };
+    struct bench bench = {0};
+    const char *path;
+    unsigned int seconds;
+    int access, format;
+    int err;
+
+    if (argc < 4) {
+        printf("Usage: %s PCM-DEVICE ACCESS SECONDS "
+               "[FORMAT [CHANNELS [RATE [PERIOD-SIZE [PERIODS]]]]]\n",
+               argv[0]);
+        printf("  ACCESS: readwrite-interleaved, readwrite-noninterleaved, "
+               "mmap-interleaved, mmap-noninterleaved\n");
+        return EXIT_FAILURE;
+    }
+    path = argv[1];
+
+    access = pcm_stream_parse_access(argv[2]);
+    if (access < 0 || access == SNDRV_PCM_ACCESS_MMAP_COMPLEX) {
+        printf("Unsupported access: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    config.access = access;
+
+    seconds = strtoul(argv[3], NULL, 10);
+
+    if (argc > 4) {
+        format = pcm_stream_parse_format(argv[4]);
+        if (format < 0) {
+            printf("Unsupported format: %s\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+        config.format = format;
+    }
+    if (argc > 5)
+        config.channels = strtoul(argv[5], NULL, 10);
+    if (argc > 6)
+        config.rate = strtoul(argv[6], NULL, 10);
+    if (argc > 7)
+        config.period_size = strtoul(argv[7], NULL, 10);
+    if (argc > 8)
+        config.periods = strtoul(argv[8], NULL, 10);
+
+    err = pcm_stream_open(&bench.stream, path, O_RDWR);
+    if (err < 0) {
+        printf("open(2): %s\n", strerror(-err));
+        return EXIT_FAILURE;
+    }
+
+    if (bench.stream.direction != SNDRV_PCM_STREAM_PLAYBACK) {
+        printf("%s is not for playback.\n", path);
+        pcm_stream_close(&bench.stream);
+        return EXIT_FAILURE;
+    }
+
+    err = pcm_stream_configure(&bench.stream, &config);
+    if (err < 0) {
+        printf("ioctl(HW_PARAMS): %s\n", strerror(-err));
+        pcm_stream_close(&bench.stream);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s\n", path);
+    printf("  Parameters:\n");
+    printf("    access:         %s\n", pcm_stream_access_labels[access]);
+    printf("    format:         %s\n",
+           pcm_stream_format_labels[bench.stream.config.format]);
+    printf("    channels:       %u\n", bench.stream.config.channels);
+    printf("    rate:           %u\n", bench.stream.config.rate);
+    printf("    period-size:    %lu\n", bench.stream.config.period_size);
+    printf("    buffer-size:    %lu\n", bench.stream.buffer_size);
+
+    err = prepare_buffers(&bench);
+    if (err >= 0)
+        err = run_bench(&bench, seconds);
+
+    release_buffers(&bench);
+    pcm_stream_close(&bench.stream);
+
+    if (err < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,393 @@
+/*
+ * stress-ctl-user-elems.c
+ *
+ * Licensed under the terms of the GNU General Public License, version 3.
+ *
+ * Add user-defined control elements of every type in steps, up to the given
+ * count or the limit of the control core, and measure how ELEM_ADD,
+ * ELEM_LIST, ELEM_INFO and ELEM_REMOVE scale with the number of elements,
+ * together with kernel memory in /proc/meminfo. The elements of one type in
+ * a step are added by one ELEM_ADD with the count in 'owner' field, thus
+ * they share one kcontrol, like the per-channel controls which drivers add.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#include <unistd.h>
+
+#include <sound/asound.h>
+#include <sound/tlv.h>
+
+#include "latency.h"
+
+#define STRESS_ELEM_NAME    "Stress %s %u"
+/* ALSA middleware has limitation of one operation. */
+#define LIST_CHUNK          1000
+
+struct elem_type {
+    snd_ctl_elem_type_t type;
+    const char *label;
+    unsigned int members;
+    bool tlv;
+};
+
+static const struct elem_type elem_types[] = {
+    { SNDRV_CTL_ELEM_TYPE_BOOLEAN,      "boolean",      2,  false },
+    { SNDRV_CTL_ELEM_TYPE_INTEGER,      "integer",      8,  true },
+    { SNDRV_CTL_ELEM_TYPE_ENUMERATED,   "enumerated",   1,  false },
+    { SNDRV_CTL_ELEM_TYPE_BYTES,        "bytes",        32, false },
+    { SNDRV_CTL_ELEM_TYPE_IEC958,       "iec60958",     1,  false },
+    { SNDRV_CTL_ELEM_TYPE_INTEGER64,    "integer64",    2,  true },
+};
+
+#define TYPE_COUNT  (sizeof(elem_types) / sizeof(elem_types[0]))
+
+static const char enum_items[] = "Off\0Peak\0RMS\0Peak+RMS";
+
+/* The elements added by one ELEM_ADD. */
+struct group {
+    struct snd_ctl_elem_id id;
+    unsigned int count;
+    unsigned int step;
+};
+
+struct meminfo {
+    long slab;
+    long unreclaimable;
+};
+
+struct stress {
+    int fd;
+    struct group *groups;
+    unsigned int group_count;
+    unsigned int group_space;
+    unsigned int elements;
+    unsigned int steps;
+
+    uint64_t add_ns;
+    uint64_t tlv_ns;
+    unsigned int tlv_writes;
+};
+
+static int read_meminfo(struct meminfo *mem)
+{
+    char line[128];
+    FILE *file;
+    long val;
+
+    memset(mem, 0, sizeof(*mem));
+    file = fopen("/proc/meminfo", "r");
+    if (file == NULL)
+        return -errno;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "Slab: %ld", &val) == 1)
+            mem->slab = val;
+        else if (sscanf(line, "SUnreclaim: %ld", &val) == 1)
+            mem->unreclaimable = val;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+/* The dB scale of -100.00 dB to 0 dB is shared by the elements in group. */
+static int write_tlv(struct stress *stress, unsigned int numid)
+{
+    unsigned int buf[2 + 4] = {
+        [0] = numid,
+        [1] = 4 * sizeof(unsigned int),
+        [2] = SNDRV_CTL_TLVT_DB_SCALE,
+        [3] = 2 * sizeof(unsigned int),
+        [4] = -10000,
+        [5] = 40 | SNDRV_CTL_TLVD_DB_SCALE_MUTE,
+    };
+    uint64_t begin;
+
+    begin = latency_now();
+    if (ioctl(stress->fd, SNDRV_CTL_IOCTL_TLV_WRITE, buf) < 0)
+        return -errno;
+    stress->tlv_ns += latency_now() - begin;
+    ++stress->tlv_writes;
+
+    return 0;
+}
+
+static int add_group(struct stress *stress, const struct elem_type *type,
+                     unsigned int count)
+{
+    struct snd_ctl_elem_info info = {0};
+    struct group *groups;
+    uint64_t begin;
+    int err;
+
+    if (stress->group_count == stress->group_space) {
+        groups = realloc(stress->groups,
+                         sizeof(*groups) * (stress->group_space + 64));
+        if (groups == NULL)
+            return -ENOMEM;
+        stress->groups = groups;
+        stress->group_space += 64;
+    }
+
+    info.id.iface = SNDRV_CTL_ELEM_IFACE_MIXER;
+    snprintf((char *)info.id.name, sizeof(info.id.name), STRESS_ELEM_NAME,
+             type->label, stress->group_count);
+    info.type = type->type;
+    info.access = SNDRV_CTL_ELEM_ACCESS_READWRITE;
+    if (type->tlv)
+        info.access |= SNDRV_CTL_ELEM_ACCESS_TLV_READWRITE;
+    info.count = type->members;
+    /* The number of elements to add at once. */
+    info.owner = count;
+
+    switch (type->type) {
+    case SNDRV_CTL_ELEM_TYPE_INTEGER:
+        info.value.integer.min = 0;
+        info.value.integer.max = 2500;
+        info.value.integer.step = 1;
+        break;
+    case SNDRV_CTL_ELEM_TYPE_INTEGER64:
+        info.value.integer64.min = 0;
+        info.value.integer64.max = 2500;
+        info.value.integer64.step = 1;
+        break;
+    case SNDRV_CTL_ELEM_TYPE_ENUMERATED:
+        info.value.enumerated.items = 4;
+        info.value.enumerated.names_ptr = (uintptr_t)enum_items;
+        info.value.enumerated.names_length = sizeof(enum_items);
+        break;
+    default:
+        break;
+    }
+
+    begin = latency_now();
+    if (ioctl(stress->fd, SNDRV_CTL_IOCTL_ELEM_ADD, &info) < 0)
+        return -errno;
+    stress->add_ns += latency_now() - begin;
+
+    groups = &stress->groups[stress->group_count++];
+    groups->id = info.id;
+    groups->count = count;
+    groups->step = stress->steps;
+    stress->elements += count;
+
+    if (type->tlv) {
+        err = write_tlv(stress, info.id.numid);
+        if (err < 0)
+            return err;
+    }
+
+    return 0;
+}
+
+/* In chunks of the identifiers, as allocate_elem_ids() in ctl-elems.c. */
+static int list_elems(int fd, unsigned int *count, uint64_t *elapsed)
+{
+    struct snd_ctl_elem_list list = {0};
+    struct snd_ctl_elem_id *ids;
+    uint64_t begin;
+    int err = 0;
+
+    begin = latency_now();
+    if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0)
+        return -errno;
+
+    ids = calloc(list.count > 0 ? list.count : 1, sizeof(*ids));
+    if (ids == NULL)
+        return -ENOMEM;
+
+    while (list.offset < list.count) {
+        list.space = list.count - list.offset;
+        if (list.space > LIST_CHUNK)
+            list.space = LIST_CHUNK;
+        list.pids = ids + list.offset;
+        if (ioctl(fd, SNDRV_CTL_IOCTL_ELEM_LIST, &list) < 0) {
+            err = -errno;
+            break;
+        }
+        list.offset += list.space;
+    }
+    *elapsed = latency_now() - begin;
+    *count = list.count;
+
+    free(ids);
+    return err;
+}
+
+/* Every element added so far, by its numid. */
+static int info_elems(struct stress *stress, uint64_t *elapsed)
+{
+    struct snd_ctl_elem_info info;
+    const struct group *group;
+    uint64_t begin;
+    unsigned int i, j;
+
+    begin = latency_now();
+    for (i = 0; i < stress->group_count; ++i) {
+        group = &stress->groups[i];
+        for (j = 0; j < group->count; ++j) {
+            memset(&info, 0, sizeof(info));
+            info.id.numid = group->id.numid + j;
+            if (ioctl(stress->fd, SNDRV_CTL_IOCTL_ELEM_INFO, &info) < 0)
+                return -errno;
+        }
+    }
+    *elapsed = latency_now() - begin;
+
+    return 0;
+}
+
+/*
+ * The groups added in the last step, in reverse order. The whole elements in
+ * the group are removed by the first one.
+ */
+static void remove_step(struct stress *stress, uint64_t *elapsed,
+                        unsigned int *removed, unsigned int *failed)
+{
+    const struct group *group;
+    uint64_t begin;
+
+    *removed = 0;
+    *failed = 0;
+    --stress->steps;
+    begin = latency_now();
+    while (stress->group_count > 0) {
+        group = &stress->groups[stress->group_count - 1];
+        if (group->step != stress->steps)
+            break;
+        --stress->group_count;
+        if (ioctl(stress->fd, SNDRV_CTL_IOCTL_ELEM_REMOVE, &group->id) < 0)
+            ++*failed;
+        *removed += group->count;
+    }
+    *elapsed = latency_now() - begin;
+    stress->elements -= *removed;
+}
+
+static int run_stress(const char *path, unsigned int elements,
+                      unsigned int step)
+{
+    struct stress stress = {0};
+    struct meminfo base, mem;
+    unsigned int per_type = step / TYPE_COUNT;
+    unsigned int listed = 0, failed, added, removed;
+    uint64_t list_ns = 0, info_ns = 0, remove_ns;
+    unsigned int i;
+    int query_err;
+    int err = 0;
+
+    if (per_type == 0)
+        per_type = 1;
+
+    stress.fd = open(path, O_RDWR);
+    if (stress.fd < 0) {
+        printf("open(2): %s\n", strerror(errno));
+        return -errno;
+    }
+    read_meminfo(&base);
+
+    printf("%u elements of each type in a step; types:", per_type);
+    for (i = 0; i < TYPE_COUNT; ++i)
+        printf(" %s(%u%s)", elem_types[i].label, elem_types[i].members,
+               elem_types[i].tlv ? ",tlv" : "");
+    printf("\n");
+    printf("%8s %8s %12s %10s %12s %10s %10s %10s\n", "elements", "listed",
+           "add ns/elem", "list ms", "info ns/elem", "slab kB", "unrecl kB",
+           "B/elem");
+
+    while (stress.elements < elements) {
+        added = stress.elements;
+        stress.add_ns = 0;
+        for (i = 0; i < TYPE_COUNT && err == 0; ++i)
+            err = add_group(&stress, &elem_types[i], per_type);
+        added = stress.elements - added;
+        if (added == 0)
+            break;
+        ++stress.steps;
+
+        query_err = list_elems(stress.fd, &listed, &list_ns);
+        if (query_err == 0)
+            query_err = info_elems(&stress, &info_ns);
+        if (query_err < 0) {
+            printf("Fail to list or query elements: %s\n",
+                   strerror(-query_err));
+            break;
+        }
+        read_meminfo(&mem);
+
+        printf("%8u %8u %12.0f %10.3f %12.0f %10ld %10ld %10.0f\n",
+               stress.elements, listed, (double)stress.add_ns / added,
+               list_ns / 1e6, (double)info_ns / stress.elements,
+               mem.slab - base.slab, mem.unreclaimable - base.unreclaimable,
+               (mem.unreclaimable - base.unreclaimable) * 1024.0 /
+                                                        stress.elements);
+
+        /* The limit of user-defined elements is reached. */
+        if (err < 0)
+            break;
+    }
+
+    if (err < 0)
+        printf("Stopped at %u elements in %u groups: %s\n", stress.elements,
+               stress.group_count, strerror(-err));
+    if (stress.tlv_writes > 0)
+        printf("TLV_WRITE: %u times, %.0f ns in average\n", stress.tlv_writes,
+               (double)stress.tlv_ns / stress.tlv_writes);
+
+    /* Removal scales with the elements left, thus by the steps. */
+    if (stress.steps > 0)
+        printf("%8s %8s %15s %8s %10s\n", "elements", "removed",
+               "remove ns/elem", "failed", "slab kB");
+    while (stress.steps > 0) {
+        added = stress.elements;
+        remove_step(&stress, &remove_ns, &removed, &failed);
+        read_meminfo(&mem);
+        printf("%8u %8u %15.0f %8u %10ld\n", added, removed,
+               (double)remove_ns / removed, failed, mem.slab - base.slab);
+    }
+
+    free(stress.groups);
+    close(stress.fd);
+
+    /* Reaching the limit is a result, not a failure. */
+    if (err == -ENOMEM || err == -EBUSY || err == -ENOSPC)
+        err = 0;
+    return err;
+}
+
+int main(int argc, const char *const argv[])
+{
+    unsigned int elements = 6144;
+    unsigned int step = 768;
+
+    if (argc < 2) {
+        printf("Usage: %s CONTROL-DEVICE [ELEMENTS [STEP]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 2)
+        elements = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        step = strtoul(argv[3], NULL, 10);
+    if (elements == 0 || step == 0) {
+        printf("Elements and step should be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (run_stress(argv[1], elements, step) < 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
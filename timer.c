@@ -13,6 +13,8 @@
 
 #include <sound/asound.h>
 
+#include "ioctl-suite.h"
+
 static void build_system_timer_id(struct snd_timer_id *tid)
 {
 	tid->dev_class = SNDRV_TIMER_CLASS_GLOBAL;
@@ -22,134 +24,82 @@ static void build_system_timer_id(struct snd_timer_id *tid)
 	tid->subdevice = 0;
 }
 
-#define TEST_IOCTL(fd, command, argument, expected)			\
-	if (ioctl(fd, command, argument) < 0 && errno != expected) {	\
-		printf("%s: %s\n", #command, strerror(errno));		\
-		return false;						\
-	}								\
-	return true;							\
-
-static bool check_pversion(int fd)
+/* Enable timestamps in the read events. */
+static void init_tread(void *arg)
 {
-	int version = 0;
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_PVERSION, &version, 0);
-}
+	int *tread = arg;
 
-static bool check_next_device(int fd)
-{
-	struct snd_timer_id id = {0};
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_NEXT_DEVICE, &id, 0);
+	*tread = 1;
 }
 
-static bool check_tread(int fd)
+static void init_ginfo(void *arg)
 {
-	int tread = 1;
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_TREAD, &tread, 0);
-}
+	struct snd_timer_ginfo *ginfo = arg;
 
-static bool check_ginfo(int fd)
-{
-	struct snd_timer_ginfo ginfo = {0};
-	build_system_timer_id(&ginfo.tid);
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_GINFO, &ginfo, 0);
+	build_system_timer_id(&ginfo->tid);
 }
 
-static bool check_gparams(int fd)
+static void init_gparams(void *arg)
 {
-	struct snd_timer_gparams gparams = {0};
-	build_system_timer_id(&gparams.tid);
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_GPARAMS, &gparams, ENOSYS);
-}
+	struct snd_timer_gparams *gparams = arg;
 
-static bool check_gstatus(int fd)
-{
-	struct snd_timer_gstatus gstatus = {0};
-	build_system_timer_id(&gstatus.tid);
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_GSTATUS, &gstatus, 0);
+	build_system_timer_id(&gparams->tid);
 }
 
-static bool check_select(int fd)
+static void init_gstatus(void *arg)
 {
-	struct snd_timer_select select = {0};
-	build_system_timer_id(&select.id);
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_SELECT, &select, 0);
-}
+	struct snd_timer_gstatus *gstatus = arg;
 
-static bool check_info(int fd)
-{
-	struct snd_timer_info info = {0};
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_INFO, &info, 0);
+	build_system_timer_id(&gstatus->tid);
 }
 
-static bool check_params(int fd)
+static void init_select(void *arg)
 {
-	struct snd_timer_params params = {0};
-	params.ticks = 1;
-	params.filter = SNDRV_TIMER_EVENT_TICK;
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_PARAMS, &params, 0);
-}
+	struct snd_timer_select *select = arg;
 
-static bool check_status(int fd)
-{
-	struct snd_timer_status status = {0};
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_STATUS, &status, 0);
+	build_system_timer_id(&select->id);
 }
 
-static bool check_start(int fd)
+static void init_params(void *arg)
 {
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_START, NULL, 0);
-}
+	struct snd_timer_params *params = arg;
 
-static bool check_stop(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_STOP, NULL, 0);
+	params->ticks = 1;
+	params->filter = SNDRV_TIMER_EVENT_TICK;
 }
 
-static bool check_continue(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_CONTINUE, NULL, 0);
-}
+static const struct ioctl_case cases[] = {
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_PVERSION, int, NULL, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_NEXT_DEVICE, struct snd_timer_id, NULL, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_TREAD, int, init_tread, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_GINFO, struct snd_timer_ginfo,
+		   init_ginfo, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_GPARAMS, struct snd_timer_gparams,
+		   init_gparams, ENOSYS),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_GSTATUS, struct snd_timer_gstatus,
+		   init_gstatus, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_SELECT, struct snd_timer_select,
+		   init_select, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_INFO, struct snd_timer_info, NULL, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_PARAMS, struct snd_timer_params,
+		   init_params, 0),
+	IOCTL_CASE(SNDRV_TIMER_IOCTL_STATUS, struct snd_timer_status, NULL, 0),
+	IOCTL_CASE_NO_ARG(SNDRV_TIMER_IOCTL_START, 0),
+	IOCTL_CASE_NO_ARG(SNDRV_TIMER_IOCTL_PAUSE, 0),
+	IOCTL_CASE_NO_ARG(SNDRV_TIMER_IOCTL_CONTINUE, 0),
+	IOCTL_CASE_NO_ARG(SNDRV_TIMER_IOCTL_STOP, 0),
+};
 
-static bool check_pause(int fd)
-{
-	TEST_IOCTL(fd, SNDRV_TIMER_IOCTL_PAUSE, NULL, 0);
-}
+static const struct ioctl_suite suite = {
+	.label = "Timer",
+	.node = "/dev/snd/timer",
+	.pattern = "timer",
+	.flags = O_RDONLY,
+	.cases = cases,
+	.count = sizeof(cases) / sizeof(cases[0]),
+};
 
-int main(void)
+int main(int argc, const char *const argv[])
 {
-	bool (*const funcs[])(int) = {
-		check_pversion,
-		check_next_device,
-		check_tread,
-		check_ginfo,
-		check_gparams,
-		check_gstatus,
-		check_select,
-		check_info,
-		check_params,
-		check_status,
-		check_start,
-		check_pause,
-		check_continue,
-		check_stop,
-		NULL,
-	};
-	unsigned int i;
-	int fd;
-
-	fd = open("/dev/snd/timer", O_RDONLY);
-	if (fd < 0) {
-		printf("%s\n", strerror(errno));
-		return EXIT_FAILURE;
-	}
-
-	i = 0;
-	while (funcs[i]) {
-		if (!funcs[i++](fd)) {
-			printf("Timer test aborts.\n");
-			return EXIT_FAILURE;
-		}
-	}
-
-	return EXIT_SUCCESS;
+	return ioctl_suite_main(&suite, argc, argv);
 }